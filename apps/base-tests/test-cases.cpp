@@ -8,6 +8,10 @@
 #include "test-suite.h"
 #include <ply-btree.h>
 #include <ply-math.h>
+#include <ply-network.h>
+#if defined(PLY_POSIX)
+#include <limits.h>
+#endif
 
 //  ▄▄  ▄▄                               ▄▄
 //  ███ ██ ▄▄  ▄▄ ▄▄▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄  ▄▄  ▄▄▄▄
@@ -101,6 +105,122 @@ TEST_CASE("Thread join") {
     check(value == 42);
 }
 
+TEST_CASE("Mutex protects a shared counter") {
+    static constexpr u32 NumThreads = 4;
+    Mutex mutex;
+    u32 counter = 0;
+    Thread threads[NumThreads];
+    for (Thread& thread : threads) {
+        thread.run([&] {
+            for (u32 i = 0; i < 20000; i++) {
+                LockGuard<Mutex> guard{mutex};
+                counter++;
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(counter == NumThreads * 20000);
+    check(mutex.try_lock());
+    check(!mutex.try_lock());
+    mutex.unlock();
+}
+
+TEST_CASE("ConditionVariable hands off values between threads") {
+    Mutex mutex;
+    ConditionVariable cond_var;
+    u32 value = 0;
+    Thread consumer([&] {
+        LockGuard<Mutex> guard{mutex};
+        for (u32 expected = 1; expected <= 1000; expected++) {
+            while (value != expected) {
+                cond_var.wait(guard);
+            }
+            value = 0;
+            cond_var.wake_all();
+        }
+    });
+    for (u32 i = 1; i <= 1000; i++) {
+        LockGuard<Mutex> guard{mutex};
+        while (value != 0) {
+            cond_var.wait(guard);
+        }
+        value = i;
+        cond_var.wake_all();
+    }
+    consumer.join();
+    check(value == 0);
+
+    // timed_wait returns even if nobody wakes it.
+    LockGuard<Mutex> guard{mutex};
+    cond_var.timed_wait(guard, 1);
+}
+
+TEST_CASE("ReadWriteLock excludes writers from readers") {
+    static constexpr u32 NumThreads = 4;
+    ReadWriteLock lock;
+    u32 a = 0;
+    u32 b = 0;
+    Atomic<u32> num_mismatches = 0;
+    Thread threads[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&, t] {
+            for (u32 i = 0; i < 20000; i++) {
+                if (i % 4 == t % 4) {
+                    lock.lock_exclusive();
+                    a++;
+                    b++;
+                    lock.unlock_exclusive();
+                } else {
+                    lock.lock_shared();
+                    if (a != b) {
+                        num_mismatches.fetch_add_acq_rel(1);
+                    }
+                    lock.unlock_shared();
+                }
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(num_mismatches.load_relaxed() == 0);
+    check(a == NumThreads * 5000);
+}
+
+#if PLY_LOCK_STATS
+TEST_CASE("Lock stats are grouped by name") {
+    Mutex mutex{"Lock stats test"};
+    ReadWriteLock lock{"Lock stats test"};
+    {
+        LockGuard<Mutex> guard{mutex};
+    }
+    check(mutex.try_lock());
+    mutex.unlock();
+    lock.lock_exclusive();
+    lock.unlock_exclusive();
+    lock.lock_shared();
+    lock.unlock_shared();
+    check(lock.try_lock_exclusive());
+    lock.unlock_exclusive();
+    check(lock.try_lock_shared());
+    lock.unlock_shared();
+
+    LockStats stats = get_lock_stats();
+    const LockStats::Entry* entry = nullptr;
+    for (u32 i = 0; i < stats.num_entries; i++) {
+        if (StringView{stats.entries[i].name} == "Lock stats test") {
+            entry = &stats.entries[i];
+        }
+    }
+    check(entry && entry->num_acquisitions == 6 && entry->num_contended == 0);
+    MemStream out;
+    write_lock_stats(out, stats);
+    check(out.move_to_string().find("Lock stats test: 6 acquisitions") >= 0);
+}
+#endif
+
 //  ▄▄  ▄▄               ▄▄     ▄▄
 //  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
 //  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██ ██  ██ ██  ██
@@ -130,6 +250,91 @@ TEST_CASE("shuffle_bits() 64") {
     }
 }
 
+TEST_CASE("multiply_128()") {
+    u64 lo, hi;
+    multiply_128(0xffffffffffffffffull, 0xffffffffffffffffull, &lo, &hi);
+    check(lo == 1);
+    check(hi == 0xfffffffffffffffeull);
+    multiply_128(0x123456789abcdefull, 0x10, &lo, &hi);
+    check(lo == 0x123456789abcdef0ull);
+    check(hi == 0);
+}
+
+TEST_CASE("String hash covers every byte") {
+    // Flip each bit of keys that exercise the short, medium and long paths, and check that the 64-bit result changes.
+    Random rand{1};
+    for (u32 num_bytes : {1, 3, 4, 7, 8, 15, 16, 17, 48, 49, 100}) {
+        String str = String::allocate(num_bytes);
+        for (u32 i = 0; i < num_bytes; i++) {
+            str[i] = (char) rand.generate_u32();
+        }
+        HashBuilder original;
+        add_to_hash(original, str);
+        for (u32 i = 0; i < num_bytes * 8; i++) {
+            str[i / 8] ^= char(1 << (i % 8));
+            HashBuilder modified;
+            add_to_hash(modified, str);
+            check(modified.get_result64() != original.get_result64());
+            str[i / 8] ^= char(1 << (i % 8));
+        }
+    }
+    // The length is mixed in, so zero-padded keys don't collide.
+    check(calculate_hash(StringView{"\0", 1}) != calculate_hash(StringView{"\0\0", 2}));
+    check(calculate_hash(StringView{""}) != calculate_hash(StringView{"\0", 1}));
+}
+
+TEST_CASE("Hash seed changes string hashes") {
+    check(calculate_hash(StringView{"Content-Type"}) == calculate_hash(StringView{"Content-Type"}));
+    check(calculate_hash(StringView{"Content-Type"}, 1) != calculate_hash(StringView{"Content-Type"}, 2));
+    check(generate_hash_seed() != 0);
+}
+
+TEST_CASE("Hash seed changes hashes of crafted keys") {
+    // These 16-byte keys hold the words of HashBuilder::Secret1 at offsets 0 and 8, and differ everywhere else. If
+    // the seed weren't folded into the secrets, they would all hash to the same value under every seed.
+    u8 keys[4][16];
+    for (u32 i = 0; i < 4; i++) {
+        for (u32 j = 0; j < 16; j++) {
+            keys[i][j] = (u8) (i * 16 + j);
+        }
+        u32 hi = (u32) (HashBuilder::Secret1 >> 32);
+        u32 lo = (u32) HashBuilder::Secret1;
+        memcpy(keys[i], &hi, 4);
+        memcpy(keys[i] + 8, &lo, 4);
+    }
+    u64 seeds[] = {0, 1, generate_hash_seed(), generate_hash_seed()};
+    for (u64 seed : seeds) {
+        Array<u32> hashes;
+        for (u32 i = 0; i < 4; i++) {
+            u32 hash = calculate_hash(StringView{(const char*) keys[i], 16}, seed);
+            check(find(hashes, hash) < 0);
+            hashes.append(hash);
+        }
+    }
+    StringView key{(const char*) keys[0], 16};
+    check(calculate_hash(key, seeds[2]) != calculate_hash(key, seeds[3]));
+}
+
+TEST_CASE("Seeded map") {
+    Map<String, u32> map;
+    for (u32 i = 0; i < 100; i++) {
+        *map.insert(String::format("key{}", i)).value = i;
+    }
+    // Changing the seed rebuilds the indices of a non-empty map.
+    map.set_hash_seed(generate_hash_seed());
+    for (u32 i = 0; i < 100; i++) {
+        u32* value = map.find(String::format("key{}", i));
+        check(value && *value == i);
+    }
+    check(map.erase("key50"));
+    check(!map.find("key50"));
+    Map<String, u32> copy = map;
+    check(copy.get_hash_seed() == map.get_hash_seed());
+    check(*copy.find("key99") == 99);
+    map.clear();
+    check(map.get_hash_seed() == copy.get_hash_seed());
+}
+
 //   ▄▄▄▄   ▄▄          ▄▄
 //  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
 //   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██
@@ -161,6 +366,63 @@ TEST_CASE("String reverse_find") {
     check(str.reverse_find('z') < 0);
 }
 
+TEST_CASE("String replace") {
+    check(StringView{"abcabc"}.replace("c", "xy") == "abxyabxy");
+    check(StringView{"aaaa"}.replace("aa", "b") == "bb");
+    check(StringView{"ab"}.replace("abc", "x") == "ab");
+    check(StringView{""}.replace("a", "x") == "");
+}
+
+TEST_CASE("String SIMD search matches scalar search") {
+    StringSIMD original = get_string_simd();
+    PLY_ON_SCOPE_EXIT({ set_string_simd(original); });
+    Random r{0};
+    String str = String::allocate(200);
+    for (StringSIMD simd : {StringSIMD::None, StringSIMD::SSE2, StringSIMD::AVX2}) {
+        if (!set_string_simd(simd))
+            continue;
+        for (u32 iter = 0; iter < 2000; iter++) {
+            // Use a small alphabet so that patterns are found at many different offsets.
+            u32 num_bytes = r.generate_u32() % 200;
+            for (u32 i = 0; i < num_bytes; i++) {
+                str[i] = " \tab\n"[r.generate_u32() % 5];
+            }
+            StringView view = str.left(num_bytes);
+            u32 pattern_bytes = 1 + r.generate_u32() % 4;
+            u32 pattern_pos = num_bytes >= pattern_bytes ? r.generate_u32() % (num_bytes - pattern_bytes + 1) : 0;
+            StringView pattern = (num_bytes >= pattern_bytes) ? view.substr(pattern_pos, pattern_bytes) : "ab";
+
+            s32 expected = -1;
+            for (u32 i = 0; i + pattern.num_bytes() <= num_bytes; i++) {
+                if (view.substr(i, pattern.num_bytes()) == pattern) {
+                    expected = i;
+                    break;
+                }
+            }
+            check(view.find(pattern) == expected);
+            s32 expected_reverse = -1;
+            for (s32 i = (s32) num_bytes - 1; i >= 0; i--) {
+                if (view[i] == pattern[0]) {
+                    expected_reverse = i;
+                    break;
+                }
+            }
+            check(view.reverse_find(pattern[0]) == expected_reverse);
+
+            u32 start = 0;
+            while (start < num_bytes && is_whitespace(view[start])) {
+                start++;
+            }
+            u32 end = num_bytes;
+            while (end > start && is_whitespace(view[end - 1])) {
+                end--;
+            }
+            check(view.trim() == view.substr(start, end - start));
+            check(view.trim().bytes() == view.bytes() + start);
+        }
+    }
+}
+
 TEST_CASE("String split") {
     // Single char separator
     {
@@ -221,6 +483,63 @@ TEST_CASE("String split") {
     }
 }
 
+#if !PLY_STRING_INLINE
+TEST_CASE("String views survive moves") {
+    Array<String> strs;
+    strs.append("short");
+    StringView view = strs[0];
+    for (u32 i = 0; i < 100; i++) {
+        strs.append("grow");
+    }
+    check(view.bytes() == strs[0].bytes());
+    check(view == "short");
+
+    String empty;
+    check(empty.bytes() == nullptr);
+    String str = "hello";
+    const char* bytes = str.bytes();
+    char* released = str.release();
+    check(released == bytes);
+    Heap::free(released);
+}
+#else
+TEST_CASE("String inline storage") {
+    check(sizeof(String) <= 16);
+    String empty;
+    check(empty.is_empty());
+    check(empty.bytes() != nullptr);
+
+    String str = "hello";
+    check((uptr) str.bytes() - (uptr) &str < sizeof(String));
+    String moved = std::move(str);
+    check(str.is_empty());
+    check(moved == "hello");
+
+    // Grow past the inline capacity, then shrink back.
+    String abc = "abc";
+    abc.resize(40);
+    check(abc.left(3) == "abc");
+    check((uptr) abc.bytes() - (uptr) &abc >= sizeof(String));
+    memset(abc.bytes() + 3, 'x', 37);
+    abc.resize(5);
+    check(abc == "abcxx");
+    check((uptr) abc.bytes() - (uptr) &abc < sizeof(String));
+
+    // release() always returns a heap block.
+    char* released = moved.release();
+    check(moved.is_empty());
+    String adopted = String::adopt(released, 5);
+    check(adopted == "hello");
+
+    String long_str = "this string is too long to be stored inline";
+    String long_copy = long_str;
+    check(long_copy == long_str);
+    check(long_copy.bytes() != long_str.bytes());
+    long_copy += "!";
+    check(long_copy.right(2) == "e!");
+}
+#endif
+
 TEST_CASE("String match identifier") {
     String str = "(hello)";
     StringView identifier;
@@ -824,6 +1143,107 @@ TEST_CASE("Set stress test u32") {
     }
 }
 
+// Only a few distinct hashes, so probe runs span several groups and wrap around the end of the table.
+struct CollidingKey {
+    u32 value;
+    bool operator==(const CollidingKey& other) const {
+        return this->value == other.value;
+    }
+};
+
+void add_to_hash(HashBuilder& builder, const CollidingKey& key) {
+    add_to_hash(builder, key.value % 8);
+}
+
+// Exercise the code paths that recompute hashes instead of caching them.
+namespace ply {
+template <>
+struct HashTraits<CollidingKey> {
+    static constexpr bool CacheHashes = false;
+};
+} // namespace ply
+
+TEST_CASE("Set with colliding hashes") {
+    Set<CollidingKey> set;
+    for (u32 i = 0; i < 300; i++) {
+        check(!set.insert({i}).was_found);
+    }
+    for (u32 i = 0; i < 300; i += 3) {
+        check(set.erase({i}));
+    }
+    check(set.items().num_items() == 200);
+    for (u32 i = 0; i < 300; i++) {
+        check((set.find({i}) != nullptr) == (i % 3 != 0));
+    }
+    check(!set.find({1000}));
+}
+
+// Counts key comparisons, which each touch the items array.
+struct CountedKey {
+    static u32 num_comparisons;
+    u32 value;
+    bool operator==(const CountedKey& other) const {
+        num_comparisons++;
+        return this->value == other.value;
+    }
+};
+u32 CountedKey::num_comparisons = 0;
+
+void add_to_hash(HashBuilder& builder, const CountedKey& key) {
+    add_to_hash(builder, key.value);
+}
+
+TEST_CASE("Set lookups skip mismatched slots") {
+    static constexpr u32 NumItems = 10000;
+    Set<CountedKey> set;
+    for (u32 i = 0; i < NumItems; i++) {
+        set.insert({i});
+    }
+    // Each absent key only compares against slots whose 7-bit tag matches, which is rare.
+    CountedKey::num_comparisons = 0;
+    for (u32 i = NumItems; i < NumItems * 2; i++) {
+        check(!set.find({i}));
+    }
+    check(CountedKey::num_comparisons < NumItems / 16);
+    CountedKey::num_comparisons = 0;
+    for (u32 i = 0; i < NumItems; i++) {
+        check(set.find({i}));
+    }
+    check(CountedKey::num_comparisons < NumItems + NumItems / 16);
+}
+
+// Counts calls to add_to_hash.
+struct HashCountingKey {
+    static u32 num_hashes;
+    String str;
+    bool operator==(const HashCountingKey& other) const {
+        return this->str == other.str;
+    }
+};
+u32 HashCountingKey::num_hashes = 0;
+
+void add_to_hash(HashBuilder& builder, const HashCountingKey& key) {
+    HashCountingKey::num_hashes++;
+    add_to_hash(builder, key.str);
+}
+
+TEST_CASE("Set growth reuses cached hashes") {
+    static constexpr u32 NumItems = 5000;
+    Set<HashCountingKey> set;
+    HashCountingKey::num_hashes = 0;
+    for (u32 i = 0; i < NumItems; i++) {
+        set.insert({String::format("{}", i)});
+    }
+    // One hash per insert, even though the table grew many times.
+    check(HashCountingKey::num_hashes == NumItems);
+    for (u32 i = 0; i < NumItems; i += 2) {
+        check(set.erase({String::format("{}", i)}));
+    }
+    for (u32 i = 0; i < NumItems; i++) {
+        check((set.find({String::format("{}", i)}) != nullptr) == (i % 2 == 1));
+    }
+}
+
 //  ▄▄   ▄▄
 //  ███▄███  ▄▄▄▄  ▄▄▄▄▄
 //  ██▀█▀██  ▄▄▄██ ██  ██
@@ -941,6 +1361,445 @@ TEST_CASE("Map stress test") {
     }
 }
 
+//   ▄▄▄▄                                                          ▄▄   ▄▄   ▄▄
+//  ██  ▀▀  ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄ ▄▄  ▄▄ ▄▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ███▄███  ▄▄▄▄  ▄▄▄▄▄
+//  ██     ██  ██ ██  ██ ██    ██  ██ ██  ▀▀ ██  ▀▀ ██▄▄██ ██  ██  ██   ██▀█▀██  ▄▄▄██ ██  ██
+//  ▀█▄▄█▀ ▀█▄▄█▀ ██  ██ ▀█▄▄▄ ▀█▄▄██ ██     ██     ▀█▄▄▄  ██  ██  ▀█▄▄ ██   ██ ▀█▄▄██ ██▄▄█▀
+//                                                                                     ██
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX ConcurrentMap_
+
+TEST_CASE("ConcurrentMap with String keys") {
+    ConcurrentMap<String, u32> map;
+    auto result1 = map.insert("apple", [](u32& value) { value = 1; });
+    check(!result1.was_found);
+    check(*result1.value == 1);
+    auto result2 = map.insert("apple", [](u32& value) { value = 2; });
+    check(result2.was_found);
+    check(result2.value == result1.value);
+    check(*result2.value == 1);
+    for (u32 i = 0; i < 1000; i++) {
+        *map.insert(String::format("key{}", i)).value = i;
+    }
+    check(map.num_items() == 1001);
+    // Growing the tables doesn't move existing values.
+    check(map.find("apple") == result1.value);
+    for (u32 i = 0; i < 1000; i++) {
+        u32* value = map.find(String::format("key{}", i));
+        check(value && *value == i);
+    }
+    check(map.find("durian") == nullptr);
+    map.clear();
+    check(map.num_items() == 0);
+    check(map.find("apple") == nullptr);
+}
+
+TEST_CASE("ConcurrentMap insert and find from multiple threads") {
+    static constexpr u32 NumThreads = 4;
+    static constexpr u32 NumKeys = 4096;
+    ConcurrentMap<u32, u32> map;
+    Atomic<u32> num_inserted = 0;
+    Atomic<u32> num_mismatches = 0;
+
+    // Each thread inserts the same keys in a different order, and looks up keys that might be inserted concurrently
+    // by other threads.
+    Thread threads[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&, t] {
+            for (u32 i = 0; i < NumKeys; i++) {
+                u32 key = (i * (t * 2 + 1) + t * 77) % NumKeys;
+                auto result = map.insert(key, [key](u32& value) { value = key * 3; });
+                if (!result.was_found) {
+                    num_inserted.fetch_add_acq_rel(1);
+                }
+                u32* found = map.find((key * 7) % NumKeys);
+                if ((result.value && *result.value != key * 3) || (found && *found != ((key * 7) % NumKeys) * 3)) {
+                    num_mismatches.fetch_add_acq_rel(1);
+                }
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(num_inserted.load_relaxed() == NumKeys);
+    check(num_mismatches.load_relaxed() == 0);
+    check(map.num_items() == NumKeys);
+    for (u32 i = 0; i < NumKeys; i++) {
+        u32* value = map.find(i);
+        check(value && *value == i * 3);
+    }
+}
+
+//   ▄▄▄▄
+//  ██  ██ ▄▄  ▄▄  ▄▄▄▄  ▄▄  ▄▄  ▄▄▄▄   ▄▄▄▄
+//  ██  ██ ██  ██ ██▄▄██ ██  ██ ██▄▄██ ▀█▄▄▄
+//  ▀█▄▄█▀ ▀█▄▄██ ▀█▄▄▄  ▀█▄▄██ ▀█▄▄▄   ▄▄▄█▀
+//     ▀█▄
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Queue_
+
+TEST_CASE("SPSCQueue try_push and try_pop") {
+    SPSCQueue<String> queue{3};
+    check(queue.capacity() == 4);
+    String item;
+    check(!queue.try_pop(item));
+    for (u32 i = 0; i < 4; i++) {
+        check(queue.try_push(String::format("{}", i)));
+    }
+    check(!queue.try_push("full"));
+    check(queue.try_pop(item) && item == "0");
+    String batch[] = {"4", "5"};
+    check(queue.try_push_batch(batch) == 1);
+    String out[8];
+    check(queue.try_pop_batch(out) == 4);
+    check(out[0] == "1" && out[1] == "2" && out[2] == "3" && out[3] == "4");
+    check(!queue.try_pop(item));
+    // The destructor destroys items that are still in the queue.
+    queue.push("left over");
+}
+
+TEST_CASE("SPSCQueue passes items between threads") {
+    static constexpr u32 NumItems = 100000;
+    SPSCQueue<u32> queue{64};
+    Thread producer([&] {
+        u32 batch[7];
+        for (u32 i = 0; i < NumItems;) {
+            if (i % 3 == 0 && i + 7 <= NumItems) {
+                for (u32& item : batch) {
+                    item = i++;
+                }
+                queue.push_batch(batch);
+            } else {
+                queue.push(i++);
+            }
+        }
+    });
+    bool in_order = true;
+    u32 out[5];
+    for (u32 expected = 0; expected < NumItems;) {
+        u32 num_items = queue.pop_batch(out);
+        for (u32 i = 0; i < num_items; i++) {
+            in_order &= (out[i] == expected++);
+        }
+    }
+    producer.join();
+    check(in_order);
+    u32 item;
+    check(!queue.try_pop(item));
+}
+
+TEST_CASE("MPMCQueue delivers every item exactly once") {
+    static constexpr u32 NumThreads = 3;
+    static constexpr u32 ItemsPerThread = 30000;
+    MPMCQueue<u32> queue{16};
+    Array<Atomic<u32>> times_seen;
+    times_seen.resize(NumThreads * ItemsPerThread);
+    Atomic<u32> num_popped = 0;
+
+    // Producers push alternately one item and a batch. Consumers stop when they see the end marker.
+    static constexpr u32 EndMarker = u32(-1);
+    Thread producers[NumThreads];
+    Thread consumers[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        producers[t].run([&, t] {
+            u32 batch[5];
+            for (u32 i = 0; i < ItemsPerThread;) {
+                u32 num_items = min<u32>(i % 2 == 0 ? 1 : 5, ItemsPerThread - i);
+                for (u32 j = 0; j < num_items; j++) {
+                    batch[j] = t * ItemsPerThread + i++;
+                }
+                queue.push_batch({batch, num_items});
+            }
+        });
+        consumers[t].run([&, t] {
+            u32 out[4];
+            for (;;) {
+                u32 num_items = 1;
+                if (t == 0) {
+                    queue.pop(out[0]);
+                } else {
+                    num_items = queue.pop_batch(out);
+                }
+                for (u32 i = 0; i < num_items; i++) {
+                    if (out[i] == EndMarker) {
+                        // Only end markers follow the first one. Pass the rest on to the other consumers.
+                        for (u32 j = i + 1; j < num_items; j++) {
+                            queue.push(EndMarker);
+                        }
+                        return;
+                    }
+                    times_seen[out[i]].fetch_add_acq_rel(1);
+                    num_popped.fetch_add_acq_rel(1);
+                }
+            }
+        });
+    }
+    for (Thread& thread : producers) {
+        thread.join();
+    }
+    // Each consumer stops at the first end marker it sees.
+    for (u32 t = 0; t < NumThreads; t++) {
+        queue.push(EndMarker);
+    }
+    for (Thread& thread : consumers) {
+        thread.join();
+    }
+    check(num_popped.load_relaxed() == NumThreads * ItemsPerThread);
+    bool all_once = true;
+    for (const Atomic<u32>& count : times_seen) {
+        all_once &= (count.load_relaxed() == 1);
+    }
+    check(all_once);
+}
+
+//  ▄▄▄▄▄                     ▄▄
+//  ██    ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄ ██▄▄▄
+//  ██▀▀  ██  ██ ██  ██ ██    ██  ██
+//  ██▄▄▄ ██▄▄█▀ ▀█▄▄█▀ ▀█▄▄▄ ██  ██
+//        ██
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Epoch_
+
+struct EpochTestNode {
+    u32 value = 0;
+    Atomic<u32>* num_deleted = nullptr;
+
+    static void destroy(void* ptr) {
+        EpochTestNode* node = (EpochTestNode*) ptr;
+        node->num_deleted->fetch_add_acq_rel(1);
+        Heap::destroy(node);
+    }
+};
+
+TEST_CASE("Epoch defers deletion until readers leave their guards") {
+    Atomic<u32> num_deleted = 0;
+    Atomic<u32> step = 0;
+    Thread reader([&] {
+        Epoch::Guard guard;
+        step.store_release(1);
+        while (step.load_acquire() != 2) {
+            yield_thread();
+        }
+    });
+    while (step.load_acquire() != 1) {
+        yield_thread();
+    }
+    Epoch::retire(Heap::create<EpochTestNode>(EpochTestNode{1, &num_deleted}), EpochTestNode::destroy);
+    for (u32 i = 0; i < 5; i++) {
+        Epoch::collect();
+    }
+    check(num_deleted.load_acquire() == 0);
+    step.store_release(2);
+    reader.join();
+    Epoch::flush();
+    check(num_deleted.load_acquire() == 1);
+}
+
+TEST_CASE("Epoch keeps objects retired by exited threads until readers leave their guards") {
+    static constexpr u32 NumRetiringThreads = 8;
+    Atomic<u32> num_deleted = 0;
+    Atomic<u32> step = 0;
+    Thread reader([&] {
+        Epoch::Guard guard;
+        step.store_release(1);
+        while (step.load_acquire() != 2) {
+            yield_thread();
+        }
+    });
+    while (step.load_acquire() != 1) {
+        yield_thread();
+    }
+    // Each thread exits with its retired object still pending, leaving it as an orphan for other threads to free.
+    for (u32 i = 0; i < NumRetiringThreads; i++) {
+        Thread retiring_thread([&] {
+            Epoch::retire(Heap::create<EpochTestNode>(EpochTestNode{i, &num_deleted}), EpochTestNode::destroy);
+            Epoch::collect();
+        });
+        retiring_thread.join();
+        Epoch::collect();
+    }
+    check(num_deleted.load_acquire() == 0);
+    step.store_release(2);
+    reader.join();
+    Epoch::flush();
+    check(num_deleted.load_acquire() == NumRetiringThreads);
+}
+
+#if defined(PLY_POSIX)
+struct LateExitCallback {
+    pthread_key_t key;
+    u32 rounds_left = PTHREAD_DESTRUCTOR_ITERATIONS;
+    Atomic<u32>* num_deleted = nullptr;
+
+    // Re-arms itself until the last round of thread exit callbacks, which runs after the heap and Epoch have released
+    // the thread's cache and record.
+    static void on_exit(void* value) {
+        LateExitCallback* callback = (LateExitCallback*) value;
+        if (--callback->rounds_left > 0) {
+            pthread_setspecific(callback->key, callback);
+            return;
+        }
+        Heap::free(Heap::alloc(32));
+        Epoch::retire(Heap::create<EpochTestNode>(EpochTestNode{0, callback->num_deleted}), EpochTestNode::destroy);
+    }
+};
+
+TEST_CASE("Epoch frees objects retired by late thread exit callbacks") {
+    Atomic<u32> num_deleted = 0;
+    LateExitCallback callback;
+    callback.num_deleted = &num_deleted;
+    // Create the key after the Epoch's own key so that its callback runs later in each round.
+    Epoch::collect();
+    int rc = pthread_key_create(&callback.key, LateExitCallback::on_exit);
+    check(rc == 0);
+    Thread thread([&] {
+        Epoch::collect();
+        pthread_setspecific(callback.key, &callback);
+    });
+    thread.join();
+    pthread_key_delete(callback.key);
+    check(callback.rounds_left == 0);
+    Epoch::flush();
+    check(num_deleted.load_acquire() == 1);
+}
+#endif
+
+TEST_CASE("Epoch protects a pointer that's replaced while other threads read it") {
+    static constexpr u32 NumReaders = 3;
+    static constexpr u32 NumUpdates = 2000;
+    Atomic<u32> num_deleted = 0;
+    Atomic<EpochTestNode*> current = Heap::create<EpochTestNode>(EpochTestNode{0, &num_deleted});
+    Atomic<u32> done = 0;
+    Atomic<u32> num_bad_reads = 0;
+
+    // A deleted node's value is overwritten before it's freed, so a reader that sees the marker read a node too late.
+    auto destroy = [](void* ptr) {
+        ((EpochTestNode*) ptr)->value = u32(-1);
+        EpochTestNode::destroy(ptr);
+    };
+    Thread readers[NumReaders];
+    for (Thread& thread : readers) {
+        thread.run([&] {
+            while (!done.load_acquire()) {
+                Epoch::Guard guard;
+                EpochTestNode* node = current.load_acquire();
+                u32 value = node->value;
+                yield_thread();
+                if (value == u32(-1) || node->value != value) {
+                    num_bad_reads.fetch_add_acq_rel(1);
+                }
+            }
+        });
+    }
+    for (u32 i = 1; i <= NumUpdates; i++) {
+        EpochTestNode* old_node = current.exchange_acq_rel(Heap::create<EpochTestNode>(EpochTestNode{i, &num_deleted}));
+        Epoch::retire(old_node, destroy);
+    }
+    done.store_release(1);
+    for (Thread& thread : readers) {
+        thread.join();
+    }
+    Epoch::flush();
+    check(num_bad_reads.load_relaxed() == 0);
+    check(num_deleted.load_relaxed() == NumUpdates);
+    EpochTestNode::destroy(current.load_relaxed());
+}
+
+//   ▄▄▄▄    ▄▄
+//  ██  ██ ▄██▄▄  ▄▄▄▄  ▄▄▄▄▄▄▄
+//  ██▀▀██  ██   ██  ██ ██ ██ ██
+//  ██  ██  ▀█▄▄ ▀█▄▄█▀ ██ ██ ██
+//
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Atom_
+
+TEST_CASE("Atom intern") {
+    AtomTable table;
+    String hello = "hello";
+    Atom a = table.intern(hello);
+    hello = "changed";
+    Atom b = table.intern(StringView{"hel"} + "lo");
+    Atom c = table.intern("world");
+    check(a == b);
+    check(a != c);
+    check(a.view() == "hello");
+    check(a.id() == 1);
+    check(c.id() == 2);
+    check(table.num_atoms() == 2);
+    check(table.find("world") == c);
+    check(table.find("absent").is_empty());
+    check(table.intern("").is_empty());
+    check(Atom{}.view() == "");
+    check(Atom{}.id() == 0);
+}
+
+TEST_CASE("Atom bulk intern") {
+    AtomTable table;
+    Atom existing = table.intern("b");
+    StringView strs[] = {"a", "b", "", "c", "a"};
+    Atom atoms[5];
+    table.intern(strs, atoms);
+    check(atoms[1] == existing);
+    check(atoms[0] == atoms[4]);
+    check(atoms[0] != atoms[3]);
+    check(atoms[2].is_empty());
+    check(table.num_atoms() == 3);
+    for (u32 i = 0; i < 5; i++) {
+        check(atoms[i].view() == strs[i]);
+    }
+}
+
+TEST_CASE("Atom as map key") {
+    AtomTable table;
+    Map<Atom, u32> map;
+    for (u32 i = 0; i < 100; i++) {
+        auto result = map.insert(table.intern(String::format("key{}", i % 10)));
+        if (!result.was_found) {
+            *result.value = 0;
+        }
+        *result.value += 1;
+    }
+    check(map.items().num_items() == 10);
+    for (u32 i = 0; i < 10; i++) {
+        u32* count = map.find(table.intern(String::format("key{}", i)));
+        check(count && *count == 10);
+    }
+}
+
+TEST_CASE("Atom intern from multiple threads") {
+    static constexpr u32 NumThreads = 4;
+    static constexpr u32 NumStrings = 1024;
+    AtomTable table;
+    Array<Atom> atoms[NumThreads];
+
+    // Each thread interns the same strings in a different order.
+    Thread threads[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&table, &atoms, t] {
+            atoms[t].resize(NumStrings);
+            for (u32 i = 0; i < NumStrings; i++) {
+                u32 j = (i * (t * 2 + 1) + t * 77) % NumStrings;
+                atoms[t][j] = table.intern(String::format("{}", j));
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(table.num_atoms() == NumStrings);
+    for (u32 i = 0; i < NumStrings; i++) {
+        check(atoms[0][i].view() == String::format("{}", i));
+        for (u32 t = 1; t < NumThreads; t++) {
+            check(atoms[t][i] == atoms[0][i]);
+        }
+    }
+}
+
 //  ▄▄▄▄▄  ▄▄▄▄▄▄
 //  ██  ██   ██   ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄
 //  ██▀▀█▄   ██   ██  ▀▀ ██▄▄██ ██▄▄██
@@ -1040,6 +1899,162 @@ TEST_CASE("BTree stress test u32") {
     }
 }
 
+TEST_CASE("BTree with pooled nodes") {
+    BTree<u32, PoolNodeAllocator> btree;
+    Array<u32> arr;
+    Random r{1};
+    for (u32 i = 0; i < 5000; i++) {
+        u32 value = r.generate_u32() % 10000;
+        arr.append(value);
+        btree.insert(value);
+    }
+    for (u32 i = 0; i < 2500; i++) {
+        u32 index_to_remove = r.generate_u32() % arr.num_items();
+        check(btree.erase(arr[index_to_remove]));
+        arr.erase_quick(index_to_remove);
+    }
+#if defined(PLY_WITH_ASSERTS)
+    btree.validate();
+#endif
+    sort(arr);
+    auto iter = btree.get_first_item();
+    for (u32 i = 0; i < arr.num_items(); i++) {
+        check(iter);
+        check(*iter == arr[i]);
+        iter++;
+    }
+    check(!iter);
+}
+
+// Checks search_btree_node against binary_search on sorted arrays of every length up to 100.
+template <typename T, typename MakeKey>
+bool search_btree_node_matches_binary_search(const MakeKey& make_key) {
+    Random r{3};
+    bool ok = true;
+    for (u32 num_keys = 0; num_keys <= 100; num_keys++) {
+        Array<T> keys;
+        for (u32 i = 0; i < num_keys; i++) {
+            keys.append(make_key(r.generate_u32() % 64));
+        }
+        sort(keys);
+        for (u32 k = 0; k < 66; k++) {
+            T desired = make_key(k);
+            for (FindType find_type : {FindGreaterThan, FindGreaterThanOrEqual}) {
+                ok &= (search_btree_node(ArrayView<T>{keys}, desired, find_type) ==
+                       binary_search(ArrayView<T>{keys}, desired, find_type));
+            }
+        }
+    }
+    return ok;
+}
+
+TEST_CASE("search_btree_node matches binary_search") {
+    // The unsigned keys straddle the sign bit, and the signed keys straddle zero.
+    check(search_btree_node_matches_binary_search<u32>([](u32 i) { return 0x7fffffe0u + i; }));
+    check(search_btree_node_matches_binary_search<s32>([](u32 i) { return s32(i) - 32; }));
+    check(search_btree_node_matches_binary_search<u64>([](u32 i) { return u64{0x7fffffffffffffe0} + i; }));
+    check(search_btree_node_matches_binary_search<float>([](u32 i) { return float(i) * 0.5f - 16.f; }));
+    check(search_btree_node_matches_binary_search<double>([](u32 i) { return double(i) * 0.25 - 8.0; }));
+    check(search_btree_node_matches_binary_search<String>([](u32 i) { return String::format("{}", i + 100); }));
+}
+
+// Inserts and erases random keys, checking the tree against a sorted array.
+template <typename BTreeType>
+void check_btree_against_array(u32 seed) {
+    using T = typename BTreeType::Key;
+    BTreeType btree;
+    Array<T> arr;
+    Random r{seed};
+    for (u32 i = 0; i < 3000; i++) {
+        T value = T(r.generate_u32() % 5000);
+        arr.append(value);
+        btree.insert(value);
+    }
+    for (u32 i = 0; i < 2000; i++) {
+        u32 index_to_remove = r.generate_u32() % arr.num_items();
+        check(btree.erase(arr[index_to_remove]));
+        arr.erase_quick(index_to_remove);
+    }
+#if defined(PLY_WITH_ASSERTS)
+    btree.validate();
+#endif
+    sort(arr);
+    auto iter = btree.get_first_item();
+    bool ok = true;
+    for (u32 i = 0; i < arr.num_items(); i++) {
+        ok &= (iter && *iter == arr[i]);
+        iter++;
+    }
+    check(ok && !iter);
+    for (u32 k = 0; k < 5000; k += 7) {
+        auto found = btree.find_earliest(T(k), FindGreaterThan);
+        u32 index = binary_search(arr, T(k), FindGreaterThan);
+        ok &= (index < arr.num_items()) ? (found && *found == arr[index]) : !found;
+    }
+    check(ok);
+}
+
+TEST_CASE("BTree with different fan-outs") {
+    check_btree_against_array<BTree<u32, HeapNodeAllocator, 4>>(1);
+    check_btree_against_array<BTree<u32, HeapNodeAllocator, 64>>(2);
+    check_btree_against_array<BTree<u64, PoolNodeAllocator, 128>>(3);
+    check_btree_against_array<BTree<float, HeapNodeAllocator, 32>>(4);
+}
+
+TEST_CASE("BTree build_from_sorted") {
+    bool ok = true;
+    for (float fill_factor : {0.5f, 0.75f, 1.f}) {
+        for (u32 num_items = 0; num_items < 300; num_items += 7) {
+            Array<u32> arr;
+            for (u32 i = 0; i < num_items; i++) {
+                arr.append(i * 2);
+            }
+            // Any existing items are replaced.
+            BTree<u32> btree;
+            btree.insert(5);
+            btree.build_from_sorted(arr, fill_factor);
+#if defined(PLY_WITH_ASSERTS)
+            btree.validate();
+#endif
+            ok &= (btree.num_items == num_items);
+            auto iter = btree.get_first_item();
+            for (u32 item : arr) {
+                ok &= (iter && *iter == item);
+                iter++;
+            }
+            ok &= !iter;
+            // The tree should stay valid as items are inserted and erased.
+            for (u32 i = 0; i < num_items; i += 3) {
+                btree.insert(i * 2 + 1);
+                if (i % 2 == 0) {
+                    ok &= btree.erase(i * 2);
+                }
+            }
+#if defined(PLY_WITH_ASSERTS)
+            btree.validate();
+#endif
+            ok &= (btree.find(1) == (num_items > 0)) && !btree.find(0);
+        }
+    }
+    check(ok);
+}
+
+TEST_CASE("BTree build_from_sorted with move semantics") {
+    Array<String> arr;
+    for (u32 i = 0; i < 1000; i++) {
+        arr.append(String::format("{}", i + 1000));
+    }
+    BTree<String, PoolNodeAllocator, 8> btree;
+    btree.build_from_sorted(std::move(arr));
+#if defined(PLY_WITH_ASSERTS)
+    btree.validate();
+#endif
+    check(btree.num_items == 1000);
+    check(arr[0].is_empty() && arr[999].is_empty());
+    check(btree.find("1000") && btree.find("1500") && btree.find("1999"));
+    check(!btree.find("2000"));
+}
+
 //  ▄▄   ▄▄               ▄▄                ▄▄
 //  ██   ██  ▄▄▄▄  ▄▄▄▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄
 //   ██ ██   ▄▄▄██ ██  ▀▀ ██  ▄▄▄██ ██  ██  ██
@@ -1281,6 +2296,369 @@ TEST_CASE("binary_search() with different numeric types") {
     check(binary_search(s32_arr, 10, FindGreaterThanOrEqual) == 6);
 }
 
+// Fills an array with one of the input patterns that trip up naive quicksorts.
+static Array<u32> make_sort_input(u32 pattern, u32 num_items) {
+    Random rand{pattern};
+    Array<u32> arr;
+    arr.resize(num_items);
+    for (u32 i = 0; i < num_items; i++) {
+        switch (pattern) {
+            case 0:
+                arr[i] = rand.generate_u32();
+                break;
+            case 1:
+                arr[i] = i;
+                break;
+            case 2:
+                arr[i] = num_items - i;
+                break;
+            case 3:
+                arr[i] = rand.generate_u32() % 4;
+                break;
+            default:
+                arr[i] = (i < num_items / 2) ? i : num_items - i; // Organ pipe
+                break;
+        }
+    }
+    return arr;
+}
+
+static bool is_sorted_u32(ArrayView<const u32> view) {
+    for (u32 i = 1; i < view.num_items(); i++) {
+        if (view[i] < view[i - 1])
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("sort() random, sorted, reversed and duplicate inputs") {
+    for (u32 pattern = 0; pattern < 5; pattern++) {
+        for (u32 num_items : {0, 1, 2, 15, 16, 17, 100, 5000}) {
+            Array<u32> arr = make_sort_input(pattern, num_items);
+            u64 sum = 0;
+            for (u32 v : arr) {
+                sum += v;
+            }
+            sort(arr);
+            check(is_sorted_u32(arr));
+            for (u32 v : arr) {
+                sum -= v;
+            }
+            check(sum == 0);
+        }
+    }
+}
+
+TEST_CASE("sort() with custom comparator") {
+    Array<String> arr = {"cherry", "apple", "elderberry", "banana", "date"};
+    sort(arr, [](const String& a, const String& b) { return a > b; });
+    check(arr == ArrayView<const StringView>{"elderberry", "date", "cherry", "banana", "apple"});
+}
+
+TEST_CASE("heap_sort() handles the introsort fallback") {
+    for (u32 pattern = 0; pattern < 5; pattern++) {
+        Array<u32> arr = make_sort_input(pattern, 1000);
+        heap_sort(ArrayView<u32>{arr}, default_less<u32>);
+        check(is_sorted_u32(arr));
+    }
+}
+
+TEST_CASE("stable_sort() keeps equal items in order") {
+    struct Item {
+        u32 key;
+        u32 order;
+    };
+    for (u32 num_items : {10, 100, 5000}) {
+        Random rand{num_items};
+        Array<Item> arr;
+        for (u32 i = 0; i < num_items; i++) {
+            arr.append({rand.generate_u32() % 8, i});
+        }
+        stable_sort(arr, [](const Item& a, const Item& b) { return a.key < b.key; });
+        for (u32 i = 1; i < num_items; i++) {
+            check(arr[i - 1].key <= arr[i].key);
+            if (arr[i - 1].key == arr[i].key) {
+                check(arr[i - 1].order < arr[i].order);
+            }
+        }
+    }
+}
+
+TEST_CASE("stable_sort() with String items") {
+    // Enough items that the scratch buffer comes from the heap rather than the stack.
+    Array<String> arr;
+    for (u32 i = 0; i < 300; i++) {
+        arr.append(String::format("{}", (i * 7919) % 1000));
+    }
+    stable_sort(arr, [](const String& a, const String& b) { return a.num_bytes() < b.num_bytes(); });
+    for (u32 i = 1; i < arr.num_items(); i++) {
+        check(arr[i - 1].num_bytes() <= arr[i].num_bytes());
+    }
+    stable_sort(arr);
+    for (u32 i = 1; i < arr.num_items(); i++) {
+        check(arr[i - 1] <= arr[i]);
+    }
+}
+
+TEST_CASE("radix_sort() signed integers and floats") {
+    Random rand{5};
+    Array<s32> ints;
+    Array<float> floats;
+    for (u32 i = 0; i < 3000; i++) {
+        ints.append((s32) rand.generate_u32());
+        floats.append((rand.generate_float() - 0.5f) * 1000.f);
+    }
+    ints.append(-2147483647 - 1);
+    ints.append(2147483647);
+    ints.append(0);
+    floats.append(-0.f);
+    floats.append(0.f);
+    radix_sort(ints);
+    radix_sort(floats);
+    for (u32 i = 1; i < ints.num_items(); i++) {
+        check(ints[i - 1] <= ints[i]);
+    }
+    for (u32 i = 1; i < floats.num_items(); i++) {
+        check(floats[i - 1] <= floats[i]);
+    }
+}
+
+TEST_CASE("radix_sort() with key function is stable") {
+    struct Item {
+        u64 key;
+        u32 order;
+    };
+    Random rand{6};
+    Array<Item> arr;
+    for (u32 i = 0; i < 2000; i++) {
+        // High bits vary so that only some digit passes get skipped.
+        arr.append({(rand.generate_u64() % 16) << 40, i});
+    }
+    radix_sort(arr, [](const Item& item) { return item.key; });
+    for (u32 i = 1; i < arr.num_items(); i++) {
+        check(arr[i - 1].key <= arr[i].key);
+        if (arr[i - 1].key == arr[i].key) {
+            check(arr[i - 1].order < arr[i].order);
+        }
+    }
+}
+
+//  ▄▄▄▄▄▄ ▄▄                              ▄▄  ▄▄▄▄▄                ▄▄
+//    ██   ██▄▄▄  ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄   ▄▄▄██  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//    ██   ██  ██ ██  ▀▀ ██▄▄██  ▄▄▄██ ██  ██  ██▀▀▀  ██  ██ ██  ██ ██
+//    ██   ██  ██ ██     ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX ThreadPool_
+
+TEST_CASE("run_batch runs every task once, including nested batches") {
+    ThreadPool pool{3};
+    Array<Atomic<u32>> counts;
+    counts.resize(1000);
+    pool.run_batch(10, [&](u32 outer) {
+        pool.run_batch(100, [&](u32 inner) { counts[outer * 100 + inner].fetch_add_acq_rel(1); });
+    });
+    bool all_once = true;
+    for (const Atomic<u32>& count : counts) {
+        all_once &= (count.load_relaxed() == 1);
+    }
+    check(all_once);
+}
+
+// Sums the integers in [lo, hi) by splitting the range in half until it's small.
+static u64 fork_join_sum(ThreadPool& pool, u64 lo, u64 hi) {
+    if (hi - lo <= 1000) {
+        u64 sum = 0;
+        for (u64 i = lo; i < hi; i++) {
+            sum += i;
+        }
+        return sum;
+    }
+    u64 mid = (lo + hi) / 2;
+    u64 left = 0;
+    JobCounter counter;
+    pool.spawn(counter, [&] { left = fork_join_sum(pool, lo, mid); });
+    u64 right = fork_join_sum(pool, mid, hi);
+    pool.wait(counter);
+    return left + right;
+}
+
+TEST_CASE("spawn and wait with nested fork/join") {
+    ThreadPool pool{3};
+    check(fork_join_sum(pool, 0, 1000000) == u64{999999} * 1000000 / 2);
+    ThreadPool::Stats stats = pool.get_stats();
+    check(stats.num_jobs_run >= 1023);
+    check(stats.num_queued_jobs == 0);
+}
+
+TEST_CASE("submitted jobs all run before the pool is destroyed") {
+    Atomic<u32> num_run = 0;
+    {
+        ThreadPool pool{2};
+        for (u32 i = 0; i < 1000; i++) {
+            pool.submit([&] { num_run.fetch_add_acq_rel(1); });
+        }
+    }
+    check(num_run.load_relaxed() == 1000);
+}
+
+TEST_CASE("ThreadPool with no workers runs jobs on the calling thread") {
+    ThreadPool pool{0};
+    TID tid = get_current_thread_id();
+    bool same_thread = false;
+    pool.submit([&] { same_thread = (get_current_thread_id() == tid); });
+    check(same_thread);
+    check(fork_join_sum(pool, 0, 10000) == u64{9999} * 10000 / 2);
+}
+
+TEST_CASE("parallel_for and parallel_reduce") {
+    ThreadPool pool{3};
+    Array<u32> arr;
+    arr.resize(10007);
+    parallel_for(0, arr.num_items(), 100, [&](u32 i) { arr[i] = i; }, pool);
+    parallel_for(arr, 64, [](u32& item) { item *= 2; }, pool);
+    u64 sum = parallel_reduce(
+        0, arr.num_items(), 100, u64{0}, [&](u32 i) { return u64{arr[i]}; }, [](u64 a, u64 b) { return a + b; },
+        pool);
+    check(sum == u64{10006} * 10007);
+    // Combining strings checks that chunk results are combined in order.
+    String digits = parallel_reduce(
+        0, 30, 4, String{}, [](u32 i) { return String::format("{}", i % 10); },
+        [](const String& a, const String& b) { return a + b; }, pool);
+    check(digits == "012345678901234567890123456789");
+}
+
+TEST_CASE("parallel_sort is stable") {
+    struct Item {
+        u32 key;
+        u32 order;
+    };
+    ThreadPool pool{3};
+    Random rand{7};
+    for (u32 num_items : {100, 20000, 100003}) {
+        Array<Item> arr;
+        for (u32 i = 0; i < num_items; i++) {
+            arr.append({rand.generate_u32() % 1000, i});
+        }
+        parallel_sort(arr, [](const Item& a, const Item& b) { return a.key < b.key; }, pool);
+        bool ok = true;
+        for (u32 i = 1; i < num_items; i++) {
+            ok &= (arr[i - 1].key < arr[i].key) || (arr[i - 1].key == arr[i].key && arr[i - 1].order < arr[i].order);
+        }
+        check(ok);
+    }
+}
+
+TEST_CASE("parallel_sort with String items") {
+    ThreadPool pool{2};
+    Array<String> arr;
+    for (u32 i = 0; i < 50000; i++) {
+        arr.append(String::format("{}", (i * 7919) % 50000));
+    }
+    parallel_sort(arr, default_less<String>, pool);
+    bool ok = true;
+    for (u32 i = 1; i < arr.num_items(); i++) {
+        ok &= (arr[i - 1] <= arr[i]);
+    }
+    check(ok);
+}
+
+//  ▄▄▄▄▄         ▄▄
+//  ██    ▄▄  ▄▄ ▄██▄▄ ▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀  ██  ██  ██   ██  ██ ██  ▀▀ ██▄▄██
+//  ██    ▀█▄▄██  ▀█▄▄ ▀█▄▄██ ██     ▀█▄▄▄
+//
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Future_
+
+TEST_CASE("start_task and then chain results") {
+    ThreadPool pool{2};
+    Future<u32> answer = start_task([] { return 6u * 7; }, pool);
+    Future<String> text = answer.then([](u32 value) { return String::format("{}", value); });
+    Atomic<u32> num_done = 0;
+    Future<void> done = text.then([&](const String&) { num_done.fetch_add_acq_rel(1); });
+    Future<u32> after_void = done.then([] { return 1u; });
+    check(text.get() == "42");
+    check(after_void.get() == 1);
+    check(num_done.load_relaxed() == 1);
+    check(answer.is_ready());
+}
+
+TEST_CASE("Promise fulfilled by another thread") {
+    ThreadPool pool{1};
+    Promise<String> promise{pool};
+    Future<String> future = promise.get_future();
+    Future<u32> length = future.then([](const String& str) { return str.num_bytes(); });
+    check(!future.is_ready());
+    Thread thread;
+    thread.run([promise] { promise.set_value("hello"); });
+    check(future.get() == "hello");
+    check(length.get() == 5);
+    thread.join();
+}
+
+TEST_CASE("Blocked waiter wakes up to run jobs submitted later") {
+    // The only worker blocks on a Promise that's fulfilled by a job submitted after it went to
+    // sleep, so the worker has to wake up and run that job itself.
+    ThreadPool pool{1};
+    Promise<u32> promise{pool};
+    Future<u32> future = promise.get_future();
+    Future<u32> doubled = start_task([future] { return future.get() * 2; }, pool);
+    sleep_millis(50);
+    check(!doubled.is_ready());
+    pool.submit([promise] { promise.set_value(21); });
+    // Poll instead of calling get(), so that this thread doesn't run the job itself.
+    for (u32 i = 0; i < 5000 && !doubled.is_ready(); i++) {
+        sleep_millis(1);
+    }
+    check(doubled.is_ready() && doubled.get() == 42);
+}
+
+TEST_CASE("when_all and when_any") {
+    ThreadPool pool{3};
+    Array<Future<u32>> futures;
+    for (u32 i = 0; i < 100; i++) {
+        futures.append(start_task([i] { return i * i; }, pool));
+    }
+    when_all(futures, pool).wait();
+    u32 sum = 0;
+    for (const Future<u32>& future : futures) {
+        check(future.is_ready());
+        sum += future.get();
+    }
+    check(sum == 328350);
+    check(when_all(Array<Future<u32>>{}, pool).is_ready());
+
+    Promise<void> never{pool};
+    Promise<void> soon{pool};
+    Future<u32> first = when_any(Array<Future<void>>{never.get_future(), soon.get_future()}, pool);
+    check(!first.is_ready());
+    soon.set_value();
+    check(first.get() == 1);
+    never.set_value();
+}
+
+TEST_CASE("when_all and when_any combine thousands of futures") {
+    // More than a single RefCounted object can count references to.
+    static constexpr u32 NumFutures = 6000;
+    ThreadPool pool{1};
+    Array<Promise<void>> promises;
+    Array<Future<void>> futures;
+    for (u32 i = 0; i < NumFutures; i++) {
+        promises.append(pool);
+        futures.append(promises.back().get_future());
+    }
+    Future<void> all = when_all(futures, pool);
+    Future<u32> any = when_any(futures, pool);
+    for (u32 i = NumFutures; i-- > 0;) {
+        promises[i].set_value();
+    }
+    check(all.is_ready());
+    check(any.get() == NumFutures - 1);
+}
+
 //  ▄▄  ▄▄        ▄▄                  ▄▄
 //  ██  ██ ▄▄▄▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄   ▄▄▄██  ▄▄▄▄
 //  ██  ██ ██  ██ ██ ██    ██  ██ ██  ██ ██▄▄██
@@ -1439,7 +2817,7 @@ TEST_CASE("Usage stats with reserve/commit/decommit/unreserve") {
     check(VirtualMemory::total_committed_bytes.load_relaxed() == initial_committed);
 
     // Commit 3 pages
-    VirtualMemory::commit_pages(addr, props.page_size * 3);
+    check(VirtualMemory::commit_pages(addr, props.page_size * 3));
     check(VirtualMemory::total_reserved_bytes.load_relaxed() == initial_reserved + region_size);
     check(VirtualMemory::total_committed_bytes.load_relaxed() == initial_committed + props.page_size * 3);
 
@@ -1473,6 +2851,394 @@ TEST_CASE("Usage stats with alloc/free") {
     check(VirtualMemory::total_committed_bytes.load_relaxed() == initial_committed);
 }
 
+TEST_CASE("Huge pages and prefaulting") {
+    VirtualMemory::Properties props = VirtualMemory::get_properties();
+    check(props.huge_page_size == 0 || is_power_of_2((u64) props.huge_page_size));
+    uptr region_size = max(props.huge_page_size, props.region_alignment) * 2;
+    u32 flags = VirtualMemory::HUGE_PAGES | VirtualMemory::PREFAULT | VirtualMemory::NUMA_LOCAL;
+
+    // Alloc region
+    u8* block = (u8*) VirtualMemory::alloc_region(region_size, flags);
+    check(block != nullptr);
+    memset(block, 0xcd, region_size);
+    check(block[region_size - 1] == 0xcd);
+    VirtualMemory::free_region(block, region_size);
+
+    // Reserve region and commit half of it
+    block = (u8*) VirtualMemory::reserve_region(region_size, flags);
+    check(block != nullptr);
+    check(VirtualMemory::commit_pages(block, region_size / 2, flags));
+    memset(block, 0xcd, region_size / 2);
+    VirtualMemory::SystemStats stats = VirtualMemory::get_system_stats();
+#if !defined(PLY_WINDOWS)
+    check(stats.huge_page_resident_size <= stats.resident_size);
+#endif
+    VirtualMemory::unreserve_region(block, region_size, region_size / 2);
+}
+
+//  ▄▄  ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄
+//  ██▀▀██ ██▄▄██  ▄▄▄██ ██  ██
+//  ██  ██ ▀█▄▄▄  ▀█▄▄██ ██▄▄█▀
+//                       ██
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Heap_
+
+TEST_CASE("Heap realloc of cached blocks") {
+    for (uptr num_bytes = 0; num_bytes < 1200; num_bytes += 7) {
+        u8* block = (u8*) Heap::alloc(num_bytes);
+        check(block != nullptr);
+        check(is_aligned_to_power_of_2((uptr) block, 16));
+        memset(block, 0xab, num_bytes);
+        block = (u8*) Heap::realloc(block, num_bytes + 100);
+        bool intact = true;
+        for (uptr i = 0; i < num_bytes; i++) {
+            intact &= (block[i] == 0xab);
+        }
+        check(intact);
+        Heap::free(block);
+    }
+    Heap::flush_thread_cache();
+}
+
+TEST_CASE("Heap blocks freed by other threads") {
+    static constexpr u32 NumThreads = 4;
+    static constexpr u32 NumBlocks = 2000;
+    Array<u32*> blocks[NumThreads];
+
+    // Each thread allocates blocks and fills them with a pattern.
+    Thread threads[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&blocks, t] {
+            Random rand{t};
+            for (u32 i = 0; i < NumBlocks; i++) {
+                u32 num_words = rand.generate_u32() % 100 + 1;
+                u32* block = (u32*) Heap::alloc(num_words * sizeof(u32));
+                for (u32 j = 0; j < num_words; j++) {
+                    block[j] = (num_words << 16) | t;
+                }
+                blocks[t].append(block);
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+
+    // Each thread verifies and frees the blocks allocated by its neighbor.
+    Atomic<u32> num_corrupt = 0;
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&blocks, &num_corrupt, t] {
+            u32 src = (t + 1) % NumThreads;
+            for (u32* block : blocks[src]) {
+                u32 num_words = block[0] >> 16;
+                for (u32 j = 0; j < num_words; j++) {
+                    if (block[j] != ((num_words << 16) | src)) {
+                        num_corrupt.fetch_add_acq_rel(1);
+                        break;
+                    }
+                }
+                Heap::free(block);
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(num_corrupt.load_relaxed() == 0);
+}
+
+TEST_CASE("Heap stats track large blocks") {
+    Heap::Stats before = Heap::get_stats();
+    void* block = Heap::alloc(1 << 20);
+    Heap::Stats during = Heap::get_stats();
+    Heap::free(block);
+    Heap::Stats after = Heap::get_stats();
+    check(during.num_bytes_allocated >= before.num_bytes_allocated + (1 << 20));
+    check(during.virtual_memory_size >= during.num_bytes_allocated);
+    check(after.num_bytes_allocated == before.num_bytes_allocated);
+}
+
+TEST_CASE("Heap returns freed small blocks when the thread cache is flushed") {
+    void* block = Heap::alloc(1);
+    Heap::flush_thread_cache();
+    Heap::Stats before = Heap::get_stats();
+    Heap::free(block);
+    Heap::flush_thread_cache();
+    Heap::Stats after = Heap::get_stats();
+    check(after.num_bytes_allocated < before.num_bytes_allocated);
+}
+
+#if PLY_HEAP_STATS
+TEST_CASE("Heap stats by tag and size class") {
+    Heap::Stats before = Heap::get_stats();
+    void* blocks[3];
+    {
+        Heap::TagScope tag_scope{"Heap stats test"};
+        blocks[0] = Heap::alloc(100);
+        blocks[1] = Heap::alloc_aligned(100, 64);
+        blocks[2] = Heap::realloc(Heap::alloc(10), 300);
+    }
+    Heap::Stats during = Heap::get_stats();
+    const Heap::TagStats* tag = nullptr;
+    for (u32 i = 0; i < during.num_tags; i++) {
+        if (StringView{during.tags[i].name} == "Heap stats test") {
+            tag = &during.tags[i];
+        }
+    }
+    check(tag && tag->num_bytes_allocated == 500 && tag->num_allocs == 4);
+    check(during.num_allocs_per_size_class[3] == before.num_allocs_per_size_class[3] + 2); // <= 128 bytes
+    check(during.num_allocs_per_size_class[5] == before.num_allocs_per_size_class[5] + 1); // <= 512 bytes
+    check(during.peak_bytes_allocated >= during.num_bytes_allocated);
+    for (void* block : blocks) {
+        Heap::free(block);
+    }
+    check(Heap::get_stats().num_frees == during.num_frees + 3);
+}
+#endif
+
+//   ▄▄▄▄
+//  ██  ██ ▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀██ ██  ▀▀ ██▄▄██ ██  ██  ▄▄▄██
+//  ██  ██ ██     ▀█▄▄▄  ██  ██ ▀█▄▄██
+//
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Arena_
+
+TEST_CASE("Arena alloc and rewind") {
+    Arena arena;
+    check(arena.num_bytes_allocated() == 0);
+    char* first = (char*) arena.alloc(10);
+    check(first != nullptr);
+    Arena::Mark mark = arena.mark();
+    {
+        Arena::Scope scope{arena};
+        u64* block = (u64*) arena.alloc(100 * sizeof(u64), 64);
+        check(is_aligned_to_power_of_2((uptr) block, 64));
+        for (u32 i = 0; i < 100; i++) {
+            block[i] = i;
+        }
+    }
+    check(arena.mark().pos == mark.pos);
+    StringView copied = arena.copy("hello");
+    check(copied == "hello");
+    check(copied.bytes() == mark.pos);
+}
+
+TEST_CASE("Arena reset retains pages") {
+    Arena arena;
+    for (u32 i = 0; i < 1000; i++) {
+        memset(arena.alloc(4096), 0xcd, 4096);
+    }
+    check(arena.num_bytes_allocated() >= 1000 * 4096);
+    check(arena.num_bytes_committed() >= arena.num_bytes_allocated());
+    arena.reset(Arena::DefaultRetainSize);
+    check(arena.num_bytes_allocated() == 0);
+    check(arena.num_bytes_committed() <= Arena::DefaultRetainSize);
+    check(arena.alloc(16) != nullptr);
+}
+
+TEST_CASE("Arena exhausts its reserved region") {
+    Arena arena{1 << 20};
+    check(arena.alloc(1000) != nullptr);
+    check(arena.alloc(2 << 20) == nullptr);
+    check(arena.alloc(1000) != nullptr);
+    // Sizes that would wrap around the address space fail instead of returning a bogus pointer.
+    check(arena.alloc(uptr(-1) - 100) == nullptr);
+    check(arena.alloc(uptr(-1), 1) == nullptr);
+    void* block = arena.alloc(16);
+    check(arena.realloc(block, 16, uptr(-1) - 8) == nullptr);
+    check(arena.alloc(1000) != nullptr);
+}
+
+TEST_CASE("Arena realloc") {
+    Arena arena;
+    char* block = (char*) arena.realloc(nullptr, 0, 10);
+    memcpy(block, "abcdefghij", 10);
+    // The most recent allocation grows in place, even past the committed pages.
+    check(arena.realloc(block, 10, 1 << 20) == block);
+    check(arena.num_bytes_allocated() == (1 << 20));
+    char* other = (char*) arena.alloc(16);
+    // Otherwise the contents are copied to a new block.
+    char* moved = (char*) arena.realloc(block, 1 << 20, 2 << 20);
+    check(moved > other);
+    check(memcmp(moved, "abcdefghij", 10) == 0);
+}
+
+TEST_CASE("Array with arena allocator") {
+    Arena arena;
+    Array<u32, ArenaAllocator> arr{arena};
+    for (u32 i = 0; i < 1000; i++) {
+        arr.append(i);
+    }
+    char* arena_base = arena.mark().pos - arena.num_bytes_allocated();
+    check((char*) arr.items() >= arena_base);
+    check((char*) arr.end() <= arena.mark().pos);
+    check(arr.get_allocator().arena == &arena);
+
+    // Copies keep the allocator; conversions to a heap array don't.
+    Array<u32, ArenaAllocator> copy = arr;
+    check(copy.get_allocator().arena == &arena);
+    Array<u32> heap_copy = arr;
+    check(heap_copy == arr);
+
+    // A moved-from or cleared array can still be used.
+    Array<u32, ArenaAllocator> moved = std::move(copy);
+    copy.append(5u);
+    check(copy == ArrayView<const u32>{5});
+    moved.clear();
+    moved.append(7u);
+    check(moved.get_allocator().arena == &arena);
+
+    // Assigning keeps the array's own allocator.
+    arr = heap_copy;
+    check(arr.get_allocator().arena == &arena);
+    check(arr.num_items() == 1000);
+
+    // Adopted items keep the allocator they came from.
+    u32* items = (u32*) arena.alloc(sizeof(u32) * 2);
+    items[0] = 1;
+    items[1] = 2;
+    Array<u32, ArenaAllocator> adopted = Array<u32, ArenaAllocator>::adopt(items, 2, arena);
+    check(adopted.get_allocator().arena == &arena);
+    adopted.append(3u);
+    check(adopted == ArrayView<const u32>{1, 2, 3});
+}
+
+TEST_CASE("Set and Map with arena allocator") {
+    Arena arena;
+    Map<u32, u32, ArenaAllocator> map{arena};
+    Set<u32, ArenaAllocator> set{arena};
+    for (u32 i = 0; i < 100; i++) {
+        *map.insert(i).value = i * 2;
+        set.insert(i);
+    }
+    uptr num_bytes_allocated = arena.num_bytes_allocated();
+    for (u32 i = 0; i < 100; i++) {
+        check(*map.find(i) == i * 2);
+        check(set.find(i));
+    }
+    check(!map.find(100));
+    map.clear();
+    check(!map.find(1));
+    map.insert(1);
+    check(map.find(1));
+    check(arena.num_bytes_allocated() > num_bytes_allocated);
+}
+
+TEST_CASE("String split with arena allocator") {
+    Arena arena;
+    String str = "apple,banana,cherry";
+    Array<StringView, ArenaAllocator> parts = str.split(",", ArenaAllocator{arena});
+    check(parts.num_items() == 3);
+    check(parts[0] == "apple");
+    check(parts[2] == "cherry");
+    check(arena.num_bytes_allocated() > 0);
+}
+
+//  ▄▄▄▄▄                ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//  ██▀▀▀  ██  ██ ██  ██ ██
+//  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX Pool_
+
+TEST_CASE("Pool reuses freed blocks") {
+    struct Node {
+        u64 values[9];
+    };
+    Pool<Node> pool;
+    check(pool.get_block_size() == 128);
+    Array<Node*> nodes;
+    for (u32 i = 0; i < 2000; i++) {
+        Node* node = pool.create();
+        check(is_aligned_to_power_of_2((uptr) node, (uptr) PoolBase::CacheLineSize));
+        node->values[0] = i;
+        nodes.append(node);
+    }
+    bool intact = true;
+    for (u32 i = 0; i < nodes.num_items(); i++) {
+        intact &= (nodes[i]->values[0] == i);
+    }
+    check(intact);
+    Node* last = nodes.back();
+    pool.destroy(last);
+    check(pool.alloc() == last);
+}
+
+TEST_CASE("Pool blocks freed by other threads") {
+    static constexpr u32 NumThreads = 4;
+    static constexpr u32 NumBlocks = 5000;
+    Pool<u64> pool{true};
+    Array<u64*> blocks[NumThreads];
+
+    // Each thread allocates blocks and tags them with its index.
+    Thread threads[NumThreads];
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&pool, &blocks, t] {
+            for (u32 i = 0; i < NumBlocks; i++) {
+                u64* block = pool.create((u64(t) << 32) | i);
+                blocks[t].append(block);
+            }
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+
+    // Each thread verifies and frees the blocks allocated by its neighbor, then allocates them again.
+    Atomic<u32> num_corrupt = 0;
+    for (u32 t = 0; t < NumThreads; t++) {
+        threads[t].run([&pool, &blocks, &num_corrupt, t] {
+            u32 src = (t + 1) % NumThreads;
+            for (u32 i = 0; i < NumBlocks; i++) {
+                if (*blocks[src][i] != ((u64(src) << 32) | i)) {
+                    num_corrupt.fetch_add_acq_rel(1);
+                }
+                pool.free(blocks[src][i]);
+            }
+            for (u32 i = 0; i < NumBlocks; i++) {
+                pool.alloc();
+            }
+            pool.flush_thread_cache();
+        });
+    }
+    for (Thread& thread : threads) {
+        thread.join();
+    }
+    check(num_corrupt.load_relaxed() == 0);
+}
+
+TEST_CASE("Pool reclaims blocks cached by threads that exit") {
+    static constexpr u32 NumBlocks = 100;
+    Pool<u64> pool{true};
+    Array<u64*> blocks;
+    // The thread frees its blocks into its own cache and exits without flushing it.
+    Thread thread([&] {
+        for (u32 i = 0; i < NumBlocks; i++) {
+            blocks.append(pool.create(i));
+        }
+        for (u64* block : blocks) {
+            pool.free(block);
+        }
+    });
+    thread.join();
+    // The shared free list may also hold spare blocks from the thread's last batch, so allocate more than NumBlocks.
+    Array<u64*> reallocated;
+    for (u32 i = 0; i < NumBlocks * 2; i++) {
+        reallocated.append((u64*) pool.alloc());
+    }
+    bool all_reused = true;
+    for (u64* block : blocks) {
+        all_reused &= (find(reallocated, block) >= 0);
+    }
+    check(all_reused);
+}
+
 //  ▄▄▄▄▄  ▄▄                      ▄▄                        ▄▄    ▄▄         ▄▄         ▄▄
 //  ██  ██ ▄▄ ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄ ▄██▄▄  ▄▄▄▄  ▄▄▄▄▄  ▄▄  ▄▄ ██ ▄▄ ██  ▄▄▄▄  ▄██▄▄  ▄▄▄▄ ██▄▄▄   ▄▄▄▄  ▄▄▄▄▄
 //  ██  ██ ██ ██  ▀▀ ██▄▄██ ██     ██   ██  ██ ██  ▀▀ ██  ██ ▀█▄██▄█▀  ▄▄▄██  ██   ██    ██  ██ ██▄▄██ ██  ▀▀
@@ -1564,3 +3330,208 @@ TEST_CASE("DirectoryWatcher") {
 }
 #endif
 
+//  ▄▄▄▄▄                       ▄▄   ▄▄
+//  ██    ▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ██     ▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄
+//  ██▀▀  ██  ██ ██▄▄██ ██  ██  ██   ██    ██  ██ ██  ██ ██  ██
+//  ██▄▄▄  ▀██▀  ▀█▄▄▄  ██  ██  ▀█▄▄ ██▄▄▄ ▀█▄▄█▀ ▀█▄▄█▀ ██▄▄█▀
+//                                                       ██
+
+#undef TEST_CASE_PREFIX
+#define TEST_CASE_PREFIX EventLoop_
+
+static constexpr u16 EventLoopTestPort = 47391;
+
+// Connects two TCP sockets to each other over the loopback interface. When it's called from a fiber, both the accept
+// and the connect go through the fiber's event loop.
+static void connect_loopback_pair(Owned<TCPConnection>& client, Owned<TCPConnection>& server) {
+    Network::initialize(IPV4);
+    TCPListener listener = Network::bind_tcp(EventLoopTestPort);
+    PLY_ASSERT(listener.is_valid());
+    client = Network::connect_tcp(IPAddress::local_host(IPV4), EventLoopTestPort);
+    server = listener.accept();
+    PLY_ASSERT(client && server);
+}
+
+TEST_CASE("EventLoop wakes a reader and a writer waiting on the same socket") {
+    static constexpr u32 NumBytes = 8 * 1024 * 1024;
+    EventLoop loop;
+    Owned<TCPConnection> client;
+    Owned<TCPConnection> server;
+    String received_by_client;
+    u32 num_received_by_server = 0;
+    loop.spawn([&] {
+        connect_loopback_pair(client, server);
+        // This fiber waits to read from the client socket.
+        loop.spawn([&] {
+            Stream in = client->create_in_stream();
+            received_by_client = read_line(in);
+        });
+        // This fiber fills the client socket's send buffer, then waits to write to the same socket.
+        loop.spawn([&] {
+            Stream out = client->create_out_stream();
+            String chunk = StringView{"x"} * 65536;
+            for (u32 i = 0; i < NumBytes / chunk.num_bytes(); i++) {
+                out.write(chunk);
+            }
+            out.flush();
+        });
+        // This fiber drains the server side, then replies. Both waiting fibers must wake up for the test to finish.
+        loop.spawn([&] {
+            loop.yield();
+            Stream in = server->create_in_stream();
+            char buf[65536];
+            while (num_received_by_server < NumBytes) {
+                u32 num_bytes = in.read({buf, sizeof(buf)});
+                if (num_bytes == 0)
+                    break;
+                num_received_by_server += num_bytes;
+            }
+            Stream out = server->create_out_stream();
+            out.write("done\n");
+            out.flush();
+        });
+    });
+    loop.run();
+    check(num_received_by_server == NumBytes);
+    check(received_by_client == "done\n");
+}
+
+TEST_CASE("EventLoop echoes lines for many connections on one thread") {
+    static constexpr u32 NumClients = 20;
+    static constexpr u32 NumLines = 10;
+    Network::initialize(IPV4);
+    EventLoop loop;
+    u32 num_good_replies = 0;
+    loop.spawn([&] {
+        TCPListener listener = Network::bind_tcp(EventLoopTestPort);
+        PLY_ASSERT(listener.is_valid());
+        // Each client connects from its own fiber, after the accept below has already suspended this one.
+        for (u32 c = 0; c < NumClients; c++) {
+            loop.spawn([&, c] {
+                Owned<TCPConnection> conn = Network::connect_tcp(IPAddress::local_host(IPV4), EventLoopTestPort);
+                Stream out = conn->create_out_stream();
+                Stream in = conn->create_in_stream();
+                for (u32 i = 0; i < NumLines; i++) {
+                    String line = String::format("client {} line {}\n", c, i);
+                    out.write(line);
+                    out.flush();
+                    if (read_line(in) == line) {
+                        num_good_replies++;
+                    }
+                }
+            });
+        }
+        for (u32 c = 0; c < NumClients; c++) {
+            Owned<TCPConnection> conn = listener.accept();
+            PLY_ASSERT(conn);
+            loop.spawn([conn = std::move(conn)] {
+                Stream in = conn->create_in_stream();
+                Stream out = conn->create_out_stream();
+                for (;;) {
+                    String line = read_line(in);
+                    if (line.is_empty())
+                        break; // The client closed the connection.
+                    out.write(line);
+                    out.flush();
+                }
+            });
+        }
+    });
+    loop.run();
+    check(num_good_replies == NumClients * NumLines);
+}
+
+TEST_CASE("TCPListener accepts outside a fiber") {
+    Network::initialize(IPV4);
+    TCPListener listener = Network::bind_tcp(EventLoopTestPort);
+    PLY_ASSERT(listener.is_valid());
+    // Listeners are non-blocking, so this accept has to wait for the connection without a fiber to suspend.
+    Owned<TCPConnection> client;
+    Thread thread([&] {
+        sleep_millis(20);
+        client = Network::connect_tcp(IPAddress::local_host(IPV4), EventLoopTestPort);
+    });
+    Owned<TCPConnection> server = listener.accept();
+    thread.join();
+    check(client && server);
+}
+
+#if defined(PLY_LINUX)
+TEST_CASE("TCPListener binds several listeners to one port with reuse_port") {
+    Network::initialize(IPV4);
+    TCPListener first = Network::bind_tcp(EventLoopTestPort, true);
+    TCPListener second = Network::bind_tcp(EventLoopTestPort, true);
+    check(first.is_valid() && second.is_valid());
+    // A listener that doesn't ask to share the port can't bind to it.
+    TCPListener other = Network::bind_tcp(EventLoopTestPort);
+    check(!other.is_valid() && Network::last_result() == IPResult::IN_USE);
+}
+#endif
+
+TEST_CASE("EventLoop completes partial reads and writes") {
+    static constexpr u32 NumBytes = 4 * 1024 * 1024;
+    EventLoop loop;
+    bool intact = true;
+    u32 num_received = 0;
+    loop.spawn([&] {
+        Owned<TCPConnection> client;
+        Owned<TCPConnection> server;
+        connect_loopback_pair(client, server);
+        // The writer sends more than the socket buffers can hold in one large write, so the write only completes in
+        // pieces as the reader drains the other end.
+        loop.spawn([&, client = std::move(client)] {
+            String data = String::allocate(NumBytes);
+            for (u32 i = 0; i < NumBytes; i++) {
+                data[i] = char(i * 7);
+            }
+            Stream out = client->create_out_stream();
+            out.write(data);
+            out.flush();
+        });
+        // The reader reads small, uneven pieces and lets other fibers run in between.
+        Stream in = server->create_in_stream();
+        char buf[1000];
+        for (;;) {
+            u32 num_bytes = in.read({buf, sizeof(buf)});
+            if (num_bytes == 0)
+                break;
+            for (u32 i = 0; i < num_bytes; i++) {
+                intact &= (buf[i] == char((num_received + i) * 7));
+            }
+            num_received += num_bytes;
+            loop.yield();
+        }
+    });
+    loop.run();
+    check(intact);
+    check(num_received == NumBytes);
+}
+
+TEST_CASE("EventLoop wakes a reader when the other end closes") {
+    EventLoop loop;
+    Owned<TCPConnection> client;
+    Owned<TCPConnection> server;
+    String received;
+    bool got_eof = false;
+    loop.spawn([&] {
+        connect_loopback_pair(client, server);
+        loop.spawn([&] {
+            Stream in = server->create_in_stream();
+            received = read_line(in);
+            // The next read waits until the client closes its end, then reports end-of-file.
+            char c;
+            got_eof = (in.read({&c, 1}) == 0);
+        });
+        loop.spawn([&] {
+            {
+                Stream out = client->create_out_stream();
+                out.write("last line\n");
+            }
+            loop.yield();
+            client = nullptr;
+        });
+    });
+    loop.run();
+    check(received == "last line\n");
+    check(got_eof);
+}
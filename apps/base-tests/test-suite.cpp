@@ -34,6 +34,20 @@ bool check(bool cond) {
     return cond;
 }
 
+#if PLY_HEAP_STATS
+// Pool::get_shared() pools keep their slabs until the process exits, so they don't count as leaks.
+uptr get_num_bytes_leaked() {
+    Heap::Stats stats = Heap::get_stats();
+    uptr num_bytes = stats.num_bytes_allocated;
+    for (u32 i = 0; i < stats.num_tags; i++) {
+        if (StringView{stats.tags[i].name} == "Pool") {
+            num_bytes -= stats.tags[i].num_bytes_allocated;
+        }
+    }
+    return num_bytes;
+}
+#endif
+
 int main() {
     u32 num_passed = 0;
     const auto& test_cases = get_test_cases();
@@ -42,14 +56,13 @@ int main() {
     for (u32 i = 0; i < test_cases.num_items(); i++) {
         out.format("[{}/{}] {}... ", (i + 1), test_cases.num_items(), test_cases[i].name);
         g_test_state.success = true;
-#if PLY_USE_DLMALLOC
-        auto begin_stats = get_heap_stats();
+#if PLY_HEAP_STATS
+        uptr begin_bytes = get_num_bytes_leaked();
 #endif
         test_cases[i].func();
-#if PLY_USE_DLMALLOC
+#if PLY_HEAP_STATS
         // Check for memory leaks
-        auto end_stats = get_heap_stats();
-        if (begin_stats.in_use_bytes != end_stats.in_use_bytes) {
+        if (get_num_bytes_leaked() != begin_bytes) {
             g_test_state.success = false;
         }
 #endif
@@ -0,0 +1,188 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+#include <ply-btree.h>
+
+//  ▄▄▄▄▄  ▄▄▄▄▄▄
+//  ██  ██   ██   ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄
+//  ██▀▀█▄   ██   ██  ▀▀ ██▄▄██ ██▄▄██
+//  ██▄▄█▀   ██   ██     ▀█▄▄▄  ▀█▄▄▄
+//
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX BTree_
+
+static constexpr u32 NumItems = 1000000;
+
+// Fills a BTree with random keys, then erases them in a different random order.
+template <typename NodeAllocator>
+static void insert_then_erase(u32 seed) {
+    BTree<u32, NodeAllocator> btree;
+    Random rand{seed};
+    for (u32 i = 0; i < NumItems; i++) {
+        btree.insert(rand.generate_u32());
+    }
+    Random erase_rand{seed};
+    Array<u32> keys;
+    keys.resize(NumItems);
+    for (u32& key : keys) {
+        key = erase_rand.generate_u32();
+    }
+    for (u32 i = NumItems; i > 1; i--) {
+        std::swap(keys[i - 1], keys[erase_rand.generate_u32() % i]);
+    }
+    for (u32 key : keys) {
+        btree.erase(key);
+    }
+}
+
+BENCHMARK("BTree insert/erase with heap and pooled nodes") {
+    for (u32 num_threads : {1, 4}) {
+        double seconds = run_on_threads(num_threads, [](u32 thread_index) {
+            insert_then_erase<HeapNodeAllocator>(thread_index + 1);
+        });
+        report(String::format("{} thread{}, HeapNodeAllocator", num_threads, num_threads > 1 ? "s" : ""), seconds,
+               u64(NumItems) * 2 * num_threads);
+        seconds = run_on_threads(num_threads, [](u32 thread_index) {
+            insert_then_erase<PoolNodeAllocator>(thread_index + 1);
+        });
+        report(String::format("{} thread{}, PoolNodeAllocator", num_threads, num_threads > 1 ? "s" : ""), seconds,
+               u64(NumItems) * 2 * num_threads);
+    }
+}
+
+// Builds a BTree from NumItems sorted keys, either by inserting them one at a time or with build_from_sorted. Each
+// item is one op.
+BENCHMARK("BTree build from sorted keys") {
+    Array<u32> keys;
+    keys.resize(NumItems);
+    for (u32 i = 0; i < NumItems; i++) {
+        keys[i] = i * 3;
+    }
+    double seconds = measure([&] {
+        BTree<u32> btree;
+        for (u32 key : keys) {
+            btree.insert(key);
+        }
+    });
+    report("insert", seconds, NumItems);
+    for (float fill_factor : {0.5f, 0.75f, 1.f}) {
+        seconds = measure([&] {
+            BTree<u32> btree;
+            btree.build_from_sorted(keys, fill_factor);
+        });
+        report(String::format("build_from_sorted, fill factor {}", fill_factor), seconds, NumItems);
+    }
+}
+
+static constexpr u32 NumLookups = 2000000;
+
+// Looks up random keys in a BTree of NumItems random keys. Each lookup is one op.
+template <typename T, u32 MaxItemsPerNode>
+static void run_lookup_benchmark(StringView type_name) {
+    BTree<T, HeapNodeAllocator, MaxItemsPerNode> btree;
+    Random rand{1};
+    for (u32 i = 0; i < NumItems; i++) {
+        btree.insert(T(rand.generate_u32()));
+    }
+    Array<T> keys;
+    keys.resize(NumLookups);
+    for (T& key : keys) {
+        key = T(rand.generate_u32());
+    }
+    u32 checksum = 0;
+    double seconds = measure([&] {
+        for (const T& key : keys) {
+            checksum += u32(bool(btree.find_earliest(key, FindGreaterThanOrEqual)));
+        }
+    });
+    report(String::format("{}, {} items per node", type_name, MaxItemsPerNode), seconds, NumLookups);
+    PLY_UNUSED(checksum);
+}
+
+template <typename T>
+static void run_lookup_benchmarks(StringView type_name) {
+    run_lookup_benchmark<T, 8>(type_name);
+    run_lookup_benchmark<T, 16>(type_name);
+    run_lookup_benchmark<T, 32>(type_name);
+    run_lookup_benchmark<T, 64>(type_name);
+    run_lookup_benchmark<T, 128>(type_name);
+    run_lookup_benchmark<T, 256>(type_name);
+}
+
+BENCHMARK("BTree lookup with different fan-outs") {
+    run_lookup_benchmarks<u32>("u32");
+    run_lookup_benchmarks<u64>("u64");
+    run_lookup_benchmarks<float>("float");
+}
+
+// Searches a single sorted node of random keys, comparing search_btree_node to binary_search. Each search is one op.
+template <typename T>
+static void run_node_search_benchmark(StringView type_name) {
+    Random rand{1};
+    for (u32 num_keys : {8, 16, 32, 64, 128, 256}) {
+        Array<T> node;
+        node.resize(num_keys);
+        for (T& key : node) {
+            key = T(rand.generate_u32());
+        }
+        sort(node);
+        Array<T> keys;
+        keys.resize(4096);
+        for (T& key : keys) {
+            key = T(rand.generate_u32());
+        }
+        u32 checksum = 0;
+        double seconds = measure([&] {
+            for (u32 i = 0; i < NumLookups; i++) {
+                checksum += binary_search(ArrayView<T>{node}, keys[i & 4095], FindGreaterThanOrEqual);
+            }
+        });
+        report(String::format("{}, {} keys, binary_search", type_name, num_keys), seconds, NumLookups);
+        seconds = measure([&] {
+            for (u32 i = 0; i < NumLookups; i++) {
+                checksum += search_btree_node(ArrayView<T>{node}, keys[i & 4095], FindGreaterThanOrEqual);
+            }
+        });
+        report(String::format("{}, {} keys, search_btree_node", type_name, num_keys), seconds, NumLookups);
+        PLY_UNUSED(checksum);
+    }
+}
+
+BENCHMARK("BTree node search") {
+    run_node_search_benchmark<u32>("u32");
+    run_node_search_benchmark<u64>("u64");
+    run_node_search_benchmark<float>("float");
+    run_node_search_benchmark<double>("double");
+}
+
+// Inserts NumItems keys in increasing or decreasing order, so every insert lands at one end of the tree and updates
+// the max or min keys of its ancestors. Each insert is one op.
+template <u32 MaxItemsPerNode>
+static void run_boundary_insert_benchmark() {
+    double seconds = measure([] {
+        BTree<u32, HeapNodeAllocator, MaxItemsPerNode> btree;
+        for (u32 i = 0; i < NumItems; i++) {
+            btree.insert(i);
+        }
+    });
+    report(String::format("append, {} items per node", MaxItemsPerNode), seconds, NumItems);
+    seconds = measure([] {
+        BTree<u32, HeapNodeAllocator, MaxItemsPerNode> btree;
+        for (u32 i = NumItems; i > 0; i--) {
+            btree.insert(i);
+        }
+    });
+    report(String::format("prepend, {} items per node", MaxItemsPerNode), seconds, NumItems);
+}
+
+BENCHMARK("BTree append and prepend") {
+    run_boundary_insert_benchmark<16>();
+    run_boundary_insert_benchmark<64>();
+    run_boundary_insert_benchmark<256>();
+}
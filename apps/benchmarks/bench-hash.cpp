@@ -0,0 +1,207 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//  ▄▄  ▄▄               ▄▄     ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
+//  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██ ██  ██ ██  ██
+//  ██  ██ ▀█▄▄██  ▄▄▄█▀ ██  ██ ██ ██  ██ ▀█▄▄██
+//                                         ▄▄▄█▀
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Hashing_
+
+static constexpr u32 NumBytesToHash = 64 * 1024 * 1024;
+
+static String make_random_string(Random& rand, u32 num_bytes) {
+    String str = String::allocate(num_bytes);
+    for (u32 i = 0; i < num_bytes; i++) {
+        str[i] = char('a' + rand.generate_u32() % 26);
+    }
+    return str;
+}
+
+BENCHMARK("String hash") {
+    Random rand{1};
+    for (u32 num_bytes : {4, 8, 16, 32, 128, 1024, 16384}) {
+        String str = make_random_string(rand, num_bytes);
+        u32 num_ops = NumBytesToHash / num_bytes;
+        u32 checksum = 0;
+        double seconds = measure([&] {
+            for (u32 i = 0; i < num_ops; i++) {
+                checksum += calculate_hash(StringView{str});
+            }
+        });
+        report(String::format("{} bytes", num_bytes), seconds, num_ops);
+        PLY_UNUSED(checksum);
+    }
+}
+
+// Looks up every key in a map of 10000 strings, so the time includes hashing and one string comparison per lookup.
+BENCHMARK("Map<String> find") {
+    static constexpr u32 NumKeys = 10000;
+    static constexpr u32 NumLookups = 2000000;
+    Random rand{1};
+    for (u32 num_bytes : {8, 32, 128, 1024}) {
+        Array<String> keys;
+        Map<String, u32> map;
+        for (u32 i = 0; i < NumKeys; i++) {
+            keys.append(make_random_string(rand, num_bytes));
+            *map.insert(keys.back()).value = i;
+        }
+        u32 num_found = 0;
+        double seconds = measure([&] {
+            for (u32 i = 0; i < NumLookups; i++) {
+                num_found += (map.find(keys[i % NumKeys]) != nullptr);
+            }
+        });
+        report(String::format("{}-byte keys", num_bytes), seconds, NumLookups);
+        PLY_UNUSED(num_found);
+    }
+}
+
+// Half of the lookups miss. Misses probe until an empty slot, so they show the cost of collisions.
+BENCHMARK("Set<u64> find") {
+    static constexpr u32 NumLookups = 10000000;
+    Random rand{1};
+    for (u32 num_keys : {1000, 100000, 1000000}) {
+        Array<u64> keys;
+        Set<u64> set;
+        for (u32 i = 0; i < num_keys * 2; i++) {
+            keys.append(rand.generate_u64());
+            if (i % 2 == 0) {
+                set.insert(keys.back());
+            }
+        }
+        u32 num_found = 0;
+        double seconds = measure([&] {
+            for (u32 i = 0; i < NumLookups; i++) {
+                num_found += (set.find(keys[i % keys.num_items()]) != nullptr);
+            }
+        });
+        report(String::format("{} keys", num_keys), seconds, NumLookups);
+        PLY_UNUSED(num_found);
+    }
+}
+
+// The same as StringView, except that Map doesn't cache its hashes.
+struct UncachedStringKey {
+    StringView str;
+    bool operator==(const UncachedStringKey& other) const {
+        return this->str == other.str;
+    }
+};
+
+void add_to_hash(HashBuilder& builder, const UncachedStringKey& key) {
+    add_to_hash(builder, key.str);
+}
+
+namespace ply {
+template <>
+struct HashTraits<UncachedStringKey> {
+    static constexpr bool CacheHashes = false;
+};
+} // namespace ply
+
+template <typename Key>
+static void run_large_map_benchmark(ArrayView<const String> keys, StringView label) {
+    Map<Key, u32> map;
+    double seconds = measure([&] {
+        for (u32 i = 0; i < keys.num_items(); i++) {
+            *map.insert(Key{keys[i]}).value = i;
+        }
+    });
+    report(String::format("insert, {}", label), seconds, keys.num_items());
+    u32 num_found = 0;
+    seconds = measure([&] {
+        for (u32 i = 0; i < keys.num_items(); i++) {
+            // Look up keys in a different order than they were inserted.
+            num_found += (map.find(Key{keys[(i * 7919) % keys.num_items()]}) != nullptr);
+        }
+    });
+    report(String::format("find, {}", label), seconds, keys.num_items());
+    PLY_UNUSED(num_found);
+}
+
+// Growing the map rehashes every key unless the hashes are cached.
+BENCHMARK("Map<StringView> with 1M keys") {
+    static constexpr u32 NumKeys = 1000000;
+    Random rand{1};
+    for (u32 num_bytes : {16, 64}) {
+        Array<String> keys;
+        for (u32 i = 0; i < NumKeys; i++) {
+            keys.append(make_random_string(rand, num_bytes));
+        }
+        run_large_map_benchmark<UncachedStringKey>(keys, String::format("{}-byte keys, hashes not cached", num_bytes));
+        run_large_map_benchmark<StringView>(keys, String::format("{}-byte keys, hashes cached", num_bytes));
+    }
+}
+
+// A Map guarded by a ReadWriteLock, which is how shared lookup tables were built before ConcurrentMap.
+struct LockedMap {
+    ReadWriteLock lock;
+    Map<u32, u32> map;
+
+    bool find(u32 key) {
+        this->lock.lock_shared();
+        bool found = this->map.find(key) != nullptr;
+        this->lock.unlock_shared();
+        return found;
+    }
+    void insert(u32 key) {
+        this->lock.lock_exclusive();
+        *this->map.insert(key).value = key;
+        this->lock.unlock_exclusive();
+    }
+};
+
+struct StripedMap {
+    ConcurrentMap<u32, u32> map;
+
+    bool find(u32 key) {
+        return this->map.find(key) != nullptr;
+    }
+    void insert(u32 key) {
+        this->map.insert(key, [key](u32& value) { value = key; });
+    }
+};
+
+// Each thread looks up random keys, and one operation in ten inserts the key instead, so the maps keep growing.
+template <typename SharedMap>
+static void run_shared_map_benchmark(u32 num_threads, StringView name) {
+    static constexpr u32 NumOpsPerThread = 2000000;
+    static constexpr u32 NumKeys = 1 << 20;
+    SharedMap shared;
+    for (u32 i = 0; i < NumKeys; i += 2) {
+        shared.insert(i);
+    }
+    // The number of keys found is accumulated so that the compiler can't skip the lookups.
+    Atomic<u32> total_found = 0;
+    double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+        Random rand{thread_index + 1};
+        u32 num_found = 0;
+        for (u32 i = 0; i < NumOpsPerThread; i++) {
+            u32 key = rand.generate_u32() % NumKeys;
+            if (i % 10 == 0) {
+                shared.insert(key);
+            } else {
+                num_found += shared.find(key);
+            }
+        }
+        total_found.fetch_add_acq_rel(num_found);
+    });
+    report(String::format("{} thread{}, {}", num_threads, num_threads > 1 ? "s" : "", name), seconds,
+           u64(NumOpsPerThread) * num_threads);
+}
+
+BENCHMARK("Shared map find/insert on N threads") {
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        run_shared_map_benchmark<StripedMap>(num_threads, "ConcurrentMap");
+        run_shared_map_benchmark<LockedMap>(num_threads, "Map + ReadWriteLock");
+    }
+}
@@ -0,0 +1,79 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//  ▄▄  ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄
+//  ██▀▀██ ██▄▄██  ▄▄▄██ ██  ██
+//  ██  ██ ▀█▄▄▄  ▀█▄▄██ ██▄▄█▀
+//                       ██
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Heap_
+
+static constexpr u32 NumSlots = 1024;
+static constexpr u32 NumOpsPerThread = 2000000;
+
+struct HeapFuncs {
+    void* (*alloc)(uptr);
+    void (*free)(void*);
+};
+
+static const HeapFuncs PlywoodHeap = {Heap::alloc, Heap::free};
+static const HeapFuncs Dlmalloc = {dlmalloc, dlfree};
+
+// Each thread repeatedly frees a random slot and refills it with a block of random size.
+static void churn(const HeapFuncs& heap, u32 thread_index) {
+    Random rand{thread_index + 1};
+    void* slots[NumSlots] = {};
+    for (u32 i = 0; i < NumOpsPerThread; i++) {
+        u32 slot = rand.generate_u32() % NumSlots;
+        heap.free(slots[slot]);
+        slots[slot] = heap.alloc(rand.generate_u32() % 256 + 8);
+    }
+    for (void* ptr : slots) {
+        heap.free(ptr);
+    }
+}
+
+BENCHMARK("Heap alloc/free churn on N threads") {
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        for (const HeapFuncs* heap : {&Dlmalloc, &PlywoodHeap}) {
+            double seconds = run_on_threads(num_threads, [heap](u32 thread_index) { churn(*heap, thread_index); });
+            String label = String::format("{} thread{}, {}", num_threads, num_threads > 1 ? "s" : "",
+                                          heap == &Dlmalloc ? "dlmalloc" : "Heap");
+            report(label, seconds, u64(NumOpsPerThread) * num_threads);
+        }
+    }
+}
+
+// Blocks allocated by each thread are freed by its neighbor, which forces blocks to travel through the central heap.
+BENCHMARK("Heap producer/consumer on N threads") {
+    static constexpr u32 NumBlocksPerThread = 200000;
+    for (u32 num_threads : {2, 4, 8}) {
+        for (const HeapFuncs* heap : {&Dlmalloc, &PlywoodHeap}) {
+            Array<Array<void*>> blocks;
+            blocks.resize(num_threads);
+            double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+                Random rand{thread_index + 1};
+                Array<void*>& own = blocks[thread_index];
+                own.resize(NumBlocksPerThread);
+                for (u32 i = 0; i < NumBlocksPerThread; i++) {
+                    own[i] = heap->alloc(rand.generate_u32() % 256 + 8);
+                }
+            });
+            seconds += run_on_threads(num_threads, [&](u32 thread_index) {
+                for (void* ptr : blocks[(thread_index + 1) % num_threads]) {
+                    heap->free(ptr);
+                }
+            });
+            String label = String::format("{} threads, {}", num_threads, heap == &Dlmalloc ? "dlmalloc" : "Heap");
+            report(label, seconds, u64(NumBlocksPerThread) * num_threads * 2);
+        }
+    }
+}
@@ -0,0 +1,201 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//  ▄▄   ▄▄         ▄▄
+//  ███▄███ ▄▄  ▄▄ ▄██▄▄  ▄▄▄▄  ▄▄  ▄▄
+//  ██▀█▀██ ██  ██  ██   ██▄▄██  ▀██▀
+//  ██   ██ ▀█▄▄██  ▀█▄▄ ▀█▄▄▄  ▄█▀▀█▄
+//
+
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Mutex_
+
+static constexpr u32 NumLockOps = 2000000;
+
+#if defined(PLY_LINUX)
+
+// The pthread-backed locks that Mutex and ReadWriteLock used on Linux before they were futex-based.
+struct PthreadMutex {
+    pthread_mutex_t mutex;
+
+    PthreadMutex() {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    ~PthreadMutex() {
+        pthread_mutex_destroy(&mutex);
+    }
+    void lock() {
+        pthread_mutex_lock(&mutex);
+    }
+    void unlock() {
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+struct PthreadReadWriteLock {
+    pthread_rwlock_t rw_lock;
+
+    PthreadReadWriteLock() {
+        pthread_rwlock_init(&this->rw_lock, NULL);
+    }
+    ~PthreadReadWriteLock() {
+        pthread_rwlock_destroy(&this->rw_lock);
+    }
+    void lock_exclusive() {
+        pthread_rwlock_wrlock(&this->rw_lock);
+    }
+    void unlock_exclusive() {
+        pthread_rwlock_unlock(&this->rw_lock);
+    }
+    void lock_shared() {
+        pthread_rwlock_rdlock(&this->rw_lock);
+    }
+    void unlock_shared() {
+        pthread_rwlock_unlock(&this->rw_lock);
+    }
+};
+
+#endif
+
+// Every thread repeatedly increments a shared counter inside the lock, then does a little work outside
+// it. Each lock/unlock pair is one op.
+template <typename LockType>
+void run_mutex_benchmark(StringView name) {
+    for (u32 num_threads : {1, 2, 4, 8, 16, 32, 64}) {
+        LockType lock;
+        u64 counter = 0;
+        u32 ops_per_thread = NumLockOps / num_threads;
+        Atomic<u32> checksum = 0;
+        double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+            u32 x = thread_index;
+            for (u32 i = 0; i < ops_per_thread; i++) {
+                lock.lock();
+                counter++;
+                lock.unlock();
+                for (u32 j = 0; j < 20; j++) {
+                    x = x * 1664525u + 1013904223u;
+                }
+            }
+            checksum.fetch_add_acq_rel(x);
+        });
+        report(String::format("{}, {} threads", name, num_threads), seconds, ops_per_thread * num_threads);
+        PLY_ASSERT(counter == u64{ops_per_thread} * num_threads);
+    }
+}
+
+BENCHMARK("Mutex contention") {
+    run_mutex_benchmark<Mutex>("Mutex");
+#if defined(PLY_LINUX)
+    run_mutex_benchmark<PthreadMutex>("pthread_mutex");
+#endif
+}
+
+//  ▄▄▄▄▄                    ▄▄ ▄▄    ▄▄        ▄▄  ▄▄          ▄▄                 ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄   ▄▄▄██ ██ ▄▄ ██ ▄▄▄▄▄  ▄▄ ▄██▄▄  ▄▄▄▄  ██     ▄▄▄▄   ▄▄▄▄ ██  ▄▄
+//  ██▀▀█▄ ██▄▄██  ▄▄▄██ ██  ██ ▀█▄██▄█▀ ██  ▀▀ ██  ██   ██▄▄██ ██    ██  ██ ██    ██▄█▀
+//  ██  ██ ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██▀▀██  ██     ██  ▀█▄▄ ▀█▄▄▄  ██▄▄▄ ▀█▄▄█▀ ▀█▄▄▄ ██ ▀█▄
+//
+
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX ReadWriteLock_
+
+// Like the Mutex benchmark, but 9 out of 10 ops only read the counter while holding a shared lock.
+template <typename LockType>
+void run_read_write_lock_benchmark(StringView name) {
+    for (u32 num_threads : {1, 2, 4, 8, 16, 32, 64}) {
+        LockType lock;
+        u64 counter = 0;
+        u32 ops_per_thread = NumLockOps / num_threads;
+        Atomic<u32> checksum = 0;
+        double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+            u32 x = thread_index;
+            for (u32 i = 0; i < ops_per_thread; i++) {
+                if (i % 10 == 0) {
+                    lock.lock_exclusive();
+                    counter++;
+                    lock.unlock_exclusive();
+                } else {
+                    lock.lock_shared();
+                    x += (u32) counter;
+                    lock.unlock_shared();
+                }
+                for (u32 j = 0; j < 20; j++) {
+                    x = x * 1664525u + 1013904223u;
+                }
+            }
+            checksum.fetch_add_acq_rel(x);
+        });
+        report(String::format("{}, {} threads", name, num_threads), seconds, ops_per_thread * num_threads);
+    }
+}
+
+BENCHMARK("ReadWriteLock contention") {
+    run_read_write_lock_benchmark<ReadWriteLock>("ReadWriteLock");
+#if defined(PLY_LINUX)
+    run_read_write_lock_benchmark<PthreadReadWriteLock>("pthread_rwlock");
+#endif
+}
+
+//  ▄▄▄▄▄                     ▄▄
+//  ██    ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄ ██▄▄▄
+//  ██▀▀  ██  ██ ██  ██ ██    ██  ██
+//  ██▄▄▄ ██▄▄█▀ ▀█▄▄█▀ ▀█▄▄▄ ██  ██
+//        ██
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Epoch_
+
+// Readers load a shared node while protected by either a shared lock or an Epoch::Guard. One read in 1000 replaces the
+// node, under an exclusive lock or through Epoch::retire. Each read or replacement is one op.
+BENCHMARK("Epoch read-mostly") {
+    struct Node {
+        u32 value;
+    };
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        u32 ops_per_thread = NumLockOps / num_threads;
+        for (bool use_epoch : {false, true}) {
+            ReadWriteLock lock;
+            Atomic<Node*> shared = Heap::create<Node>(Node{0});
+            Atomic<u32> checksum = 0;
+            double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+                u32 sum = 0;
+                for (u32 i = 0; i < ops_per_thread; i++) {
+                    if (i % 1000 == 999) {
+                        Node* node = Heap::create<Node>(Node{i});
+                        if (use_epoch) {
+                            Epoch::retire(shared.exchange_acq_rel(node));
+                        } else {
+                            lock.lock_exclusive();
+                            Heap::destroy(shared.exchange_acq_rel(node));
+                            lock.unlock_exclusive();
+                        }
+                    } else if (use_epoch) {
+                        Epoch::Guard guard;
+                        sum += shared.load_acquire()->value;
+                    } else {
+                        lock.lock_shared();
+                        sum += shared.load_acquire()->value;
+                        lock.unlock_shared();
+                    }
+                }
+                checksum.fetch_add_acq_rel(sum);
+            });
+            Epoch::flush();
+            Heap::destroy(shared.load_relaxed());
+            report(String::format("{}, {} threads", use_epoch ? "Epoch::Guard" : "ReadWriteLock", num_threads), seconds,
+                   ops_per_thread * num_threads);
+        }
+    }
+}
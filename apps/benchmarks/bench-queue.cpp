@@ -0,0 +1,142 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//   ▄▄▄▄
+//  ██  ██ ▄▄  ▄▄  ▄▄▄▄  ▄▄  ▄▄  ▄▄▄▄   ▄▄▄▄
+//  ██  ██ ██  ██ ██▄▄██ ██  ██ ██▄▄██ ▀█▄▄▄
+//  ▀█▄▄█▀ ▀█▄▄██ ▀█▄▄▄  ▀█▄▄██ ▀█▄▄▄   ▄▄▄█▀
+//     ▀█▄
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Queue_
+
+static constexpr u32 NumQueueItems = 2000000;
+static constexpr u32 QueueCapacity = 1024;
+
+// The Mutex + ConditionVariable ring buffer that SPSCQueue and MPMCQueue replace.
+template <typename T>
+class LockedQueue {
+private:
+    Mutex mutex;
+    ConditionVariable cond_var;
+    Array<T> items;
+    u32 head = 0;
+    u32 num_items = 0;
+
+public:
+    explicit LockedQueue(u32 capacity) {
+        this->items.resize(capacity);
+    }
+    void push(const T& item) {
+        LockGuard<Mutex> guard{this->mutex};
+        while (this->num_items == this->items.num_items()) {
+            this->cond_var.wait(guard);
+        }
+        this->items[(this->head + this->num_items) % this->items.num_items()] = item;
+        this->num_items++;
+        this->cond_var.wake_all();
+    }
+    void pop(T& item) {
+        LockGuard<Mutex> guard{this->mutex};
+        while (this->num_items == 0) {
+            this->cond_var.wait(guard);
+        }
+        item = this->items[this->head];
+        this->head = (this->head + 1) % this->items.num_items();
+        this->num_items--;
+        this->cond_var.wake_all();
+    }
+    void push_batch(ArrayView<T> items) {
+        LockGuard<Mutex> guard{this->mutex};
+        for (const T& item : items) {
+            while (this->num_items == this->items.num_items()) {
+                this->cond_var.wake_all();
+                this->cond_var.wait(guard);
+            }
+            this->items[(this->head + this->num_items) % this->items.num_items()] = item;
+            this->num_items++;
+        }
+        this->cond_var.wake_all();
+    }
+    u32 pop_batch(ArrayView<T> out) {
+        LockGuard<Mutex> guard{this->mutex};
+        while (this->num_items == 0) {
+            this->cond_var.wait(guard);
+        }
+        u32 num_popped = min(this->num_items, out.num_items());
+        for (u32 i = 0; i < num_popped; i++) {
+            out[i] = this->items[this->head];
+            this->head = (this->head + 1) % this->items.num_items();
+        }
+        this->num_items -= num_popped;
+        this->cond_var.wake_all();
+        return num_popped;
+    }
+};
+
+// Half the threads push NumQueueItems items in total, and the other half pop them. When batch_size is greater than 1,
+// items are pushed and popped in batches. Each item is one op.
+template <typename QueueType>
+void run_queue_benchmark(StringView name, u32 num_threads, u32 batch_size) {
+    QueueType queue{QueueCapacity};
+    u32 num_pairs = num_threads / 2;
+    u32 items_per_thread = NumQueueItems / num_pairs;
+    Atomic<u32> checksum = 0;
+    double seconds = run_on_threads(num_threads, [&](u32 thread_index) {
+        u32 batch[64];
+        u32 sum = 0;
+        if (thread_index < num_pairs) {
+            for (u32 i = 0; i < items_per_thread; i += batch_size) {
+                for (u32 j = 0; j < batch_size; j++) {
+                    batch[j] = i + j;
+                }
+                if (batch_size == 1) {
+                    queue.push(batch[0]);
+                } else {
+                    queue.push_batch({batch, batch_size});
+                }
+            }
+        } else {
+            for (u32 i = 0; i < items_per_thread;) {
+                u32 num_items = 1;
+                if (batch_size == 1) {
+                    queue.pop(batch[0]);
+                } else {
+                    num_items = queue.pop_batch({batch, min(batch_size, items_per_thread - i)});
+                }
+                for (u32 j = 0; j < num_items; j++) {
+                    sum += batch[j];
+                }
+                i += num_items;
+            }
+        }
+        checksum.fetch_add_acq_rel(sum);
+    });
+    String label = String::format("{}, {} threads", name, num_threads);
+    if (batch_size > 1) {
+        label = String::format("{}, batches of {}", label, batch_size);
+    }
+    report(label, seconds, items_per_thread * num_pairs);
+}
+
+BENCHMARK("SPSC queue") {
+    for (u32 batch_size : {1, 16}) {
+        run_queue_benchmark<LockedQueue<u32>>("Mutex + ConditionVariable", 2, batch_size);
+        run_queue_benchmark<SPSCQueue<u32>>("SPSCQueue", 2, batch_size);
+    }
+}
+
+BENCHMARK("MPMC queue") {
+    for (u32 num_threads : {2, 4, 8}) {
+        for (u32 batch_size : {1, 16}) {
+            run_queue_benchmark<LockedQueue<u32>>("Mutex + ConditionVariable", num_threads, batch_size);
+            run_queue_benchmark<MPMCQueue<u32>>("MPMCQueue", num_threads, batch_size);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//   ▄▄▄▄                 ▄▄   ▄▄
+//  ██  ▀▀  ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
+//   ▀▀▀█▄ ██  ██ ██  ▀▀  ██   ██ ██  ██ ██  ██
+//  ▀█▄▄█▀ ▀█▄▄█▀ ██      ▀█▄▄ ██ ██  ██ ▀█▄▄██
+//                                        ▄▄▄█▀
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX Sorting_
+
+static constexpr u32 NumItemsToSort = 1000000;
+
+static Array<u32> make_sort_input(StringView pattern) {
+    Random rand{1};
+    Array<u32> arr;
+    arr.resize(NumItemsToSort);
+    for (u32 i = 0; i < NumItemsToSort; i++) {
+        if (pattern == "random") {
+            arr[i] = rand.generate_u32();
+        } else if (pattern == "sorted") {
+            arr[i] = i;
+        } else if (pattern == "reversed") {
+            arr[i] = NumItemsToSort - i;
+        } else {
+            arr[i] = rand.generate_u32() % 16; // Many duplicates
+        }
+    }
+    return arr;
+}
+
+// Sorts a fresh copy of each input pattern. Each item sorted is one op.
+static void run_sort_benchmark(const Functor<void(ArrayView<u32>)>& sort_func) {
+    for (StringView pattern : {"random", "sorted", "reversed", "duplicates"}) {
+        Array<u32> arr = make_sort_input(pattern);
+        double seconds = measure([&] { sort_func(arr); });
+        for (u32 i = 1; i < arr.num_items(); i++) {
+            PLY_ASSERT(arr[i - 1] <= arr[i]);
+        }
+        report(String::format("{} u32s, {}", NumItemsToSort, pattern), seconds, NumItemsToSort);
+    }
+}
+
+BENCHMARK("sort") {
+    run_sort_benchmark([](ArrayView<u32> view) { sort(view); });
+}
+
+BENCHMARK("stable_sort") {
+    run_sort_benchmark([](ArrayView<u32> view) { stable_sort(view); });
+}
+
+BENCHMARK("radix_sort") {
+    run_sort_benchmark([](ArrayView<u32> view) { radix_sort(view); });
+}
+
+BENCHMARK("parallel_sort") {
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        ThreadPool pool{num_threads - 1};
+        Array<u32> arr = make_sort_input("random");
+        double seconds = measure([&] { parallel_sort(arr, default_less<u32>, pool); });
+        report(String::format("{} u32s, random, {} threads", NumItemsToSort, num_threads), seconds, NumItemsToSort);
+    }
+}
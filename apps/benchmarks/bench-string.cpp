@@ -0,0 +1,80 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//   ▄▄▄▄   ▄▄          ▄▄               ▄▄   ▄▄ ▄▄
+//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
+//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
+//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██   ▀█▀   ██ ▀█▄▄▄   ██▀▀██
+//                                 ▄▄▄█▀
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX StringView_
+
+static constexpr u32 NumBytesToScan = 64 * 1024 * 1024;
+
+static StringView get_simd_name(StringSIMD simd) {
+    switch (simd) {
+        case StringSIMD::SSE2:
+            return "SSE2";
+        case StringSIMD::AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+// Calls func on strings of increasing length with each available SIMD level. Each call is one op.
+static void run_string_benchmark(const Functor<u32(StringView str)>& func, const Functor<String(u32)>& make_string) {
+    StringSIMD original = get_string_simd();
+    for (u32 num_bytes : {8, 32, 128, 1024, 16384}) {
+        String str = make_string(num_bytes);
+        u32 num_ops = NumBytesToScan / num_bytes;
+        for (StringSIMD simd : {StringSIMD::None, StringSIMD::SSE2, StringSIMD::AVX2}) {
+            if (!set_string_simd(simd))
+                continue;
+            u32 checksum = 0;
+            double seconds = measure([&] {
+                for (u32 i = 0; i < num_ops; i++) {
+                    checksum += func(str);
+                }
+            });
+            report(String::format("{} bytes, {}", num_bytes, get_simd_name(simd)), seconds, num_ops);
+            PLY_UNUSED(checksum);
+        }
+    }
+    set_string_simd(original);
+}
+
+BENCHMARK("StringView find byte") {
+    run_string_benchmark([](StringView str) { return (u32) str.find('"'); },
+                         [](u32 num_bytes) {
+                             String str = StringView{"a"} * num_bytes;
+                             str.back() = '"';
+                             return str;
+                         });
+}
+
+BENCHMARK("StringView find substring") {
+    run_string_benchmark([](StringView str) { return (u32) str.find("\r\n\r\n"); },
+                         [](u32 num_bytes) {
+                             String str = StringView{"a\r\n"} * (num_bytes / 3 + 1);
+                             str.resize(num_bytes);
+                             memcpy(str.end() - 4, "\r\n\r\n", 4);
+                             return str;
+                         });
+}
+
+BENCHMARK("StringView trim") {
+    run_string_benchmark([](StringView str) { return str.trim().num_bytes(); },
+                         [](u32 num_bytes) {
+                             String str = StringView{" "} * num_bytes;
+                             str[num_bytes / 2] = 'x';
+                             return str;
+                         });
+}
@@ -0,0 +1,90 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+struct Benchmark {
+    StringView name;
+    void (*func)();
+};
+
+Array<Benchmark>& get_benchmarks() {
+    static Array<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+RegisterBenchmark::RegisterBenchmark(StringView name, void (*func)()) {
+    get_benchmarks().append({name, func});
+}
+
+double run_on_threads(u32 num_threads, const Functor<void(u32 thread_index)>& func) {
+    Mutex mutex;
+    ConditionVariable start_cond;
+    bool started = false;
+    Atomic<u32> num_ready = 0;
+    Array<Owned<Thread>> threads;
+    for (u32 i = 0; i < num_threads; i++) {
+        threads.append(Heap::create<Thread>([&, i] {
+            {
+                LockGuard<Mutex> guard{mutex};
+                num_ready.fetch_add_acq_rel(1);
+                while (!started) {
+                    start_cond.wait(guard);
+                }
+            }
+            func(i);
+        }));
+    }
+    while (num_ready.load_acquire() < num_threads) {
+        sleep_millis(1);
+    }
+    u64 start = get_cpu_ticks();
+    {
+        LockGuard<Mutex> guard{mutex};
+        started = true;
+        start_cond.wake_all();
+    }
+    for (Owned<Thread>& thread : threads) {
+        thread->join();
+    }
+    return (get_cpu_ticks() - start) / (double) get_cpu_ticks_per_second();
+}
+
+double measure(const Functor<void()>& func) {
+    u64 start = get_cpu_ticks();
+    func();
+    return (get_cpu_ticks() - start) / (double) get_cpu_ticks_per_second();
+}
+
+// Prints a non-negative value with two decimal places.
+void print_fixed(Stream& out, double value) {
+    u64 hundredths = u64(value * 100 + 0.5);
+    out.format("{}.{}{}", hundredths / 100, (hundredths / 10) % 10, hundredths % 10);
+}
+
+void report(StringView label, double seconds, u64 num_ops) {
+    Stream out = get_stdout();
+    out.format("    {}: ", label);
+    print_fixed(out, seconds * 1e3);
+    out.write(" ms, ");
+    print_fixed(out, seconds * 1e9 / max<u64>(num_ops, 1));
+    out.write(" ns/op\n");
+}
+
+int main(int argc, const char* argv[]) {
+    // Pass a substring on the command line to run a subset of the benchmarks.
+    StringView filter = (argc > 1) ? StringView{argv[1]} : StringView{};
+    Stream out = get_stdout();
+    for (const Benchmark& benchmark : get_benchmarks()) {
+        if (!filter.is_empty() && benchmark.name.find(filter) < 0)
+            continue;
+        out.format("{}\n", benchmark.name);
+        out.flush();
+        benchmark.func();
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include <ply-base.h>
+
+using namespace ply;
+
+struct RegisterBenchmark {
+    RegisterBenchmark(StringView name, void (*func)());
+};
+
+#define BENCHMARK(name) \
+    void PLY_CAT(PLY_CAT(bench_, BENCHMARK_PREFIX), __LINE__)(); \
+    RegisterBenchmark PLY_CAT(PLY_CAT(autoReg_, BENCHMARK_PREFIX), __LINE__){ \
+        name, PLY_CAT(PLY_CAT(bench_, BENCHMARK_PREFIX), __LINE__)}; \
+    void PLY_CAT(PLY_CAT(bench_, BENCHMARK_PREFIX), __LINE__)()
+
+// Runs func on num_threads threads at the same time and returns the elapsed time in seconds, measured from the moment
+// all threads are released until the last one finishes.
+double run_on_threads(u32 num_threads, const Functor<void(u32 thread_index)>& func);
+
+// Returns the number of seconds func takes to run once on the calling thread.
+double measure(const Functor<void()>& func);
+
+// Prints one line of results.
+void report(StringView label, double seconds, u64 num_ops);
@@ -0,0 +1,80 @@
+/*========================================================
+       ____
+      ╱   ╱╲    Plywood C++ Base Library
+     ╱___╱╭╮╲   https://plywood.dev/
+      └──┴┴┴┘
+========================================================*/
+
+#include "bench-suite.h"
+
+//  ▄▄▄▄▄▄ ▄▄                              ▄▄  ▄▄▄▄▄                ▄▄
+//    ██   ██▄▄▄  ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄   ▄▄▄██  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//    ██   ██  ██ ██  ▀▀ ██▄▄██  ▄▄▄██ ██  ██  ██▀▀▀  ██  ██ ██  ██ ██
+//    ██   ██  ██ ██     ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+#undef BENCHMARK_PREFIX
+#define BENCHMARK_PREFIX ThreadPool_
+
+static void report_stats(const ThreadPool& pool) {
+    ThreadPool::Stats stats = pool.get_stats();
+    get_stdout().format("        {} jobs run, {} steals, {} failed steals, {} sleeps, max queue depth {}\n",
+                        stats.num_jobs_run, stats.num_steals, stats.num_failed_steals, stats.num_sleeps,
+                        stats.max_queue_depth);
+}
+
+// Compares starting a thread per unit of work with running each unit as a job. Each unit is one op.
+BENCHMARK("Empty jobs vs. spawn_thread") {
+    static constexpr u32 NumThreadsToSpawn = 2000;
+    static constexpr u32 NumJobs = 200000;
+    Atomic<u32> num_run = 0;
+    double seconds = measure([&] {
+        for (u32 i = 0; i < NumThreadsToSpawn; i++) {
+            spawn_thread([&] { num_run.fetch_add_acq_rel(1); }).join();
+        }
+    });
+    report("spawn_thread and join", seconds, NumThreadsToSpawn);
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        ThreadPool pool{num_threads - 1};
+        seconds = measure([&] {
+            JobCounter counter;
+            for (u32 i = 0; i < NumJobs; i++) {
+                pool.spawn(counter, [&] { num_run.fetch_add_acq_rel(1); });
+            }
+            pool.wait(counter);
+        });
+        report(String::format("spawn and wait, {} threads", num_threads), seconds, NumJobs);
+        report_stats(pool);
+    }
+}
+
+static u64 fork_join_sum(ThreadPool& pool, u64 lo, u64 hi) {
+    if (hi - lo <= 4096) {
+        u64 sum = 0;
+        for (u64 i = lo; i < hi; i++) {
+            sum += i * i;
+        }
+        return sum;
+    }
+    u64 mid = (lo + hi) / 2;
+    u64 left = 0;
+    JobCounter counter;
+    pool.spawn(counter, [&] { left = fork_join_sum(pool, lo, mid); });
+    u64 right = fork_join_sum(pool, mid, hi);
+    pool.wait(counter);
+    return left + right;
+}
+
+// Recursively splits a range in half, spawning a job for one half and running the other. Each item in the
+// range is one op.
+BENCHMARK("Fork/join sum") {
+    static constexpr u32 NumItems = 64 * 1024 * 1024;
+    for (u32 num_threads : {1, 2, 4, 8}) {
+        ThreadPool pool{num_threads - 1};
+        u64 sum = 0;
+        double seconds = measure([&] { sum = fork_join_sum(pool, 0, NumItems); });
+        report(String::format("{} threads", num_threads), seconds, NumItems);
+        report_stats(pool);
+        PLY_UNUSED(sum);
+    }
+}
@@ -378,28 +378,38 @@ void generate_whole_site() {
     Filesystem::make_dirs(join_path(out_folder, "content"));
     Filesystem::make_dirs(join_path(out_folder, "static"));
 
-    // Copy front page to content/index.html.
-    String front_page = Filesystem::load_text(join_path(source_folder, "index.html"));
-    front_page = front_page.replace("/static/style.css", String::format("/static/style.css?key={}", publish_key));
-    Filesystem::save_text(join_path(out_folder, "content/index.html"), front_page, server_text_format);
+    // Copying the front page, static files and docs template doesn't depend on contents.json, so it runs on the
+    // thread pool while contents.json is parsed.
+    Array<Future<void>> tasks;
+    tasks.append(start_task([] {
+        // Copy front page to content/index.html.
+        String front_page = Filesystem::load_text(join_path(source_folder, "index.html"));
+        front_page = front_page.replace("/static/style.css", String::format("/static/style.css?key={}", publish_key));
+        Filesystem::save_text(join_path(out_folder, "content/index.html"), front_page, server_text_format);
+    }));
 
     // Copy static files to static/.
     for (const DirectoryEntry& entry : Filesystem::list_dir(join_path(source_folder, "static"))) {
         if (entry.is_file()) {
-            String src_path = join_path(source_folder, "static", entry.name);
-            String dst_path = join_path(out_folder, "static", entry.name);
-            if (entry.name.ends_with(".css") || entry.name.ends_with(".js") || entry.name.ends_with(".html")) {
-                String text = Filesystem::load_text_autodetect(src_path);
-                Filesystem::save_text(dst_path, text, server_text_format);
-            } else {
-                Filesystem::copy_file(src_path, dst_path);
-            }
+            String name = entry.name;
+            tasks.append(start_task([name] {
+                String src_path = join_path(source_folder, "static", name);
+                String dst_path = join_path(out_folder, "static", name);
+                if (name.ends_with(".css") || name.ends_with(".js") || name.ends_with(".html")) {
+                    String text = Filesystem::load_text_autodetect(src_path);
+                    Filesystem::save_text(dst_path, text, server_text_format);
+                } else {
+                    Filesystem::copy_file(src_path, dst_path);
+                }
+            }));
         }
     }
 
     // Copy docs template to content/.
-    String template_text = Filesystem::load_text_autodetect(join_path(source_folder, "docs-template.html"));
-    Filesystem::save_text(join_path(out_folder, "content/docs-template.html"), template_text, server_text_format);
+    tasks.append(start_task([] {
+        String template_text = Filesystem::load_text_autodetect(join_path(source_folder, "docs-template.html"));
+        Filesystem::save_text(join_path(out_folder, "content/docs-template.html"), template_text, server_text_format);
+    }));
 
     // Parse contents.json and generate table of contents HTML.
     contents = parse_json(join_path(docs_folder, "contents.json"));
@@ -408,14 +418,17 @@ void generate_whole_site() {
     Filesystem::make_dirs(join_path(out_folder, "content/docs"));
     Filesystem::save_text(join_path(out_folder, "content/toc.html"), toc_stream.move_to_string(), server_text_format);
 
-    // Traverse contents.json and generate pages in content/docs/.
+    // Traverse contents.json and generate pages in content/docs/. Each page is converted in its own task.
     Array<const json::Node*> pages;
     flatten_pages(pages, contents);
     for (u32 i = 0; i < pages.num_items(); i++) {
-        const json::Node* prev_page = (i > 0) ? pages[i - 1] : nullptr;
-        const json::Node* next_page = (i + 1 < pages.num_items()) ? pages[i + 1] : nullptr;
-        convert_page(*pages[i], prev_page, next_page);
+        tasks.append(start_task([&pages, i] {
+            const json::Node* prev_page = (i > 0) ? pages[i - 1] : nullptr;
+            const json::Node* next_page = (i + 1 < pages.num_items()) ? pages[i + 1] : nullptr;
+            convert_page(*pages[i], prev_page, next_page);
+        }));
     }
+    when_all(tasks).wait();
 }
 
 int main(int argc, const char* argv[]) {
@@ -19,10 +19,10 @@ int main(int argc, const char* argv[]) {
     String src = Filesystem::load_text_autodetect(path);
     json::Parser::Result result = json::Parser{}.parse(path, src);
 
-    for (const json::Node* test_case : result.root->array_) {
-        String converted = markdown::convert_to_html(test_case->get("markdown")->text());
+    for (const json::Node& test_case : result.root.array_view()) {
+        String converted = markdown::convert_to_html(test_case.get("markdown").text());
         get_stdout().write("---------------------\n");
         get_stdout().write(converted);
-        get_stdout().write(test_case->get("html")->text());
+        get_stdout().write(test_case.get("html").text());
     }
 }
@@ -18,10 +18,13 @@ String docs_folder = join_path(PLYWOOD_ROOT_DIR, "docs/build");
 struct Request {
     IPAddress client_addr;
     u16 client_port = 0;
-    String method;
-    String uri;
-    String http_version;
-    Map<String, String> headers;
+    StringView method;
+    StringView uri;
+    StringView http_version;
+    Map<StringView, StringView> headers;
+    // Scratch memory owned by the connection's fiber. Reset after each response. The request strings above are
+    // stored here too.
+    Arena* arena = nullptr;
 };
 
 class Response;
@@ -30,7 +33,8 @@ using RequestHandler = Functor<void(const Request& request, Response& response)>
 class Response {
 private:
     Stream* out = nullptr;
-    friend void handle_http_request(TCPConnection* tcp_conn, const RequestHandler& req_handler);
+    friend void handle_http_request(TCPConnection* tcp_conn, Arena& arena, u64 hash_seed,
+                                    const RequestHandler& req_handler);
 
 public:
     enum Code {
@@ -53,6 +57,18 @@ void send_generic_response(Response& response, Response::Code response_code);
 // serve_plywood_docs
 //-------------------------------------
 
+// Page templates are loaded on first use and shared by every server thread. Restart the server to pick up
+// changes to them.
+ConcurrentMap<String, String> template_cache;
+
+StringView load_template(StringView name) {
+    if (const String* text = template_cache.find(name))
+        return *text;
+    auto result = template_cache.insert(
+        name, [&](String& text) { text = Filesystem::load_text(join_path(docs_folder, "content", name)); });
+    return *result.value;
+}
+
 void serve_plywood_docs(const Request& request, Response& response) {
     String url_path = request.uri;
     s32 query_pos = url_path.find('?');
@@ -104,9 +120,7 @@ void serve_plywood_docs(const Request& request, Response& response) {
         if (parts[0].is_empty()) {
             *response.headers.insert("Content-type").value = "text/html";
             Stream* out = response.begin(Response::OK);
-            String templ = Filesystem::load_text(join_path(docs_folder, "content/index.html"));
-            String toc = Filesystem::load_text(join_path(docs_folder, "content/toc.html"));
-            String full_html = templ.replace("{%toc%}", toc);
+            String full_html = load_template("index.html").replace("{%toc%}", load_template("toc.html"));
             out->write(full_html);
             return;
         }
@@ -143,8 +157,6 @@ void serve_plywood_docs(const Request& request, Response& response) {
                 out->write(Filesystem::load_text(local_path));
             } else {
                 // Assemble full page from template + TOC + AJAX content
-                String templ = Filesystem::load_text(join_path(docs_folder, "content/docs-template.html"));
-                String toc = Filesystem::load_text(join_path(docs_folder, "content/toc.html"));
                 String ajax_content = Filesystem::load_text(local_path);
 
                 // Parse title from first line of AJAX content
@@ -153,8 +165,8 @@ void serve_plywood_docs(const Request& request, Response& response) {
                 String content = ajax_content.substr(newline_pos + 1);
 
                 // Replace placeholders
-                String full_html = templ.replace("{%title%}", title);
-                full_html = full_html.replace("{%toc%}", toc);
+                String full_html = load_template("docs-template.html").replace("{%title%}", title);
+                full_html = full_html.replace("{%toc%}", load_template("toc.html"));
                 full_html = full_html.replace("{%content%}", content);
                 out->write(full_html);
             }
@@ -241,14 +253,18 @@ void send_generic_response(Response& response, Response::Code response_code) {
                 response_code, message, response_code, message);
 }
 
-void handle_http_request(TCPConnection* tcp_conn, const RequestHandler& req_handler) {
+void handle_http_request(TCPConnection* tcp_conn, Arena& arena, u64 hash_seed, const RequestHandler& req_handler) {
     Stream in = tcp_conn->create_in_stream();
     Stream out = tcp_conn->create_out_stream();
+    PLY_ON_SCOPE_EXIT({ arena.reset(); });
 
     // Create request and response objects
     Request request;
     request.client_addr = tcp_conn->remote_address();
     request.client_port = tcp_conn->remote_port();
+    request.arena = &arena;
+    // Header names come from the client, so don't let it choose colliding keys.
+    request.headers.set_hash_seed(hash_seed);
     Response response;
     response.out = &out;
 
@@ -260,9 +276,9 @@ void handle_http_request(TCPConnection* tcp_conn, const RequestHandler& req_hand
         send_generic_response(response, Response::BadRequest);
         return;
     }
-    request.method = tokens[0];
-    request.uri = tokens[1];
-    request.http_version = tokens[2];
+    request.method = arena.copy(tokens[0]);
+    request.uri = arena.copy(tokens[1]);
+    request.http_version = arena.copy(tokens[2]);
 
     // Parse HTTP headers
     for (;;) {
@@ -277,7 +293,8 @@ void handle_http_request(TCPConnection* tcp_conn, const RequestHandler& req_hand
             send_generic_response(response, Response::BadRequest);
             return;
         }
-        *request.headers.insert(line.left(colon_pos).trim()).value = line.substr(colon_pos + 1).trim();
+        *request.headers.insert(arena.copy(line.left(colon_pos).trim())).value =
+            arena.copy(line.substr(colon_pos + 1).trim());
     }
 
     // Invoke request handler
@@ -285,18 +302,52 @@ void handle_http_request(TCPConnection* tcp_conn, const RequestHandler& req_hand
 }
 
 void run_http_server(u16 port, const RequestHandler& req_handler) {
-    TCPListener listener = Network::bind_tcp(port);
+    // Where it's supported, each server thread accepts connections from its own listener on the same port, so that a
+    // new connection only wakes one thread. Otherwise, the threads share one listener.
+    bool reuse_port = true;
+    TCPListener listener = Network::bind_tcp(port, true);
+    if (!listener.is_valid()) {
+        reuse_port = false;
+        listener = Network::bind_tcp(port);
+    }
     if (!listener.is_valid()) {
         get_stderr().format("Error: Can't bind to port {}\n", port);
         return;
     }
 
-    for (;;) {
-        Owned<TCPConnection> tcp_conn = listener.accept();
-        if (!tcp_conn)
-            break;
-        spawn_thread(
-            [tcp_conn = std::move(tcp_conn), &req_handler] { handle_http_request(tcp_conn.get(), req_handler); });
+    // Each server thread runs an EventLoop that accepts connections and handles each one in its own fiber. A fiber
+    // that's waiting for a slow client suspends itself, so a few threads can serve many idle connections.
+    auto serve = [&](TCPListener& thread_listener) {
+        EventLoop loop;
+        // Read one seed per thread from the OS entropy source rather than making a system call for every request.
+        u64 hash_seed = generate_hash_seed();
+        loop.spawn([&] {
+            for (;;) {
+                Owned<TCPConnection> tcp_conn = thread_listener.accept();
+                if (!tcp_conn)
+                    break;
+                loop.spawn([tcp_conn = std::move(tcp_conn), hash_seed, &req_handler] {
+                    Arena arena;
+                    handle_http_request(tcp_conn.get(), arena, hash_seed, req_handler);
+                });
+            }
+        });
+        loop.run();
+    };
+    Array<Thread> threads;
+    threads.resize(get_num_cpu_cores() - 1);
+    for (Thread& thread : threads) {
+        thread.run([&] {
+            TCPListener own_listener;
+            if (reuse_port) {
+                own_listener = Network::bind_tcp(port, true);
+            }
+            serve(own_listener.is_valid() ? own_listener : listener);
+        });
+    }
+    serve(listener);
+    for (Thread& thread : threads) {
+        thread.join();
     }
 }
 
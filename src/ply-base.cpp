@@ -10,6 +10,7 @@
 #if defined(PLY_WINDOWS)
 #include <shellapi.h>
 #include <Psapi.h>
+#include <ntsecapi.h>
 #elif defined(PLY_POSIX)
 #include <string>
 #include <fstream>
@@ -32,7 +33,13 @@
 #if PLY_WITH_DIRECTORY_WATCHER
 #include <CoreServices/CoreServices.h>
 #endif
+#elif defined(PLY_LINUX)
+#include <sys/syscall.h>
+#endif
 #endif
+
+#if PLY_CPU_X64
+#include <immintrin.h>
 #endif
 
 namespace ply {
@@ -83,6 +90,26 @@ s64 get_unix_timestamp() {
 #endif
 }
 
+#if defined(PLY_APPLE)
+
+float get_cpu_ticks_per_second() {
+    static float ticks_per_second = []() {
+        mach_timebase_info_data_t info;
+        mach_timebase_info(&info);
+        return 1e9f * info.denom / info.numer;
+    }();
+    return ticks_per_second;
+}
+
+#else
+
+float get_cpu_ticks_per_second() {
+    // get_cpu_ticks() uses CLOCK_MONOTONIC, which is measured in nanoseconds.
+    return 1e9f;
+}
+
+#endif
+
 #endif
 
 // Based on http://howardhinnant.github.io/date_algorithms.html
@@ -356,6 +383,271 @@ void* thread_entry(void* arg) {
 
 #endif
 
+//  ▄▄   ▄▄         ▄▄
+//  ███▄███ ▄▄  ▄▄ ▄██▄▄  ▄▄▄▄  ▄▄  ▄▄
+//  ██▀█▀██ ██  ██  ██   ██▄▄██  ▀██▀
+//  ██   ██ ▀█▄▄██  ▀█▄▄ ▀█▄▄▄  ▄█▀▀█▄
+//
+
+
+#if PLY_LOCK_STATS
+
+struct LockCounters {
+    const char* name = nullptr;
+    Atomic<u64> num_acquisitions;
+    Atomic<u64> num_contended;
+    Atomic<u64> wait_ticks;
+    Atomic<u64> max_hold_ticks;
+};
+
+namespace {
+
+struct LockRegistry {
+    // Entry 0 is used for unnamed locks. Names are only added, never removed.
+    RawMutex mutex;
+    LockCounters entries[LockStats::MaxNames];
+    Atomic<u32> num_entries = 1;
+
+    LockRegistry() {
+        this->entries[0].name = "unnamed";
+    }
+};
+
+LockRegistry& get_lock_registry() {
+    // Constructed on first use since locks may be constructed during static initialization. Never destroyed.
+    static LockRegistry* registry = new (dlmalloc(sizeof(LockRegistry))) LockRegistry;
+    return *registry;
+}
+
+LockCounters* find_lock_counters(const char* name) {
+    LockRegistry& registry = get_lock_registry();
+    if (!name)
+        return &registry.entries[0];
+    LockGuard<RawMutex> guard{registry.mutex};
+    u32 num_entries = registry.num_entries.load_relaxed();
+    for (u32 i = 1; i < num_entries; i++) {
+        if (strcmp(registry.entries[i].name, name) == 0)
+            return &registry.entries[i];
+    }
+    // When the registry is full, new names are counted as unnamed.
+    if (num_entries == LockStats::MaxNames)
+        return &registry.entries[0];
+    registry.entries[num_entries].name = name;
+    registry.num_entries.store_release(num_entries + 1);
+    return &registry.entries[num_entries];
+}
+
+// Counts the acquisition as contended, and measures the wait, only if try_lock fails.
+template <typename TryLock, typename Lock>
+void acquire_and_count(LockCounters* counters, const TryLock& try_lock, const Lock& lock) {
+    if (!try_lock()) {
+        u64 start_ticks = get_cpu_ticks();
+        lock();
+        counters->num_contended.fetch_add_acq_rel(1);
+        counters->wait_ticks.fetch_add_acq_rel(get_cpu_ticks() - start_ticks);
+    }
+    counters->num_acquisitions.fetch_add_acq_rel(1);
+}
+
+void record_hold(LockCounters* counters, u64 hold_start_ticks) {
+    u64 hold_ticks = get_cpu_ticks() - hold_start_ticks;
+    u64 max_hold_ticks = counters->max_hold_ticks.load_relaxed();
+    while (hold_ticks > max_hold_ticks) {
+        u64 prev = counters->max_hold_ticks.compare_exchange_acq_rel(max_hold_ticks, hold_ticks);
+        if (prev == max_hold_ticks)
+            break;
+        max_hold_ticks = prev;
+    }
+}
+
+} // namespace
+
+Mutex::Mutex(const char* name) : counters{find_lock_counters(name)} {
+}
+
+void Mutex::begin_hold() {
+    this->hold_start_ticks = get_cpu_ticks();
+}
+
+void Mutex::end_hold() {
+    record_hold(this->counters, this->hold_start_ticks);
+}
+
+void Mutex::lock() {
+    acquire_and_count(
+        this->counters, [this] { return RawMutex::try_lock(); }, [this] { RawMutex::lock(); });
+    this->begin_hold();
+}
+
+bool Mutex::try_lock() {
+    if (!RawMutex::try_lock())
+        return false;
+    this->counters->num_acquisitions.fetch_add_acq_rel(1);
+    this->begin_hold();
+    return true;
+}
+
+void Mutex::unlock() {
+    this->end_hold();
+    RawMutex::unlock();
+}
+
+#endif // PLY_LOCK_STATS
+
+LockStats get_lock_stats() {
+    LockStats stats;
+#if PLY_LOCK_STATS
+    LockRegistry& registry = get_lock_registry();
+    stats.num_entries = registry.num_entries.load_acquire();
+    for (u32 i = 0; i < stats.num_entries; i++) {
+        const LockCounters& counters = registry.entries[i];
+        LockStats::Entry& entry = stats.entries[i];
+        entry.name = counters.name;
+        entry.num_acquisitions = counters.num_acquisitions.load_relaxed();
+        entry.num_contended = counters.num_contended.load_relaxed();
+        entry.wait_ticks = counters.wait_ticks.load_relaxed();
+        entry.max_hold_ticks = counters.max_hold_ticks.load_relaxed();
+    }
+#endif
+    return stats;
+}
+
+void write_lock_stats(Stream& out, const LockStats& stats) {
+    double micros_per_tick = 1e6 / get_cpu_ticks_per_second();
+    for (u32 i = 0; i < stats.num_entries; i++) {
+        const LockStats::Entry& entry = stats.entries[i];
+        if (entry.num_acquisitions == 0)
+            continue;
+        out.format("{}: {} acquisitions, {} contended, {} us waiting, {} us max hold\n", entry.name,
+                   entry.num_acquisitions, entry.num_contended, u64(entry.wait_ticks * micros_per_tick),
+                   u64(entry.max_hold_ticks * micros_per_tick));
+    }
+}
+
+#if defined(PLY_LINUX)
+
+void RawMutex::lock_slow() {
+    // Critical sections are usually short, so spin for a bit first. Once other threads are sleeping,
+    // the lock is contended enough that spinning is unlikely to pay off.
+    for (u32 i = 0; i < LockSpinCount; i++) {
+        u32 state = this->state.load_relaxed();
+        if (state == 0) {
+            if (this->state.compare_exchange_acq_rel(0, 1) == 0)
+                return;
+        } else if (state == 2) {
+            break;
+        }
+        cpu_relax();
+    }
+    this->lock_contended();
+}
+
+void RawMutex::lock_contended() {
+    // Set the state to 2 rather than 1, since there might be other threads sleeping. The extra wakeup
+    // in unlock() is harmless if there aren't.
+    while (this->state.exchange_acq_rel(2) != 0) {
+        futex_wait(&this->state, 2);
+    }
+}
+
+#endif
+
+//  ▄▄▄▄▄                    ▄▄ ▄▄    ▄▄        ▄▄  ▄▄          ▄▄                 ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄   ▄▄▄██ ██ ▄▄ ██ ▄▄▄▄▄  ▄▄ ▄██▄▄  ▄▄▄▄  ██     ▄▄▄▄   ▄▄▄▄ ██  ▄▄
+//  ██▀▀█▄ ██▄▄██  ▄▄▄██ ██  ██ ▀█▄██▄█▀ ██  ▀▀ ██  ██   ██▄▄██ ██    ██  ██ ██    ██▄█▀
+//  ██  ██ ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██▀▀██  ██     ██  ▀█▄▄ ▀█▄▄▄  ██▄▄▄ ▀█▄▄█▀ ▀█▄▄▄ ██ ▀█▄
+//
+
+
+#if defined(PLY_LINUX)
+
+void RawReadWriteLock::lock_exclusive_slow() {
+    // Registering as a waiting writer makes new readers wait.
+    this->state.fetch_add_acq_rel(OneWaitingWriter);
+    u32 num_spins = 0;
+    for (;;) {
+        u32 state = this->state.load_relaxed();
+        if ((state & (ReaderMask | WriterHeld)) == 0) {
+            if (this->state.compare_exchange_acq_rel(state, (state - OneWaitingWriter) | WriterHeld) == state)
+                return;
+            continue;
+        }
+        if (num_spins < LockSpinCount) {
+            num_spins++;
+            cpu_relax();
+            continue;
+        }
+        futex_wait(&this->state, state);
+    }
+}
+
+void RawReadWriteLock::lock_shared_slow() {
+    u32 num_spins = 0;
+    for (;;) {
+        u32 state = this->state.load_relaxed();
+        if ((state & (WriterHeld | WaitingWriterMask)) == 0) {
+            PLY_ASSERT((state & ReaderMask) < ReaderMask);
+            if (this->state.compare_exchange_acq_rel(state, state + 1) == state)
+                return;
+            continue;
+        }
+        if (num_spins < LockSpinCount) {
+            num_spins++;
+            cpu_relax();
+            continue;
+        }
+        // Tell unlock_exclusive that it needs to wake us.
+        if (!(state & ReadersSleeping)) {
+            if (this->state.compare_exchange_acq_rel(state, state | ReadersSleeping) != state)
+                continue;
+            state |= ReadersSleeping;
+        }
+        futex_wait(&this->state, state);
+    }
+}
+
+#endif
+
+#if PLY_LOCK_STATS
+
+ReadWriteLock::ReadWriteLock(const char* name) : counters{find_lock_counters(name)} {
+}
+
+void ReadWriteLock::lock_exclusive() {
+    acquire_and_count(
+        this->counters, [this] { return RawReadWriteLock::try_lock_exclusive(); },
+        [this] { RawReadWriteLock::lock_exclusive(); });
+    this->hold_start_ticks = get_cpu_ticks();
+}
+
+bool ReadWriteLock::try_lock_exclusive() {
+    if (!RawReadWriteLock::try_lock_exclusive())
+        return false;
+    this->counters->num_acquisitions.fetch_add_acq_rel(1);
+    this->hold_start_ticks = get_cpu_ticks();
+    return true;
+}
+
+void ReadWriteLock::unlock_exclusive() {
+    record_hold(this->counters, this->hold_start_ticks);
+    RawReadWriteLock::unlock_exclusive();
+}
+
+void ReadWriteLock::lock_shared() {
+    acquire_and_count(
+        this->counters, [this] { return RawReadWriteLock::try_lock_shared(); },
+        [this] { RawReadWriteLock::lock_shared(); });
+}
+
+bool ReadWriteLock::try_lock_shared() {
+    if (!RawReadWriteLock::try_lock_shared())
+        return false;
+    this->counters->num_acquisitions.fetch_add_acq_rel(1);
+    return true;
+}
+
+#endif // PLY_LOCK_STATS
+
 //  ▄▄   ▄▄ ▄▄         ▄▄                 ▄▄▄  ▄▄   ▄▄
 //  ██   ██ ▄▄ ▄▄▄▄▄  ▄██▄▄ ▄▄  ▄▄  ▄▄▄▄   ██  ███▄███  ▄▄▄▄  ▄▄▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄  ▄▄  ▄▄
 //   ██ ██  ██ ██  ▀▀  ██   ██  ██  ▄▄▄██  ██  ██▀█▀██ ██▄▄██ ██ ██ ██ ██  ██ ██  ▀▀ ██  ██
@@ -377,7 +669,8 @@ VirtualMemory::Properties VirtualMemory::get_properties() {
         GetSystemInfo(&sys_info);
         PLY_ASSERT(is_power_of_2((u32) sys_info.dwAllocationGranularity));
         PLY_ASSERT(is_power_of_2((u32) sys_info.dwPageSize));
-        return VirtualMemory::Properties{sys_info.dwAllocationGranularity, sys_info.dwPageSize};
+        return VirtualMemory::Properties{sys_info.dwAllocationGranularity, sys_info.dwPageSize,
+                                         (uptr) GetLargePageMinimum()};
     }();
     return props;
 }
@@ -393,10 +686,34 @@ VirtualMemory::SystemStats VirtualMemory::get_system_stats() {
     return usage_stats;
 }
 
-void* VirtualMemory::reserve_region(uptr num_bytes) {
+static DWORD get_current_numa_node() {
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    USHORT node = 0;
+    GetNumaProcessorNodeEx(&processor, &node);
+    return node;
+}
+
+// Touches each page so that it's mapped to physical memory. The first byte of each page is written back with its
+// current value.
+static void prefault_pages(void* addr, uptr num_bytes) {
+    uptr page_size = VirtualMemory::get_properties().page_size;
+    for (char* page = (char*) addr; page < (char*) addr + num_bytes; page += page_size) {
+        *(volatile char*) page = *(volatile char*) page;
+    }
+}
+
+void* VirtualMemory::reserve_region(uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().region_alignment));
 
-    void* addr = VirtualAlloc(0, (SIZE_T) num_bytes, MEM_RESERVE, PAGE_READWRITE);
+    // Large pages can't be reserved without committing them, so HUGE_PAGES is ignored here.
+    void* addr;
+    if (flags & NUMA_LOCAL) {
+        addr = VirtualAllocExNuma(GetCurrentProcess(), 0, (SIZE_T) num_bytes, MEM_RESERVE, PAGE_READWRITE,
+                                  get_current_numa_node());
+    } else {
+        addr = VirtualAlloc(0, (SIZE_T) num_bytes, MEM_RESERVE, PAGE_READWRITE);
+    }
     if (addr == NULL)
         return nullptr;
     VirtualMemory::total_reserved_bytes.fetch_add_acq_rel(num_bytes);
@@ -426,14 +743,24 @@ void VirtualMemory::unreserve_region(void* addr, uptr num_reserved_bytes, uptr n
     VirtualMemory::total_committed_bytes.fetch_sub_acq_rel(num_committed_bytes);
 }
 
-void VirtualMemory::commit_pages(void* addr, uptr num_bytes) {
+bool VirtualMemory::commit_pages(void* addr, uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2((uptr) addr, VirtualMemory::get_properties().page_size));
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().page_size));
 
-    LPVOID result = VirtualAlloc(addr, (SIZE_T) num_bytes, MEM_COMMIT, PAGE_READWRITE);
-    PLY_ASSERT(result != NULL); // Failure is considered fatal
-    PLY_UNUSED(result);
+    LPVOID result;
+    if (flags & NUMA_LOCAL) {
+        result = VirtualAllocExNuma(GetCurrentProcess(), addr, (SIZE_T) num_bytes, MEM_COMMIT, PAGE_READWRITE,
+                                    get_current_numa_node());
+    } else {
+        result = VirtualAlloc(addr, (SIZE_T) num_bytes, MEM_COMMIT, PAGE_READWRITE);
+    }
+    if (result == NULL)
+        return false;
+    if (flags & PREFAULT) {
+        prefault_pages(addr, num_bytes);
+    }
     VirtualMemory::total_committed_bytes.fetch_add_acq_rel(num_bytes);
+    return true;
 }
 
 void VirtualMemory::decommit_pages(void* addr, uptr num_bytes) {
@@ -446,12 +773,34 @@ void VirtualMemory::decommit_pages(void* addr, uptr num_bytes) {
     VirtualMemory::total_committed_bytes.fetch_sub_acq_rel(num_bytes);
 }
 
-void* VirtualMemory::alloc_region(uptr num_bytes) {
+void* VirtualMemory::alloc_region(uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().region_alignment));
 
-    void* addr = VirtualAlloc(0, (SIZE_T) num_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-    if (addr == NULL)
-        return nullptr;
+    void* addr = NULL;
+    uptr huge_page_size = VirtualMemory::get_properties().huge_page_size;
+    if ((flags & HUGE_PAGES) && huge_page_size && is_aligned_to_power_of_2(num_bytes, huge_page_size)) {
+        // Requires SeLockMemoryPrivilege. Large pages are always resident, so there's no need to prefault them.
+        DWORD alloc_type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+        if (flags & NUMA_LOCAL) {
+            addr = VirtualAllocExNuma(GetCurrentProcess(), 0, (SIZE_T) num_bytes, alloc_type, PAGE_READWRITE,
+                                      get_current_numa_node());
+        } else {
+            addr = VirtualAlloc(0, (SIZE_T) num_bytes, alloc_type, PAGE_READWRITE);
+        }
+    }
+    if (addr == NULL) {
+        if (flags & NUMA_LOCAL) {
+            addr = VirtualAllocExNuma(GetCurrentProcess(), 0, (SIZE_T) num_bytes, MEM_RESERVE | MEM_COMMIT,
+                                      PAGE_READWRITE, get_current_numa_node());
+        } else {
+            addr = VirtualAlloc(0, (SIZE_T) num_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+        if (addr == NULL)
+            return nullptr;
+        if (flags & PREFAULT) {
+            prefault_pages(addr, num_bytes);
+        }
+    }
     VirtualMemory::total_reserved_bytes.fetch_add_acq_rel(num_bytes);
     VirtualMemory::total_committed_bytes.fetch_add_acq_rel(num_bytes);
     return addr;
@@ -467,11 +816,103 @@ void VirtualMemory::free_region(void* addr, uptr num_bytes) {
 // POSIX
 //--------------------------------------------
 
+#if defined(PLY_LINUX)
+
+// Not defined by older system headers.
+#if !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+constexpr int LinuxMPolLocal = 4; // MPOL_LOCAL in <linux/mempolicy.h>
+
+// Returns the sum, in bytes, of lines such as "AnonHugePages:  2048 kB" in a /proc file.
+static uptr read_proc_kb_values(StringView path, ArrayView<const StringView> keys) {
+    Stream in = Filesystem::open_binary_for_read(path);
+    if (!in)
+        return 0;
+    uptr total = 0;
+    for (;;) {
+        String line = read_line(in);
+        if (line.is_empty())
+            break;
+        for (StringView key : keys) {
+            if (line.starts_with(key)) {
+                ViewStream line_in{line.substr(key.num_bytes())};
+                skip_whitespace(line_in);
+                total += (uptr) read_u64_from_text(line_in) * 1024;
+            }
+        }
+    }
+    return total;
+}
+
+static uptr get_huge_page_size() {
+    Stream in = Filesystem::open_binary_for_read("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    if (in)
+        return (uptr) read_u64_from_text(in);
+    StringView keys[] = {"Hugepagesize:"};
+    return read_proc_kb_values("/proc/meminfo", keys);
+}
+
+static void apply_placement_flags(void* addr, uptr num_bytes, u32 flags) {
+    if (flags & VirtualMemory::HUGE_PAGES) {
+        madvise(addr, num_bytes, MADV_HUGEPAGE);
+    }
+    if (flags & VirtualMemory::NUMA_LOCAL) {
+        syscall(SYS_mbind, addr, num_bytes, LinuxMPolLocal, nullptr, 0, 0);
+    }
+}
+
+#endif
+
+// Maps each page to physical memory.
+static void prefault_pages(void* addr, uptr num_bytes) {
+#if defined(PLY_LINUX)
+    if (madvise(addr, num_bytes, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    // Touch each page, writing back the current value of its first byte.
+    uptr page_size = VirtualMemory::get_properties().page_size;
+    for (char* page = (char*) addr; page < (char*) addr + num_bytes; page += page_size) {
+        *(volatile char*) page = *(volatile char*) page;
+    }
+}
+
+// When huge pages are requested, the mapping is aligned to the huge page size so that every huge page in it can be
+// used.
+static void* map_region(uptr num_bytes, int prot, int mmap_flags, u32 flags) {
+    VirtualMemory::Properties props = VirtualMemory::get_properties();
+    uptr alignment = 0;
+    if ((flags & VirtualMemory::HUGE_PAGES) && props.huge_page_size > props.page_size &&
+        num_bytes >= props.huge_page_size) {
+        alignment = props.huge_page_size;
+    }
+    uptr map_size = num_bytes + (alignment ? alignment - props.page_size : 0);
+    char* addr = (char*) mmap(0, map_size, prot, MAP_PRIVATE | MAP_ANONYMOUS | mmap_flags, -1, 0);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    if (alignment) {
+        // Trim the unaligned head and tail.
+        char* start = (char*) align_to_power_of_2((u64) addr, (u64) alignment);
+        if (start > addr) {
+            munmap(addr, start - addr);
+        }
+        if (addr + map_size > start + num_bytes) {
+            munmap(start + num_bytes, addr + map_size - (start + num_bytes));
+        }
+        addr = start;
+    }
+    return addr;
+}
+
 VirtualMemory::Properties VirtualMemory::get_properties() {
     static VirtualMemory::Properties props = []() {
         long result = sysconf(_SC_PAGE_SIZE);
         PLY_ASSERT(is_power_of_2((u64) result));
-        return VirtualMemory::Properties{(uptr) result, (uptr) result};
+        uptr huge_page_size = 0;
+#if defined(PLY_LINUX)
+        huge_page_size = get_huge_page_size();
+#endif
+        return VirtualMemory::Properties{(uptr) result, (uptr) result, huge_page_size};
     }();
     return props;
 }
@@ -496,17 +937,22 @@ VirtualMemory::SystemStats VirtualMemory::get_system_stats() {
         usage_stats.virtual_size = vm_pages * page_size;
         usage_stats.resident_size = rss_pages * page_size;
     }
+    StringView huge_page_keys[] = {"AnonHugePages:", "Shared_Hugetlb:", "Private_Hugetlb:"};
+    usage_stats.huge_page_resident_size = read_proc_kb_values("/proc/self/smaps_rollup", huge_page_keys);
 #endif
 
     return usage_stats;
 }
 
-void* VirtualMemory::reserve_region(uptr num_bytes) {
+void* VirtualMemory::reserve_region(uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().region_alignment));
 
-    void* addr = mmap(0, num_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (addr == MAP_FAILED)
+    void* addr = map_region(num_bytes, PROT_NONE, 0, flags);
+    if (!addr)
         return nullptr;
+#if defined(PLY_LINUX)
+    apply_placement_flags(addr, num_bytes, flags);
+#endif
     VirtualMemory::total_reserved_bytes.fetch_add_acq_rel(num_bytes);
     return addr;
 }
@@ -523,14 +969,21 @@ void VirtualMemory::unreserve_region(void* addr, uptr num_reserved_bytes, uptr n
     VirtualMemory::total_committed_bytes.fetch_sub_acq_rel(num_committed_bytes);
 }
 
-void VirtualMemory::commit_pages(void* addr, uptr num_bytes) {
+bool VirtualMemory::commit_pages(void* addr, uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2((uptr) addr, VirtualMemory::get_properties().page_size));
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().page_size));
 
     int rc = mprotect(addr, num_bytes, PROT_READ | PROT_WRITE);
-    PLY_ASSERT(rc == 0);
-    PLY_UNUSED(rc);
+    if (rc != 0)
+        return false;
+#if defined(PLY_LINUX)
+    apply_placement_flags(addr, num_bytes, flags);
+#endif
+    if (flags & PREFAULT) {
+        prefault_pages(addr, num_bytes);
+    }
     VirtualMemory::total_committed_bytes.fetch_add_acq_rel(num_bytes);
+    return true;
 }
 
 void VirtualMemory::decommit_pages(void* addr, uptr num_bytes) {
@@ -545,12 +998,42 @@ void VirtualMemory::decommit_pages(void* addr, uptr num_bytes) {
     VirtualMemory::total_committed_bytes.fetch_sub_acq_rel(num_bytes);
 }
 
-void* VirtualMemory::alloc_region(uptr num_bytes) {
+void* VirtualMemory::alloc_region(uptr num_bytes, u32 flags) {
     PLY_ASSERT(is_aligned_to_power_of_2(num_bytes, VirtualMemory::get_properties().region_alignment));
 
-    void* addr = mmap(0, num_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (addr == MAP_FAILED)
-        return nullptr;
+    void* addr = nullptr;
+#if defined(PLY_LINUX)
+    uptr huge_page_size = VirtualMemory::get_properties().huge_page_size;
+    if ((flags & HUGE_PAGES) && huge_page_size && is_aligned_to_power_of_2(num_bytes, huge_page_size)) {
+        // Explicit huge pages only work if the system has reserved some. Otherwise, fall back to transparent huge
+        // pages.
+        addr = map_region(num_bytes, PROT_READ | PROT_WRITE, MAP_HUGETLB, 0);
+        if (addr) {
+            apply_placement_flags(addr, num_bytes, flags & NUMA_LOCAL);
+            if (flags & PREFAULT) {
+                prefault_pages(addr, num_bytes);
+            }
+        }
+    }
+#endif
+    if (!addr) {
+        // MAP_POPULATE can't be used when huge pages are requested, because the pages must be advised first.
+        int mmap_flags = 0;
+#if defined(PLY_LINUX)
+        if ((flags & PREFAULT) && !(flags & HUGE_PAGES) && !(flags & NUMA_LOCAL)) {
+            mmap_flags = MAP_POPULATE;
+        }
+#endif
+        addr = map_region(num_bytes, PROT_READ | PROT_WRITE, mmap_flags, flags);
+        if (!addr)
+            return nullptr;
+#if defined(PLY_LINUX)
+        apply_placement_flags(addr, num_bytes, flags);
+#endif
+        if ((flags & PREFAULT) && !mmap_flags) {
+            prefault_pages(addr, num_bytes);
+        }
+    }
     VirtualMemory::total_reserved_bytes.fetch_add_acq_rel(num_bytes);
     VirtualMemory::total_committed_bytes.fetch_add_acq_rel(num_bytes);
     return addr;
@@ -568,129 +1051,1275 @@ void VirtualMemory::free_region(void* addr, uptr num_bytes) {
 //  ██  ██ ▀█▄▄▄  ▀█▄▄██ ██▄▄█▀
 //                       ██
 
-#if !defined(PLY_OVERRIDE_NEW)
-#define PLY_OVERRIDE_NEW 1
+#if !defined(PLY_HEAP_THREAD_CACHE)
+#define PLY_HEAP_THREAD_CACHE 1
 #endif
 
-#if PLY_OVERRIDE_NEW
-
 } // namespace ply
 
+// Matches struct mallinfo in dlmalloc.c.
+struct DLMallInfo {
+    ply::uptr arena;
+    ply::uptr ordblks;
+    ply::uptr smblks;
+    ply::uptr hblks;
+    ply::uptr hblkhd;
+    ply::uptr usmblks;
+    ply::uptr fsmblks;
+    ply::uptr uordblks;
+    ply::uptr fordblks;
+    ply::uptr keepcost;
+};
+
+extern "C" {
+DLMallInfo dlmallinfo();
+ply::uptr dlmalloc_usable_size(void*);
+void** dlindependent_comalloc(ply::uptr, ply::uptr*, void**);
+ply::uptr dlbulk_free(void**, ply::uptr);
+};
+
+namespace ply {
+
+#if PLY_HEAP_THREAD_CACHE
+
 //---------------------------------------------------------------------------
-// Override operators new/delete
-// C++ allows us to replace global operators new/delete with our own thanks to weak linking.
+// Thread cache
+// Small blocks are cached per thread in size classes of 16-byte granularity. Every cached block is an
+// ordinary dlmalloc chunk, so it can be freed from any thread and passed to dlrealloc. When a bin runs
+// dry, it's refilled with a whole batch, either taken from the central heap or carved out of dlmalloc
+// in a single call. When a bin holds too many blocks, one batch is handed back to the central heap.
+// dlmalloc's global lock is only taken once per batch.
 //---------------------------------------------------------------------------
-void* operator new(std::size_t size) {
-    return ply::Heap::alloc(size);
-}
 
-void* operator new[](std::size_t size) {
-    return ply::Heap::alloc(size);
+namespace {
+
+// Size class N holds chunks of N * 16 bytes. Chunk overhead is one size_t, so a block in class N always has
+// at least N * 16 - sizeof(size_t) usable bytes. Where dlmalloc aligns chunks to 8 bytes, the smallest chunks
+// fall below MinHeapClass; those are never cached and go straight back to dlmalloc.
+constexpr uptr HeapClassGranularity = 16;
+constexpr uptr HeapChunkOverhead = sizeof(size_t);
+constexpr u32 MinHeapClass = 2;
+constexpr u32 NumHeapClasses = 65;
+constexpr uptr MaxCachedAllocSize = (NumHeapClasses - 1) * HeapClassGranularity - HeapChunkOverhead;
+constexpr u32 MaxHeapBatchSize = 32;
+constexpr u32 MaxCentralBatches = 64;
+
+struct FreeBlock {
+    FreeBlock* next;       // Next block in the same batch or bin
+    FreeBlock* next_batch; // Links batches together in the central heap
+};
+
+struct ThreadCache {
+    struct Bin {
+        FreeBlock* head = nullptr;
+        u32 num_blocks = 0;
+    };
+    Bin bins[NumHeapClasses];
+};
+
+struct CentralHeap {
+    struct Bin {
+        Mutex mutex{"Heap central bin"};
+        FreeBlock* batches = nullptr;
+        u32 num_batches = 0;
+    };
+    Bin bins[NumHeapClasses];
+};
+
+// Set once the calling thread's cache has been destroyed, so that blocks freed by later thread exit callbacks
+// go straight back to dlmalloc. It can't be kept in the thread cache slot, since the platform clears that slot
+// between rounds of thread exit callbacks. A trivially destructible thread_local lasts until the thread is gone.
+thread_local bool thread_cache_destroyed = false;
+
+u32 get_heap_class_for_alloc(uptr num_bytes) {
+    return max<u32>(u32((num_bytes + HeapChunkOverhead + HeapClassGranularity - 1) / HeapClassGranularity),
+                    MinHeapClass);
 }
 
-void operator delete(void* ptr) noexcept {
-    ply::Heap::free(ptr);
+u32 get_heap_batch_size(u32 heap_class) {
+    // About 4 KB per batch.
+    return clamp<u32>(u32(4096 / (heap_class * HeapClassGranularity)), 4, MaxHeapBatchSize);
 }
 
-void operator delete[](void* ptr) noexcept {
-    ply::Heap::free(ptr);
+CentralHeap& get_central_heap() {
+    // Constructed on first use since the heap may be used during static initialization. Never destroyed.
+    static CentralHeap* central_heap = new (dlmalloc(sizeof(CentralHeap))) CentralHeap;
+    return *central_heap;
 }
 
-void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
-    return ply::Heap::alloc(size);
+void destroy_thread_cache(void* value);
+
+#if defined(PLY_WINDOWS)
+
+void WINAPI on_fiber_storage_freed(void* value) {
+    destroy_thread_cache(value);
 }
 
-void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
-    return ply::Heap::alloc(size);
+DWORD get_thread_cache_index() {
+    static DWORD fls_index = FlsAlloc(on_fiber_storage_freed);
+    return fls_index;
 }
 
-void operator delete(void* ptr, std::nothrow_t const&) noexcept {
-    ply::Heap::free(ptr);
+void* load_thread_cache_slot() {
+    return FlsGetValue(get_thread_cache_index());
 }
 
-void operator delete[](void* ptr, std::nothrow_t const&) noexcept {
-    ply::Heap::free(ptr);
+void store_thread_cache_slot(void* value) {
+    FlsSetValue(get_thread_cache_index(), value);
 }
 
-namespace ply {
+#elif defined(PLY_POSIX)
 
-#endif // PLY_OVERRIDE_NEW
+pthread_key_t get_thread_cache_key() {
+    static pthread_key_t tls_key = []() {
+        pthread_key_t key;
+        int rc = pthread_key_create(&key, destroy_thread_cache);
+        PLY_ASSERT(rc == 0);
+        PLY_UNUSED(rc);
+        return key;
+    }();
+    return tls_key;
+}
 
-//   ▄▄▄▄   ▄▄          ▄▄               ▄▄   ▄▄ ▄▄
-//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
-//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
-//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██   ▀█▀   ██ ▀█▄▄▄   ██▀▀██
-//                                 ▄▄▄█▀
+void* load_thread_cache_slot() {
+    return pthread_getspecific(get_thread_cache_key());
+}
 
-bool StringView::starts_with(StringView other) const {
-    if (other.num_bytes_ > this->num_bytes_)
-        return false;
-    return memcmp(this->bytes_, other.bytes_, other.num_bytes_) == 0;
+void store_thread_cache_slot(void* value) {
+    pthread_setspecific(get_thread_cache_key(), value);
 }
 
-bool StringView::ends_with(StringView other) const {
-    if (other.num_bytes_ > this->num_bytes_)
-        return false;
-    return memcmp(this->bytes_ + this->num_bytes_ - other.num_bytes_, other.bytes_, other.num_bytes_) == 0;
+#endif
+
+// Returns nullptr if the calling thread's cache was already destroyed.
+PLY_FORCE_INLINE ThreadCache* get_thread_cache() {
+    void* value = load_thread_cache_slot();
+    if (value)
+        return (ThreadCache*) value;
+    if (thread_cache_destroyed)
+        return nullptr;
+    ThreadCache* thread_cache = new (dlmalloc(sizeof(ThreadCache))) ThreadCache;
+    store_thread_cache_slot(thread_cache);
+    return thread_cache;
 }
 
-StringView StringView::trim(bool (*match_func)(char), bool left, bool right) const {
-    const char* start = this->bytes_;
-    const char* end = start + this->num_bytes_;
-    if (left) {
-        while ((start < end) && match_func(*start)) {
-            start++;
+void free_block_list(FreeBlock* block) {
+    void* blocks[MaxHeapBatchSize];
+    while (block) {
+        u32 num_blocks = 0;
+        for (; block && num_blocks < MaxHeapBatchSize; block = block->next) {
+            blocks[num_blocks++] = block;
         }
+        dlbulk_free(blocks, num_blocks);
     }
-    if (right) {
-        while ((start < end) && match_func(end[-1])) {
-            end--;
-        }
+}
+
+void refill_bin(ThreadCache::Bin& bin, u32 heap_class) {
+    PLY_ASSERT(!bin.head && bin.num_blocks == 0);
+    u32 batch_size = get_heap_batch_size(heap_class);
+
+    // Take a batch from the central heap.
+    CentralHeap::Bin& central_bin = get_central_heap().bins[heap_class];
+    {
+        LockGuard<Mutex> guard{central_bin.mutex};
+        if (FreeBlock* batch = central_bin.batches) {
+            central_bin.batches = batch->next_batch;
+            central_bin.num_batches--;
+            bin.head = batch;
+            bin.num_blocks = batch_size;
+            return;
+        }
     }
-    return {start, end};
+
+    // Central heap is empty. Carve a new batch out of dlmalloc.
+    uptr sizes[MaxHeapBatchSize];
+    void* blocks[MaxHeapBatchSize];
+    for (u32 i = 0; i < batch_size; i++) {
+        sizes[i] = heap_class * HeapClassGranularity - HeapChunkOverhead;
+    }
+    if (!dlindependent_comalloc(batch_size, sizes, blocks))
+        return; // Out of memory
+    for (u32 i = 0; i < batch_size; i++) {
+        ((FreeBlock*) blocks[i])->next = (i + 1 < batch_size) ? (FreeBlock*) blocks[i + 1] : nullptr;
+    }
+    bin.head = (FreeBlock*) blocks[0];
+    bin.num_blocks = batch_size;
 }
 
-Array<StringView> StringView::split(StringView separator) const {
-    Array<StringView> result;
-    u32 start = 0;
-    while (start < this->num_bytes_) {
-        s32 pos = this->find(separator, start);
-        if (pos < 0) {
-            // No more separators found, add the rest
-            StringView remainder = this->substr(start);
-            if (remainder.num_bytes_ > 0) {
-                result.append(remainder);
+// Moves the first batch_size blocks of the bin to the central heap.
+void release_batch(ThreadCache::Bin& bin, u32 heap_class, u32 batch_size) {
+    PLY_ASSERT(bin.num_blocks >= batch_size);
+    FreeBlock* batch = bin.head;
+    FreeBlock* last = batch;
+    for (u32 i = 1; i < batch_size; i++) {
+        last = last->next;
+    }
+    bin.head = last->next;
+    bin.num_blocks -= batch_size;
+    last->next = nullptr;
+
+    CentralHeap::Bin& central_bin = get_central_heap().bins[heap_class];
+    {
+        LockGuard<Mutex> guard{central_bin.mutex};
+        if (central_bin.num_batches < MaxCentralBatches) {
+            batch->next_batch = central_bin.batches;
+            central_bin.batches = batch;
+            central_bin.num_batches++;
+            return;
+        }
+    }
+    // Central heap is full. Give the batch back to dlmalloc.
+    free_block_list(batch);
+}
+
+void flush_bins(ThreadCache* thread_cache) {
+    for (u32 heap_class = MinHeapClass; heap_class < NumHeapClasses; heap_class++) {
+        ThreadCache::Bin& bin = thread_cache->bins[heap_class];
+        u32 batch_size = get_heap_batch_size(heap_class);
+        while (bin.num_blocks >= batch_size) {
+            release_batch(bin, heap_class, batch_size);
+        }
+        free_block_list(bin.head);
+        bin.head = nullptr;
+        bin.num_blocks = 0;
+    }
+}
+
+void destroy_thread_cache(void* value) {
+    if (!value)
+        return;
+    // Mark the thread first so that nothing freed while flushing ends up in a new cache.
+    thread_cache_destroyed = true;
+    store_thread_cache_slot(nullptr);
+    ThreadCache* thread_cache = (ThreadCache*) value;
+    flush_bins(thread_cache);
+    dlfree(thread_cache);
+}
+
+void* raw_alloc(uptr num_bytes) {
+    if (num_bytes <= MaxCachedAllocSize) {
+        if (ThreadCache* thread_cache = get_thread_cache()) {
+            u32 heap_class = get_heap_class_for_alloc(num_bytes);
+            ThreadCache::Bin& bin = thread_cache->bins[heap_class];
+            if (!bin.head) {
+                refill_bin(bin, heap_class);
+                if (!bin.head)
+                    return nullptr;
             }
+            FreeBlock* block = bin.head;
+            bin.head = block->next;
+            bin.num_blocks--;
+            return block;
+        }
+    }
+    return dlmalloc(num_bytes);
+}
+
+void raw_free(void* ptr) {
+    if (!ptr)
+        return;
+    u32 heap_class = u32((dlmalloc_usable_size(ptr) + HeapChunkOverhead) / HeapClassGranularity);
+    if (heap_class >= MinHeapClass && heap_class < NumHeapClasses) {
+        if (ThreadCache* thread_cache = get_thread_cache()) {
+            ThreadCache::Bin& bin = thread_cache->bins[heap_class];
+            FreeBlock* block = (FreeBlock*) ptr;
+            block->next = bin.head;
+            bin.head = block;
+            bin.num_blocks++;
+            u32 batch_size = get_heap_batch_size(heap_class);
+            if (bin.num_blocks >= batch_size * 2) {
+                release_batch(bin, heap_class, batch_size);
+            }
+            return;
+        }
+    }
+    dlfree(ptr);
+}
+
+} // namespace
+
+void Heap::flush_thread_cache() {
+    void* value = load_thread_cache_slot();
+    if (value) {
+        flush_bins((ThreadCache*) value);
+    }
+}
+
+#else // PLY_HEAP_THREAD_CACHE
+
+namespace {
+
+PLY_FORCE_INLINE void* raw_alloc(uptr num_bytes) {
+    return dlmalloc(num_bytes);
+}
+
+PLY_FORCE_INLINE void raw_free(void* ptr) {
+    dlfree(ptr);
+}
+
+} // namespace
+
+void Heap::flush_thread_cache() {
+}
+
+#endif // PLY_HEAP_THREAD_CACHE
+
+#if PLY_HEAP_STATS
+
+//---------------------------------------------------------------------------
+// Instrumentation
+// Every block is preceded by a 16-byte header that records its requested size and tag, so that frees can be
+// subtracted from the right counters. The header sits immediately before the pointer returned to the caller;
+// aligned blocks are padded so that the header fits.
+//---------------------------------------------------------------------------
+
+namespace {
+
+struct alignas(16) BlockHeader {
+    u32 offset; // Distance from the start of the underlying dlmalloc chunk to the user pointer
+    u32 tag;
+    uptr num_bytes;
+};
+PLY_STATIC_ASSERT(sizeof(BlockHeader) == 16);
+
+struct HeapCounters {
+    Atomic<uptr> num_bytes_allocated;
+    Atomic<uptr> peak_bytes_allocated;
+    Atomic<u64> num_allocs;
+    Atomic<u64> num_frees;
+    Atomic<u64> num_allocs_per_size_class[Heap::NumStatsSizeClasses];
+
+    // Tag 0 is used for untagged allocations. Tag names are only added, never removed.
+    Mutex tag_mutex;
+    const char* tag_names[Heap::MaxTags] = {"untagged"};
+    Atomic<u32> num_tags = 1;
+    Atomic<uptr> tag_bytes_allocated[Heap::MaxTags];
+    Atomic<u64> tag_num_allocs[Heap::MaxTags];
+
+    ThreadLocal<u32> current_tag;
+};
+
+HeapCounters& get_heap_counters() {
+    // Constructed on first use since the heap may be used during static initialization. Never destroyed.
+    static HeapCounters* counters = new (dlmalloc(sizeof(HeapCounters))) HeapCounters;
+    return *counters;
+}
+
+u32 get_stats_size_class(uptr num_bytes) {
+    u32 size_class = 0;
+    while (size_class + 1 < Heap::NumStatsSizeClasses && num_bytes > (uptr(16) << size_class)) {
+        size_class++;
+    }
+    return size_class;
+}
+
+void* on_alloc(void* raw, uptr offset, uptr num_bytes) {
+    if (!raw)
+        return nullptr;
+    HeapCounters& counters = get_heap_counters();
+    u32 tag = counters.current_tag.load();
+    BlockHeader* header = (BlockHeader*) ((char*) raw + offset) - 1;
+    header->offset = (u32) offset;
+    header->tag = tag;
+    header->num_bytes = num_bytes;
+
+    uptr total = counters.num_bytes_allocated.fetch_add_acq_rel(num_bytes) + num_bytes;
+    uptr peak = counters.peak_bytes_allocated.load_relaxed();
+    while (total > peak) {
+        uptr prev = counters.peak_bytes_allocated.compare_exchange_acq_rel(peak, total);
+        if (prev == peak)
             break;
+        peak = prev;
+    }
+    counters.num_allocs.fetch_add_acq_rel(1);
+    counters.num_allocs_per_size_class[get_stats_size_class(num_bytes)].fetch_add_acq_rel(1);
+    counters.tag_bytes_allocated[tag].fetch_add_acq_rel(num_bytes);
+    counters.tag_num_allocs[tag].fetch_add_acq_rel(1);
+    return header + 1;
+}
+
+void record_free(u32 tag, uptr num_bytes) {
+    HeapCounters& counters = get_heap_counters();
+    counters.num_bytes_allocated.fetch_sub_acq_rel(num_bytes);
+    counters.tag_bytes_allocated[tag].fetch_sub_acq_rel(num_bytes);
+    counters.num_frees.fetch_add_acq_rel(1);
+}
+
+// Returns the start of the underlying dlmalloc chunk.
+void* on_free(void* ptr) {
+    BlockHeader* header = (BlockHeader*) ptr - 1;
+    record_free(header->tag, header->num_bytes);
+    return (char*) ptr - header->offset;
+}
+
+} // namespace
+
+void* Heap::alloc(uptr num_bytes) {
+    return on_alloc(raw_alloc(num_bytes + sizeof(BlockHeader)), sizeof(BlockHeader), num_bytes);
+}
+
+void Heap::free(void* ptr) {
+    if (!ptr)
+        return;
+    raw_free(on_free(ptr));
+}
+
+void* Heap::realloc(void* ptr, uptr num_bytes) {
+    if (!ptr)
+        return Heap::alloc(num_bytes);
+    BlockHeader* header = (BlockHeader*) ptr - 1;
+    if (header->offset != sizeof(BlockHeader)) {
+        // Aligned block. Move it to an ordinary block.
+        void* new_ptr = Heap::alloc(num_bytes);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, min(num_bytes, header->num_bytes));
+            Heap::free(ptr);
+        }
+        return new_ptr;
+    }
+    // Update the stats only once dlrealloc succeeds. If it fails, the original block is still allocated.
+    u32 tag = header->tag;
+    uptr old_num_bytes = header->num_bytes;
+    void* raw = dlrealloc(header, num_bytes + sizeof(BlockHeader));
+    if (!raw)
+        return nullptr;
+    record_free(tag, old_num_bytes);
+    // Keep the block's original tag.
+    HeapCounters& counters = get_heap_counters();
+    u32 prev_tag = counters.current_tag.load();
+    counters.current_tag.store(tag);
+    void* result = on_alloc(raw, sizeof(BlockHeader), num_bytes);
+    counters.current_tag.store(prev_tag);
+    return result;
+}
+
+void* Heap::alloc_aligned(uptr num_bytes, u32 alignment) {
+    uptr offset = max<uptr>(alignment, sizeof(BlockHeader));
+    return on_alloc(dlmemalign(offset, num_bytes + offset), offset, num_bytes);
+}
+
+Heap::TagScope::TagScope(const char* name) {
+    HeapCounters& counters = get_heap_counters();
+    this->prev_tag = counters.current_tag.load();
+
+    // Look up the tag by name, adding it if needed.
+    u32 tag = 0;
+    {
+        LockGuard<Mutex> guard{counters.tag_mutex};
+        u32 num_tags = counters.num_tags.load_relaxed();
+        for (u32 i = 1; i < num_tags; i++) {
+            if (strcmp(counters.tag_names[i], name) == 0) {
+                tag = i;
+                break;
+            }
+        }
+        if (tag == 0 && num_tags < MaxTags) {
+            tag = num_tags;
+            counters.tag_names[tag] = name;
+            counters.num_tags.store_release(num_tags + 1);
         }
-        // Add the part before the separator (if non-empty)
-        if ((u32) pos > start) {
-            result.append(this->substr(start, pos - start));
+    }
+    // When the tag table is full, new tags are counted as untagged.
+    counters.current_tag.store(tag);
+}
+
+Heap::TagScope::~TagScope() {
+    get_heap_counters().current_tag.store(this->prev_tag);
+}
+
+#else // PLY_HEAP_STATS
+
+void* Heap::alloc(uptr num_bytes) {
+    return raw_alloc(num_bytes);
+}
+
+void Heap::free(void* ptr) {
+    raw_free(ptr);
+}
+
+void* Heap::realloc(void* ptr, uptr num_bytes) {
+    // Blocks handed out by the thread cache are ordinary dlmalloc chunks.
+    return dlrealloc(ptr, num_bytes);
+}
+
+void* Heap::alloc_aligned(uptr num_bytes, u32 alignment) {
+    return dlmemalign(alignment, num_bytes);
+}
+
+#endif // PLY_HEAP_STATS
+
+Heap::Stats Heap::get_stats() {
+    Stats stats;
+    DLMallInfo info = dlmallinfo();
+    stats.virtual_memory_size = info.arena + info.hblkhd;
+#if PLY_HEAP_STATS
+    HeapCounters& counters = get_heap_counters();
+    stats.num_bytes_allocated = counters.num_bytes_allocated.load_relaxed();
+    stats.peak_bytes_allocated = counters.peak_bytes_allocated.load_relaxed();
+    stats.num_allocs = counters.num_allocs.load_relaxed();
+    stats.num_frees = counters.num_frees.load_relaxed();
+    for (u32 i = 0; i < NumStatsSizeClasses; i++) {
+        stats.num_allocs_per_size_class[i] = counters.num_allocs_per_size_class[i].load_relaxed();
+    }
+    stats.num_tags = counters.num_tags.load_acquire();
+    for (u32 i = 0; i < stats.num_tags; i++) {
+        stats.tags[i].name = counters.tag_names[i];
+        stats.tags[i].num_bytes_allocated = counters.tag_bytes_allocated[i].load_relaxed();
+        stats.tags[i].num_allocs = counters.tag_num_allocs[i].load_relaxed();
+    }
+#else
+    // Includes blocks held by thread caches.
+    stats.num_bytes_allocated = info.uordblks;
+#endif
+    return stats;
+}
+
+void Heap::write_stats(Stream& out, const Stats& stats) {
+    out.format("num_bytes_allocated: {}\n", stats.num_bytes_allocated);
+    out.format("virtual_memory_size: {}\n", stats.virtual_memory_size);
+#if PLY_HEAP_STATS
+    out.format("peak_bytes_allocated: {}\n", stats.peak_bytes_allocated);
+    out.format("num_allocs: {}\n", stats.num_allocs);
+    out.format("num_frees: {}\n", stats.num_frees);
+    out.write("allocations by size:\n");
+    for (u32 i = 0; i < NumStatsSizeClasses; i++) {
+        if (stats.num_allocs_per_size_class[i] == 0)
+            continue;
+        if (i + 1 < NumStatsSizeClasses) {
+            out.format("    <= {}: {}\n", u64(16) << i, stats.num_allocs_per_size_class[i]);
+        } else {
+            out.format("    > {}: {}\n", u64(16) << (i - 1), stats.num_allocs_per_size_class[i]);
+        }
+    }
+    out.write("tags:\n");
+    for (u32 i = 0; i < stats.num_tags; i++) {
+        const TagStats& tag = stats.tags[i];
+        out.format("    {}: {} bytes in use, {} allocations\n", tag.name, tag.num_bytes_allocated, tag.num_allocs);
+    }
+#endif
+}
+
+//   ▄▄▄▄
+//  ██  ██ ▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀██ ██  ▀▀ ██▄▄██ ██  ██  ▄▄▄██
+//  ██  ██ ██     ▀█▄▄▄  ██  ██ ▀█▄▄██
+//
+
+// Pages are committed in chunks of at least this size to reduce the number of system calls.
+static constexpr uptr ArenaCommitGranularity = 64 * 1024;
+
+Arena::~Arena() {
+    if (this->base) {
+        VirtualMemory::unreserve_region(this->base, this->num_reserved_bytes, this->committed_end - this->base);
+    }
+}
+
+// Huge pages can only be used once a whole huge page is committed.
+uptr Arena::get_commit_granularity() const {
+    VirtualMemory::Properties props = VirtualMemory::get_properties();
+    uptr granularity = max(ArenaCommitGranularity, props.page_size);
+    if (this->vm_flags & VirtualMemory::HUGE_PAGES) {
+        granularity = max(granularity, props.huge_page_size);
+    }
+    return granularity;
+}
+
+void* Arena::alloc_slow(uptr num_bytes, u32 alignment) {
+    VirtualMemory::Properties props = VirtualMemory::get_properties();
+    if (!this->base) {
+        // First allocation. Reserve the region.
+        uptr num_reserved_bytes =
+            (uptr) align_to_power_of_2((u64) this->num_reserved_bytes, (u64) props.region_alignment);
+        if (num_reserved_bytes < this->num_reserved_bytes)
+            return nullptr; // Rounding up overflowed.
+        this->base = (char*) VirtualMemory::reserve_region(num_reserved_bytes, this->vm_flags);
+        if (!this->base)
+            return nullptr;
+        this->num_reserved_bytes = num_reserved_bytes;
+        this->cur = this->base;
+        this->committed_end = this->base;
+    }
+
+    // Compare sizes instead of end addresses so that a huge num_bytes can't wrap around.
+    uptr pos = (uptr) align_to_power_of_2((u64) this->cur, (u64) alignment);
+    uptr reserved_end = (uptr) this->base + this->num_reserved_bytes;
+    if (pos > reserved_end || num_bytes > reserved_end - pos)
+        return nullptr; // The reserved region is exhausted.
+    uptr end = pos + num_bytes;
+
+    if (end > (uptr) this->committed_end) {
+        uptr granularity = this->get_commit_granularity();
+        uptr new_committed_end = reserved_end;
+        if (reserved_end - end >= granularity) {
+            new_committed_end = (uptr) align_to_power_of_2((u64) end, (u64) granularity);
+        }
+        if (!VirtualMemory::commit_pages(this->committed_end, new_committed_end - (uptr) this->committed_end,
+                                         this->vm_flags))
+            return nullptr;
+        this->committed_end = (char*) new_committed_end;
+    }
+    this->cur = (char*) end;
+    return (void*) pos;
+}
+
+void* Arena::realloc(void* ptr, uptr old_num_bytes, uptr num_bytes, u32 alignment) {
+    if (!ptr)
+        return this->alloc(num_bytes, alignment);
+    if (num_bytes <= old_num_bytes)
+        return ptr;
+    if ((char*) ptr + old_num_bytes == this->cur) {
+        // This is the most recent allocation. Try to extend it.
+        if (num_bytes <= (uptr) (this->committed_end - (char*) ptr)) {
+            this->cur = (char*) ptr + num_bytes;
+            return ptr;
+        }
+        if (num_bytes <= (uptr) (this->base + this->num_reserved_bytes - (char*) ptr)) {
+            this->cur = (char*) ptr;
+            void* result = this->alloc_slow(num_bytes, 1);
+            if (!result) {
+                // Committing more pages failed. The original block is left intact.
+                this->cur = (char*) ptr + old_num_bytes;
+                return nullptr;
+            }
+            PLY_ASSERT(result == ptr);
+            return result;
+        }
+    }
+    void* result = this->alloc(num_bytes, alignment);
+    if (result) {
+        memcpy(result, ptr, old_num_bytes);
+    }
+    return result;
+}
+
+StringView Arena::copy(StringView str) {
+    char* bytes = (char*) this->alloc(str.num_bytes(), 1);
+    PLY_ASSERT(bytes);
+    memcpy(bytes, str.bytes(), str.num_bytes());
+    return {bytes, str.num_bytes()};
+}
+
+void Arena::reset(uptr num_bytes_to_retain) {
+    this->cur = this->base;
+    if (!this->base)
+        return;
+    uptr granularity = this->get_commit_granularity();
+    uptr retain_end = (uptr) this->base + (uptr) align_to_power_of_2((u64) num_bytes_to_retain, (u64) granularity);
+    if (retain_end < (uptr) this->committed_end) {
+        VirtualMemory::decommit_pages((void*) retain_end, (uptr) this->committed_end - retain_end);
+        this->committed_end = (char*) retain_end;
+    }
+}
+
+//  ▄▄▄▄▄                ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//  ██▀▀▀  ██  ██ ██  ██ ██
+//  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+PoolBase::PoolBase(uptr object_size, u32 object_alignment, bool use_thread_caches)
+    : use_thread_caches{use_thread_caches} {
+    PLY_ASSERT(object_alignment <= CacheLineSize);
+    // Small blocks are rounded up to a power of 2 so that they never straddle a cache line. Larger blocks are rounded
+    // up to a multiple of the cache line size so that each one starts on a cache line boundary.
+    uptr num_bytes = max(object_size, (uptr) sizeof(FreeBlock));
+    if (num_bytes < CacheLineSize) {
+        this->block_size = sizeof(FreeBlock);
+        while (this->block_size < num_bytes) {
+            this->block_size *= 2;
+        }
+    } else {
+        this->block_size = (uptr) align_to_power_of_2((u64) num_bytes, (u64) CacheLineSize);
+    }
+    // The first cache line of each slab holds the pointer to the next slab.
+    this->slab_size = max(SlabSize, CacheLineSize + this->block_size * 8);
+    this->batch_size = clamp<u32>(u32(4096 / this->block_size), 4, 32);
+    if (use_thread_caches) {
+#if defined(PLY_WINDOWS)
+        this->thread_exit_index = FlsAlloc([](void* value) {
+            if (value) {
+                destroy_thread_cache(value);
+            }
+        });
+        PLY_ASSERT(this->thread_exit_index != FLS_OUT_OF_INDEXES);
+#elif defined(PLY_POSIX)
+        int rc = pthread_key_create(&this->thread_exit_key, destroy_thread_cache);
+        PLY_ASSERT(rc == 0);
+        PLY_UNUSED(rc);
+#endif
+    }
+}
+
+PoolBase::~PoolBase() {
+    if (this->use_thread_caches) {
+#if defined(PLY_WINDOWS)
+        // Runs the callback for every thread that still has a cache.
+        FlsFree(this->thread_exit_index);
+#elif defined(PLY_POSIX)
+        pthread_key_delete(this->thread_exit_key);
+#endif
+    }
+    while (this->slabs) {
+        void* next = *(void**) this->slabs;
+        Heap::free(this->slabs);
+        this->slabs = next;
+    }
+    while (this->thread_caches) {
+        ThreadCache* next = this->thread_caches->next_cache;
+        Heap::free(this->thread_caches);
+        this->thread_caches = next;
+    }
+}
+
+PoolBase::FreeBlock* PoolBase::pop_block_locked() {
+    if (FreeBlock* block = this->free_list) {
+        this->free_list = block->next;
+        return block;
+    }
+    if (this->slab_cur + this->block_size > this->slab_end) {
+        // Start a new slab.
+        Heap::TagScope tag_scope{"Pool"};
+        char* slab = (char*) Heap::alloc_aligned(this->slab_size, CacheLineSize);
+        if (!slab)
+            return nullptr;
+        *(void**) slab = this->slabs;
+        this->slabs = slab;
+        this->slab_cur = slab + CacheLineSize;
+        this->slab_end = slab + this->slab_size;
+    }
+    FreeBlock* block = (FreeBlock*) this->slab_cur;
+    this->slab_cur += this->block_size;
+    return block;
+}
+
+PoolBase::ThreadCache* PoolBase::get_or_create_thread_cache() {
+    ThreadCache* tc = this->thread_cache.load();
+    if (!tc) {
+        Heap::TagScope tag_scope{"Pool"};
+        tc = Heap::create<ThreadCache>();
+        tc->pool = this;
+        LockGuard<Mutex> guard{this->mutex};
+        tc->next_cache = this->thread_caches;
+        this->thread_caches = tc;
+        this->thread_cache.store(tc);
+#if defined(PLY_WINDOWS)
+        FlsSetValue(this->thread_exit_index, tc);
+#elif defined(PLY_POSIX)
+        pthread_setspecific(this->thread_exit_key, tc);
+#endif
+    }
+    return tc;
+}
+
+void PoolBase::destroy_thread_cache(void* value) {
+    // Called when a thread exits. Return its cached blocks to the shared free list, then free the cache itself.
+    ThreadCache* tc = (ThreadCache*) value;
+    PoolBase* pool = tc->pool;
+    {
+        LockGuard<Mutex> guard{pool->mutex};
+        while (FreeBlock* cached = tc->head) {
+            tc->head = cached->next;
+            cached->next = pool->free_list;
+            pool->free_list = cached;
+        }
+        ThreadCache** link = &pool->thread_caches;
+        while (*link != tc) {
+            link = &(*link)->next_cache;
+        }
+        *link = tc->next_cache;
+    }
+    // Other exit callbacks may still use the pool. If they do, this thread gets a new cache.
+    pool->thread_cache.store((ThreadCache*) nullptr);
+    Heap::free(tc);
+}
+
+void* PoolBase::alloc_slow() {
+    if (!this->use_thread_caches) {
+        LockGuard<Mutex> guard{this->mutex};
+        return this->pop_block_locked();
+    }
+
+    // The thread cache is empty. Refill it with a batch of blocks.
+    ThreadCache* tc = this->get_or_create_thread_cache();
+    PLY_ASSERT(!tc->head);
+    LockGuard<Mutex> guard{this->mutex};
+    FreeBlock* result = this->pop_block_locked();
+    for (u32 i = 1; i < this->batch_size; i++) {
+        FreeBlock* block = this->pop_block_locked();
+        if (!block)
+            break;
+        block->next = tc->head;
+        tc->head = block;
+        tc->num_blocks++;
+    }
+    return result;
+}
+
+void PoolBase::free_slow(void* ptr) {
+    FreeBlock* block = (FreeBlock*) ptr;
+    if (!this->use_thread_caches) {
+        LockGuard<Mutex> guard{this->mutex};
+        block->next = this->free_list;
+        this->free_list = block;
+        return;
+    }
+
+    ThreadCache* tc = this->get_or_create_thread_cache();
+    if (tc->num_blocks < this->batch_size * 2) {
+        // The thread cache was just created.
+        block->next = tc->head;
+        tc->head = block;
+        tc->num_blocks++;
+        return;
+    }
+
+    // The thread cache is full. Return this block and a batch of cached blocks to the shared free list.
+    LockGuard<Mutex> guard{this->mutex};
+    block->next = this->free_list;
+    this->free_list = block;
+    for (u32 i = 0; i < this->batch_size; i++) {
+        FreeBlock* cached = tc->head;
+        tc->head = cached->next;
+        cached->next = this->free_list;
+        this->free_list = cached;
+    }
+    tc->num_blocks -= this->batch_size;
+}
+
+void PoolBase::flush_thread_cache() {
+    ThreadCache* tc = this->thread_cache.load();
+    if (!tc || !tc->head)
+        return;
+    LockGuard<Mutex> guard{this->mutex};
+    while (FreeBlock* cached = tc->head) {
+        tc->head = cached->next;
+        cached->next = this->free_list;
+        this->free_list = cached;
+    }
+    tc->num_blocks = 0;
+}
+
+#if !defined(PLY_OVERRIDE_NEW)
+#define PLY_OVERRIDE_NEW 1
+#endif
+
+#if PLY_OVERRIDE_NEW
+
+} // namespace ply
+
+//---------------------------------------------------------------------------
+// Override operators new/delete
+// C++ allows us to replace global operators new/delete with our own thanks to weak linking.
+//---------------------------------------------------------------------------
+void* operator new(std::size_t size) {
+    return ply::Heap::alloc(size);
+}
+
+void* operator new[](std::size_t size) {
+    return ply::Heap::alloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    ply::Heap::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    ply::Heap::free(ptr);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+    return ply::Heap::alloc(size);
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+    return ply::Heap::alloc(size);
+}
+
+void operator delete(void* ptr, std::nothrow_t const&) noexcept {
+    ply::Heap::free(ptr);
+}
+
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept {
+    ply::Heap::free(ptr);
+}
+
+namespace ply {
+
+#endif // PLY_OVERRIDE_NEW
+
+//   ▄▄▄▄   ▄▄          ▄▄               ▄▄   ▄▄ ▄▄
+//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
+//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
+//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██   ▀█▀   ██ ▀█▄▄▄   ██▀▀██
+//                                 ▄▄▄█▀
+
+//---------------------------------------------------------
+// String kernels
+//---------------------------------------------------------
+// Byte search, substring search and whitespace skipping have a scalar implementation and, on x64, SSE2 and AVX2
+// implementations. SSE2 is always available on x64. AVX2 is used if the CPU supports it. On other CPUs, including
+// ARM64, the scalar implementation is used.
+
+namespace {
+
+#if PLY_CPU_X64
+
+#if defined(_MSC_VER)
+#define PLY_TARGET_AVX2
+#else
+#define PLY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#endif // PLY_CPU_X64
+
+//-------------------------------------
+// Scalar
+//-------------------------------------
+
+PLY_FORCE_INLINE s32 find_byte_scalar(const char* bytes, u32 num_bytes, char c) {
+    for (u32 i = 0; i < num_bytes; i++) {
+        if (bytes[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+PLY_FORCE_INLINE s32 reverse_find_byte_scalar(const char* bytes, u32 num_bytes, char c) {
+    for (s32 i = (s32) num_bytes - 1; i >= 0; i--) {
+        if (bytes[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+// pattern_bytes must be at least 2.
+PLY_FORCE_INLINE s32 find_substr_scalar(const char* bytes, u32 num_bytes, const char* pattern, u32 pattern_bytes) {
+    for (u32 i = 0; i + pattern_bytes <= num_bytes; i++) {
+        if (bytes[i] == pattern[0] && memcmp(bytes + i + 1, pattern + 1, pattern_bytes - 1) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Returns the number of leading whitespace bytes.
+PLY_FORCE_INLINE u32 skip_whitespace_scalar(const char* bytes, u32 num_bytes) {
+    u32 i = 0;
+    while (i < num_bytes && is_whitespace(bytes[i])) {
+        i++;
+    }
+    return i;
+}
+
+// Returns the number of bytes that remain after trimming trailing whitespace.
+PLY_FORCE_INLINE u32 reverse_skip_whitespace_scalar(const char* bytes, u32 num_bytes) {
+    while (num_bytes > 0 && is_whitespace(bytes[num_bytes - 1])) {
+        num_bytes--;
+    }
+    return num_bytes;
+}
+
+#if PLY_CPU_X64
+
+//-------------------------------------
+// SSE2
+//-------------------------------------
+// These are force-inlined into the AVX2 functions below, which use them for the last few bytes, so that they're
+// compiled with VEX encoding there. Mixing legacy SSE and AVX instructions is slow on many CPUs.
+
+PLY_FORCE_INLINE u32 whitespace_mask_sse2(__m128i block) {
+    __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                                           _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r')),
+                                           _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))));
+    return (u32) _mm_movemask_epi8(ws);
+}
+
+PLY_FORCE_INLINE s32 find_byte_sse2(const char* bytes, u32 num_bytes, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    u32 i = 0;
+    for (; i + 16 <= num_bytes; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (bytes + i));
+        u32 mask = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask)
+            return i + lowest_bit_index(mask);
+    }
+    s32 r = find_byte_scalar(bytes + i, num_bytes - i, c);
+    return r < 0 ? r : i + r;
+}
+
+PLY_FORCE_INLINE s32 reverse_find_byte_sse2(const char* bytes, u32 num_bytes, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    u32 end = num_bytes;
+    for (; end >= 16; end -= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (bytes + end - 16));
+        u32 mask = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask)
+            return end - 16 + highest_bit_index(mask);
+    }
+    return reverse_find_byte_scalar(bytes, end, c);
+}
+
+// Compares 16 candidate positions at a time against the first and last bytes of the pattern, then verifies the
+// candidates that match both.
+PLY_FORCE_INLINE s32 find_substr_sse2(const char* bytes, u32 num_bytes, const char* pattern, u32 pattern_bytes) {
+    __m128i first = _mm_set1_epi8(pattern[0]);
+    __m128i last = _mm_set1_epi8(pattern[pattern_bytes - 1]);
+    u32 i = 0;
+    for (; i + pattern_bytes - 1 + 16 <= num_bytes; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*) (bytes + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i*) (bytes + i + pattern_bytes - 1));
+        u32 mask = (u32) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            u32 pos = i + lowest_bit_index(mask);
+            if (memcmp(bytes + pos + 1, pattern + 1, pattern_bytes - 2) == 0)
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+    s32 r = find_substr_scalar(bytes + i, num_bytes - i, pattern, pattern_bytes);
+    return r < 0 ? r : i + r;
+}
+
+PLY_FORCE_INLINE u32 skip_whitespace_sse2(const char* bytes, u32 num_bytes) {
+    u32 i = 0;
+    for (; i + 16 <= num_bytes; i += 16) {
+        u32 mask = ~whitespace_mask_sse2(_mm_loadu_si128((const __m128i*) (bytes + i))) & 0xffff;
+        if (mask)
+            return i + lowest_bit_index(mask);
+    }
+    return i + skip_whitespace_scalar(bytes + i, num_bytes - i);
+}
+
+PLY_FORCE_INLINE u32 reverse_skip_whitespace_sse2(const char* bytes, u32 num_bytes) {
+    u32 end = num_bytes;
+    for (; end >= 16; end -= 16) {
+        u32 mask = ~whitespace_mask_sse2(_mm_loadu_si128((const __m128i*) (bytes + end - 16))) & 0xffff;
+        if (mask)
+            return end - 16 + highest_bit_index(mask) + 1;
+    }
+    return reverse_skip_whitespace_scalar(bytes, end);
+}
+
+//-------------------------------------
+// AVX2
+//-------------------------------------
+
+PLY_TARGET_AVX2 PLY_FORCE_INLINE u32 whitespace_mask_avx2(__m256i block) {
+    __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+                                                 _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t'))),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')),
+                                                 _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n'))));
+    return (u32) _mm256_movemask_epi8(ws);
+}
+
+PLY_TARGET_AVX2 s32 find_byte_avx2(const char* bytes, u32 num_bytes, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    u32 i = 0;
+    for (; i + 32 <= num_bytes; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (bytes + i));
+        u32 mask = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask)
+            return i + lowest_bit_index(mask);
+    }
+    s32 r = find_byte_sse2(bytes + i, num_bytes - i, c);
+    return r < 0 ? r : i + r;
+}
+
+PLY_TARGET_AVX2 s32 reverse_find_byte_avx2(const char* bytes, u32 num_bytes, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    u32 end = num_bytes;
+    for (; end >= 32; end -= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (bytes + end - 32));
+        u32 mask = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask)
+            return end - 32 + highest_bit_index(mask);
+    }
+    return reverse_find_byte_sse2(bytes, end, c);
+}
+
+PLY_TARGET_AVX2 s32 find_substr_avx2(const char* bytes, u32 num_bytes, const char* pattern, u32 pattern_bytes) {
+    __m256i first = _mm256_set1_epi8(pattern[0]);
+    __m256i last = _mm256_set1_epi8(pattern[pattern_bytes - 1]);
+    u32 i = 0;
+    for (; i + pattern_bytes - 1 + 32 <= num_bytes; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*) (bytes + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*) (bytes + i + pattern_bytes - 1));
+        u32 mask = (u32) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        while (mask) {
+            u32 pos = i + lowest_bit_index(mask);
+            if (memcmp(bytes + pos + 1, pattern + 1, pattern_bytes - 2) == 0)
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+    s32 r = find_substr_sse2(bytes + i, num_bytes - i, pattern, pattern_bytes);
+    return r < 0 ? r : i + r;
+}
+
+PLY_TARGET_AVX2 u32 skip_whitespace_avx2(const char* bytes, u32 num_bytes) {
+    u32 i = 0;
+    for (; i + 32 <= num_bytes; i += 32) {
+        u32 mask = ~whitespace_mask_avx2(_mm256_loadu_si256((const __m256i*) (bytes + i)));
+        if (mask)
+            return i + lowest_bit_index(mask);
+    }
+    return i + skip_whitespace_sse2(bytes + i, num_bytes - i);
+}
+
+PLY_TARGET_AVX2 u32 reverse_skip_whitespace_avx2(const char* bytes, u32 num_bytes) {
+    u32 end = num_bytes;
+    for (; end >= 32; end -= 32) {
+        u32 mask = ~whitespace_mask_avx2(_mm256_loadu_si256((const __m256i*) (bytes + end - 32)));
+        if (mask)
+            return end - 32 + highest_bit_index(mask) + 1;
+    }
+    return reverse_skip_whitespace_sse2(bytes, end);
+}
+
+bool cpu_supports_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && ((_xgetbv(0) & 6) == 6);
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PLY_CPU_X64
+
+//-------------------------------------
+// Dispatch
+//-------------------------------------
+
+struct StringKernels {
+    StringSIMD simd;
+    s32 (*find_byte)(const char* bytes, u32 num_bytes, char c);
+    s32 (*reverse_find_byte)(const char* bytes, u32 num_bytes, char c);
+    s32 (*find_substr)(const char* bytes, u32 num_bytes, const char* pattern, u32 pattern_bytes);
+    u32 (*skip_whitespace)(const char* bytes, u32 num_bytes);
+    u32 (*reverse_skip_whitespace)(const char* bytes, u32 num_bytes);
+};
+
+bool get_string_kernels(StringKernels* kernels, StringSIMD simd) {
+    switch (simd) {
+        case StringSIMD::None: {
+            *kernels = {simd,
+                        find_byte_scalar,
+                        reverse_find_byte_scalar,
+                        find_substr_scalar,
+                        skip_whitespace_scalar,
+                        reverse_skip_whitespace_scalar};
+            return true;
+        }
+#if PLY_CPU_X64
+        case StringSIMD::SSE2: {
+            *kernels = {simd,
+                        find_byte_sse2,
+                        reverse_find_byte_sse2,
+                        find_substr_sse2,
+                        skip_whitespace_sse2,
+                        reverse_skip_whitespace_sse2};
+            return true;
+        }
+        case StringSIMD::AVX2: {
+            if (!cpu_supports_avx2())
+                return false;
+            *kernels = {simd,
+                        find_byte_avx2,
+                        reverse_find_byte_avx2,
+                        find_substr_avx2,
+                        skip_whitespace_avx2,
+                        reverse_skip_whitespace_avx2};
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+StringKernels& string_kernels() {
+    static StringKernels kernels = []() {
+        StringKernels result;
+        for (StringSIMD simd : {StringSIMD::AVX2, StringSIMD::SSE2, StringSIMD::None}) {
+            if (get_string_kernels(&result, simd))
+                break;
+        }
+        return result;
+    }();
+    return kernels;
+}
+
+} // namespace
+
+StringSIMD get_string_simd() {
+    return string_kernels().simd;
+}
+
+bool set_string_simd(StringSIMD simd) {
+    return get_string_kernels(&string_kernels(), simd);
+}
+
+//---------------------------------------------------------
+
+bool StringView::starts_with(StringView other) const {
+    if (other.num_bytes_ > this->num_bytes_)
+        return false;
+    return memcmp(this->bytes_, other.bytes_, other.num_bytes_) == 0;
+}
+
+bool StringView::ends_with(StringView other) const {
+    if (other.num_bytes_ > this->num_bytes_)
+        return false;
+    return memcmp(this->bytes_ + this->num_bytes_ - other.num_bytes_, other.bytes_, other.num_bytes_) == 0;
+}
+
+StringView StringView::trim(bool (*match_func)(char), bool left, bool right) const {
+    if (match_func == is_whitespace) {
+        const StringKernels& kernels = string_kernels();
+        u32 start = left ? kernels.skip_whitespace(this->bytes_, this->num_bytes_) : 0;
+        u32 end = this->num_bytes_;
+        if (right) {
+            end = start + kernels.reverse_skip_whitespace(this->bytes_ + start, end - start);
+        }
+        return {this->bytes_ + start, end - start};
+    }
+    const char* start = this->bytes_;
+    const char* end = start + this->num_bytes_;
+    if (left) {
+        while ((start < end) && match_func(*start)) {
+            start++;
         }
-        start = pos + separator.num_bytes_;
     }
-    if (result.is_empty()) {
-        result.append({});
+    if (right) {
+        while ((start < end) && match_func(end[-1])) {
+            end--;
+        }
     }
-    return result;
+    return {start, end};
 }
 
 String StringView::replace(StringView old_substr, StringView new_substr) const {
     PLY_ASSERT(old_substr.num_bytes_ > 0);
     MemStream out;
-    u32 limit = this->num_bytes_ - old_substr.num_bytes_;
     u32 i = 0;
-    for (; i < limit; i++) {
-        if (memcmp(this->bytes_ + i, old_substr.bytes_, old_substr.num_bytes_) == 0) {
-            out.write(new_substr);
-            i += old_substr.num_bytes_ - 1;
-        } else {
-            out.write(this->bytes_[i]);
-        }
-    }
-    if (i < this->num_bytes_) {
-        out.write({this->bytes_ + i, this->bytes_ + this->num_bytes_});
+    for (;;) {
+        s32 pos = this->find(old_substr, i);
+        if (pos < 0)
+            break;
+        out.write({this->bytes_ + i, this->bytes_ + pos});
+        out.write(new_substr);
+        i = pos + old_substr.num_bytes_;
     }
+    out.write({this->bytes_ + i, this->bytes_ + this->num_bytes_});
     return out.move_to_string();
 }
 
@@ -732,16 +2361,12 @@ String StringView::join(ArrayView<const StringView> comps) const {
 }
 
 s32 compare(StringView a, StringView b) {
+    // memcmp is already vectorized by the C runtime.
     u32 compare_bytes = min(a.num_bytes(), b.num_bytes());
-    const u8* u0 = (const u8*) a.bytes();
-    const u8* u1 = (const u8*) b.bytes();
-    const u8* u_end0 = u0 + compare_bytes;
-    while (u0 < u_end0) {
-        s32 diff = *u0 - *u1;
+    if (compare_bytes > 0) {
+        s32 diff = memcmp(a.bytes(), b.bytes(), compare_bytes);
         if (diff != 0)
             return diff;
-        u0++;
-        u1++;
     }
     return a.num_bytes() - b.num_bytes();
 }
@@ -766,16 +2391,14 @@ String operator*(StringView str, u32 count) {
 s32 StringView::find(StringView pattern, u32 start_pos) const {
     if (start_pos + pattern.num_bytes_ > this->num_bytes_)
         return -1;
-    u32 limit = this->num_bytes_ - pattern.num_bytes_;
-    for (; start_pos <= limit; start_pos++) {
-        for (u32 i = 0; i < pattern.num_bytes_; i++) {
-            if (pattern.bytes_[i] != this->bytes_[start_pos + i])
-                goto next;
-        }
+    if (pattern.num_bytes_ == 0)
         return start_pos;
-    next:;
-    }
-    return -1;
+    const StringKernels& kernels = string_kernels();
+    s32 pos = (pattern.num_bytes_ == 1)
+                  ? kernels.find_byte(this->bytes_ + start_pos, this->num_bytes_ - start_pos, pattern.bytes_[0])
+                  : kernels.find_substr(this->bytes_ + start_pos, this->num_bytes_ - start_pos, pattern.bytes_,
+                                        pattern.num_bytes_);
+    return (pos < 0) ? pos : start_pos + pos;
 }
 
 s32 StringView::reverse_find(StringView pattern, s32 start_pos) const {
@@ -785,6 +2408,11 @@ s32 StringView::reverse_find(StringView pattern, s32 start_pos) const {
     if (start_pos + pattern.num_bytes_ >= this->num_bytes_) {
         start_pos = (s32) this->num_bytes_ - pattern.num_bytes_;
     }
+    if (pattern.num_bytes_ == 1) {
+        if (start_pos < 0)
+            return -1;
+        return string_kernels().reverse_find_byte(this->bytes_, start_pos + 1, pattern.bytes_[0]);
+    }
     for (; start_pos >= 0; start_pos--) {
         for (u32 i = 0; i < pattern.num_bytes_; i++) {
             if (pattern.bytes_[i] != this->bytes_[start_pos + i])
@@ -987,157 +2615,1182 @@ static bool match_pattern_segment(MatchState& state, MatchMode mode) {
                 PLY_ASSERT(0); // Expected a character to follow `'`.
                 return false;
             }
-            char escaped = *state.pattern->cur_byte++;
-            if (mode == MatchMode::Matching) {
-                if (state.str->make_readable() && *state.str->cur_byte == escaped) {
-                    element_matched = true;
-                    state.str->cur_byte++;
-                }
+            char escaped = *state.pattern->cur_byte++;
+            if (mode == MatchMode::Matching) {
+                if (state.str->make_readable() && *state.str->cur_byte == escaped) {
+                    element_matched = true;
+                    state.str->cur_byte++;
+                }
+            }
+        } else {
+            PLY_ASSERT((pattern_element != '*') && (pattern_element != '?')); // Unexpected quantifier.
+            if (mode == MatchMode::Matching) {
+                if (state.str->make_readable() && *state.str->cur_byte == pattern_element) {
+                    element_matched = true;
+                    state.str->cur_byte++;
+                }
+            }
+        }
+
+        if (state.pattern->make_readable()) {
+            char c = *state.pattern->cur_byte;
+            if (c == '?') {
+                // It's a question mark. Make the current element optional.
+                state.pattern->cur_byte++;
+                if ((mode == MatchMode::Matching) && !element_matched) {
+                    // The current element didn't match, but was optional.
+                    // Revert the input string to the start of the current element.
+                    state.str->cur_byte = input_at_start_of_current_element;
+                }
+                continue;
+            } else if (c == '*') {
+                // It's a star. Make the current element repeatable.
+                state.pattern->cur_byte++;
+                // It's illegal to capture variables inside repeated elements:
+                PLY_ASSERT(state.arg_index == arg_index_at_start_of_current_element); // No repeated captures!
+                if ((mode == MatchMode::Matching) && element_matched) {
+                    // The current element matched. Rewind the pattern to the start of the current element
+                    // and try to match it again.
+                    state.pattern->cur_byte = pattern_at_start_of_current_element;
+                } else {
+                    // The current element didn't match, but was repeatable.
+                    // Revert the input string to the start of the current element.
+                    state.str->cur_byte = input_at_start_of_current_element;
+                }
+                continue;
+            }
+        }
+
+        if ((mode == MatchMode::Matching) && !element_matched) {
+            // The current element didn't match.
+            current_clause_succeeded = false;
+        }
+    }
+
+    // We reached the end of the segment.
+    if ((mode == MatchMode::Matching) && current_clause_succeeded) {
+        any_clause_succeeded = true;
+        for (Functor<void()>& commit : output_variables_to_commit) {
+            commit();
+        }
+    }
+
+    return any_clause_succeeded;
+}
+
+bool match_with_args(ViewStream& in, StringView pattern, ArrayView<const MatchArg> match_args) {
+    MatchState state;
+    ViewStream pattern_in{pattern};
+    state.str = &in;
+    state.pattern = &pattern_in;
+    state.match_args = match_args;
+    state.arg_index = 0;
+
+    if (!match_pattern_segment(state, MatchMode::Matching))
+        return false;
+
+    if (state.pattern->make_readable() && (*state.pattern->cur_byte == '$')) {
+        if (state.str->make_readable())
+            return false; // Expected end of string
+    }
+
+    // Check that we consumed all match args
+    PLY_ASSERT(state.arg_index == match_args.num_items());
+
+    return true;
+}
+
+//   ▄▄▄▄   ▄▄          ▄▄
+//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
+//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██
+//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██
+//                                 ▄▄▄█▀
+
+#if PLY_STRING_INLINE
+PLY_STATIC_ASSERT(sizeof(String) == String::InlineCapacity + 1);
+#endif
+
+String::String(StringView other) : String{allocate(other.num_bytes())} {
+    memcpy(this->bytes(), other.bytes(), other.num_bytes());
+}
+
+#if PLY_STRING_INLINE
+
+String String::allocate(u32 num_bytes) {
+    String result;
+    if (num_bytes <= InlineCapacity) {
+        result.set_inline(num_bytes);
+    } else {
+        result.set_heap((char*) Heap::alloc(num_bytes), num_bytes);
+    }
+    return result;
+}
+
+String String::adopt(char* bytes, u32 num_bytes) {
+    String result;
+    if (num_bytes <= InlineCapacity) {
+        memcpy(result.inline_, bytes, num_bytes);
+        result.set_inline(num_bytes);
+        Heap::free(bytes);
+    } else {
+        result.set_heap(bytes, num_bytes);
+    }
+    return result;
+}
+
+void String::resize(u32 num_bytes) {
+    if (this->is_inline()) {
+        if (num_bytes <= InlineCapacity) {
+            this->set_inline(num_bytes);
+        } else {
+            char* bytes = (char*) Heap::alloc(num_bytes);
+            memcpy(bytes, this->inline_, this->num_bytes());
+            this->set_heap(bytes, num_bytes);
+        }
+    } else {
+        if (num_bytes <= InlineCapacity) {
+            char* bytes = this->heap_.bytes;
+            memcpy(this->inline_, bytes, num_bytes);
+            this->set_inline(num_bytes);
+            Heap::free(bytes);
+        } else {
+            this->set_heap((char*) Heap::realloc(this->heap_.bytes, num_bytes), num_bytes);
+        }
+    }
+}
+
+char* String::release() {
+    char* bytes;
+    if (this->is_inline()) {
+        u32 num_bytes = this->num_bytes();
+        bytes = (char*) Heap::alloc(num_bytes);
+        memcpy(bytes, this->inline_, num_bytes);
+    } else {
+        bytes = this->heap_.bytes;
+    }
+    new (this) String;
+    return bytes;
+}
+
+#else
+
+String String::allocate(u32 num_bytes) {
+    String result;
+    result.bytes_ = (char*) Heap::alloc(num_bytes);
+    result.num_bytes_ = num_bytes;
+    return result;
+}
+
+String String::adopt(char* bytes, u32 num_bytes) {
+    String result;
+    result.bytes_ = bytes;
+    result.num_bytes_ = num_bytes;
+    return result;
+}
+
+void String::resize(u32 num_bytes) {
+    this->bytes_ = (char*) Heap::realloc(this->bytes_, num_bytes);
+    this->num_bytes_ = num_bytes;
+}
+
+char* String::release() {
+    char* bytes = this->bytes_;
+    this->bytes_ = nullptr;
+    this->num_bytes_ = 0;
+    return bytes;
+}
+
+#endif
+
+//  ▄▄  ▄▄               ▄▄     ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
+//  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██ ██  ██ ██  ██
+//  ██  ██ ▀█▄▄██  ▄▄▄█▀ ██  ██ ██ ██  ██ ▀█▄▄██
+//                                         ▄▄▄█▀
+
+namespace {
+
+PLY_FORCE_INLINE u64 read_u64(const u8* p) {
+    u64 v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+PLY_FORCE_INLINE u64 read_u32(const u8* p) {
+    u32 v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+} // namespace
+
+// A wyhash-style kernel. Keys up to 16 bytes are handled with at most four overlapping reads and no loop. Longer keys
+// are consumed 48 bytes at a time along three independent multiply chains.
+void add_to_hash(HashBuilder& builder, StringView str) {
+    static constexpr u64 Secret2 = 0x4b33a62ed433d4a3ull;
+    static constexpr u64 Secret3 = 0x4d5a2da51de1aa47ull;
+    const u8* p = (const u8*) str.bytes();
+    u32 num_bytes = str.num_bytes();
+    // As in wyhash's seeded form, the seed is premixed and folded into every secret before any key bytes are mixed
+    // in. Otherwise, a key word equal to a public secret would zero one factor of a multiply, and crafted keys would
+    // collide under every seed.
+    u64 seed = builder.accumulator;
+    seed ^= multiply_and_fold(seed ^ HashBuilder::Secret0, HashBuilder::Secret1);
+    u64 secret1 = HashBuilder::Secret1 ^ seed;
+    u64 a;
+    u64 b;
+    if (num_bytes <= 16) {
+        if (num_bytes >= 4) {
+            u32 mid = (num_bytes >> 3) << 2;
+            a = (read_u32(p) << 32) | read_u32(p + mid);
+            b = (read_u32(p + num_bytes - 4) << 32) | read_u32(p + num_bytes - 4 - mid);
+        } else if (num_bytes > 0) {
+            a = (u64{p[0]} << 16) | (u64{p[num_bytes >> 1]} << 8) | p[num_bytes - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        u32 i = num_bytes;
+        if (i > 48) {
+            u64 secret2 = Secret2 ^ seed;
+            u64 secret3 = Secret3 ^ seed;
+            u64 seed1 = seed;
+            u64 seed2 = seed;
+            do {
+                seed = multiply_and_fold(read_u64(p) ^ secret1, read_u64(p + 8) ^ seed);
+                seed1 = multiply_and_fold(read_u64(p + 16) ^ secret2, read_u64(p + 24) ^ seed1);
+                seed2 = multiply_and_fold(read_u64(p + 32) ^ secret3, read_u64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = multiply_and_fold(read_u64(p) ^ secret1, read_u64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read_u64(p + i - 16);
+        b = read_u64(p + i - 8);
+    }
+    multiply_128(a ^ secret1, b ^ seed, &a, &b);
+    builder.accumulator = multiply_and_fold(a ^ HashBuilder::Secret0 ^ num_bytes, b ^ secret1);
+}
+
+u64 generate_hash_seed() {
+    // Read the seed from the OS entropy source. Random{} is seeded from the clock and the thread ID, which an attacker
+    // could narrow down.
+    u64 seed = 0;
+    bool ok = false;
+#if defined(PLY_WINDOWS)
+    ok = RtlGenRandom(&seed, sizeof(seed)) != 0;
+#elif defined(PLY_APPLE)
+    arc4random_buf(&seed, sizeof(seed));
+    ok = true;
+#elif defined(PLY_POSIX)
+#if defined(SYS_getrandom)
+    ok = syscall(SYS_getrandom, &seed, sizeof(seed), 0) == sizeof(seed);
+#endif
+    if (!ok) {
+        int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ok = read(fd, &seed, sizeof(seed)) == sizeof(seed);
+            close(fd);
+        }
+    }
+#endif
+    if (!ok) {
+        // Better than no seed at all.
+        seed = Random{}.generate_u64();
+    }
+    return seed | 1;
+}
+
+//  ▄▄  ▄▄               ▄▄     ▄▄                  ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ██     ▄▄▄▄   ▄▄▄▄  ██  ▄▄ ▄▄  ▄▄ ▄▄▄▄▄
+//  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██    ██  ██ ██  ██ ██▄█▀  ██  ██ ██  ██
+//  ██  ██ ▀█▄▄██  ▄▄▄█▀ ██  ██ ██▄▄▄ ▀█▄▄█▀ ▀█▄▄█▀ ██ ▀█▄ ▀█▄▄██ ██▄▄█▀
+//                                                                ██
+
+u32 get_best_num_hash_indices(u32 num_items) {
+    if (num_items >= 8) {
+        return round_up_to_nearest_to_power_of_2(u32((u64{num_items} * 5) >> 2));
+    }
+    return (num_items < 4) ? 4 : 8;
+}
+
+//   ▄▄▄▄    ▄▄
+//  ██  ██ ▄██▄▄  ▄▄▄▄  ▄▄▄▄▄▄▄
+//  ██▀▀██  ██   ██  ██ ██ ██ ██
+//  ██  ██  ▀█▄▄ ▀█▄▄█▀ ██ ██ ██
+//
+
+AtomTable& AtomTable::get_default() {
+    static AtomTable* table = []() {
+        Heap::TagScope tag_scope{"AtomTable"};
+        return Heap::create<AtomTable>();
+    }();
+    return *table;
+}
+
+Atom AtomTable::add_locked(StringView str) {
+    auto result = this->map.insert(str);
+    if (!result.was_found) {
+        StringView copied = this->arena.copy(str);
+        Atom::Entry* entry = this->arena.create<Atom::Entry>(Atom::Entry{copied, this->map.items().num_items()});
+        // Point the key at the copy so that it outlives the caller's string.
+        this->map.items().back().key = copied;
+        *result.value = entry;
+    }
+    return Atom{*result.value};
+}
+
+Atom AtomTable::intern(StringView str) {
+    if (str.is_empty())
+        return {};
+    Atom atom = this->find(str);
+    if (!atom.is_empty())
+        return atom;
+    this->lock.lock_exclusive();
+    atom = this->add_locked(str);
+    this->lock.unlock_exclusive();
+    return atom;
+}
+
+void AtomTable::intern(ArrayView<const StringView> strs, ArrayView<Atom> out) {
+    PLY_ASSERT(strs.num_items() == out.num_items());
+    bool any_missing = false;
+    this->lock.lock_shared();
+    for (u32 i = 0; i < strs.num_items(); i++) {
+        const Atom::Entry* const* entry = this->map.find(strs[i]);
+        out[i] = entry ? Atom{*entry} : Atom{};
+        any_missing |= (!entry && !strs[i].is_empty());
+    }
+    this->lock.unlock_shared();
+    if (!any_missing)
+        return;
+    this->lock.lock_exclusive();
+    for (u32 i = 0; i < strs.num_items(); i++) {
+        if (out[i].is_empty() && !strs[i].is_empty()) {
+            out[i] = this->add_locked(strs[i]);
+        }
+    }
+    this->lock.unlock_exclusive();
+}
+
+Atom AtomTable::find(StringView str) const {
+    this->lock.lock_shared();
+    const Atom::Entry* const* entry = this->map.find(str);
+    Atom atom = entry ? Atom{*entry} : Atom{};
+    this->lock.unlock_shared();
+    return atom;
+}
+
+u32 AtomTable::num_atoms() const {
+    this->lock.lock_shared();
+    u32 num_atoms = this->map.items().num_items();
+    this->lock.unlock_shared();
+    return num_atoms;
+}
+
+//  ▄▄▄▄▄▄ ▄▄                              ▄▄  ▄▄▄▄▄                ▄▄
+//    ██   ██▄▄▄  ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄   ▄▄▄██  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//    ██   ██  ██ ██  ▀▀ ██▄▄██  ▄▄▄██ ██  ██  ██▀▀▀  ██  ██ ██  ██ ██
+//    ██   ██  ██ ██     ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+u32 get_num_cpu_cores() {
+#if defined(PLY_WINDOWS)
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    return max<u32>(sys_info.dwNumberOfProcessors, 1);
+#elif defined(PLY_POSIX)
+    long result = sysconf(_SC_NPROCESSORS_ONLN);
+    return max<u32>((u32) result, 1);
+#endif
+}
+
+namespace {
+
+// Chase-Lev work-stealing deque of pointers, using the memory orderings from "Correct and Efficient
+// Work-Stealing for Weak Memory Models" (Lê et al., 2013). The owning thread pushes and pops at the
+// bottom, and other threads steal from the top. A ring that's outgrown is kept until the deque is
+// destroyed, because a thief might still be reading from it.
+template <typename T>
+class WorkStealingDeque {
+private:
+    struct Ring {
+        s64 mask;
+        Ring* prev;
+        Atomic<T*> items[1]; // Actually mask + 1 items.
+    };
+
+    Atomic<s64> top = 0;
+    Atomic<s64> bottom = 0;
+    Atomic<Ring*> ring;
+
+    static Ring* create_ring(s64 num_items, Ring* prev) {
+        Ring* ring = (Ring*) Heap::alloc(sizeof(Ring) + sizeof(Atomic<T*>) * (num_items - 1));
+        ring->mask = num_items - 1;
+        ring->prev = prev;
+        for (s64 i = 0; i < num_items; i++) {
+            new (&ring->items[i]) Atomic<T*>{nullptr};
+        }
+        return ring;
+    }
+
+public:
+    WorkStealingDeque() : ring{create_ring(256, nullptr)} {
+    }
+    ~WorkStealingDeque() {
+        Ring* ring = this->ring.load_relaxed();
+        while (ring) {
+            Ring* prev = ring->prev;
+            Heap::free(ring);
+            ring = prev;
+        }
+    }
+    u32 num_items() const {
+        s64 num_items = this->bottom.load_relaxed() - this->top.load_relaxed();
+        return num_items > 0 ? (u32) num_items : 0;
+    }
+    // Only the owning thread can call push.
+    void push(T* item) {
+        s64 b = this->bottom.load_relaxed();
+        s64 t = this->top.load_acquire();
+        Ring* ring = this->ring.load_relaxed();
+        if (b - t > ring->mask) {
+            Ring* new_ring = create_ring((ring->mask + 1) * 2, ring);
+            for (s64 i = t; i < b; i++) {
+                new_ring->items[i & new_ring->mask].store_relaxed(ring->items[i & ring->mask].load_relaxed());
+            }
+            this->ring.store_release(new_ring);
+            ring = new_ring;
+        }
+        ring->items[b & ring->mask].store_relaxed(item);
+        this->bottom.store_release(b + 1);
+    }
+    // Only the owning thread can call pop. Returns nullptr if the deque is empty.
+    T* pop() {
+        s64 b = this->bottom.load_relaxed() - 1;
+        Ring* ring = this->ring.load_relaxed();
+        this->bottom.store_relaxed(b);
+        thread_fence_seq_cst();
+        s64 t = this->top.load_relaxed();
+        if (t > b) {
+            this->bottom.store_relaxed(b + 1);
+            return nullptr;
+        }
+        T* item = ring->items[b & ring->mask].load_relaxed();
+        if (t == b) {
+            // This is the last item, so a thief might be trying to take it too.
+            if (this->top.compare_exchange_acq_rel(t, t + 1) != t) {
+                item = nullptr;
+            }
+            this->bottom.store_relaxed(b + 1);
+        }
+        return item;
+    }
+    // Any thread can call steal. Returns nullptr if the deque is empty or if another thread took the
+    // item first, in which case lost_race is set.
+    T* steal(bool& lost_race) {
+        s64 t = this->top.load_acquire();
+        thread_fence_seq_cst();
+        s64 b = this->bottom.load_acquire();
+        if (t >= b)
+            return nullptr;
+        Ring* ring = this->ring.load_acquire();
+        T* item = ring->items[t & ring->mask].load_relaxed();
+        if (this->top.compare_exchange_acq_rel(t, t + 1) != t) {
+            lost_race = true;
+            return nullptr;
+        }
+        return item;
+    }
+};
+
+// Increments a counter that only one thread writes to, but that other threads can read.
+template <typename T>
+void increment_counter(Atomic<T>& counter) {
+    counter.store_relaxed(counter.load_relaxed() + 1);
+}
+
+} // namespace
+
+struct ThreadPool::Job {
+    Functor<void()> func;
+    JobCounter* counter = nullptr;
+};
+
+struct ThreadPool::Worker {
+    ThreadPool* pool = nullptr;
+    u32 random_state = 0; // For choosing which worker to steal from.
+    WorkStealingDeque<Job> deque;
+    Thread thread;
+
+    // Only this worker writes to these.
+    Atomic<u64> num_jobs_run = 0;
+    Atomic<u64> num_steals = 0;
+    Atomic<u64> num_failed_steals = 0;
+    Atomic<u64> num_sleeps = 0;
+    Atomic<u32> max_queue_depth = 0;
+};
+
+ThreadLocal<ThreadPool::Worker*> ThreadPool::current_worker;
+
+ThreadPool::ThreadPool(u32 num_workers) {
+    for (u32 i = 0; i < num_workers; i++) {
+        Worker* worker = Heap::create<Worker>();
+        worker->pool = this;
+        worker->random_state = i + 1;
+        this->workers.append(worker);
+    }
+    // Start the threads only once every worker exists, since they steal from each other.
+    for (Owned<Worker>& worker : this->workers) {
+        Worker* w = worker.get();
+        w->thread.run([this, w] { this->worker_loop(w); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    this->exiting.store_release(1);
+    this->wake_sema.signal(this->workers.num_items());
+    for (Owned<Worker>& worker : this->workers) {
+        worker->thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::get_default() {
+    static ThreadPool* pool = []() {
+        Heap::TagScope tag_scope{"ThreadPool"};
+        return Heap::create<ThreadPool>(get_num_cpu_cores() - 1);
+    }();
+    return *pool;
+}
+
+ThreadPool::Worker* ThreadPool::get_current_worker() const {
+    Worker* worker = current_worker.load();
+    return (worker && worker->pool == this) ? worker : nullptr;
+}
+
+void ThreadPool::push_job(Job* job) {
+    if (this->workers.is_empty()) {
+        // There's nobody else to run it.
+        this->run_job(nullptr, job);
+        return;
+    }
+    if (Worker* worker = this->get_current_worker()) {
+        worker->deque.push(job);
+        u32 depth = worker->deque.num_items();
+        if (depth > worker->max_queue_depth.load_relaxed()) {
+            worker->max_queue_depth.store_relaxed(depth);
+        }
+    } else {
+        LockGuard<Mutex> guard{this->external_mutex};
+        this->external_jobs.append(job);
+        this->num_external_jobs.fetch_add_acq_rel(1);
+    }
+    // Pairs with the fence in worker_loop. Either the sleeping worker sees this job, or we see it's
+    // about to sleep.
+    thread_fence_seq_cst();
+    if (this->num_sleeping.load_relaxed() > 0) {
+        this->wake_one_worker();
+    }
+    // A thread blocked in wait() might be waiting on this job, and every worker might be busy.
+    if (this->num_waiters.load_relaxed() > 0) {
+        this->wake_waiters();
+    }
+}
+
+ThreadPool::Job* ThreadPool::find_job(Worker* worker) {
+    if (worker) {
+        if (Job* job = worker->deque.pop())
+            return job;
+    }
+    if (this->num_external_jobs.load_acquire() > 0) {
+        LockGuard<Mutex> guard{this->external_mutex};
+        if (this->external_head < this->external_jobs.num_items()) {
+            Job* job = this->external_jobs[this->external_head++];
+            // Drop the consumed jobs once they make up half the array, so the array stays bounded
+            // even if it never fully drains. Each job is shifted at most once per halving, so this
+            // is amortized O(1).
+            if (this->external_head * 2 >= this->external_jobs.num_items()) {
+                this->external_jobs.erase(0, this->external_head);
+                this->external_head = 0;
+            }
+            this->num_external_jobs.fetch_sub_acq_rel(1);
+            return job;
+        }
+    }
+
+    // Try to steal, starting from a random worker.
+    u32 num_workers = this->workers.num_items();
+    u32 start = 0;
+    if (worker) {
+        worker->random_state = worker->random_state * 1664525u + 1013904223u;
+        start = worker->random_state >> 16;
+    }
+    for (u32 i = 0; i < num_workers; i++) {
+        Worker* victim = this->workers[(start + i) % num_workers];
+        if (victim == worker)
+            continue;
+        bool lost_race = false;
+        Job* job = victim->deque.steal(lost_race);
+        if (worker) {
+            if (job) {
+                increment_counter(worker->num_steals);
+            } else if (lost_race) {
+                increment_counter(worker->num_failed_steals);
             }
-        } else {
-            PLY_ASSERT((pattern_element != '*') && (pattern_element != '?')); // Unexpected quantifier.
-            if (mode == MatchMode::Matching) {
-                if (state.str->make_readable() && *state.str->cur_byte == pattern_element) {
-                    element_matched = true;
-                    state.str->cur_byte++;
+        }
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+bool ThreadPool::has_work() const {
+    if (this->num_external_jobs.load_relaxed() > 0)
+        return true;
+    for (const Owned<Worker>& worker : this->workers) {
+        if (worker->deque.num_items() > 0)
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::run_job(Worker* worker, Job* job) {
+    job->func();
+    JobCounter* counter = job->counter;
+    Heap::destroy(job);
+    // Count the job before decrementing the counter, so that get_stats() includes it once wait() returns.
+    if (worker) {
+        increment_counter(worker->num_jobs_run);
+    } else {
+        this->num_external_jobs_run.fetch_add_acq_rel(1);
+    }
+    // Don't touch counter after decrementing it. The thread waiting on it may return and free it.
+    if (counter && counter->num_pending.fetch_sub_acq_rel(1) == 1) {
+        // Pairs with the fence in wait().
+        thread_fence_seq_cst();
+        if (this->num_waiters.load_relaxed() > 0) {
+            this->wake_waiters();
+        }
+    }
+}
+
+void ThreadPool::wake_one_worker() {
+    u32 num_sleeping = this->num_sleeping.load_relaxed();
+    while (num_sleeping > 0) {
+        u32 prev = this->num_sleeping.compare_exchange_acq_rel(num_sleeping, num_sleeping - 1);
+        if (prev == num_sleeping) {
+            this->wake_sema.signal();
+            return;
+        }
+        num_sleeping = prev;
+    }
+}
+
+void ThreadPool::wake_waiters() {
+    // Taking the lock ensures that a waiter has either seen the change or is inside waiter_cond.wait.
+    LockGuard<Mutex> guard{this->waiter_mutex};
+    this->waiter_cond.wake_all();
+}
+
+void ThreadPool::worker_loop(Worker* worker) {
+    current_worker.store(worker);
+    for (;;) {
+        if (Job* job = this->find_job(worker)) {
+            this->run_job(worker, job);
+            continue;
+        }
+        if (this->exiting.load_acquire())
+            break;
+
+        // Announce that this worker is going to sleep, then check for work once more, so that a job
+        // pushed in the meantime either gets seen here or sends a wakeup.
+        this->num_sleeping.fetch_add_acq_rel(1);
+        thread_fence_seq_cst();
+        if (this->has_work() || this->exiting.load_acquire()) {
+            // Take back the announcement. If a wakeup was already sent for it, consume the wakeup.
+            u32 num_sleeping = this->num_sleeping.load_relaxed();
+            for (;;) {
+                if (num_sleeping == 0) {
+                    this->wake_sema.wait();
+                    break;
                 }
+                u32 prev = this->num_sleeping.compare_exchange_acq_rel(num_sleeping, num_sleeping - 1);
+                if (prev == num_sleeping)
+                    break;
+                num_sleeping = prev;
             }
+            continue;
         }
+        increment_counter(worker->num_sleeps);
+        this->wake_sema.wait();
+    }
+    current_worker.store((Worker*) nullptr);
+}
 
-        if (state.pattern->make_readable()) {
-            char c = *state.pattern->cur_byte;
-            if (c == '?') {
-                // It's a question mark. Make the current element optional.
-                state.pattern->cur_byte++;
-                if ((mode == MatchMode::Matching) && !element_matched) {
-                    // The current element didn't match, but was optional.
-                    // Revert the input string to the start of the current element.
-                    state.str->cur_byte = input_at_start_of_current_element;
-                }
-                continue;
-            } else if (c == '*') {
-                // It's a star. Make the current element repeatable.
-                state.pattern->cur_byte++;
-                // It's illegal to capture variables inside repeated elements:
-                PLY_ASSERT(state.arg_index == arg_index_at_start_of_current_element); // No repeated captures!
-                if ((mode == MatchMode::Matching) && element_matched) {
-                    // The current element matched. Rewind the pattern to the start of the current element
-                    // and try to match it again.
-                    state.pattern->cur_byte = pattern_at_start_of_current_element;
-                } else {
-                    // The current element didn't match, but was repeatable.
-                    // Revert the input string to the start of the current element.
-                    state.str->cur_byte = input_at_start_of_current_element;
-                }
-                continue;
+void ThreadPool::submit(Functor<void()>&& job) {
+    this->push_job(Heap::create<Job>(Job{std::move(job), nullptr}));
+}
+
+void ThreadPool::spawn(JobCounter& counter, Functor<void()>&& job) {
+    counter.num_pending.fetch_add_acq_rel(1);
+    this->push_job(Heap::create<Job>(Job{std::move(job), &counter}));
+}
+
+void ThreadPool::wait(JobCounter& counter) {
+    Worker* worker = this->get_current_worker();
+    u32 num_spins = 0;
+    while (counter.num_pending.load_acquire() > 0) {
+        if (Job* job = this->find_job(worker)) {
+            this->run_job(worker, job);
+            num_spins = 0;
+            continue;
+        }
+        if (this->has_work()) {
+            // A job is queued, but another thread took it first or won the race to steal it. Back off before
+            // trying again instead of spinning.
+            if (num_spins < LockSpinCount) {
+                num_spins++;
+                cpu_relax();
+            } else {
+                yield_thread();
             }
+            continue;
+        }
+        // The remaining jobs are running on other threads, or the counter is waiting on a Promise.
+        // Announce that this thread is going to block, then check once more, so that a change made in
+        // the meantime either gets seen here or sends a wakeup.
+        LockGuard<Mutex> guard{this->waiter_mutex};
+        this->num_waiters.fetch_add_acq_rel(1);
+        thread_fence_seq_cst();
+        if (counter.num_pending.load_relaxed() > 0 && !this->has_work()) {
+            this->waiter_cond.wait(guard);
         }
+        this->num_waiters.fetch_sub_acq_rel(1);
+    }
+}
 
-        if ((mode == MatchMode::Matching) && !element_matched) {
-            // The current element didn't match.
-            current_clause_succeeded = false;
+void ThreadPool::run_batch(u32 num_tasks, const Functor<void(u32 task_index)>& func) {
+    // Spawn one job per helper. Each job claims tasks until there are none left, so the batch is
+    // balanced even when tasks take different amounts of time.
+    Atomic<u32> next_task = 0;
+    auto run_tasks = [&] {
+        for (;;) {
+            u32 task_index = next_task.fetch_add_acq_rel(1);
+            if (task_index >= num_tasks)
+                break;
+            func(task_index);
         }
+    };
+    JobCounter counter;
+    u32 num_helpers = min(this->workers.num_items(), num_tasks > 0 ? num_tasks - 1 : 0);
+    for (u32 i = 0; i < num_helpers; i++) {
+        this->spawn(counter, run_tasks);
+    }
+    run_tasks();
+    this->wait(counter);
+}
+
+ThreadPool::Stats ThreadPool::get_stats() const {
+    Stats stats;
+    stats.num_jobs_run = this->num_external_jobs_run.load_relaxed();
+    stats.num_queued_jobs = this->num_external_jobs.load_relaxed();
+    for (const Owned<Worker>& worker : this->workers) {
+        stats.num_jobs_run += worker->num_jobs_run.load_relaxed();
+        stats.num_steals += worker->num_steals.load_relaxed();
+        stats.num_failed_steals += worker->num_failed_steals.load_relaxed();
+        stats.num_sleeps += worker->num_sleeps.load_relaxed();
+        stats.num_queued_jobs += worker->deque.num_items();
+        stats.max_queue_depth = max(stats.max_queue_depth, worker->max_queue_depth.load_relaxed());
+    }
+    return stats;
+}
+
+//  ▄▄▄▄▄         ▄▄
+//  ██    ▄▄  ▄▄ ▄██▄▄ ▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀  ██  ██  ██   ██  ██ ██  ▀▀ ██▄▄██
+//  ██    ▀█▄▄██  ▀█▄▄ ▀█▄▄██ ██     ▀█▄▄▄
+//
+
+void FutureStateBase::mark_ready() {
+    Array<Functor<void()>> to_run;
+    {
+        LockGuard<Mutex> guard{this->mutex};
+        PLY_ASSERT(!this->is_ready());
+        // Pairs with load_acquire in is_ready(), so waiters see the result.
+        this->pending.num_pending.store_release(0);
+        to_run = std::move(this->continuations);
+    }
+    // Pairs with the fence in ThreadPool::wait().
+    thread_fence_seq_cst();
+    if (this->pool->num_waiters.load_relaxed() > 0) {
+        this->pool->wake_waiters();
     }
+    // Continuations typically keep this state alive, so running them also breaks that cycle.
+    for (const Functor<void()>& func : to_run) {
+        func();
+    }
+}
 
-    // We reached the end of the segment.
-    if ((mode == MatchMode::Matching) && current_clause_succeeded) {
-        any_clause_succeeded = true;
-        for (Functor<void()>& commit : output_variables_to_commit) {
-            commit();
+void FutureStateBase::add_continuation(Functor<void()>&& func) {
+    {
+        LockGuard<Mutex> guard{this->mutex};
+        if (!this->is_ready()) {
+            this->continuations.append(std::move(func));
+            return;
+        }
+    }
+    func();
+}
+
+namespace {
+
+// The continuations added to the input futures share a single reference to these states, which the last continuation
+// to run releases. A reference per continuation would limit how many futures can be combined.
+struct WhenAllState : FutureState<void> {
+    Atomic<u32> num_remaining;
+
+    WhenAllState(ThreadPool* pool, u32 num_remaining) : FutureState<void>{pool} {
+        this->num_remaining.store_relaxed(num_remaining);
+        this->inc_ref_count();
+    }
+    void finish_one() {
+        if (this->num_remaining.fetch_sub_acq_rel(1) == 1) {
+            this->set();
+            this->dec_ref_count();
         }
     }
+};
 
-    return any_clause_succeeded;
+struct WhenAnyState : FutureState<u32> {
+    Atomic<u32> is_claimed = 0;
+    Atomic<u32> num_remaining;
+
+    WhenAnyState(ThreadPool* pool, u32 num_remaining) : FutureState<u32>{pool} {
+        this->num_remaining.store_relaxed(num_remaining);
+        this->inc_ref_count();
+    }
+    void finish_one(u32 index) {
+        if (this->is_claimed.exchange_acq_rel(1) == 0) {
+            this->set(index);
+        }
+        if (this->num_remaining.fetch_sub_acq_rel(1) == 1) {
+            this->dec_ref_count();
+        }
+    }
+};
+
+} // namespace
+
+Future<void> when_all_states(ArrayView<FutureStateBase* const> states, ThreadPool& pool) {
+    // Start with one extra count so that the result isn't set until every continuation has been added.
+    Reference<WhenAllState> all = Heap::create<WhenAllState>(&pool, states.num_items() + 1);
+    WhenAllState* shared = all;
+    for (FutureStateBase* state : states) {
+        state->add_continuation([shared] { shared->finish_one(); });
+    }
+    all->finish_one();
+    return Future<void>{all};
 }
 
-bool match_with_args(ViewStream& in, StringView pattern, ArrayView<const MatchArg> match_args) {
-    MatchState state;
-    ViewStream pattern_in{pattern};
-    state.str = &in;
-    state.pattern = &pattern_in;
-    state.match_args = match_args;
-    state.arg_index = 0;
+Future<u32> when_any_states(ArrayView<FutureStateBase* const> states, ThreadPool& pool) {
+    PLY_ASSERT(!states.is_empty());
+    Reference<WhenAnyState> any = Heap::create<WhenAnyState>(&pool, states.num_items());
+    WhenAnyState* shared = any;
+    for (u32 i = 0; i < states.num_items(); i++) {
+        states[i]->add_continuation([shared, i] { shared->finish_one(i); });
+    }
+    return Future<u32>{any};
+}
 
-    if (!match_pattern_segment(state, MatchMode::Matching))
-        return false;
+//  ▄▄▄▄▄                     ▄▄
+//  ██    ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄ ██▄▄▄
+//  ██▀▀  ██  ██ ██  ██ ██    ██  ██
+//  ██▄▄▄ ██▄▄█▀ ▀█▄▄█▀ ▀█▄▄▄ ██  ██
+//        ██
 
-    if (state.pattern->make_readable() && (*state.pattern->cur_byte == '$')) {
-        if (state.str->make_readable())
-            return false; // Expected end of string
+// Each thread calls collect() after retiring this many objects.
+static constexpr u32 EpochCollectInterval = 64;
+
+namespace {
+
+struct RetiredObject {
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+// Objects retired during a single epoch. Once the global epoch is two past it, no Guard can still see them.
+struct RetiredBag {
+    u32 epoch = 0;
+    Array<RetiredObject> objects;
+};
+
+struct EpochRecord {
+    // 0 while the thread is outside any Guard. Otherwise, the epoch the thread observed, shifted left by one, plus one.
+    Atomic<u32> state;
+    // Set while a thread owns this record. Records of threads that have exited are reused.
+    Atomic<u32> in_use;
+    // The members below are only accessed by the owning thread.
+    u32 nesting = 0;
+    u32 num_retired = 0;
+    // Bag N holds objects retired during an epoch that's equal to N modulo 3.
+    RetiredBag bags[3];
+    EpochRecord* next = nullptr;
+};
+
+struct EpochGlobals {
+    Atomic<u32> epoch;
+    // New records are pushed to the front. Records are never removed.
+    Atomic<EpochRecord*> records;
+    // Bags left behind by threads that have exited.
+    Mutex orphan_mutex{"Epoch orphans"};
+    Array<RetiredBag> orphans;
+};
+
+// Set once the calling thread's record has been released at thread exit. See thread_cache_destroyed.
+thread_local bool epoch_thread_exited = false;
+
+EpochGlobals& get_epoch_globals() {
+    // Constructed on first use and never destroyed, since other threads can still retire objects during exit.
+    static EpochGlobals* globals = new (dlmalloc(sizeof(EpochGlobals))) EpochGlobals;
+    return *globals;
+}
+
+bool is_epoch_expired(u32 bag_epoch, u32 epoch) {
+    // A bag orphaned by another thread can be newer than the epoch this thread observed, so compare the signed
+    // difference.
+    return s32(epoch - bag_epoch) >= 2;
+}
+
+void run_deleters(ArrayView<const RetiredObject> objects) {
+    for (const RetiredObject& obj : objects) {
+        obj.deleter(obj.ptr);
     }
+}
 
-    // Check that we consumed all match args
-    PLY_ASSERT(state.arg_index == match_args.num_items());
+void store_epoch_record_slot(void* value);
 
-    return true;
+void on_epoch_thread_exit(void* value) {
+    // Hand any remaining objects over to the threads that are still running, then make the record available for reuse.
+    epoch_thread_exited = true;
+    store_epoch_record_slot(nullptr);
+    EpochRecord* record = (EpochRecord*) value;
+    PLY_ASSERT(record->nesting == 0);
+    EpochGlobals& globals = get_epoch_globals();
+    {
+        LockGuard<Mutex> guard{globals.orphan_mutex};
+        for (RetiredBag& bag : record->bags) {
+            if (!bag.objects.is_empty()) {
+                globals.orphans.append(std::move(bag));
+            }
+        }
+    }
+    record->num_retired = 0;
+    record->in_use.store_release(0);
 }
 
-//   ▄▄▄▄   ▄▄          ▄▄
-//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
-//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██
-//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██
-//                                 ▄▄▄█▀
+#if defined(PLY_WINDOWS)
 
-String::String(StringView other) : bytes_{(char*) Heap::alloc(other.num_bytes())}, num_bytes_{other.num_bytes()} {
-    memcpy(this->bytes_, other.bytes(), other.num_bytes());
+void WINAPI on_epoch_fiber_storage_freed(void* value) {
+    if (value) {
+        on_epoch_thread_exit(value);
+    }
 }
 
-String String::allocate(u32 num_bytes) {
-    String result;
-    result.bytes_ = (char*) Heap::alloc(num_bytes);
-    result.num_bytes_ = num_bytes;
-    return result;
+DWORD get_epoch_record_index() {
+    static DWORD fls_index = FlsAlloc(on_epoch_fiber_storage_freed);
+    return fls_index;
 }
 
-void String::resize(u32 num_bytes) {
-    this->bytes_ = (char*) Heap::realloc(this->bytes_, num_bytes);
-    this->num_bytes_ = num_bytes;
+void* load_epoch_record_slot() {
+    return FlsGetValue(get_epoch_record_index());
 }
 
-//  ▄▄  ▄▄               ▄▄     ▄▄
-//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄
-//  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██ ██  ██ ██  ██
-//  ██  ██ ▀█▄▄██  ▄▄▄█▀ ██  ██ ██ ██  ██ ▀█▄▄██
-//                                         ▄▄▄█▀
+void store_epoch_record_slot(void* value) {
+    FlsSetValue(get_epoch_record_index(), value);
+}
+
+#elif defined(PLY_POSIX)
+
+pthread_key_t get_epoch_record_key() {
+    static pthread_key_t tls_key = []() {
+        pthread_key_t key;
+        int rc = pthread_key_create(&key, on_epoch_thread_exit);
+        PLY_ASSERT(rc == 0);
+        PLY_UNUSED(rc);
+        return key;
+    }();
+    return tls_key;
+}
 
-void add_to_hash(HashBuilder& builder, u32 value) {
-    value *= 0xcc9e2d51u;
-    value = (value << 15) | (value >> 17);
-    value *= 0x1b873593u;
-    builder.accumulator ^= value;
-    builder.accumulator = (builder.accumulator << 13) | (builder.accumulator >> 19);
-    builder.accumulator = builder.accumulator * 5 + 0xe6546b64u;
+void* load_epoch_record_slot() {
+    return pthread_getspecific(get_epoch_record_key());
 }
 
-void add_to_hash(HashBuilder& builder, StringView str) {
-    // FIXME: More work is needed for platforms that don't support unaligned reads
-    u32 i = 0;
-    while (i + 4 <= str.num_bytes()) {
-        add_to_hash(builder, *(const u32*) (str.bytes() + i)); // May be unaligned
-        i += 4;
+void store_epoch_record_slot(void* value) {
+    pthread_setspecific(get_epoch_record_key(), value);
+}
+
+#endif
+
+PLY_NO_INLINE EpochRecord* claim_epoch_record() {
+    // Reuse the record of a thread that has exited, or add a new one.
+    EpochGlobals& globals = get_epoch_globals();
+    EpochRecord* record = globals.records.load_acquire();
+    for (; record; record = record->next) {
+        if (record->in_use.load_relaxed() == 0 && record->in_use.compare_exchange_acq_rel(0, 1) == 0)
+            break;
+    }
+    if (!record) {
+        record = new (dlmalloc(sizeof(EpochRecord))) EpochRecord;
+        record->in_use.store_relaxed(1);
+        EpochRecord* head = globals.records.load_relaxed();
+        for (;;) {
+            record->next = head;
+            EpochRecord* prev = globals.records.compare_exchange_acq_rel(head, record);
+            if (prev == head)
+                break;
+            head = prev;
+        }
+    }
+    store_epoch_record_slot(record);
+    return record;
+}
+
+PLY_FORCE_INLINE EpochRecord* get_epoch_record() {
+    if (void* value = load_epoch_record_slot())
+        return (EpochRecord*) value;
+    return claim_epoch_record();
+}
+
+// Advances the global epoch if every thread that's inside a Guard has observed the current one. Returns the epoch
+// afterwards, as seen by this thread. Other threads may have advanced it further by then.
+u32 try_advance_epoch(EpochGlobals& globals) {
+    u32 epoch = globals.epoch.load_acquire();
+    // Pairs with the fence in Guard(). Either this thread sees the other thread's state, or the other thread sees
+    // every change made before the epoch advanced.
+    thread_fence_seq_cst();
+    u32 current_state = (epoch << 1) + 1;
+    for (EpochRecord* record = globals.records.load_acquire(); record; record = record->next) {
+        u32 state = record->state.load_relaxed();
+        if (state != 0 && state != current_state)
+            return epoch;
+    }
+    u32 prev = globals.epoch.compare_exchange_acq_rel(epoch, epoch + 1);
+    return prev == epoch ? epoch + 1 : prev;
+}
+
+void free_expired_objects(EpochRecord* record) {
+    EpochGlobals& globals = get_epoch_globals();
+    // Compare against the current global epoch, not an epoch observed earlier that may have been passed since.
+    u32 epoch = globals.epoch.load_acquire();
+    // Deleters may retire more objects, so take each expired list out of its bag before running it.
+    for (RetiredBag& bag : record->bags) {
+        if (!bag.objects.is_empty() && is_epoch_expired(bag.epoch, epoch)) {
+            Array<RetiredObject> objects = std::move(bag.objects);
+            run_deleters(objects);
+        }
+    }
+    Array<RetiredBag> expired;
+    {
+        LockGuard<Mutex> guard{globals.orphan_mutex};
+        if (globals.orphans.is_empty())
+            return;
+        Array<RetiredBag> remaining;
+        for (RetiredBag& bag : globals.orphans) {
+            if (is_epoch_expired(bag.epoch, epoch)) {
+                expired.append(std::move(bag));
+            } else {
+                remaining.append(std::move(bag));
+            }
+        }
+        globals.orphans = std::move(remaining);
+    }
+    for (const RetiredBag& bag : expired) {
+        run_deleters(bag.objects);
+    }
+}
+
+} // namespace
+
+Epoch::Guard::Guard() {
+    EpochRecord* record = get_epoch_record();
+    if (record->nesting++ == 0) {
+        u32 epoch = get_epoch_globals().epoch.load_relaxed();
+        record->state.store_relaxed((epoch << 1) + 1);
+        // Pairs with the fence in try_advance_epoch. If the epoch advanced in the meantime, this thread holds back the
+        // next advance until it leaves the Guard.
+        thread_fence_seq_cst();
+    }
+}
+
+Epoch::Guard::~Guard() {
+    EpochRecord* record = (EpochRecord*) load_epoch_record_slot();
+    PLY_ASSERT(record && record->nesting > 0);
+    if (--record->nesting == 0) {
+        record->state.store_release(0);
     }
-    if (i < str.num_bytes()) {
-        // Avoid potential unaligned read across page boundary
-        u32 v = 0;
-        while (i < str.num_bytes()) {
-            v = (v << 8) | *(const u8*) (str.bytes() + i);
-            i++;
+}
+
+void Epoch::retire(void* ptr, void (*deleter)(void*)) {
+    EpochRecord* record = (EpochRecord*) load_epoch_record_slot();
+    // The object was unlinked before this point, so any thread that enters a Guard in a later epoch can't reach it.
+    thread_fence_seq_cst();
+    u32 epoch = get_epoch_globals().epoch.load_relaxed();
+    if (!record) {
+        if (epoch_thread_exited) {
+            // Called from a thread exit callback after this thread's record was released. Claiming a new record here
+            // would leak it, so hand the object straight to the orphans.
+            EpochGlobals& globals = get_epoch_globals();
+            LockGuard<Mutex> guard{globals.orphan_mutex};
+            RetiredBag& bag = globals.orphans.append();
+            bag.epoch = epoch;
+            bag.objects.append({ptr, deleter});
+            return;
         }
-        add_to_hash(builder, v);
+        record = claim_epoch_record();
+    }
+    RetiredBag& bag = record->bags[epoch % 3];
+    Array<RetiredObject> expired;
+    if (bag.epoch != epoch) {
+        // The bag holds objects from at least three epochs ago.
+        expired = std::move(bag.objects);
+        bag.epoch = epoch;
+    }
+    bag.objects.append({ptr, deleter});
+    run_deleters(expired);
+    if (++record->num_retired >= EpochCollectInterval) {
+        collect();
     }
 }
 
-//  ▄▄  ▄▄               ▄▄     ▄▄                  ▄▄
-//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██▄▄▄  ██     ▄▄▄▄   ▄▄▄▄  ██  ▄▄ ▄▄  ▄▄ ▄▄▄▄▄
-//  ██▀▀██  ▄▄▄██ ▀█▄▄▄  ██  ██ ██    ██  ██ ██  ██ ██▄█▀  ██  ██ ██  ██
-//  ██  ██ ▀█▄▄██  ▄▄▄█▀ ██  ██ ██▄▄▄ ▀█▄▄█▀ ▀█▄▄█▀ ██ ▀█▄ ▀█▄▄██ ██▄▄█▀
-//                                                                ██
+void Epoch::collect() {
+    EpochRecord* record = get_epoch_record();
+    record->num_retired = 0;
+    try_advance_epoch(get_epoch_globals());
+    free_expired_objects(record);
+}
 
-u32 get_best_num_hash_indices(u32 num_items) {
-    if (num_items >= 8) {
-        return round_up_to_nearest_to_power_of_2(u32((u64{num_items} * 5) >> 2));
+void Epoch::flush() {
+    EpochRecord* record = get_epoch_record();
+    PLY_ASSERT(record->nesting == 0);
+    EpochGlobals& globals = get_epoch_globals();
+    thread_fence_seq_cst();
+    u32 target = globals.epoch.load_relaxed() + 2;
+    for (;;) {
+        u32 epoch = try_advance_epoch(globals);
+        if (s32(epoch - target) >= 0)
+            break;
+        yield_thread();
     }
-    return (num_items < 4) ? 4 : 8;
+    record->num_retired = 0;
+    free_expired_objects(record);
 }
 
 //  ▄▄▄▄▄  ▄▄
@@ -1786,6 +4439,15 @@ String MemStream::move_to_string() {
 
     if (this->mem.buffers.num_items() == 1) {
         u32 num_bytes = this->mem.num_bytes_in_last_buffer;
+#if PLY_STRING_INLINE
+        if (num_bytes <= String::InlineCapacity) {
+            // Copy short results straight into the String's inline storage instead of shrinking the
+            // buffer first.
+            String result{StringView{this->mem.buffers[0], num_bytes}};
+            this->close();
+            return result;
+        }
+#endif
         char* bytes = (char*) Heap::realloc(this->mem.buffers[0], num_bytes);
         this->mem.~MemData();
         new (this) Stream;
@@ -3773,7 +6435,7 @@ FSResult Filesystem::save_text(StringView path, StringView str_contents, const T
 
 #define PLY_FSWIN32_ALLOW_UNKNOWN_ERRORS 0
 
-ReadWriteLock Filesystem::working_dir_lock;
+ReadWriteLock Filesystem::working_dir_lock{"Filesystem working dir"};
 
 inline double windows_to_posix_time(const FILETIME& file_time) {
     return (u64(file_time.dwHighDateTime) << 32 | file_time.dwLowDateTime) / 10000000.0 - 11644473600.0;
@@ -27,8 +27,13 @@
 
 #if defined(_M_X64)
 #define PLY_PTR_SIZE 8
+#define PLY_CPU_X64 1
 #elif defined(_M_IX86)
 #define PLY_PTR_SIZE 4
+#define PLY_CPU_X86 1
+#elif defined(_M_ARM64)
+#define PLY_PTR_SIZE 8
+#define PLY_CPU_ARM64 1
 #endif
 
 #define PLY_NO_INLINE __declspec(noinline)
@@ -71,12 +76,16 @@
 
 #if defined(__x86_64__)
 #define PLY_PTR_SIZE 8
+#define PLY_CPU_X64 1
 #elif defined(__i386__)
 #define PLY_PTR_SIZE 4
+#define PLY_CPU_X86 1
 #elif defined(__arm__)
 #define PLY_PTR_SIZE 4
+#define PLY_CPU_ARM 1
 #elif defined(__arm64__) || defined(__aarch64__)
 #define PLY_PTR_SIZE 8
+#define PLY_CPU_ARM64 1
 #endif
 
 #define PLY_NO_INLINE __attribute__((noinline))
@@ -86,6 +95,10 @@
 #define PLY_COMPILER_BARRIER() asm volatile("" ::: "memory")
 #define PLY_NO_DISCARD __attribute__((warn_unused_result))
 
+#if PLY_CPU_X64
+#include <emmintrin.h>
+#endif
+
 #endif
 
 //--------------------------------------------
@@ -108,11 +121,16 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <netdb.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#if defined(PLY_LINUX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #if defined(PLY_APPLE) // macOS & iOS
 #include <mach/mach.h>
 #include <mach/mach_time.h>
@@ -402,6 +420,27 @@ inline constexpr u64 round_up_to_nearest_to_power_of_2(u64 v) {
     v |= v >> 32;
     return v + 1;
 }
+// Returns the index of the lowest (or highest) set bit. mask must not be zero.
+PLY_FORCE_INLINE u32 lowest_bit_index(u32 mask) {
+    PLY_ASSERT(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+PLY_FORCE_INLINE u32 highest_bit_index(u32 mask) {
+    PLY_ASSERT(mask != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
 template <typename DstType, typename SrcType>
 constexpr bool is_representable(SrcType val) {
     if (((SrcType) (DstType) val) != val)
@@ -592,6 +631,15 @@ inline void sleep_millis(u32 millis) {
 #endif
 }
 
+// Gives up the rest of the calling thread's time slice to any other thread that's ready to run.
+inline void yield_thread() {
+#if defined(PLY_WINDOWS)
+    SwitchToThread();
+#elif defined(PLY_POSIX)
+    sched_yield();
+#endif
+}
+
 template <typename>
 struct Functor;
 
@@ -685,6 +733,41 @@ class Atomic;
 
 //----------------------------------------------------
 // MSVC implementation.
+
+// Single-byte atomics only support loads and stores.
+template <typename T>
+class Atomic<T, 1> {
+protected:
+    T value = 0;
+
+public:
+    Atomic(T value = 0) : value{value} {
+    }
+    Atomic(const Atomic<T, 1>& other) : value{other.value} {
+    }
+    // Hide operator=
+    Atomic& operator=(T value) = delete;
+    Atomic& operator=(const Atomic<T, 1>& other) {
+        this->value = other.value;
+        return *this;
+    }
+    T load_relaxed() const {
+        return *(volatile T*) &this->value;
+    }
+    T load_acquire() const {
+        T result = *(volatile T*) &this->value;
+        _ReadWriteBarrier();
+        return result;
+    }
+    void store_relaxed(T value) {
+        *(volatile T*) &this->value = value;
+    }
+    void store_release(T value) {
+        _ReadWriteBarrier();
+        *(volatile T*) &this->value = value;
+    }
+};
+
 template <typename T>
 class Atomic<T, 4> {
 protected:
@@ -796,10 +879,47 @@ public:
     }
 };
 
+// Full memory barrier. Orders every earlier load and store before every later one.
+inline void thread_fence_seq_cst() {
+    MemoryBarrier();
+}
+
 #elif defined(__GNUC__)
 
 //----------------------------------------------------
 // GCC/Clang implementation.
+
+// Single-byte atomics only support loads and stores.
+template <typename T>
+class Atomic<T, 1> {
+protected:
+    T value = 0;
+
+public:
+    Atomic(T value = 0) : value{value} {
+    }
+    Atomic(const Atomic<T, 1>& other) : value{other.value} {
+    }
+    // Hide operator=
+    Atomic& operator=(T value) = delete;
+    Atomic& operator=(const Atomic<T, 1>& other) {
+        this->value = other.value;
+        return *this;
+    }
+    T load_relaxed() const {
+        return __atomic_load_n(&this->value, __ATOMIC_RELAXED);
+    }
+    T load_acquire() const {
+        return __atomic_load_n(&this->value, __ATOMIC_ACQUIRE);
+    }
+    void store_relaxed(T value) {
+        __atomic_store_n(&this->value, value, __ATOMIC_RELAXED);
+    }
+    void store_release(T value) {
+        __atomic_store_n(&this->value, value, __ATOMIC_RELEASE);
+    }
+};
+
 template <typename T>
 class Atomic<T, 4> {
 protected:
@@ -829,11 +949,11 @@ public:
         __atomic_store_n(&this->value, value, __ATOMIC_RELEASE);
     }
     T compare_exchange_acq_rel(T expected, T desired) {
-        __atomic_compare_exchange(&this->value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQ_REL);
+        __atomic_compare_exchange_n(&this->value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
         return expected;
     }
     T exchange_acq_rel(T desired) {
-        return __atomic_exchange(&this->value, desired, __ATOMIC_ACQ_REL);
+        return __atomic_exchange_n(&this->value, desired, __ATOMIC_ACQ_REL);
     }
     T fetch_add_acq_rel(T operand) {
         return __atomic_fetch_add(&this->value, operand, __ATOMIC_ACQ_REL);
@@ -878,11 +998,11 @@ public:
         __atomic_store_n(&this->value, value, __ATOMIC_RELEASE);
     }
     T compare_exchange_acq_rel(T expected, T desired) {
-        __atomic_compare_exchange(&this->value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQ_REL);
+        __atomic_compare_exchange_n(&this->value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
         return expected;
     }
     T exchange_acq_rel(T desired) {
-        return __atomic_exchange(&this->value, desired, __ATOMIC_ACQ_REL);
+        return __atomic_exchange_n(&this->value, desired, __ATOMIC_ACQ_REL);
     }
     T fetch_add_acq_rel(T operand) {
         return __atomic_fetch_add(&this->value, operand, __ATOMIC_ACQ_REL);
@@ -898,6 +1018,11 @@ public:
     }
 };
 
+// Full memory barrier. Orders every earlier load and store before every later one.
+inline void thread_fence_seq_cst() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
 #endif
 
 //  ▄▄▄▄▄▄ ▄▄                              ▄▄ ▄▄                        ▄▄▄
@@ -1021,6 +1146,13 @@ public:
         return (T) (uptr) value;
     }
 
+    template <typename U = T, std::enable_if_t<std::is_pointer<U>::value, int> = 0>
+    void store(U value) {
+        int rc = pthread_setspecific(m_tlsKey, (void*) value);
+        PLY_ASSERT(rc == 0);
+        PLY_UNUSED(rc);
+    }
+
     template <typename U = T, std::enable_if_t<std::is_enum<U>::value || std::is_integral<U>::value, int> = 0>
     void store(U value) {
         int rc = pthread_setspecific(m_tlsKey, (void*) (uptr) value);
@@ -1043,17 +1175,48 @@ public:
 //  ██   ██ ▀█▄▄██  ▀█▄▄ ▀█▄▄▄  ▄█▀▀█▄
 //
 
+// Define PLY_LOCK_STATS=1 to count acquisitions, contended acquisitions, wait time and hold time for every Mutex
+// and ReadWriteLock. Locks are grouped by the name passed to their constructor.
+#if !defined(PLY_LOCK_STATS)
+#define PLY_LOCK_STATS 0
+#endif
+
+struct Stream;
+struct LockCounters;
+
+struct LockStats {
+    // Entry 0 counts unnamed locks, and names beyond MaxNames.
+    static constexpr u32 MaxNames = 128;
+
+    struct Entry {
+        const char* name = nullptr;
+        u64 num_acquisitions = 0;
+        u64 num_contended = 0;
+        // Measured with get_cpu_ticks. Shared acquisitions of a ReadWriteLock don't count toward hold time.
+        u64 wait_ticks = 0;
+        u64 max_hold_ticks = 0;
+    };
+
+    Entry entries[MaxNames];
+    u32 num_entries = 0;
+};
+
+// Returns an empty LockStats when PLY_LOCK_STATS=0.
+LockStats get_lock_stats();
+// Writes a human-readable summary, with times in microseconds.
+void write_lock_stats(Stream& out, const LockStats& stats);
+
 #if defined(PLY_WINDOWS)
 
 //----------------------------------------------------
 // Windows implementation.
-class Mutex {
+class RawMutex {
 private:
     SRWLOCK srwlock;
     friend class ConditionVariable;
 
 public:
-    Mutex() {
+    RawMutex() {
         InitializeSRWLock(&srwlock);
     }
     void lock() {
@@ -1067,24 +1230,78 @@ public:
     }
 };
 
+#elif defined(PLY_LINUX)
+
+//----------------------------------------------------
+// Linux implementation.
+
+// Thin wrappers around the futex system call. futex_wait sleeps only if *addr still equals expected.
+inline void futex_wait(Atomic<u32>* addr, u32 expected, const timespec* timeout = nullptr) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+static constexpr u32 FutexWakeAll = 0x7fffffff;
+inline void futex_wake(Atomic<u32>* addr, u32 count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+// Hint to the CPU that the calling thread is spinning.
+PLY_FORCE_INLINE void cpu_relax() {
+#if PLY_CPU_X64
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    PLY_COMPILER_BARRIER();
+#endif
+}
+
+// Number of times a lock polls its state before going to sleep.
+static constexpr u32 LockSpinCount = 100;
+
+// A 4-byte lock that spins briefly, then sleeps on a futex. Not recursive.
+class RawMutex {
+private:
+    // 0 = unlocked, 1 = locked, 2 = locked and other threads might be sleeping.
+    Atomic<u32> state = 0;
+    friend class ConditionVariable;
+
+    void lock_slow();
+    void lock_contended();
+
+public:
+    void lock() {
+        if (this->state.compare_exchange_acq_rel(0, 1) != 0) {
+            this->lock_slow();
+        }
+    }
+    bool try_lock() {
+        return this->state.compare_exchange_acq_rel(0, 1) == 0;
+    }
+    void unlock() {
+        if (this->state.exchange_acq_rel(0) == 2) {
+            futex_wake(&this->state, 1);
+        }
+    }
+};
+
 #elif defined(PLY_POSIX)
 
 //----------------------------------------------------
 // POSIX implementation.
-class Mutex {
+class RawMutex {
 private:
     pthread_mutex_t mutex;
     friend class ConditionVariable;
 
 public:
-    Mutex() {
+    RawMutex() {
         pthread_mutexattr_t attr;
         pthread_mutexattr_init(&attr);
         pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
         pthread_mutex_init(&mutex, &attr);
         pthread_mutexattr_destroy(&attr);
     }
-    ~Mutex() {
+    ~RawMutex() {
         pthread_mutex_destroy(&mutex);
     }
     void lock() {
@@ -1100,6 +1317,45 @@ public:
 
 #endif
 
+//----------------------------------------------------
+// Mutex wraps the platform lock. When PLY_LOCK_STATS=1, it also records statistics.
+#if PLY_LOCK_STATS
+
+class Mutex : public RawMutex {
+private:
+    LockCounters* counters;
+    u64 hold_start_ticks = 0;
+    friend class ConditionVariable;
+
+    void begin_hold();
+    void end_hold();
+
+public:
+    // name must outlive the program, such as a string literal.
+    Mutex(const char* name = nullptr);
+    void lock();
+    bool try_lock();
+    void unlock();
+};
+
+#else
+
+class Mutex : public RawMutex {
+private:
+    friend class ConditionVariable;
+
+    void begin_hold() {
+    }
+    void end_hold() {
+    }
+
+public:
+    Mutex(const char* = nullptr) {
+    }
+};
+
+#endif
+
 //  ▄▄                 ▄▄      ▄▄▄▄                           ▄▄
 //  ██     ▄▄▄▄   ▄▄▄▄ ██  ▄▄ ██  ▀▀ ▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄▄   ▄▄▄██
 //  ██    ██  ██ ██    ██▄█▀  ██ ▀██ ██  ██  ▄▄▄██ ██  ▀▀ ██  ██
@@ -1137,11 +1393,15 @@ public:
         InitializeConditionVariable(&cond_var);
     }
     void wait(LockGuard<Mutex>& lock_guard) {
+        lock_guard.mutex.end_hold();
         SleepConditionVariableSRW(&cond_var, &lock_guard.mutex.srwlock, INFINITE, 0);
+        lock_guard.mutex.begin_hold();
     }
     void timed_wait(LockGuard<Mutex>& lock_guard, u32 wait_millis) {
         if (wait_millis > 0) {
+            lock_guard.mutex.end_hold();
             SleepConditionVariableSRW(&cond_var, &lock_guard.mutex.srwlock, wait_millis, 0);
+            lock_guard.mutex.begin_hold();
         }
     }
     void wake_one() {
@@ -1152,6 +1412,45 @@ public:
     }
 };
 
+#elif defined(PLY_LINUX)
+
+//----------------------------------------------------
+// Linux implementation.
+class ConditionVariable {
+private:
+    // Incremented on every wakeup, so that a waiter that's about to sleep can tell it missed one.
+    Atomic<u32> sequence = 0;
+
+public:
+    void wait(LockGuard<Mutex>& lock_guard) {
+        u32 sequence = this->sequence.load_relaxed();
+        lock_guard.mutex.unlock();
+        futex_wait(&this->sequence, sequence);
+        lock_guard.mutex.lock_contended();
+        lock_guard.mutex.begin_hold();
+    }
+    void timed_wait(LockGuard<Mutex>& lock_guard, u32 wait_millis) {
+        if (wait_millis > 0) {
+            u32 sequence = this->sequence.load_relaxed();
+            lock_guard.mutex.unlock();
+            timespec ts;
+            ts.tv_sec = wait_millis / 1000;
+            ts.tv_nsec = (wait_millis % 1000) * 1000000;
+            futex_wait(&this->sequence, sequence, &ts);
+            lock_guard.mutex.lock_contended();
+            lock_guard.mutex.begin_hold();
+        }
+    }
+    void wake_one() {
+        this->sequence.fetch_add_acq_rel(1);
+        futex_wake(&this->sequence, 1);
+    }
+    void wake_all() {
+        this->sequence.fetch_add_acq_rel(1);
+        futex_wake(&this->sequence, FutexWakeAll);
+    }
+};
+
 #elif defined(PLY_POSIX)
 
 //----------------------------------------------------
@@ -1168,7 +1467,9 @@ public:
         pthread_cond_destroy(&cond);
     }
     void wait(LockGuard<Mutex>& lock_guard) {
+        lock_guard.mutex.end_hold();
         pthread_cond_wait(&cond, &lock_guard.mutex.mutex);
+        lock_guard.mutex.begin_hold();
     }
     void timed_wait(LockGuard<Mutex>& lock_guard, u32 wait_millis) {
         if (wait_millis > 0) {
@@ -1181,7 +1482,9 @@ public:
                 ts.tv_sec++;
                 ts.tv_nsec -= 1000000000;
             }
+            lock_guard.mutex.end_hold();
             pthread_cond_timedwait(&cond, &lock_guard.mutex.mutex, &ts);
+            lock_guard.mutex.begin_hold();
         }
     }
     void wake_one() {
@@ -1204,51 +1507,116 @@ public:
 
 //----------------------------------------------------
 // Windows implementation.
-struct ReadWriteLock {
+struct RawReadWriteLock {
     SRWLOCK srw_lock;
 
-    ReadWriteLock() {
+    RawReadWriteLock() {
         InitializeSRWLock(&this->srw_lock);
     }
-    ~ReadWriteLock() {
+    ~RawReadWriteLock() {
         // SRW locks do not need to be destroyed.
     }
     void lock_exclusive() {
         AcquireSRWLockExclusive(&this->srw_lock);
     }
+    bool try_lock_exclusive() {
+        return TryAcquireSRWLockExclusive(&this->srw_lock) != 0;
+    }
     void unlock_exclusive() {
         ReleaseSRWLockExclusive(&this->srw_lock);
     }
     void lock_shared() {
         AcquireSRWLockShared(&this->srw_lock);
     }
+    bool try_lock_shared() {
+        return TryAcquireSRWLockShared(&this->srw_lock) != 0;
+    }
     void unlock_shared() {
         ReleaseSRWLockShared(&this->srw_lock);
     }
 };
 
+#elif defined(PLY_LINUX)
+
+//----------------------------------------------------
+// Linux implementation. Writer-preferring: once a writer is waiting, new readers wait behind it.
+struct RawReadWriteLock {
+    // Bits 0-15 count the readers holding the lock, and bits 16-29 count the writers waiting for it.
+    // Bit 30 is set while a writer holds the lock, and bit 31 is set while readers are sleeping.
+    static constexpr u32 ReaderMask = 0xffff;
+    static constexpr u32 OneWaitingWriter = 0x10000;
+    static constexpr u32 WaitingWriterMask = 0x3fff0000;
+    static constexpr u32 WriterHeld = 0x40000000;
+    static constexpr u32 ReadersSleeping = 0x80000000;
+
+    Atomic<u32> state = 0;
+
+    void lock_exclusive_slow();
+    void lock_shared_slow();
+
+    void lock_exclusive() {
+        if (this->state.compare_exchange_acq_rel(0, WriterHeld) != 0) {
+            this->lock_exclusive_slow();
+        }
+    }
+    bool try_lock_exclusive() {
+        return this->state.compare_exchange_acq_rel(0, WriterHeld) == 0;
+    }
+    void unlock_exclusive() {
+        u32 prev = this->state.fetch_and_acq_rel(~(WriterHeld | ReadersSleeping));
+        if (prev & (WaitingWriterMask | ReadersSleeping)) {
+            futex_wake(&this->state, FutexWakeAll);
+        }
+    }
+    void lock_shared() {
+        u32 state = this->state.load_relaxed();
+        if ((state & (WriterHeld | WaitingWriterMask)) ||
+            this->state.compare_exchange_acq_rel(state, state + 1) != state) {
+            this->lock_shared_slow();
+        }
+    }
+    bool try_lock_shared() {
+        u32 state = this->state.load_relaxed();
+        return !(state & (WriterHeld | WaitingWriterMask)) &&
+               this->state.compare_exchange_acq_rel(state, state + 1) == state;
+    }
+    void unlock_shared() {
+        u32 prev = this->state.fetch_sub_acq_rel(1);
+        // Readers and writers sleep on the same word, so wake them all. The readers go back to sleep.
+        if ((prev & ReaderMask) == 1 && (prev & WaitingWriterMask)) {
+            futex_wake(&this->state, FutexWakeAll);
+        }
+    }
+};
+
 #elif defined(PLY_POSIX)
 
 //----------------------------------------------------
 // POSIX implementation.
-struct ReadWriteLock {
+struct RawReadWriteLock {
     pthread_rwlock_t rw_lock;
 
-    ReadWriteLock() {
+    RawReadWriteLock() {
         pthread_rwlock_init(&this->rw_lock, NULL);
     }
-    ~ReadWriteLock() {
+    ~RawReadWriteLock() {
         pthread_rwlock_destroy(&this->rw_lock);
     }
     void lock_exclusive() {
         pthread_rwlock_wrlock(&this->rw_lock);
     }
+    bool try_lock_exclusive() {
+        return pthread_rwlock_trywrlock(&this->rw_lock) == 0;
+    }
     void unlock_exclusive() {
         pthread_rwlock_unlock(&this->rw_lock);
     }
     void lock_shared() {
         pthread_rwlock_rdlock(&this->rw_lock);
     }
+    bool try_lock_shared() {
+        return pthread_rwlock_tryrdlock(&this->rw_lock) == 0;
+    }
     void unlock_shared() {
         pthread_rwlock_unlock(&this->rw_lock);
     }
@@ -1256,6 +1624,32 @@ struct ReadWriteLock {
 
 #endif
 
+//----------------------------------------------------
+// ReadWriteLock wraps the platform lock. When PLY_LOCK_STATS=1, it also records statistics.
+#if PLY_LOCK_STATS
+
+struct ReadWriteLock : RawReadWriteLock {
+    LockCounters* counters;
+    u64 hold_start_ticks = 0;
+
+    // name must outlive the program, such as a string literal.
+    ReadWriteLock(const char* name = nullptr);
+    void lock_exclusive();
+    bool try_lock_exclusive();
+    void unlock_exclusive();
+    void lock_shared();
+    bool try_lock_shared();
+};
+
+#else
+
+struct ReadWriteLock : RawReadWriteLock {
+    ReadWriteLock(const char* = nullptr) {
+    }
+};
+
+#endif
+
 //   ▄▄▄▄                                ▄▄
 //  ██  ▀▀  ▄▄▄▄  ▄▄▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄  ██▄▄▄   ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄
 //   ▀▀▀█▄ ██▄▄██ ██ ██ ██  ▄▄▄██ ██  ██ ██  ██ ██  ██ ██  ▀▀ ██▄▄██
@@ -1348,10 +1742,17 @@ struct VirtualMemory {
     // The current total amount of memory that was committed using alloc_region or commit_pages
     static Atomic<uptr> total_committed_bytes;
 
+    // Flags for reserve_region, commit_pages and alloc_region. They're hints; a flag is ignored where the platform
+    // doesn't support it.
+    static constexpr u32 HUGE_PAGES = 0x1; // Back the pages with huge pages when possible
+    static constexpr u32 PREFAULT = 0x2;   // Map committed pages to physical memory immediately
+    static constexpr u32 NUMA_LOCAL = 0x4; // Place pages on the NUMA node of the thread that touches them first
+
     // Returned by get_properties()
     struct Properties {
         uptr region_alignment = 0; // reserve/alloc_region sizes must be a multiple of this
         uptr page_size = 0;        // commit_pages sizes must be a multiple of this
+        uptr huge_page_size = 0;   // 0 if huge pages aren't supported
     };
 
     // Returned by get_system_stats()
@@ -1364,6 +1765,8 @@ struct VirtualMemory {
         // System-specific stats reported by task_info (Apple platforms) or /proc/self/statm (Linux)
         uptr virtual_size = 0;
         uptr resident_size = 0;
+        // Resident memory backed by huge pages, reported by /proc/self/smaps_rollup (Linux only)
+        uptr huge_page_resident_size = 0;
 #endif
     };
 
@@ -1378,13 +1781,13 @@ struct VirtualMemory {
     //----------------------------------------------------
     // Reserves a region of address space. Memory pages are initially uncommitted. Returns nullptr on failure. num_bytes
     // must be a multiple of region_alignment.
-    static void* reserve_region(uptr num_bytes);
+    static void* reserve_region(uptr num_bytes, u32 flags = 0);
     // Unreserves a region of address space. num_reserved_bytes must match the argument passed to to reserve_region.
     // Caller is responsible for passing the correct num_committed_bytes, otherwise stats will get out of sync.
     static void unreserve_region(void* addr, uptr num_reserved_bytes, uptr num_committed_bytes);
-    // Commits a subregion of reserved address space, making it legal to read and write to the subregion.
-    // addr must be aligned to page_size and num_bytes must be a multiple of page_size.
-    static void commit_pages(void* addr, uptr num_bytes);
+    // Commits a subregion of reserved address space, making it legal to read and write to the subregion. Returns
+    // false on failure. addr must be aligned to page_size and num_bytes must be a multiple of page_size.
+    static bool commit_pages(void* addr, uptr num_bytes, u32 flags = 0);
     // Decommits a subregion of previously committed memory.
     // addr must be aligned to page_size and num_bytes must be a multiple of page_size.
     static void decommit_pages(void* addr, uptr num_bytes);
@@ -1395,7 +1798,7 @@ struct VirtualMemory {
     // Reserves and commits a region of address space. Returns nullptr on failure. Free using free_region. Don't
     // decommit any pages in the returned region, otherwise stats will get out of sync. num_bytes must be a multiple of
     // region_alignment.
-    static void* alloc_region(uptr num_bytes);
+    static void* alloc_region(uptr num_bytes, u32 flags = 0);
     // Decommits and unreserves a region of address space. num_bytes must match the argument passed to alloc_region.
     static void free_region(void* addr, uptr num_bytes);
 };
@@ -1417,19 +1820,62 @@ void* dlmemalign(ply::uptr, ply::uptr);
 
 namespace ply {
 
+#if !defined(PLY_HEAP_STATS)
+#define PLY_HEAP_STATS 0
+#endif
+
+struct Stream;
+
+// Small blocks are served from a per-thread cache of size classes that sits in front of dlmalloc. Define
+// PLY_HEAP_THREAD_CACHE=0 to send every call straight to dlmalloc. Define PLY_HEAP_STATS=1 to count every
+// allocation; the counters are available through get_stats().
 struct Heap {
-    static void* alloc(uptr num_bytes) {
-        return dlmalloc(num_bytes);
-    }
-    static void* realloc(void* ptr, uptr num_bytes) {
-        return dlrealloc(ptr, num_bytes);
-    }
-    static void free(void* ptr) {
-        dlfree(ptr);
-    }
-    static void* alloc_aligned(uptr num_bytes, u32 alignment) {
-        return dlmemalign(num_bytes, alignment);
-    }
+    // Size class N counts allocations of up to 16 << N bytes. The last size class counts everything larger.
+    static constexpr u32 NumStatsSizeClasses = 20;
+    static constexpr u32 MaxTags = 64;
+
+    struct TagStats {
+        const char* name = nullptr;
+        uptr num_bytes_allocated = 0;
+        u64 num_allocs = 0;
+    };
+
+    struct Stats {
+        uptr num_bytes_allocated = 0;
+        uptr virtual_memory_size = 0;
+        // The remaining members are only collected when PLY_HEAP_STATS=1.
+        uptr peak_bytes_allocated = 0;
+        u64 num_allocs = 0;
+        u64 num_frees = 0;
+        u64 num_allocs_per_size_class[NumStatsSizeClasses] = {};
+        TagStats tags[MaxTags];
+        u32 num_tags = 0;
+    };
+
+    // Attributes allocations made by the calling thread to a named tag while the scope is active. name must outlive
+    // the program, such as a string literal. Only has an effect when PLY_HEAP_STATS=1.
+    struct TagScope {
+#if PLY_HEAP_STATS
+        u32 prev_tag = 0;
+
+        TagScope(const char* name);
+        ~TagScope();
+#else
+        TagScope(const char*) {
+        }
+#endif
+        TagScope(const TagScope&) = delete;
+    };
+
+    static void* alloc(uptr num_bytes);
+    static void* realloc(void* ptr, uptr num_bytes);
+    static void free(void* ptr);
+    static void* alloc_aligned(uptr num_bytes, u32 alignment);
+    // Returns every block cached by the calling thread to the central heap. Called automatically when a thread exits.
+    static void flush_thread_cache();
+    static Stats get_stats();
+    // Writes a human-readable summary. Use json::to_node to get the stats as JSON instead.
+    static void write_stats(Stream& out, const Stats& stats);
 
     // Perfect forwarding
     template <typename T, typename... Args>
@@ -1465,37 +1911,324 @@ inline void Thread::run(Functor<void()>&& entry) {
 
 #endif
 
-//   ▄▄▄▄   ▄▄          ▄▄               ▄▄   ▄▄ ▄▄
-//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
-//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
-//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██   ▀█▀   ██ ▀█▄▄▄   ██▀▀██
-//                                 ▄▄▄█▀
+//   ▄▄▄▄
+//  ██  ██ ▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀██ ██  ▀▀ ██▄▄██ ██  ██  ▄▄▄██
+//  ██  ██ ██     ▀█▄▄▄  ██  ██ ▀█▄▄██
+//
 
-struct String;
-template <typename>
-class ArrayView;
-template <typename>
-class Array;
+class StringView;
 
-inline bool is_whitespace(char c) {
-    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
-}
-inline bool is_ascii_letter(char c) {
-    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
-}
-inline bool is_decimal_digit(char c) {
-    return (c >= '0' && c <= '9');
-}
+// A bump allocator backed by a reserved region of virtual memory. The region is reserved on the first allocation and
+// pages are committed as the arena grows. Individual blocks are never freed; instead, everything allocated after a
+// mark() is released at once by rewind(), and everything is released by reset(). Not thread-safe.
+class Arena {
+public:
+    // Returned by mark(). Pass it to rewind() to free everything allocated since.
+    struct Mark {
+        char* pos = nullptr;
+    };
+
+    // Rewinds the arena to its current position when the Scope goes out of scope.
+    struct Scope {
+        Arena& arena;
+        Mark mark;
+
+        Scope(Arena& arena) : arena{arena}, mark{arena.mark()} {
+        }
+        ~Scope() {
+            this->arena.rewind(this->mark);
+        }
+    };
+
+    // Maximum size an arena can grow to. Only address space is reserved up front.
+    static constexpr uptr DefaultReserveSize = (PLY_PTR_SIZE == 8) ? (uptr(1) << 32) : (uptr(1) << 26);
+    // reset() decommits pages beyond this size.
+    static constexpr uptr DefaultRetainSize = uptr(1) << 20;
 
-class StringView {
 private:
-    const char* bytes_ = nullptr;
-    u32 num_bytes_ = 0;
+    char* base = nullptr;
+    char* cur = nullptr;
+    char* committed_end = nullptr;
+    uptr num_reserved_bytes = 0;
+    u32 vm_flags = 0;
+
+    PLY_NO_INLINE void* alloc_slow(uptr num_bytes, u32 alignment);
+    uptr get_commit_granularity() const;
 
 public:
-    //----------------------------------------------------
-    // Constructors
-    //----------------------------------------------------
+    // vm_flags are passed to VirtualMemory::reserve_region and commit_pages.
+    Arena(uptr num_reserved_bytes = DefaultReserveSize, u32 vm_flags = 0)
+        : num_reserved_bytes{num_reserved_bytes}, vm_flags{vm_flags} {
+    }
+    Arena(const Arena&) = delete;
+    ~Arena();
+
+    // Returns nullptr if the reserved region is exhausted or more pages can't be committed.
+    void* alloc(uptr num_bytes, u32 alignment = 16) {
+        PLY_ASSERT(is_power_of_2(alignment));
+        uptr pos = ((uptr) this->cur + alignment - 1) & ~uptr(alignment - 1);
+        if (!this->cur || pos > (uptr) this->committed_end || num_bytes > (uptr) this->committed_end - pos)
+            return this->alloc_slow(num_bytes, alignment);
+        this->cur = (char*) pos + num_bytes;
+        return (void*) pos;
+    }
+    // Objects created in an arena are never destroyed, so they must be trivially destructible.
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        PLY_STATIC_ASSERT(std::is_trivially_destructible<T>::value);
+        T* obj = (T*) this->alloc(sizeof(T), alignof(T));
+        new (obj) T{std::forward<Args>(args)...};
+        return obj;
+    }
+    // Resizes a block returned by alloc(). The block grows in place if it's the most recent allocation; otherwise a
+    // new block is allocated and the contents are copied. Shrinking never moves the block.
+    void* realloc(void* ptr, uptr old_num_bytes, uptr num_bytes, u32 alignment = 16);
+    // Copies the string into the arena and returns a view of the copy.
+    StringView copy(StringView str);
+
+    Mark mark() const {
+        return {this->cur};
+    }
+    void rewind(Mark mark) {
+        PLY_ASSERT(mark.pos <= this->cur && (mark.pos >= this->base || !mark.pos));
+        if (mark.pos) {
+            this->cur = mark.pos;
+        } else {
+            this->cur = this->base;
+        }
+    }
+    // Frees everything. Committed pages up to num_bytes_to_retain are kept for reuse.
+    void reset(uptr num_bytes_to_retain = DefaultRetainSize);
+
+    uptr num_bytes_allocated() const {
+        return this->cur - this->base;
+    }
+    uptr num_bytes_committed() const {
+        return this->committed_end - this->base;
+    }
+};
+
+//  ▄▄▄▄▄                ▄▄
+//  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//  ██▀▀▀  ██  ██ ██  ██ ██
+//  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+// Untyped base class of Pool<T>. Blocks are carved from cache-line-aligned slabs and never returned to the heap until
+// the pool is destroyed. Freed blocks go onto an intrusive free list. When thread caches are enabled, each thread keeps
+// its own free list and only locks the shared one to move blocks in batches.
+class PoolBase {
+public:
+    static constexpr u32 CacheLineSize = 64;
+    static constexpr uptr SlabSize = 64 * 1024;
+
+protected:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct ThreadCache {
+        PoolBase* pool = nullptr;
+        FreeBlock* head = nullptr;
+        u32 num_blocks = 0;
+        ThreadCache* next_cache = nullptr;
+    };
+
+    uptr block_size = 0;
+    uptr slab_size = 0;
+    u32 batch_size = 0;
+    bool use_thread_caches = false;
+    ThreadLocal<ThreadCache*> thread_cache;
+    // Holds the same ThreadCache as thread_cache. Its destructor returns the cache to the pool when the thread exits.
+#if defined(PLY_WINDOWS)
+    DWORD thread_exit_index = FLS_OUT_OF_INDEXES;
+#elif defined(PLY_POSIX)
+    pthread_key_t thread_exit_key;
+#endif
+
+    // The following members are protected by mutex.
+    Mutex mutex;
+    FreeBlock* free_list = nullptr;
+    char* slab_cur = nullptr;
+    char* slab_end = nullptr;
+    void* slabs = nullptr;                 // Each slab begins with a pointer to the next slab.
+    ThreadCache* thread_caches = nullptr; // Every thread cache created for this pool.
+
+    PoolBase(uptr object_size, u32 object_alignment, bool use_thread_caches);
+    ~PoolBase();
+    FreeBlock* pop_block_locked();
+    ThreadCache* get_or_create_thread_cache();
+    static void destroy_thread_cache(void* value);
+    PLY_NO_INLINE void* alloc_slow();
+    PLY_NO_INLINE void free_slow(void* ptr);
+
+public:
+    PoolBase(const PoolBase&) = delete;
+
+    void* alloc() {
+        if (this->use_thread_caches) {
+            ThreadCache* tc = this->thread_cache.load();
+            if (tc && tc->head) {
+                FreeBlock* block = tc->head;
+                tc->head = block->next;
+                tc->num_blocks--;
+                return block;
+            }
+        }
+        return this->alloc_slow();
+    }
+    void free(void* ptr) {
+        if (!ptr)
+            return;
+        if (this->use_thread_caches) {
+            ThreadCache* tc = this->thread_cache.load();
+            if (tc && tc->num_blocks < this->batch_size * 2) {
+                FreeBlock* block = (FreeBlock*) ptr;
+                block->next = tc->head;
+                tc->head = block;
+                tc->num_blocks++;
+                return;
+            }
+        }
+        this->free_slow(ptr);
+    }
+    // Returns the calling thread's cached blocks to the shared free list. This happens automatically when the thread
+    // exits.
+    void flush_thread_cache();
+
+    uptr get_block_size() const {
+        return this->block_size;
+    }
+};
+
+// A pool of fixed-size blocks for objects of type T. Useful for node-based containers that allocate and free many
+// objects of the same size.
+template <typename T>
+class Pool : public PoolBase {
+public:
+    Pool(bool use_thread_caches = false) : PoolBase{sizeof(T), alignof(T), use_thread_caches} {
+    }
+
+    // A process-wide pool with thread caches enabled. It's never destroyed.
+    static Pool& get_shared() {
+        static Pool* pool = []() {
+            Heap::TagScope tag_scope{"Pool"};
+            return Heap::create<Pool>(true);
+        }();
+        return *pool;
+    }
+
+    T* alloc() {
+        return (T*) PoolBase::alloc();
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        T* obj = this->alloc();
+        new (obj) T{std::forward<Args>(args)...};
+        return obj;
+    }
+
+    void destroy(T* obj) {
+        obj->~T();
+        this->free(obj);
+    }
+};
+
+// Node allocators for node-based containers such as BTree. They allocate raw memory; the container constructs and
+// destructs the nodes itself.
+struct HeapNodeAllocator {
+    template <typename Node>
+    static Node* alloc() {
+        return (Node*) Heap::alloc(sizeof(Node));
+    }
+    template <typename Node>
+    static void free(Node* node) {
+        Heap::free(node);
+    }
+};
+
+struct PoolNodeAllocator {
+    template <typename Node>
+    static Node* alloc() {
+        return Pool<Node>::get_shared().alloc();
+    }
+    template <typename Node>
+    static void free(Node* node) {
+        Pool<Node>::get_shared().free(node);
+    }
+};
+
+// Allocators for Array, Set and Map. Each container keeps a copy of its allocator and always returns memory to the
+// allocator that provided it. HeapAllocator is empty, so it doesn't add to the size of the container.
+struct HeapAllocator {
+    void* alloc(uptr num_bytes) {
+        return Heap::alloc(num_bytes);
+    }
+    void* realloc(void* ptr, uptr, uptr num_bytes) {
+        return Heap::realloc(ptr, num_bytes);
+    }
+    void free(void* ptr, uptr) {
+        Heap::free(ptr);
+    }
+};
+
+// Allocates from an Arena, which must outlive the container. Freed memory is only reclaimed when the arena is rewound
+// or reset.
+struct ArenaAllocator {
+    Arena* arena = nullptr;
+
+    ArenaAllocator() = default;
+    ArenaAllocator(Arena& arena) : arena{&arena} {
+    }
+    void* alloc(uptr num_bytes) {
+        PLY_ASSERT(this->arena);
+        void* ptr = this->arena->alloc(num_bytes);
+        PLY_ASSERT(ptr);
+        return ptr;
+    }
+    void* realloc(void* ptr, uptr old_num_bytes, uptr num_bytes) {
+        PLY_ASSERT(this->arena);
+        ptr = this->arena->realloc(ptr, old_num_bytes, num_bytes);
+        PLY_ASSERT(ptr || num_bytes == 0);
+        return ptr;
+    }
+    void free(void*, uptr) {
+    }
+};
+
+//   ▄▄▄▄   ▄▄          ▄▄               ▄▄   ▄▄ ▄▄
+//  ██  ▀▀ ▄██▄▄ ▄▄▄▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
+//   ▀▀▀█▄  ██   ██  ▀▀ ██ ██  ██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
+//  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██   ▀█▀   ██ ▀█▄▄▄   ██▀▀██
+//                                 ▄▄▄█▀
+
+struct String;
+template <typename>
+class ArrayView;
+template <typename Item, typename Allocator = HeapAllocator>
+class Array;
+
+inline bool is_whitespace(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+inline bool is_ascii_letter(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+inline bool is_decimal_digit(char c) {
+    return (c >= '0' && c <= '9');
+}
+
+class StringView {
+private:
+    const char* bytes_ = nullptr;
+    u32 num_bytes_ = 0;
+
+public:
+    //----------------------------------------------------
+    // Constructors
+    //----------------------------------------------------
 
     StringView() = default;
     StringView(const char* s) : bytes_{s}, num_bytes_{numeric_cast<u32>(::strlen(s))} {
@@ -1616,6 +2349,8 @@ public:
     PLY_NO_DISCARD String upper() const;
     PLY_NO_DISCARD String lower() const;
     PLY_NO_DISCARD Array<StringView> split(StringView separator) const;
+    template <typename Allocator>
+    PLY_NO_DISCARD Array<StringView, Allocator> split(StringView separator, const Allocator& allocator) const;
     PLY_NO_DISCARD String join(ArrayView<const StringView> comps) const;
     PLY_NO_DISCARD String replace(StringView old_substr, StringView new_substr) const;
 
@@ -1627,12 +2362,24 @@ public:
     bool match(StringView pattern, Args*... args) const;
 };
 
+// StringView's find, reverse_find, trim, split and replace functions use SIMD instructions when the CPU supports them.
+// The best instruction set is detected at runtime. set_string_simd selects a different one, which is mainly useful for
+// tests and benchmarks; it returns false if the CPU doesn't support it. It isn't thread-safe.
+enum class StringSIMD {
+    None,
+    SSE2,
+    AVX2,
+};
+StringSIMD get_string_simd();
+bool set_string_simd(StringSIMD simd);
+
 s32 compare(StringView a, StringView b);
 inline bool operator==(StringView a, StringView b) {
-    return compare(a, b) == 0;
+    return (a.num_bytes() == b.num_bytes()) &&
+           ((a.num_bytes() == 0) || (memcmp(a.bytes(), b.bytes(), a.num_bytes()) == 0));
 }
 inline bool operator!=(StringView a, StringView b) {
-    return compare(a, b) != 0;
+    return !(a == b);
 }
 inline bool operator<(StringView a, StringView b) {
     return compare(a, b) < 0;
@@ -1688,29 +2435,79 @@ struct MutStringView {
 //  ▀█▄▄█▀  ▀█▄▄ ██     ██ ██  ██ ▀█▄▄██
 //                                 ▄▄▄█▀
 
+// Define PLY_STRING_INLINE=1 to store short strings inside the String object itself instead of on the heap. It's
+// opt-in because a StringView of a short String then points into the String object, so the view is invalidated when
+// the String is moved, including when an Array of objects containing Strings grows.
+#if !defined(PLY_STRING_INLINE)
+#define PLY_STRING_INLINE 0
+#endif
+
+// When PLY_STRING_INLINE=1, the last byte of the object holds the length of an inline string, or HeapTag if the bytes
+// are on the heap.
 class String {
+public:
+    static constexpr u32 InlineCapacity = PLY_STRING_INLINE ? ((PLY_PTR_SIZE == 8) ? 15 : 11) : 0;
+
+private:
+#if PLY_STRING_INLINE
+    static constexpr u8 HeapTag = 0xff;
+
+    struct HeapBytes {
+        char* bytes;
+        u32 num_bytes;
+    };
+    union {
+        HeapBytes heap_;
+        char inline_[InlineCapacity + 1];
+    };
+
+    bool is_inline() const {
+        return (u8) this->inline_[InlineCapacity] != HeapTag;
+    }
+    void set_inline(u32 num_bytes) {
+        PLY_ASSERT(num_bytes <= InlineCapacity);
+        this->inline_[InlineCapacity] = (char) num_bytes;
+    }
+    void set_heap(char* bytes, u32 num_bytes) {
+        this->heap_.bytes = bytes;
+        this->heap_.num_bytes = num_bytes;
+        this->inline_[InlineCapacity] = (char) HeapTag;
+    }
+#else
     char* bytes_ = nullptr;
     u32 num_bytes_ = 0;
+#endif
 
 public:
     //----------------------------------------------------
     // Constructors
     //----------------------------------------------------
 
+#if PLY_STRING_INLINE
+    String() : inline_{} {
+    }
+#else
     String() = default;
+#endif
     String(const String& other) : String{StringView{other}} {
     }
-    String(String&& other) : bytes_{other.bytes_}, num_bytes_{other.num_bytes_} {
-        other.bytes_ = nullptr;
-        other.num_bytes_ = 0;
+    String(String&& other) {
+        memcpy((void*) this, (const void*) &other, sizeof(String));
+        new (&other) String;
     }
     String(StringView other);
     String(const char* s) : String{StringView{s}} { // Needed?
     }
     ~String() {
+#if PLY_STRING_INLINE
+        if (!this->is_inline()) {
+            Heap::free(this->heap_.bytes);
+        }
+#else
         if (this->bytes_) {
             Heap::free(this->bytes_);
         }
+#endif
     }
 
     //----------------------------------------------------
@@ -1718,13 +2515,17 @@ public:
     //----------------------------------------------------
 
     String& operator=(const String& other) {
-        this->~String();
-        new (this) String{other};
+        if (this != &other) {
+            this->~String();
+            new (this) String{other};
+        }
         return *this;
     }
     String& operator=(String&& other) {
-        this->~String();
-        new (this) String{std::move(other)};
+        if (this != &other) {
+            this->~String();
+            new (this) String{std::move(other)};
+        }
         return *this;
     }
 
@@ -1733,13 +2534,24 @@ public:
     //----------------------------------------------------
 
     operator StringView() const {
-        return {this->bytes_, this->num_bytes_};
+        return {this->bytes(), this->num_bytes()};
     }
 
     //----------------------------------------------------
     // Accessing string bytes
     //----------------------------------------------------
 
+#if PLY_STRING_INLINE
+    const char* bytes() const {
+        return this->is_inline() ? this->inline_ : this->heap_.bytes;
+    }
+    char* bytes() {
+        return this->is_inline() ? this->inline_ : this->heap_.bytes;
+    }
+    u32 num_bytes() const {
+        return this->is_inline() ? (u8) this->inline_[InlineCapacity] : this->heap_.num_bytes;
+    }
+#else
     const char* bytes() const {
         return this->bytes_;
     }
@@ -1749,33 +2561,34 @@ public:
     u32 num_bytes() const {
         return this->num_bytes_;
     }
+#endif
     const char& operator[](u32 index) const {
-        PLY_ASSERT(index < this->num_bytes_);
-        return this->bytes_[index];
+        PLY_ASSERT(index < this->num_bytes());
+        return this->bytes()[index];
     }
     char& operator[](u32 index) {
-        PLY_ASSERT(index < this->num_bytes_);
-        return this->bytes_[index];
+        PLY_ASSERT(index < this->num_bytes());
+        return this->bytes()[index];
     }
     const char& back(s32 ofs = -1) const {
-        PLY_ASSERT(u32(-ofs - 1) < this->num_bytes_);
-        return this->bytes_[this->num_bytes_ + ofs];
+        PLY_ASSERT(u32(-ofs - 1) < this->num_bytes());
+        return this->bytes()[this->num_bytes() + ofs];
     }
     char& back(s32 ofs = -1) {
-        PLY_ASSERT(u32(-ofs - 1) < this->num_bytes_);
-        return this->bytes_[this->num_bytes_ + ofs];
+        PLY_ASSERT(u32(-ofs - 1) < this->num_bytes());
+        return this->bytes()[this->num_bytes() + ofs];
     }
     char* begin() {
-        return this->bytes_;
+        return this->bytes();
     }
     const char* begin() const {
-        return this->bytes_;
+        return this->bytes();
     }
     char* end() {
-        return this->bytes_ + this->num_bytes_;
+        return this->bytes() + this->num_bytes();
     }
     const char* end() const {
-        return this->bytes_ + this->num_bytes_;
+        return this->bytes() + this->num_bytes();
     }
 
     //----------------------------------------------------
@@ -1783,10 +2596,10 @@ public:
     //----------------------------------------------------
 
     bool is_empty() const {
-        return this->num_bytes_ == 0;
+        return this->num_bytes() == 0;
     }
     explicit operator bool() const {
-        return this->num_bytes_ != 0;
+        return this->num_bytes() != 0;
     }
     bool starts_with(StringView arg) const {
         return ((StringView) * this).starts_with(arg);
@@ -1814,25 +2627,19 @@ public:
     //----------------------------------------------------
 
     StringView substr(u32 start) const {
-        PLY_ASSERT(start <= this->num_bytes_);
-        return {this->bytes_ + start, this->num_bytes_ - start};
+        return ((StringView) * this).substr(start);
     }
     StringView substr(u32 start, u32 num_bytes) const {
-        PLY_ASSERT(start <= this->num_bytes_);
-        PLY_ASSERT(start + num_bytes <= this->num_bytes_);
-        return {this->bytes_ + start, num_bytes};
+        return ((StringView) * this).substr(start, num_bytes);
     }
     StringView left(u32 num_bytes) const {
-        PLY_ASSERT(num_bytes <= this->num_bytes_);
-        return {this->bytes_, num_bytes};
+        return ((StringView) * this).left(num_bytes);
     }
     StringView shortened_by(u32 num_bytes) const {
-        PLY_ASSERT(num_bytes <= this->num_bytes_);
-        return {this->bytes_, this->num_bytes_ - num_bytes};
+        return ((StringView) * this).shortened_by(num_bytes);
     }
     StringView right(u32 num_bytes) const {
-        PLY_ASSERT(num_bytes <= this->num_bytes_);
-        return {this->bytes_ + this->num_bytes_ - num_bytes, num_bytes};
+        return ((StringView) * this).right(num_bytes);
     }
     StringView trim(bool (*match_func)(char) = is_whitespace, bool left = true, bool right = true) const {
         return ((StringView) * this).trim(match_func, left, right);
@@ -1855,17 +2662,16 @@ public:
         return ((StringView) * this).lower();
     }
     PLY_NO_DISCARD Array<StringView> split(StringView separator) const;
+    template <typename Allocator>
+    PLY_NO_DISCARD Array<StringView, Allocator> split(StringView separator, const Allocator& allocator) const;
     PLY_NO_DISCARD String join(ArrayView<const StringView> comps) const;
     PLY_NO_DISCARD String replace(StringView old_substr, StringView new_substr) const {
         return ((StringView) * this).replace(old_substr, new_substr);
     }
     static String allocate(u32 num_bytes);
-    static String adopt(char* bytes, u32 num_bytes) {
-        String str;
-        str.bytes_ = bytes;
-        str.num_bytes_ = num_bytes;
-        return str;
-    }
+    // Takes ownership of a block allocated from the heap. When PLY_STRING_INLINE=1, short strings are copied inline and
+    // the block is freed.
+    static String adopt(char* bytes, u32 num_bytes);
 
     //----------------------------------------------------
     // Pattern matching
@@ -1879,22 +2685,16 @@ public:
     //----------------------------------------------------
 
     void clear() {
-        if (this->bytes_) {
-            Heap::free(this->bytes_);
-        }
-        this->bytes_ = nullptr;
-        this->num_bytes_ = 0;
+        this->~String();
+        new (this) String;
     }
     void operator+=(StringView other) {
         *this = *this + other;
     }
     void resize(u32 num_bytes);
-    char* release() {
-        char* r = this->bytes_;
-        this->bytes_ = nullptr;
-        this->num_bytes_ = 0;
-        return r;
-    }
+    // Returns the bytes in a block allocated from the heap, which the caller must free. The string is left empty. When
+    // PLY_STRING_INLINE=1, inline strings are copied to a new block.
+    char* release();
 
     //----------------------------------------------------
     // Formatting
@@ -1955,37 +2755,79 @@ inline u64 unshuffle_bits(u64 h) {
     return h;
 }
 
+// multiply_128 computes the full 128-bit product of two 64-bit integers. multiply_and_fold XORs the upper and lower
+// halves of the product together. It's the mixing step used by HashBuilder, following wyhash:
+// https://github.com/wangyi-fudan/wyhash.
+
+inline void multiply_128(u64 a, u64 b, u64* lo, u64* hi) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t) a * b;
+    *lo = (u64) product;
+    *hi = (u64) (product >> 64);
+#else
+    u64 a_lo = (u32) a, a_hi = a >> 32;
+    u64 b_lo = (u32) b, b_hi = b >> 32;
+    u64 mid0 = a_hi * b_lo;
+    u64 mid1 = a_lo * b_hi;
+    u64 low = a_lo * b_lo;
+    u64 t = low + (mid0 << 32);
+    u64 carry = t < low;
+    *lo = t + (mid1 << 32);
+    carry += *lo < t;
+    *hi = a_hi * b_hi + (mid0 >> 32) + (mid1 >> 32) + carry;
+#endif
+}
+
+inline u64 multiply_and_fold(u64 a, u64 b) {
+    u64 lo, hi;
+    multiply_128(a, b, &lo, &hi);
+    return lo ^ hi;
+}
+
 //----------------------------------------------------
 // HashBuilder is a helper class used to calculate hash values for aggregate data types.
-// It uses MurmurHash3's hashing algorithm.
+// It keeps a 64-bit state. Integers are mixed in with one multiply_and_fold each, and strings are hashed eight bytes at
+// a time using a wyhash-style kernel that's seeded with the current state. Passing a nonzero seed to the constructor
+// makes the result unpredictable to anyone who doesn't know the seed.
 
 struct HashBuilder {
-    u32 accumulator = 0;
+    static constexpr u64 Secret0 = 0x2d358dccaa6c78a5ull;
+    static constexpr u64 Secret1 = 0x8bb84b93962eacc9ull;
 
+    u64 accumulator = 0;
+
+    HashBuilder(u64 seed = 0) : accumulator{seed} {
+    }
+    u64 get_result64() const {
+        return this->accumulator;
+    }
     u32 get_result() const {
-        return shuffle_bits(this->accumulator);
+        return (u32) (this->accumulator ^ (this->accumulator >> 32));
     }
 };
 
-void add_to_hash(HashBuilder& builder, u32 value);
+inline void add_to_hash(HashBuilder& builder, u64 value) {
+    // The state is folded into both factors so that no value can zero a factor independently of the seed.
+    builder.accumulator = multiply_and_fold(builder.accumulator ^ HashBuilder::Secret0,
+                                            value ^ HashBuilder::Secret1 ^ builder.accumulator);
+}
+inline void add_to_hash(HashBuilder& builder, u32 value) {
+    add_to_hash(builder, (u64) value);
+}
 inline void add_to_hash(HashBuilder& builder, u8 value) {
-    add_to_hash(builder, (u32) value);
+    add_to_hash(builder, (u64) value);
 }
 inline void add_to_hash(HashBuilder& builder, u16 value) {
-    add_to_hash(builder, (u32) value);
-}
-inline void add_to_hash(HashBuilder& builder, u64 value) {
-    add_to_hash(builder, (u32) value);
-    add_to_hash(builder, (u32) (value >> 32));
+    add_to_hash(builder, (u64) value);
 }
 inline void add_to_hash(HashBuilder& builder, s8 value) {
-    add_to_hash(builder, (u32) value);
+    add_to_hash(builder, (u64) value);
 }
 inline void add_to_hash(HashBuilder& builder, s16 value) {
-    add_to_hash(builder, (u32) value);
+    add_to_hash(builder, (u64) value);
 }
 inline void add_to_hash(HashBuilder& builder, s32 value) {
-    add_to_hash(builder, (u32) value);
+    add_to_hash(builder, (u64) value);
 }
 inline void add_to_hash(HashBuilder& builder, s64 value) {
     add_to_hash(builder, (u64) value);
@@ -2002,27 +2844,32 @@ void add_to_hash(HashBuilder& builder, StringView str);
 
 //----------------------------------------------------
 // calculate_hash() is a wrapper around HashBuilder that's used internally by Map and Set.
+// The seed is nonzero only for containers that called set_hash_seed().
 
 template <typename T>
-u32 calculate_hash(const T& item) {
-    HashBuilder visitor;
+u32 calculate_hash(const T& item, u64 seed = 0) {
+    HashBuilder visitor{seed};
     add_to_hash(visitor, item);
     return visitor.get_result();
 }
 
 // Specialize calculate_hash() for pointers, u32 and u64.
-// These specializations don't use Hash_Calculator; they just call shuffle_bits directly.
+// These specializations don't use HashBuilder; they just call shuffle_bits directly.
 template <typename T>
-inline u32 calculate_hash(T* item) {
-    return (u32) shuffle_bits((uptr) item);
+inline u32 calculate_hash(T* item, u64 seed = 0) {
+    return (u32) shuffle_bits((uptr) item ^ (uptr) seed);
 }
-inline u32 calculate_hash(u32 item) {
-    return shuffle_bits(item);
+inline u32 calculate_hash(u32 item, u64 seed = 0) {
+    return shuffle_bits(item ^ (u32) seed);
 }
-inline u32 calculate_hash(u64 item) {
-    return (u32) shuffle_bits(item);
+inline u32 calculate_hash(u64 item, u64 seed = 0) {
+    return (u32) shuffle_bits(item ^ seed);
 }
 
+// Returns a random seed suitable for set_hash_seed(), read from the operating system's entropy source. Maps whose keys
+// come from untrusted input, such as HTTP headers, should use one so that an attacker can't choose keys that collide.
+u64 generate_hash_seed();
+
 //   ▄▄▄▄                              ▄▄   ▄▄ ▄▄
 //  ██  ██ ▄▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄  ▄▄  ▄▄ ██   ██ ▄▄  ▄▄▄▄  ▄▄    ▄▄
 //  ██▀▀██ ██  ▀▀ ██  ▀▀  ▄▄▄██ ██  ██  ██ ██  ██ ██▄▄██ ██ ██ ██
@@ -2162,23 +3009,36 @@ bool operator==(const Arr0& a, const Arr1& b) {
 //  ██  ██ ██     ██     ▀█▄▄██ ▀█▄▄██
 //                               ▄▄▄█▀
 
-template <typename Item>
-class Array {
+// The allocator is stored as a private base class so that empty allocators take up no space.
+template <typename Item, typename Allocator>
+class Array : private Allocator {
 private:
     Item* items_ = nullptr;
     u32 num_items_ = 0;
     u32 allocated = 0;
 
     // Make all other Array specializations friend classes.
-    template <typename>
+    template <typename, typename>
     friend class Array;
 
     void alloc(u32 num_items) {
         PLY_ASSERT(!this->items_);
         this->allocated = round_up_to_nearest_to_power_of_2(num_items);
-        this->items_ = (Item*) Heap::alloc(uptr(this->allocated) * sizeof(Item));
+        this->items_ = (Item*) Allocator::alloc(uptr(this->allocated) * sizeof(Item));
         this->num_items_ = num_items;
     }
+    void destroy_and_free() {
+        for (u32 i = 0; i < this->num_items_; i++) {
+            ((Item*) this->items_)[i].~Item();
+        }
+        Allocator::free(this->items_, uptr(this->allocated) * sizeof(Item));
+    }
+    // Reset to an empty state without touching the allocator.
+    void reset() {
+        this->items_ = nullptr;
+        this->num_items_ = 0;
+        this->allocated = 0;
+    }
 
 public:
     //----------------------------------------------------
@@ -2186,21 +3046,29 @@ public:
     //----------------------------------------------------
 
     Array() = default;
-    // Copy constructor.
-    Array(const Array<Item>& other_array) {
+    // Construct an empty array that allocates from the given allocator.
+    explicit Array(const Allocator& allocator) : Allocator(allocator) {
+    }
+    // Copy constructor. The new array uses a copy of the other array's allocator.
+    Array(const Array& other_array) : Array(other_array, other_array.get_allocator()) {
+    }
+    // Copy using the given allocator.
+    Array(const Array& other_array, const Allocator& allocator) : Allocator(allocator) {
         this->alloc(other_array.num_items_);
         for (u32 i = 0; i < other_array.num_items_; i++) {
             new (&this->items_[i]) Item{other_array.items_[i]};
         }
     }
-    // Move constructor.
-    Array(Array<Item>&& other_array)
-        : items_{other_array.items_}, num_items_{other_array.num_items_}, allocated{other_array.allocated} {
-        new (&other_array) Array<Item>;
+    // Move constructor. The other array is left empty but keeps its allocator.
+    Array(Array&& other_array)
+        : Allocator(other_array.get_allocator()), items_{other_array.items_}, num_items_{other_array.num_items_},
+          allocated{other_array.allocated} {
+        other_array.reset();
     }
     // Construct from any compatible array.
-    template <typename T, PLY_ENABLE_IF_WELL_FORMED(ArrayView<const Item>(declval<T>()))>
-    Array(T&& other_array) {
+    template <typename T, PLY_ENABLE_IF_WELL_FORMED(ArrayView<const Item>(declval<T>())),
+              PLY_ENABLE_IF((!std::is_same<std::decay_t<T>, Array>::value))>
+    Array(T&& other_array, const Allocator& allocator = Allocator{}) : Allocator(allocator) {
         u32 num_other_items = ArrayView<const Item>{other_array}.num_items();
         this->alloc(num_other_items);
         for (u32 i = 0; i < num_other_items; i++) {
@@ -2208,7 +3076,7 @@ public:
         }
     }
     // Construct from initializer list.
-    Array(std::initializer_list<Item> init_list) {
+    Array(std::initializer_list<Item> init_list, const Allocator& allocator = Allocator{}) : Allocator(allocator) {
         u32 init_size = numeric_cast<u32>(init_list.size());
         this->alloc(init_size);
         const Item* src = init_list.begin();
@@ -2218,48 +3086,53 @@ public:
     }
     // Destructor.
     ~Array() {
-        for (u32 i = 0; i < this->num_items_; i++) {
-            ((Item*) this->items_)[i].~Item();
-        }
-        Heap::free(this->items_);
+        this->destroy_and_free();
+    }
+    // Adopt an array from a raw pointer. The items must have been allocated by the given allocator.
+    static Array adopt(Item* items, u32 num_items, const Allocator& allocator = Allocator{}) {
+        Array result(allocator);
+        result.items_ = items;
+        result.num_items_ = num_items;
+        result.allocated = num_items;
+        return result;
     }
-    // Adopt an array from a raw pointer.
-    static Array<Item> adopt(Item* items, u32 num_items) {
-        return {items, num_items, num_items};
+    // Return the allocator used by this array.
+    const Allocator& get_allocator() const {
+        return *this;
     }
 
     //----------------------------------------------------
     // Assignment operators
     //----------------------------------------------------
 
-    // Copy assignment operator.
-    Array& operator=(const Array<Item>& other) {
+    // Copy assignment operator. The array keeps its own allocator.
+    Array& operator=(const Array& other) {
         if (this != &other) {
+            Allocator allocator = this->get_allocator();
             this->~Array();
-            new (this) Array{other};
+            new (this) Array(other, allocator);
         }
         return *this;
     }
-    // Move assignment operator.
-    Array& operator=(Array<Item>&& other) {
+    // Move assignment operator. The array takes the other array's allocator.
+    Array& operator=(Array&& other) {
         if (this != &other) {
             this->~Array();
             new (this) Array{std::move(other)};
         }
         return *this;
     }
-    // Assign from any compatible array.
+    // Assign from any compatible array. The array keeps its own allocator.
     template <typename Other, PLY_ENABLE_IF_WELL_FORMED(ArrayView<const Item>(declval<Other>()))>
     Array& operator=(Other&& other) {
-        Array<Item> array_to_free{std::move(*this)};
-        new (this) Array{std::forward<Other>(other)};
+        Array array_to_free{std::move(*this)};
+        new (this) Array(std::forward<Other>(other), array_to_free.get_allocator());
         return *this;
     }
     // Assign from initializer list.
     Array& operator=(std::initializer_list<Item> init_list) {
-        for (u32 i = 0; i < this->num_items_; i++) {
-            ((Item*) this->items_)[i].~Item();
-        }
+        this->destroy_and_free();
+        this->reset();
         u32 init_size = numeric_cast<u32>(init_list.size());
         this->alloc(init_size);
         const Item* src = init_list.begin();
@@ -2269,7 +3142,7 @@ public:
         return *this;
     }
     // Extend from array with move semantics.
-    Array& operator+=(Array<Item>&& other_array) {
+    Array& operator+=(Array&& other_array) {
         u32 num_other_items = ArrayView<const Item>{other_array}.num_items();
         this->reserve(this->num_items_ + num_other_items);
         for (u32 i = 0; i < num_other_items; i++) {
@@ -2394,11 +3267,8 @@ public:
     }
     // Clear the array.
     void clear() {
-        for (u32 i = 0; i < this->num_items_; i++) {
-            ((Item*) this->items_)[i].~Item();
-        }
-        Heap::free(this->items_);
-        new (this) Array<Item>;
+        this->destroy_and_free();
+        this->reset();
     }
     // Append an item to the array with copy semantics.
     Item& append(const Item& item) {
@@ -2473,15 +3343,18 @@ public:
     // Reserve space for a given number of items. The number is rounded up to the nearest power of 2.
     void reserve(u32 num_items) {
         if (num_items > this->allocated) {
-            this->allocated =
+            u32 new_allocated =
                 round_up_to_nearest_to_power_of_2(num_items); // FIXME: Generalize to other resize strategies?
-            this->items_ = (Item*) Heap::realloc(this->items_, uptr(this->allocated) * sizeof(Item));
+            this->items_ = (Item*) Allocator::realloc(this->items_, uptr(this->allocated) * sizeof(Item),
+                                                      uptr(new_allocated) * sizeof(Item));
+            this->allocated = new_allocated;
         }
     }
     // Compact the array by compacting the heap memory to exactly fit the number of items.
     void compact() {
+        this->items_ = (Item*) Allocator::realloc(this->items_, uptr(this->allocated) * sizeof(Item),
+                                                  uptr(this->num_items_) * sizeof(Item));
         this->allocated = this->num_items_;
-        this->items_ = (Item*) Heap::realloc(this->items_, uptr(this->allocated) * sizeof(Item));
     }
 
     //----------------------------------------------------
@@ -2491,7 +3364,7 @@ public:
     // Release the array and return the items. The array is reset to an empty state.
     Item* release() {
         Item* items = (Item*) this->items_;
-        new (this) Array<Item>; // Reset the array to an empty state.
+        this->reset(); // Reset the array to an empty state.
         return items;
     }
     // Convert to an `ArrayView`.
@@ -2520,20 +3393,55 @@ public:
     }
 };
 
-template <typename Item_>
-struct ArrayTraits<Array<Item_>> {
+template <typename Item_, typename Allocator>
+struct ArrayTraits<Array<Item_, Allocator>> {
     using Item = Item_;
 };
 
-template <typename Item_>
-struct ArrayTraits<const Array<Item_>> {
+template <typename Item_, typename Allocator>
+struct ArrayTraits<const Array<Item_, Allocator>> {
     using Item = const Item_;
 };
 
+template <typename Allocator>
+Array<StringView, Allocator> StringView::split(StringView separator, const Allocator& allocator) const {
+    Array<StringView, Allocator> result(allocator);
+    u32 start = 0;
+    while (start < this->num_bytes_) {
+        s32 pos = this->find(separator, start);
+        if (pos < 0) {
+            // No more separators found, add the rest
+            StringView remainder = this->substr(start);
+            if (remainder.num_bytes_ > 0) {
+                result.append(remainder);
+            }
+            break;
+        }
+        // Add the part before the separator (if non-empty)
+        if ((u32) pos > start) {
+            result.append(this->substr(start, pos - start));
+        }
+        start = pos + separator.num_bytes_;
+    }
+    if (result.is_empty()) {
+        result.append({});
+    }
+    return result;
+}
+
+inline Array<StringView> StringView::split(StringView separator) const {
+    return this->split(separator, HeapAllocator{});
+}
+
 inline Array<StringView> String::split(StringView separator) const {
     return ((StringView) * this).split(separator);
 }
 
+template <typename Allocator>
+Array<StringView, Allocator> String::split(StringView separator, const Allocator& allocator) const {
+    return ((StringView) * this).split(separator, allocator);
+}
+
 //  ▄▄▄▄▄ ▄▄                   ▄▄  ▄▄▄▄
 //  ██    ▄▄ ▄▄  ▄▄  ▄▄▄▄   ▄▄▄██ ██  ██ ▄▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄  ▄▄  ▄▄
 //  ██▀▀  ██  ▀██▀  ██▄▄██ ██  ██ ██▀▀██ ██  ▀▀ ██  ▀▀  ▄▄▄██ ██  ██
@@ -2664,31 +3572,102 @@ using LookupKey = std::decay_t<decltype(get_any_lookup_key(declval<Item>()))>;
 u32 get_best_num_hash_indices(u32 num_items);
 
 //----------------------------------------------------
-template <typename Key, typename Subclass>
-struct HashLookup {
+// HashLookup maps keys to item indices using open addressing with linear probing. Each slot holds an s32 item index
+// and a control byte. The control byte is HashEmpty if the slot is empty; otherwise, it holds the top 7 bits of the
+// item's hash. Probes compare HashGroupSize control bytes at once and only call get_key() for slots whose 7 bits
+// match, so most collisions are rejected without touching the subclass's items.
+//
+// The control bytes are stored right after the indices and are followed by HashGroupSize - 1 clones of the first
+// control bytes, so that a group can be loaded starting at any slot without wrapping around.
+
+static constexpr u32 HashGroupSize = 16;
+static constexpr u8 HashEmpty = 0x80;
+static constexpr u32 HashNumScalarProbes = 2;
+
+PLY_FORCE_INLINE u8 get_hash_tag(u32 hash) {
+    return u8(hash >> 25);
+}
+
+struct HashGroupMasks {
+    u32 matches; // Bit i is set if control[i] equals the tag.
+    u32 empty;   // Bit i is set if control[i] is HashEmpty.
+};
+
+PLY_FORCE_INLINE HashGroupMasks scan_hash_group(const u8* control, u8 tag) {
+#if PLY_CPU_X64
+    __m128i group = _mm_loadu_si128((const __m128i*) control);
+    u32 matches = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+    return {matches, (u32) _mm_movemask_epi8(group)};
+#else
+    HashGroupMasks masks = {0, 0};
+    for (u32 i = 0; i < HashGroupSize; i++) {
+        masks.matches |= u32(control[i] == tag) << i;
+        masks.empty |= u32(control[i] >> 7) << i;
+    }
+    return masks;
+#endif
+}
+
+// When HashTraits<Key>::CacheHashes is true, each slot also stores the full 32-bit hash of its item. Growing the table
+// then reuses the stored hashes instead of calling get_key() and rehashing every item, and lookups compare the full
+// hash before comparing keys. It's enabled for every key type except integers, floating-point numbers, enums and
+// pointers, whose hashes are cheaper to recompute than to store. Specialize HashTraits to override it.
+template <typename Key>
+struct HashTraits {
+    static constexpr bool CacheHashes =
+        !std::is_arithmetic<Key>::value && !std::is_enum<Key>::value && !std::is_pointer<Key>::value;
+};
+
+// The indices are allocated from the same allocator as the subclass's items. Like Array, the allocator is stored as a
+// private base class. The block holds the indices, each followed by its cached hash if any, then the control bytes.
+template <typename Key, typename Subclass, typename Allocator>
+struct HashLookup : private Allocator {
+    static constexpr bool CacheHashes = HashTraits<Key>::CacheHashes;
+
     s32* indices = nullptr;
     u32 num_indices = 0;
     u32 num_allocated_indices = 0;
+    u64 hash_seed = 0;
+
+    static uptr get_block_size(u32 num_slots) {
+        uptr bytes_per_slot = sizeof(s32) + (CacheHashes ? sizeof(u32) : 0) + 1;
+        return bytes_per_slot * num_slots + HashGroupSize - 1;
+    }
 
     HashLookup() = default;
-    HashLookup(const HashLookup& other)
-        : indices{(s32*) Heap::alloc(sizeof(s32) * other.num_allocated_indices)}, num_indices{other.num_indices},
-          num_allocated_indices{other.num_allocated_indices} {
-        for (u32 i = 0; i < this->num_allocated_indices; i++) {
-            this->indices[i] = other.indices[i];
+    explicit HashLookup(const Allocator& allocator) : Allocator(allocator) {
+    }
+    HashLookup(const HashLookup& other) : HashLookup(other, other.get_allocator()) {
+    }
+    HashLookup(const HashLookup& other, const Allocator& allocator)
+        : Allocator(allocator), num_indices{other.num_indices}, num_allocated_indices{other.num_allocated_indices},
+          hash_seed{other.hash_seed} {
+        if (other.indices) {
+            uptr block_size = get_block_size(this->num_allocated_indices);
+            this->indices = (s32*) Allocator::alloc(block_size);
+            memcpy(this->indices, other.indices, block_size);
         }
     }
     HashLookup(HashLookup&& other)
-        : indices{other.indices}, num_indices{other.num_indices}, num_allocated_indices{other.num_allocated_indices} {
-        new (&other) HashLookup;
+        : Allocator(other.get_allocator()), indices{other.indices}, num_indices{other.num_indices},
+          num_allocated_indices{other.num_allocated_indices}, hash_seed{other.hash_seed} {
+        other.indices = nullptr;
+        other.num_indices = 0;
+        other.num_allocated_indices = 0;
     }
     ~HashLookup() {
-        Heap::free(this->indices);
+        if (this->indices) {
+            Allocator::free(this->indices, get_block_size(this->num_allocated_indices));
+        }
+    }
+    const Allocator& get_allocator() const {
+        return *this;
     }
     HashLookup& operator=(const HashLookup& other) {
         if (this != &other) {
+            Allocator allocator = this->get_allocator();
             this->~HashLookup();
-            new (this) HashLookup{other};
+            new (this) HashLookup(other, allocator);
         }
         return *this;
     }
@@ -2700,48 +3679,157 @@ struct HashLookup {
         return *this;
     }
 
-private:
-    PLY_NO_INLINE void reindex(u32 num_allocated_indices) {
-        PLY_ASSERT(is_power_of_2(num_allocated_indices));
-        u32 mask = num_allocated_indices - 1;
+    PLY_FORCE_INLINE u32 hash_of(const Key& key) const {
+        return calculate_hash(key, this->hash_seed);
+    }
 
-        // Allocate new indices.
-        s32* new_indices = (s32*) Heap::alloc(sizeof(s32) * num_allocated_indices);
-        for (u32 i = 0; i < num_allocated_indices; i++) {
-            new_indices[i] = -1;
+    // Changes the seed passed to calculate_hash and rebuilds the indices.
+    void set_hash_seed(u64 seed) {
+        this->hash_seed = seed;
+        if (this->indices) {
+            this->reindex(this->num_allocated_indices, true);
         }
+    }
+    u64 get_hash_seed() const {
+        return this->hash_seed;
+    }
 
-        // Rebuild indices.
-        for (u32 old_idx = 0; old_idx < this->num_allocated_indices; old_idx++) {
-            s32 item_index = this->indices[old_idx];
-            if (item_index >= 0) {
-                for (u32 new_idx = calculate_hash(static_cast<Subclass*>(this)->get_key(item_index));; new_idx++) {
-                    if (new_indices[new_idx & mask] < 0) {
-                        new_indices[new_idx & mask] = item_index;
-                        break;
-                    }
-                }
-            }
-        }
+private:
+    // If hashes are cached, each one is stored right after its index so that both are in the same cache line.
+    static constexpr u32 SlotStride = CacheHashes ? 2 : 1;
 
-        Heap::free(this->indices);
-        this->indices = new_indices;
-        this->num_allocated_indices = num_allocated_indices;
+    s32& index_at(u32 slot) const {
+        return this->indices[slot * SlotStride];
+    }
+    u32& hash_at(u32 slot) const {
+        PLY_ASSERT(CacheHashes);
+        return (u32&) this->indices[slot * SlotStride + 1];
+    }
+    u8* get_control() const {
+        return (u8*) (this->indices + this->num_allocated_indices * SlotStride);
+    }
+    // Moves the contents of one slot to another, leaving the source slot as is.
+    void copy_slot(u32 dst, u32 src) {
+        this->index_at(dst) = this->index_at(src);
+        if (CacheHashes) {
+            this->hash_at(dst) = this->hash_at(src);
+        }
+        this->set_control(dst, this->get_control()[src]);
+    }
+    u32 get_item_hash(u32 slot) const {
+        if (CacheHashes)
+            return this->hash_at(slot);
+        return this->hash_of(static_cast<const Subclass*>(this)->get_key(this->index_at(slot)));
     }
 
-public:
-    PLY_NO_INLINE s32 find_index(const Key& key) const {
-        if (!this->indices)
-            return -1;
+    // Sets a control byte along with any clones of it.
+    void set_control(u32 slot, u8 value) {
+        u8* control = this->get_control();
+        u32 num_slots = this->num_allocated_indices;
+        control[slot] = value;
+        for (u32 clone = slot + num_slots; clone < num_slots + HashGroupSize - 1; clone += num_slots) {
+            control[clone] = value;
+        }
+    }
+    // Returns the first empty slot in the probe sequence that starts at hash.
+    u32 find_empty_slot(u32 hash) const {
+        const u8* control = this->get_control();
+        u32 mask = this->num_allocated_indices - 1;
+        for (u32 pos = hash & mask;; pos = (pos + HashGroupSize) & mask) {
+            u32 empty = scan_hash_group(control + pos, HashEmpty).empty;
+            if (empty)
+                return (pos + lowest_bit_index(empty)) & mask;
+        }
+    }
+    // Calls match(slot) for each occupied slot whose tag matches hash, in probe order, until match returns true.
+    // Returns the matching slot, or the first empty slot as ~slot if there was no match.
+    template <typename Match>
+    PLY_FORCE_INLINE s32 probe(u32 hash, const Match& match) const {
         PLY_ASSERT(is_power_of_2(this->num_allocated_indices));
+        const u8* control = this->get_control();
         u32 mask = this->num_allocated_indices - 1;
-        for (u32 idx = calculate_hash(key);; idx++) {
-            s32 item_index = this->indices[idx & mask];
-            if (item_index < 0)
-                return -1;
-            if (key == static_cast<const Subclass*>(this)->get_key(item_index))
-                return item_index;
+        u8 tag = get_hash_tag(hash);
+        u32 pos = hash & mask;
+
+        // Check the first few slots one at a time. At the load factors chosen by get_best_num_hash_indices, most
+        // probes end there, and scanning a whole group would only add latency. Longer probes continue a group at a
+        // time.
+        for (u32 i = 0; i < HashNumScalarProbes; i++) {
+            u32 slot = (pos + i) & mask;
+            u8 slot_tag = control[slot];
+            if (slot_tag == HashEmpty)
+                return ~s32(slot);
+            if (slot_tag == tag && match(slot))
+                return (s32) slot;
         }
+
+        // The first group starts at the home slot, so skip the slots that were already checked.
+        for (u32 skip = (1u << HashNumScalarProbes) - 1;; pos = (pos + HashGroupSize) & mask, skip = 0) {
+            HashGroupMasks masks = scan_hash_group(control + pos, tag);
+            // Slots after the first empty slot aren't part of the probe sequence.
+            u32 first_empty = masks.empty & (0 - masks.empty);
+            for (u32 candidates = masks.matches & (first_empty - 1) & ~skip; candidates;
+                 candidates &= candidates - 1) {
+                u32 slot = (pos + lowest_bit_index(candidates)) & mask;
+                if (match(slot))
+                    return (s32) slot;
+            }
+            if (first_empty)
+                return ~s32((pos + lowest_bit_index(first_empty)) & mask);
+        }
+    }
+
+    // Pass rehash = true if the cached hashes are no longer valid.
+    PLY_NO_INLINE void reindex(u32 num_allocated_indices, bool rehash = false) {
+        PLY_ASSERT(is_power_of_2(num_allocated_indices));
+        s32* old_indices = this->indices;
+        bool reuse_hashes = CacheHashes && !rehash;
+        u8* old_control = old_indices ? this->get_control() : nullptr;
+        u32 old_num_allocated_indices = this->num_allocated_indices;
+
+        // Allocate new indices and control bytes.
+        this->indices = (s32*) Allocator::alloc(get_block_size(num_allocated_indices));
+        this->num_allocated_indices = num_allocated_indices;
+        memset(this->get_control(), HashEmpty, num_allocated_indices + HashGroupSize - 1);
+
+        // Rebuild indices. If hashes are cached, this doesn't touch the items at all.
+        for (u32 old_slot = 0; old_slot < old_num_allocated_indices; old_slot++) {
+            if (old_control[old_slot] != HashEmpty) {
+                s32 item_index = old_indices[old_slot * SlotStride];
+                u32 hash = reuse_hashes ? (u32) old_indices[old_slot * SlotStride + 1]
+                                        : this->hash_of(static_cast<Subclass*>(this)->get_key(item_index));
+                u32 slot = this->find_empty_slot(hash);
+                this->index_at(slot) = item_index;
+                if (CacheHashes) {
+                    this->hash_at(slot) = hash;
+                }
+                this->set_control(slot, get_hash_tag(hash));
+            }
+        }
+
+        if (old_indices) {
+            Allocator::free(old_indices, get_block_size(old_num_allocated_indices));
+        }
+    }
+
+    PLY_FORCE_INLINE bool slot_matches(u32 slot, u32 hash, const Key& key) const {
+        if (CacheHashes && this->hash_at(slot) != hash)
+            return false;
+        return key == static_cast<const Subclass*>(this)->get_key(this->index_at(slot));
+    }
+
+    PLY_FORCE_INLINE s32 find_slot(const Key& key) const {
+        if (!this->indices)
+            return -1;
+        u32 hash = this->hash_of(key);
+        s32 slot = this->probe(hash, [&](u32 slot) { return this->slot_matches(slot, hash, key); });
+        return slot >= 0 ? slot : -1;
+    }
+
+public:
+    PLY_NO_INLINE s32 find_index(const Key& key) const {
+        s32 slot = this->find_slot(key);
+        return slot >= 0 ? this->index_at(slot) : -1;
     }
 
     struct InsertIndexResult {
@@ -2754,20 +3842,56 @@ public:
         if (this->num_allocated_indices < min_allocated) {
             this->reindex(min_allocated);
         }
-        PLY_ASSERT(is_power_of_2(this->num_allocated_indices));
+        u32 hash = this->hash_of(key);
+        s32 slot = this->probe(hash, [&](u32 slot) { return this->slot_matches(slot, hash, key); });
+        if (slot >= 0)
+            return {numeric_cast<u32>(this->index_at(slot)), true};
+        u32 new_index = static_cast<Subclass*>(this)->add_item(key);
+        this->index_at(~slot) = new_index;
+        if (CacheHashes) {
+            this->hash_at(~slot) = hash;
+        }
+        this->set_control(~slot, get_hash_tag(hash));
+        this->num_indices++;
+        return {new_index, false};
+    }
+
+    // Removes the item with the given key by moving the last item into its place. Returns false if there's no such
+    // item.
+    PLY_NO_INLINE bool erase_index(const Key& key) {
+        s32 slot = this->find_slot(key);
+        if (slot < 0)
+            return false;
+        auto& items = static_cast<Subclass*>(this)->items_;
+        s32 item_index = this->index_at(slot);
+        s32 last_index = items.num_items() - 1;
+        if (item_index < last_index) {
+            // Point the last item's slot at the erased item's index.
+            s32 last_slot = this->probe(this->hash_of(static_cast<Subclass*>(this)->get_key(last_index)),
+                                        [&](u32 slot) { return this->index_at(slot) == last_index; });
+            PLY_ASSERT(last_slot >= 0);
+            this->index_at(last_slot) = item_index;
+        }
+        items.erase_quick(item_index);
+        this->num_indices--;
+
+        // Free the slot, then check subsequent slots to see if any should move into the newly freed slot.
         u32 mask = this->num_allocated_indices - 1;
-        for (u32 idx = calculate_hash(key);; idx++) {
-            s32 item_index = this->indices[idx & mask];
-            if (item_index < 0) {
-                u32 new_index = static_cast<Subclass*>(this)->add_item(key);
-                this->indices[idx & mask] = new_index;
-                this->num_indices++;
-                return {new_index, false};
-            }
-            if (key == static_cast<const Subclass*>(this)->get_key(item_index)) {
-                return {numeric_cast<u32>(item_index), true};
+        u8* control = this->get_control();
+        u32 freed = slot;
+        this->set_control(freed, HashEmpty);
+        for (u32 trailing = freed + 1;; trailing++) {
+            if (control[trailing & mask] == HashEmpty)
+                break; // No more trailing slots.
+            u32 home = this->get_item_hash(trailing & mask);
+            if (((trailing - home) & mask) >= ((trailing - freed) & mask)) {
+                // Move this slot.
+                this->copy_slot(freed & mask, trailing & mask);
+                this->set_control(trailing & mask, HashEmpty);
+                freed = trailing; // This is the new freed slot.
             }
         }
+        return true;
     }
 };
 
@@ -2779,14 +3903,20 @@ public:
 
 PLY_CHECK_WELL_FORMED(is_constructible_from_key, T{declval<const LookupKey<T>&>()})
 
-template <typename Item>
-struct Set : HashLookup<LookupKey<Item>, Set<Item>> {
+template <typename Item, typename Allocator = HeapAllocator>
+struct Set : HashLookup<LookupKey<Item>, Set<Item, Allocator>, Allocator> {
     using Key = LookupKey<Item>;
+    using Base = HashLookup<Key, Set<Item, Allocator>, Allocator>;
+
+    Array<Item, Allocator> items_;
 
-    Array<Item> items_;
+    Set() = default;
+    // Construct an empty set that allocates from the given allocator.
+    explicit Set(const Allocator& allocator) : Base(allocator), items_(allocator) {
+    }
 
 private:
-    friend struct HashLookup<Key, Set<Item>>;
+    friend Base;
 
     auto get_key(u32 index) const {
         return get_any_lookup_key(this->items_[index]);
@@ -2842,59 +3972,16 @@ public:
         return {dst_item, result.was_found};
     }
 
-    PLY_NO_INLINE bool erase(const Key& key) {
-        if (!this->items_)
-            return false;
-        PLY_ASSERT(is_power_of_2(this->num_allocated_indices));
-        u32 mask = this->num_allocated_indices - 1;
-        for (u32 idx = calculate_hash(key);; idx++) {
-            s32 item_index = this->indices[idx & mask];
-            if (item_index < 0)
-                return false;
-
-            if (key == get_any_lookup_key(this->items_[item_index])) {
-                // Found the item to erase.
-                u32 last_index = this->items_.num_items() - 1;
-                if ((u32) item_index < last_index) {
-                    // Move the last item to the erased item's index.
-                    for (u32 j = calculate_hash(get_any_lookup_key(this->items_[last_index]));; j++) {
-                        PLY_ASSERT(this->indices[j & mask] >= 0);
-                        if ((u32) this->indices[j & mask] == last_index) {
-                            this->indices[j & mask] = item_index;
-                            break;
-                        }
-                    }
-                }
-
-                // Erase the item from the array.
-                this->items_.erase_quick(item_index);
-
-                // Free the slot in the indices array.
-                this->indices[idx & mask] = -1;
-
-                // Check subsequent indices to see if any should move into the newly freed slot.
-                for (u32 trailing_idx = idx + 1;; trailing_idx++) {
-                    s32 trailing_item_index = this->indices[trailing_idx & mask];
-                    if (trailing_item_index < 0) {
-                        // No more trailing indices.
-                        break;
-                    }
-                    u32 trailing_item_hash = calculate_hash(get_any_lookup_key(this->items_[trailing_item_index]));
-                    if (((trailing_idx - trailing_item_hash) & mask) >= ((trailing_idx - idx) & mask)) {
-                        // Move this index.
-                        this->indices[idx & mask] = trailing_item_index;
-                        this->indices[trailing_idx & mask] = -1;
-                        idx = trailing_idx; // This is the new freed slot.
-                    }
-                }
-                return true;
-            }
-        }
+    bool erase(const Key& key) {
+        return this->erase_index(key);
     }
 
     void clear() {
+        Allocator allocator = this->items_.get_allocator();
+        u64 seed = this->hash_seed;
         this->~Set();
-        new (this) Set;
+        new (this) Set(allocator);
+        this->hash_seed = seed;
     }
 
     const Item* begin() const {
@@ -2911,9 +3998,10 @@ public:
 //  ██   ██ ▀█▄▄██ ██▄▄█▀
 //                 ██
 
-template <typename Key, typename Value>
-struct Map : HashLookup<LookupKey<Key>, Map<Key, Value>> {
+template <typename Key, typename Value, typename Allocator = HeapAllocator>
+struct Map : HashLookup<LookupKey<Key>, Map<Key, Value, Allocator>, Allocator> {
     using K = LookupKey<Key>;
+    using Base = HashLookup<K, Map<Key, Value, Allocator>, Allocator>;
 
     struct Item {
         Key key;
@@ -2925,10 +4013,15 @@ struct Map : HashLookup<LookupKey<Key>, Map<Key, Value>> {
             return this->key;
         }
     };
-    Array<Item> items_;
+    Array<Item, Allocator> items_;
+
+    Map() = default;
+    // Construct an empty map that allocates from the given allocator.
+    explicit Map(const Allocator& allocator) : Base(allocator), items_(allocator) {
+    }
 
 private:
-    friend struct HashLookup<K, Map<Key, Value>>;
+    friend Base;
 
     auto get_key(u32 index) const {
         return get_any_lookup_key(this->items_[index]);
@@ -2977,68 +4070,810 @@ public:
     }
 
     bool erase(const K& key) {
-        if (!this->items_)
-            return false;
-        PLY_ASSERT(is_power_of_2(this->num_allocated_indices));
-        u32 mask = this->num_allocated_indices - 1;
-        for (u32 idx = calculate_hash(key);; idx++) {
-            s32 item_index = this->indices[idx & mask];
-            if (item_index < 0)
-                return false;
+        return this->erase_index(key);
+    }
 
-            if (key == get_any_lookup_key(this->items_[item_index])) {
-                // Found the item to erase.
-                u32 last_index = this->items_.num_items() - 1;
-                if ((u32) item_index < last_index) {
-                    // Move the last item to the erased item's index.
-                    for (u32 j = calculate_hash(get_any_lookup_key(this->items_[last_index]));; j++) {
-                        PLY_ASSERT(this->indices[j & mask] >= 0);
-                        if ((u32) this->indices[j & mask] == last_index) {
-                            this->indices[j & mask] = item_index;
-                            break;
-                        }
-                    }
+    void clear() {
+        Allocator allocator = this->items_.get_allocator();
+        u64 seed = this->hash_seed;
+        this->~Map();
+        new (this) Map(allocator);
+        this->hash_seed = seed;
+    }
+
+    const Item* begin() const {
+        return this->items_.begin();
+    }
+    const Item* end() const {
+        return this->items_.end();
+    }
+};
+
+//   ▄▄▄▄                                                          ▄▄   ▄▄   ▄▄
+//  ██  ▀▀  ▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄ ▄▄  ▄▄ ▄▄▄▄▄  ▄▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ███▄███  ▄▄▄▄  ▄▄▄▄▄
+//  ██     ██  ██ ██  ██ ██    ██  ██ ██  ▀▀ ██  ▀▀ ██▄▄██ ██  ██  ██   ██▀█▀██  ▄▄▄██ ██  ██
+//  ▀█▄▄█▀ ▀█▄▄█▀ ██  ██ ▀█▄▄▄ ▀█▄▄██ ██     ██     ▀█▄▄▄  ██  ██  ▀█▄▄ ██   ██ ▀█▄▄██ ██▄▄█▀
+//                                                                                     ██
+
+// ConcurrentMap is a hash map that can be read and modified by several threads at once. find() never takes a lock.
+// insert() locks one of NumStripes stripes, selected by the key's hash, so inserts of unrelated keys rarely contend,
+// and each stripe's table grows independently of the others. Each table uses the same control bytes as HashLookup, but
+// since readers load them concurrently with writers, they're atomic and probed one slot at a time.
+//
+// Items are never moved or erased while the map is in use, so the value pointers returned by find() and insert() remain
+// valid until clear() is called or the map is destroyed. When a stripe's table grows, the old table is kept alive for
+// readers that might still be probing it. Access to the values themselves isn't synchronized by the map.
+template <typename Key, typename Value>
+class ConcurrentMap {
+public:
+    using K = LookupKey<Key>;
+
+    static constexpr u32 NumStripeBits = 6;
+    static constexpr u32 NumStripes = 1 << NumStripeBits;
+
+    struct Item {
+        Key key;
+        Value value;
+
+        Item(const K& key) : key{key} {
+        }
+        const Key& get_lookup_key() const {
+            return this->key;
+        }
+    };
+
+    struct InsertResult {
+        Value* value;
+        bool was_found;
+    };
+
+private:
+    struct Node {
+        u32 hash;
+        Item item;
+    };
+
+    // A node pointer is stored before its control byte, and the control byte is stored with release semantics. A reader
+    // that loads a non-empty control byte with acquire semantics is therefore guaranteed to see the node.
+    struct Table {
+        u32 num_slots = 0;
+        // num_slots node pointers, followed by num_slots control bytes.
+        Atomic<Node*>* nodes = nullptr;
+        Atomic<u8>* control = nullptr;
+        // The table this one replaced. It's freed by clear().
+        Table* prev = nullptr;
+    };
+
+    struct alignas(PoolBase::CacheLineSize) Stripe {
+        // Loaded by find() without taking the mutex.
+        Atomic<Table*> table;
+        Atomic<u32> num_items;
+        // Held while modifying the members above and below.
+        Mutex mutex;
+        // Nodes are allocated consecutively from chunks that double in size. Each chunk begins with a pointer to the
+        // previous chunk.
+        char* chunk_cur = nullptr;
+        char* chunk_end = nullptr;
+        void* chunks = nullptr;
+    };
+
+    Stripe* stripes = nullptr;
+    u64 hash_seed = 0;
+
+    // The tables use the top bits of the hash as tags and the bottom bits as slot indices, so the stripe index is
+    // taken from a remix of the hash. Otherwise, every item in a stripe would have nearly the same tag.
+    PLY_FORCE_INLINE Stripe& get_stripe(u32 hash) const {
+        return this->stripes[(hash * 0x9e3779b9u) >> (32 - NumStripeBits)];
+    }
+
+    // Called with the stripe's mutex held.
+    static Node* alloc_node(Stripe& stripe, u32 num_items) {
+        static constexpr uptr HeaderSize = max<uptr>(sizeof(void*), alignof(Node));
+        if (stripe.chunk_cur == stripe.chunk_end) {
+            uptr num_bytes = HeaderSize + sizeof(Node) * max<u32>(num_items, 8);
+            char* chunk = (char*) Heap::alloc(num_bytes);
+            *(void**) chunk = stripe.chunks;
+            stripe.chunks = chunk;
+            stripe.chunk_cur = chunk + HeaderSize;
+            stripe.chunk_end = chunk + num_bytes;
+        }
+        Node* node = (Node*) stripe.chunk_cur;
+        stripe.chunk_cur += sizeof(Node);
+        return node;
+    }
+
+    // Called with the stripe's mutex held.
+    static void add_node(Table* table, Node* node) {
+        u32 mask = table->num_slots - 1;
+        u32 slot = node->hash & mask;
+        while (table->control[slot].load_relaxed() != HashEmpty) {
+            slot = (slot + 1) & mask;
+        }
+        table->nodes[slot].store_relaxed(node);
+        table->control[slot].store_release(get_hash_tag(node->hash));
+    }
+
+    // Called with the stripe's mutex held. Readers keep using the old table until they load the new one.
+    static Table* grow(Stripe& stripe, Table* old_table, u32 num_items) {
+        u32 num_slots = get_best_num_hash_indices(num_items);
+        Table* table = Heap::create<Table>();
+        table->num_slots = num_slots;
+        table->nodes = (Atomic<Node*>*) Heap::alloc((sizeof(Atomic<Node*>) + sizeof(Atomic<u8>)) * num_slots);
+        table->control = (Atomic<u8>*) (table->nodes + num_slots);
+        for (u32 i = 0; i < num_slots; i++) {
+            new (&table->control[i]) Atomic<u8>{HashEmpty};
+        }
+        if (old_table) {
+            for (u32 i = 0; i < old_table->num_slots; i++) {
+                if (old_table->control[i].load_relaxed() != HashEmpty) {
+                    add_node(table, old_table->nodes[i].load_relaxed());
                 }
+            }
+            table->prev = old_table;
+        }
+        stripe.table.store_release(table);
+        return table;
+    }
+
+    // Returns the matching node, or nullptr if there isn't one.
+    PLY_FORCE_INLINE static Node* find_node(Table* table, u32 hash, const K& key) {
+        u32 mask = table->num_slots - 1;
+        u8 tag = get_hash_tag(hash);
+        for (u32 slot = hash & mask;; slot = (slot + 1) & mask) {
+            u8 slot_tag = table->control[slot].load_acquire();
+            if (slot_tag == HashEmpty)
+                return nullptr;
+            if (slot_tag == tag) {
+                Node* node = table->nodes[slot].load_relaxed();
+                if (node->hash == hash && key == get_any_lookup_key(node->item))
+                    return node;
+            }
+        }
+    }
 
-                // Erase the item from the array.
-                this->items_.erase_quick(item_index);
+public:
+    // Keys are hashed with the given seed. See generate_hash_seed().
+    explicit ConcurrentMap(u64 hash_seed = 0) : hash_seed{hash_seed} {
+        this->stripes = (Stripe*) Heap::alloc_aligned(sizeof(Stripe) * NumStripes, PoolBase::CacheLineSize);
+        for (u32 i = 0; i < NumStripes; i++) {
+            new (&this->stripes[i]) Stripe;
+        }
+    }
+    ConcurrentMap(const ConcurrentMap&) = delete;
+    ~ConcurrentMap() {
+        this->clear();
+        for (u32 i = 0; i < NumStripes; i++) {
+            this->stripes[i].~Stripe();
+        }
+        Heap::free(this->stripes);
+    }
 
-                // Free the slot in the indices array.
-                this->indices[idx & mask] = -1;
+    // Lock-free. Returns nullptr if the key isn't in the map.
+    Value* find(const K& key) const {
+        u32 hash = calculate_hash(key, this->hash_seed);
+        Table* table = this->get_stripe(hash).table.load_acquire();
+        if (!table)
+            return nullptr;
+        Node* node = find_node(table, hash, key);
+        return node ? &node->item.value : nullptr;
+    }
 
-                // Check subsequent indices to see if any should move into the newly freed slot.
-                for (u32 trailing_idx = idx + 1;; trailing_idx++) {
-                    s32 trailing_item_index = this->indices[trailing_idx & mask];
-                    if (trailing_item_index < 0) {
-                        // No more trailing indices.
-                        break;
+    // If the key isn't in the map, adds a new item and passes its value to init before any other thread can see it.
+    // init is called with the stripe locked, so it shouldn't access the same map.
+    InsertResult insert(const K& key) {
+        return this->insert(key, [](Value&) {});
+    }
+    template <typename Init>
+    InsertResult insert(const K& key, const Init& init) {
+        u32 hash = calculate_hash(key, this->hash_seed);
+        Stripe& stripe = this->get_stripe(hash);
+        LockGuard<Mutex> guard{stripe.mutex};
+        Table* table = stripe.table.load_relaxed();
+        if (table) {
+            if (Node* node = find_node(table, hash, key))
+                return {&node->item.value, true};
+        }
+        u32 num_items = stripe.num_items.load_relaxed() + 1;
+        if (!table || get_best_num_hash_indices(num_items) > table->num_slots) {
+            table = grow(stripe, table, num_items);
+        }
+        Node* node = new (alloc_node(stripe, num_items)) Node{hash, key};
+        init(node->item.value);
+        add_node(table, node);
+        stripe.num_items.store_relaxed(num_items);
+        return {&node->item.value, false};
+    }
+
+    // The result is only exact if no other thread is inserting.
+    u32 num_items() const {
+        u32 result = 0;
+        for (u32 i = 0; i < NumStripes; i++) {
+            result += this->stripes[i].num_items.load_relaxed();
+        }
+        return result;
+    }
+
+    // Not thread-safe. Destroys every item and frees every table.
+    void clear() {
+        for (u32 i = 0; i < NumStripes; i++) {
+            Stripe& stripe = this->stripes[i];
+            Table* table = stripe.table.load_relaxed();
+            if (table) {
+                for (u32 j = 0; j < table->num_slots; j++) {
+                    if (table->control[j].load_relaxed() != HashEmpty) {
+                        table->nodes[j].load_relaxed()->~Node();
                     }
-                    u32 trailing_item_hash = calculate_hash(get_any_lookup_key(this->items_[trailing_item_index]));
-                    if (((trailing_idx - trailing_item_hash) & mask) >= ((trailing_idx - idx) & mask)) {
-                        // Move this index.
-                        this->indices[idx & mask] = trailing_item_index;
-                        this->indices[trailing_idx & mask] = -1;
-                        idx = trailing_idx; // This is the new freed slot.
+                }
+            }
+            while (table) {
+                Table* prev = table->prev;
+                Heap::free(table->nodes);
+                Heap::destroy(table);
+                table = prev;
+            }
+            while (stripe.chunks) {
+                void* prev = *(void**) stripe.chunks;
+                Heap::free(stripe.chunks);
+                stripe.chunks = prev;
+            }
+            stripe.table.store_relaxed(nullptr);
+            stripe.num_items.store_relaxed(0);
+            stripe.chunk_cur = nullptr;
+            stripe.chunk_end = nullptr;
+        }
+    }
+};
+
+//   ▄▄▄▄
+//  ██  ██ ▄▄  ▄▄  ▄▄▄▄  ▄▄  ▄▄  ▄▄▄▄   ▄▄▄▄
+//  ██  ██ ██  ██ ██▄▄██ ██  ██ ██▄▄██ ▀█▄▄▄
+//  ▀█▄▄█▀ ▀█▄▄██ ▀█▄▄▄  ▀█▄▄██ ▀█▄▄▄   ▄▄▄█▀
+//     ▀█▄
+
+// QueueWaiters lets the threads using a queue sleep until another thread makes progress. wake() costs a fence and a
+// load when nobody is waiting, so queues call it after every successful push or pop.
+class QueueWaiters {
+private:
+    Atomic<u32> num_waiting;
+    Semaphore sema;
+
+public:
+    // Blocks until try_op returns true. try_op is called once more after announcing the wait, so a wake() that happens
+    // in between isn't missed.
+    template <typename Callable>
+    void wait_until(const Callable& try_op) {
+        while (!try_op()) {
+            this->num_waiting.fetch_add_acq_rel(1);
+            thread_fence_seq_cst();
+            if (try_op()) {
+                // Take back the announcement. If a wakeup was already sent for it, consume the wakeup.
+                u32 num_waiting = this->num_waiting.load_relaxed();
+                for (;;) {
+                    if (num_waiting == 0) {
+                        this->sema.wait();
+                        break;
                     }
+                    u32 prev = this->num_waiting.compare_exchange_acq_rel(num_waiting, num_waiting - 1);
+                    if (prev == num_waiting)
+                        break;
+                    num_waiting = prev;
                 }
-                return true;
+                return;
             }
+            this->sema.wait();
         }
     }
+    // Wakes up to count waiting threads.
+    void wake(u32 count = 1) {
+        // Pairs with the fence in wait_until. Either the waiter sees our change, or we see its announcement.
+        thread_fence_seq_cst();
+        u32 num_waiting = this->num_waiting.load_relaxed();
+        while (num_waiting > 0) {
+            u32 num_to_wake = min(num_waiting, count);
+            u32 prev = this->num_waiting.compare_exchange_acq_rel(num_waiting, num_waiting - num_to_wake);
+            if (prev == num_waiting) {
+                this->sema.signal(num_to_wake);
+                return;
+            }
+            num_waiting = prev;
+        }
+    }
+};
 
-    void clear() {
-        this->~Map();
-        new (this) Map;
+// SPSCQueue is a bounded ring buffer for passing items from one producer thread to one consumer thread. try_push and
+// try_pop never block. Each side keeps its position on its own cache line, along with a copy of the other side's
+// position, so it only loads the other side's cache line when the queue looks full or empty. The batch functions
+// publish several items with a single store.
+template <typename T>
+class SPSCQueue {
+private:
+    struct alignas(PoolBase::CacheLineSize) Side {
+        // Counts every item that has passed through this side. The slot index is position & mask.
+        Atomic<u32> position;
+        // The other side's position, as of the last time this side loaded it.
+        u32 other_position = 0;
+    };
+
+    // sides[0] belongs to the producer and sides[1] to the consumer. The items follow them in the same block.
+    Side* sides = nullptr;
+    T* items = nullptr;
+    u32 mask = 0;
+    QueueWaiters not_empty;
+    QueueWaiters not_full;
+
+    template <typename U>
+    bool try_push_impl(U&& item) {
+        Side& producer = this->sides[0];
+        u32 position = producer.position.load_relaxed();
+        if (position - producer.other_position > this->mask) {
+            producer.other_position = this->sides[1].position.load_acquire();
+            if (position - producer.other_position > this->mask)
+                return false;
+        }
+        new (&this->items[position & this->mask]) T{std::forward<U>(item)};
+        producer.position.store_release(position + 1);
+        this->not_empty.wake();
+        return true;
     }
 
-    const Item* begin() const {
-        return this->items_.begin();
+public:
+    // The capacity is rounded up to a power of 2.
+    explicit SPSCQueue(u32 capacity) {
+        PLY_STATIC_ASSERT(alignof(T) <= PoolBase::CacheLineSize);
+        PLY_ASSERT(capacity > 0 && capacity <= 0x80000000u);
+        u32 num_slots = round_up_to_nearest_to_power_of_2(capacity);
+        this->sides = (Side*) Heap::alloc_aligned(sizeof(Side) * 2 + sizeof(T) * num_slots, PoolBase::CacheLineSize);
+        new (&this->sides[0]) Side;
+        new (&this->sides[1]) Side;
+        this->items = (T*) (this->sides + 2);
+        this->mask = num_slots - 1;
+    }
+    SPSCQueue(const SPSCQueue&) = delete;
+    ~SPSCQueue() {
+        u32 end = this->sides[0].position.load_relaxed();
+        for (u32 i = this->sides[1].position.load_relaxed(); i != end; i++) {
+            this->items[i & this->mask].~T();
+        }
+        Heap::free(this->sides);
     }
-    const Item* end() const {
-        return this->items_.end();
+
+    u32 capacity() const {
+        return this->mask + 1;
+    }
+
+    // Producer only. Returns false if the queue is full.
+    bool try_push(const T& item) {
+        return this->try_push_impl(item);
+    }
+    bool try_push(T&& item) {
+        return this->try_push_impl(std::move(item));
+    }
+    // Producer only. Waits while the queue is full.
+    void push(const T& item) {
+        this->not_full.wait_until([&] { return this->try_push_impl(item); });
+    }
+    void push(T&& item) {
+        this->not_full.wait_until([&] { return this->try_push_impl(std::move(item)); });
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool try_pop(T& item) {
+        Side& consumer = this->sides[1];
+        u32 position = consumer.position.load_relaxed();
+        if (position == consumer.other_position) {
+            consumer.other_position = this->sides[0].position.load_acquire();
+            if (position == consumer.other_position)
+                return false;
+        }
+        T& slot = this->items[position & this->mask];
+        item = std::move(slot);
+        slot.~T();
+        consumer.position.store_release(position + 1);
+        this->not_full.wake();
+        return true;
+    }
+    // Consumer only. Waits while the queue is empty.
+    void pop(T& item) {
+        this->not_empty.wait_until([&] { return this->try_pop(item); });
+    }
+
+    // Producer only. Moves as many items as there is room for into the queue, in order, and returns the number moved.
+    u32 try_push_batch(ArrayView<T> items) {
+        Side& producer = this->sides[0];
+        u32 position = producer.position.load_relaxed();
+        if (this->mask + 1 - (position - producer.other_position) < items.num_items()) {
+            producer.other_position = this->sides[1].position.load_acquire();
+        }
+        u32 num_items = min(this->mask + 1 - (position - producer.other_position), items.num_items());
+        if (num_items == 0)
+            return 0;
+        for (u32 i = 0; i < num_items; i++) {
+            new (&this->items[(position + i) & this->mask]) T{std::move(items[i])};
+        }
+        producer.position.store_release(position + num_items);
+        this->not_empty.wake();
+        return num_items;
+    }
+    // Producer only. Moves every item into the queue, waiting whenever it's full.
+    void push_batch(ArrayView<T> items) {
+        this->not_full.wait_until([&] {
+            items = items.subview(this->try_push_batch(items));
+            return items.is_empty();
+        });
+    }
+
+    // Consumer only. Moves up to out.num_items() items out of the queue and returns the number moved.
+    u32 try_pop_batch(ArrayView<T> out) {
+        Side& consumer = this->sides[1];
+        u32 position = consumer.position.load_relaxed();
+        if (consumer.other_position - position < out.num_items()) {
+            consumer.other_position = this->sides[0].position.load_acquire();
+        }
+        u32 num_items = min(consumer.other_position - position, out.num_items());
+        if (num_items == 0)
+            return 0;
+        for (u32 i = 0; i < num_items; i++) {
+            T& slot = this->items[(position + i) & this->mask];
+            out[i] = std::move(slot);
+            slot.~T();
+        }
+        consumer.position.store_release(position + num_items);
+        this->not_full.wake();
+        return num_items;
+    }
+    // Consumer only. Waits until the queue isn't empty, then behaves like try_pop_batch. out must not be empty.
+    u32 pop_batch(ArrayView<T> out) {
+        PLY_ASSERT(!out.is_empty());
+        u32 num_items = 0;
+        this->not_empty.wait_until([&] {
+            num_items = this->try_pop_batch(out);
+            return num_items > 0;
+        });
+        return num_items;
     }
 };
 
+// MPMCQueue is a bounded queue that any number of threads can push to and pop from. It's based on Dmitry Vyukov's
+// bounded MPMC queue: each cell has a sequence number that tells a thread whether the cell is ready to be pushed to or
+// popped from, so try_push and try_pop only need a compare-and-swap on their own side's position. try_push can report
+// the queue full while another thread is still popping the oldest item, and try_pop can report it empty while another
+// thread is still pushing.
+//
+// The batch functions claim a run of consecutive cells with a single compare-and-swap. If another thread has claimed
+// one of those cells on the opposite side but hasn't finished with it yet, they yield until it does.
+template <typename T>
+class MPMCQueue {
+private:
+    struct Cell {
+        // Equals the position that may be pushed to this cell next, or that position + 1 once the item is in place.
+        Atomic<u32> sequence;
+        alignas(T) char storage[sizeof(T)];
+    };
+
+    struct alignas(PoolBase::CacheLineSize) Side {
+        // Counts every cell that has been claimed on this side. The cell index is position & mask.
+        Atomic<u32> position;
+    };
+
+    // sides[0] is the push side and sides[1] the pop side. The cells follow them in the same block.
+    Side* sides = nullptr;
+    Cell* cells = nullptr;
+    u32 mask = 0;
+    QueueWaiters not_empty;
+    QueueWaiters not_full;
+
+    template <typename U>
+    bool try_push_impl(U&& item) {
+        Atomic<u32>& push_position = this->sides[0].position;
+        u32 position = push_position.load_relaxed();
+        Cell* cell;
+        for (;;) {
+            cell = &this->cells[position & this->mask];
+            s32 diff = s32(cell->sequence.load_acquire() - position);
+            if (diff == 0) {
+                u32 prev = push_position.compare_exchange_acq_rel(position, position + 1);
+                if (prev == position)
+                    break;
+                position = prev;
+            } else if (diff < 0) {
+                // The cell still holds the item pushed one lap ago.
+                return false;
+            } else {
+                position = push_position.load_relaxed();
+            }
+        }
+        new (cell->storage) T{std::forward<U>(item)};
+        cell->sequence.store_release(position + 1);
+        this->not_empty.wake();
+        return true;
+    }
+
+public:
+    // The capacity is rounded up to a power of 2.
+    explicit MPMCQueue(u32 capacity) {
+        PLY_STATIC_ASSERT(alignof(Cell) <= PoolBase::CacheLineSize);
+        PLY_ASSERT(capacity > 0 && capacity <= 0x80000000u);
+        u32 num_cells = round_up_to_nearest_to_power_of_2(capacity);
+        this->sides =
+            (Side*) Heap::alloc_aligned(sizeof(Side) * 2 + sizeof(Cell) * num_cells, PoolBase::CacheLineSize);
+        new (&this->sides[0]) Side;
+        new (&this->sides[1]) Side;
+        this->cells = (Cell*) (this->sides + 2);
+        for (u32 i = 0; i < num_cells; i++) {
+            new (&this->cells[i]) Cell;
+            this->cells[i].sequence.store_relaxed(i);
+        }
+        this->mask = num_cells - 1;
+    }
+    MPMCQueue(const MPMCQueue&) = delete;
+    ~MPMCQueue() {
+        u32 end = this->sides[0].position.load_relaxed();
+        for (u32 i = this->sides[1].position.load_relaxed(); i != end; i++) {
+            ((T*) this->cells[i & this->mask].storage)->~T();
+        }
+        Heap::free(this->sides);
+    }
+
+    u32 capacity() const {
+        return this->mask + 1;
+    }
+
+    // Returns false if the queue is full.
+    bool try_push(const T& item) {
+        return this->try_push_impl(item);
+    }
+    bool try_push(T&& item) {
+        return this->try_push_impl(std::move(item));
+    }
+    // Waits while the queue is full.
+    void push(const T& item) {
+        this->not_full.wait_until([&] { return this->try_push_impl(item); });
+    }
+    void push(T&& item) {
+        this->not_full.wait_until([&] { return this->try_push_impl(std::move(item)); });
+    }
+
+    // Returns false if the queue is empty.
+    bool try_pop(T& item) {
+        Atomic<u32>& pop_position = this->sides[1].position;
+        u32 position = pop_position.load_relaxed();
+        Cell* cell;
+        for (;;) {
+            cell = &this->cells[position & this->mask];
+            s32 diff = s32(cell->sequence.load_acquire() - (position + 1));
+            if (diff == 0) {
+                u32 prev = pop_position.compare_exchange_acq_rel(position, position + 1);
+                if (prev == position)
+                    break;
+                position = prev;
+            } else if (diff < 0) {
+                // Nothing has been pushed to the cell since it was last popped.
+                return false;
+            } else {
+                position = pop_position.load_relaxed();
+            }
+        }
+        T* slot = (T*) cell->storage;
+        item = std::move(*slot);
+        slot->~T();
+        cell->sequence.store_release(position + this->mask + 1);
+        this->not_full.wake();
+        return true;
+    }
+    // Waits while the queue is empty.
+    void pop(T& item) {
+        this->not_empty.wait_until([&] { return this->try_pop(item); });
+    }
+
+    // Moves as many items as there is room for into the queue, in order, and returns the number moved.
+    u32 try_push_batch(ArrayView<T> items) {
+        Atomic<u32>& push_position = this->sides[0].position;
+        u32 position = push_position.load_relaxed();
+        u32 num_items;
+        for (;;) {
+            s32 num_used = s32(position - this->sides[1].position.load_acquire());
+            if (num_used < 0) {
+                // position is out of date.
+                position = push_position.load_relaxed();
+                continue;
+            }
+            num_items = min(this->mask + 1 - u32(num_used), items.num_items());
+            if (num_items == 0)
+                return 0;
+            u32 prev = push_position.compare_exchange_acq_rel(position, position + num_items);
+            if (prev == position)
+                break;
+            position = prev;
+        }
+        for (u32 i = 0; i < num_items; i++) {
+            Cell* cell = &this->cells[(position + i) & this->mask];
+            // The item pushed one lap ago has been claimed by a pop, but it might not have been moved out yet.
+            while (cell->sequence.load_acquire() != position + i) {
+                yield_thread();
+            }
+            new (cell->storage) T{std::move(items[i])};
+            cell->sequence.store_release(position + i + 1);
+        }
+        this->not_empty.wake(num_items);
+        return num_items;
+    }
+    // Moves every item into the queue, waiting whenever it's full.
+    void push_batch(ArrayView<T> items) {
+        this->not_full.wait_until([&] {
+            items = items.subview(this->try_push_batch(items));
+            return items.is_empty();
+        });
+    }
+
+    // Moves up to out.num_items() items out of the queue and returns the number moved.
+    u32 try_pop_batch(ArrayView<T> out) {
+        Atomic<u32>& pop_position = this->sides[1].position;
+        u32 position = pop_position.load_relaxed();
+        u32 num_items;
+        for (;;) {
+            // The push position is never behind the pop position, so if position is out of date, this overestimates
+            // and the compare-and-swap fails.
+            num_items = min(this->sides[0].position.load_acquire() - position, out.num_items());
+            if (num_items == 0)
+                return 0;
+            u32 prev = pop_position.compare_exchange_acq_rel(position, position + num_items);
+            if (prev == position)
+                break;
+            position = prev;
+        }
+        for (u32 i = 0; i < num_items; i++) {
+            Cell* cell = &this->cells[(position + i) & this->mask];
+            // The cell has been claimed by a push, but the item might not be in place yet.
+            while (cell->sequence.load_acquire() != position + i + 1) {
+                yield_thread();
+            }
+            T* slot = (T*) cell->storage;
+            out[i] = std::move(*slot);
+            slot->~T();
+            cell->sequence.store_release(position + i + this->mask + 1);
+        }
+        this->not_full.wake(num_items);
+        return num_items;
+    }
+    // Waits until the queue isn't empty, then behaves like try_pop_batch. out must not be empty.
+    u32 pop_batch(ArrayView<T> out) {
+        PLY_ASSERT(!out.is_empty());
+        u32 num_items = 0;
+        this->not_empty.wait_until([&] {
+            num_items = this->try_pop_batch(out);
+            return num_items > 0;
+        });
+        return num_items;
+    }
+};
+
+//  ▄▄▄▄▄                     ▄▄
+//  ██    ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄ ██▄▄▄
+//  ██▀▀  ██  ██ ██  ██ ██    ██  ██
+//  ██▄▄▄ ██▄▄█▀ ▀█▄▄█▀ ▀█▄▄▄ ██  ██
+//        ██
+
+// Epoch implements epoch-based reclamation, which lets lock-free data structures free memory that other threads might
+// still be reading. Readers wrap each access in an Epoch::Guard. A writer that unlinks an object passes it to retire()
+// instead of freeing it, and the object is only freed once every thread that was inside a Guard at that time has left
+// it. Entering and leaving a Guard only touches the calling thread's own record, so readers don't contend with each
+// other.
+struct Epoch {
+    // Marks a critical section on the calling thread. Pointers loaded from a shared data structure inside the Guard
+    // remain valid until the Guard is destroyed. Guards can be nested.
+    struct Guard {
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+    };
+
+    // Calls deleter(ptr) once no thread can still be using ptr. ptr must already be unreachable by threads that enter a
+    // Guard from now on.
+    static void retire(void* ptr, void (*deleter)(void*));
+    template <typename T>
+    static void retire(T* obj) {
+        retire(obj, [](void* ptr) { Heap::destroy((T*) ptr); });
+    }
+    // Tries to advance the epoch, then frees whatever the calling thread retired that's no longer in use. retire()
+    // calls this periodically.
+    static void collect();
+    // Frees everything the calling thread has retired so far, as well as anything left behind by threads that have
+    // exited. Waits for other threads to leave their Guards if necessary, so it must not be called inside a Guard.
+    static void flush();
+};
+
+//   ▄▄▄▄    ▄▄
+//  ██  ██ ▄██▄▄  ▄▄▄▄  ▄▄▄▄▄▄▄
+//  ██▀▀██  ██   ██  ██ ██ ██ ██
+//  ██  ██  ▀█▄▄ ▀█▄▄█▀ ██ ██ ██
+//
+
+// An Atom is a string interned in an AtomTable. Equal strings interned in the same table map to the same Atom, so
+// atoms are compared and hashed by pointer. The default-constructed Atom is the empty string.
+class Atom {
+public:
+    struct Entry {
+        StringView str;
+        u32 id;
+    };
+
+private:
+    const Entry* entry = nullptr;
+
+public:
+    Atom() = default;
+    explicit Atom(const Entry* entry) : entry{entry} {
+    }
+    // Interns str in the default AtomTable.
+    static Atom intern(StringView str);
+
+    StringView view() const {
+        return this->entry ? this->entry->str : StringView{};
+    }
+    operator StringView() const {
+        return this->view();
+    }
+    // Atoms are numbered from 1 in the order they were added to the table. The empty Atom is 0.
+    u32 id() const {
+        return this->entry ? this->entry->id : 0;
+    }
+    bool is_empty() const {
+        return !this->entry;
+    }
+    bool operator==(Atom other) const {
+        return this->entry == other.entry;
+    }
+    bool operator!=(Atom other) const {
+        return this->entry != other.entry;
+    }
+    const Entry* get_entry() const {
+        return this->entry;
+    }
+};
+
+inline u32 calculate_hash(Atom atom, u64 seed = 0) {
+    return calculate_hash(atom.get_entry(), seed);
+}
+inline void add_to_hash(HashBuilder& builder, Atom atom) {
+    add_to_hash(builder, (u64) (uptr) atom.get_entry());
+}
+// Atoms hash their pointer, so there's no need to cache their hashes.
+template <>
+struct HashTraits<Atom> {
+    static constexpr bool CacheHashes = false;
+};
+
+// A thread-safe table of interned strings. Entries and string bytes are stored in an arena and live until the table is
+// destroyed. The map is allocated from the heap, since an arena would strand the old arrays each time it grows.
+// Lookups take a shared lock; only new strings take the exclusive lock.
+class AtomTable {
+private:
+    mutable ReadWriteLock lock;
+    // The following members are protected by lock.
+    Arena arena;
+    Map<StringView, const Atom::Entry*> map;
+
+    Atom add_locked(StringView str);
+
+public:
+    AtomTable() = default;
+    AtomTable(const AtomTable&) = delete;
+
+    // The table used by Atom::intern. It's never destroyed.
+    static AtomTable& get_default();
+
+    Atom intern(StringView str);
+    // Interns every string in strs and writes the results to out, taking each lock at most once.
+    void intern(ArrayView<const StringView> strs, ArrayView<Atom> out);
+    // Returns the empty Atom if str hasn't been interned.
+    Atom find(StringView str) const;
+    u32 num_atoms() const;
+};
+
+inline Atom Atom::intern(StringView str) {
+    return AtomTable::get_default().intern(str);
+}
+
 //   ▄▄▄▄                             ▄▄
 //  ██  ██ ▄▄    ▄▄ ▄▄▄▄▄   ▄▄▄▄   ▄▄▄██
 //  ██  ██ ██ ██ ██ ██  ██ ██▄▄██ ██  ██
@@ -3571,56 +5406,118 @@ template <typename T>
 bool default_less(const T& a, const T& b) {
     return a < b;
 }
-template <typename T, typename IsLess = decltype(default_less<T>)>
-void sort(ArrayView<T> view, const IsLess& is_less = default_less<T>) {
-    if (view.num_items() <= 1)
-        return;
-    u32 lo = 0;
-    u32 hi = view.num_items() - 1;
-    u32 pivot = view.num_items() / 2;
+
+namespace detail {
+// Ranges with this many items or fewer are finished off with insertion sort.
+constexpr u32 SortInsertionThreshold = 16;
+} // namespace detail
+
+// Stable. O(n^2), but fastest on small or nearly sorted ranges.
+template <typename T, typename IsLess>
+void insertion_sort(ArrayView<T> view, const IsLess& is_less) {
+    for (u32 i = 1; i < view.num_items(); i++) {
+        if (!is_less(view[i], view[i - 1]))
+            continue;
+        T item = std::move(view[i]);
+        u32 j = i;
+        do {
+            view[j] = std::move(view[j - 1]);
+            j--;
+        } while (j > 0 && is_less(item, view[j - 1]));
+        view[j] = std::move(item);
+    }
+}
+
+template <typename T, typename IsLess>
+void heap_sift_down(ArrayView<T> view, u32 root, u32 end, const IsLess& is_less) {
     for (;;) {
-        while (lo < hi && is_less(view[lo], view[pivot])) {
-            lo++;
-        }
-        while (lo < hi && is_less(view[pivot], view[hi])) {
-            hi--;
-        }
-        if (lo >= hi)
-            break;
-        // view[lo] is >= pivot
-        // All slots to left of lo are < pivot
-        // view[hi] <= pivot
-        // All slots to the right of hi are > pivot
-        PLY_ASSERT(!is_less(view[lo], view[pivot]));
-        PLY_ASSERT(!is_less(view[pivot], view[hi]));
-        PLY_ASSERT(lo < hi);
-        std::swap(view[lo], view[hi]);
-        if (lo == pivot) {
-            pivot = hi;
-        } else if (hi == pivot) {
-            pivot = lo;
-        }
-        lo++;
-    }
-    PLY_ASSERT((s32) hi >= 0);
-    // Now, everything to left of lo is <= pivot, and everything from hi onwards is >= pivot.
-    PLY_ASSERT(hi <= lo);
-    while (lo > 1) {
-        if (!is_less(view[lo - 1], view[pivot])) {
-            lo--;
-        } else {
-            sort(view.subview(0, lo), is_less);
+        u32 child = root * 2 + 1;
+        if (child >= end)
             break;
+        if (child + 1 < end && is_less(view[child], view[child + 1])) {
+            child++;
         }
+        if (!is_less(view[root], view[child]))
+            break;
+        std::swap(view[root], view[child]);
+        root = child;
+    }
+}
+
+// Not stable. O(n log n) in all cases.
+template <typename T, typename IsLess>
+void heap_sort(ArrayView<T> view, const IsLess& is_less) {
+    u32 n = view.num_items();
+    for (u32 i = n / 2; i-- > 0;) {
+        heap_sift_down(view, i, n, is_less);
     }
-    while (hi + 1 < view.num_items()) {
-        if (!is_less(view[pivot], view[hi])) {
-            hi++;
+    for (u32 end = n; end-- > 1;) {
+        std::swap(view[0], view[end]);
+        heap_sift_down(view, 0, end, is_less);
+    }
+}
+
+// Quicksort with a median-of-three pivot that switches to heap_sort once depth_limit reaches zero.
+// Recurses into the smaller partition and loops on the larger one, so stack depth is O(log n).
+template <typename T, typename IsLess>
+void introsort(ArrayView<T> view, u32 depth_limit, const IsLess& is_less) {
+    while (view.num_items() > detail::SortInsertionThreshold) {
+        if (depth_limit == 0) {
+            heap_sort(view, is_less);
+            return;
+        }
+        depth_limit--;
+
+        // Order the second, middle and last items, then move the median to the front to serve as
+        // the pivot. view[1] and view[n - 1] then act as sentinels for the partition loops below.
+        u32 n = view.num_items();
+        u32 mid = n / 2;
+        if (is_less(view[mid], view[1])) {
+            std::swap(view[mid], view[1]);
+        }
+        if (is_less(view[n - 1], view[mid])) {
+            std::swap(view[n - 1], view[mid]);
+            if (is_less(view[mid], view[1])) {
+                std::swap(view[mid], view[1]);
+            }
+        }
+        std::swap(view[0], view[mid]);
+
+        // Hoare partition. Both scans stop on items equal to the pivot, which keeps the partitions
+        // balanced when there are many duplicates.
+        u32 lo = 0;
+        u32 hi = n;
+        for (;;) {
+            do {
+                lo++;
+            } while (is_less(view[lo], view[0]));
+            do {
+                hi--;
+            } while (is_less(view[0], view[hi]));
+            if (lo >= hi)
+                break;
+            std::swap(view[lo], view[hi]);
+        }
+        // Everything left of hi is <= pivot, and everything right of hi is >= pivot.
+        std::swap(view[0], view[hi]);
+        ArrayView<T> left = view.subview(0, hi);
+        ArrayView<T> right = view.subview(hi + 1);
+        if (left.num_items() < right.num_items()) {
+            introsort(left, depth_limit, is_less);
+            view = right;
         } else {
-            sort(view.subview(hi), is_less);
-            break;
+            introsort(right, depth_limit, is_less);
+            view = left;
         }
     }
+    insertion_sort(view, is_less);
+}
+
+template <typename T, typename IsLess = decltype(default_less<T>)>
+void sort(ArrayView<T> view, const IsLess& is_less = default_less<T>) {
+    if (view.num_items() <= 1)
+        return;
+    introsort(view, highest_bit_index(view.num_items()) * 2, is_less);
 }
 template <typename Arr, typename IsLess = decltype(default_less<ArrayItemType<Arr>>)>
 void sort(Arr& arr, const IsLess& is_less = default_less<ArrayItemType<Arr>>) {
@@ -3628,6 +5525,168 @@ void sort(Arr& arr, const IsLess& is_less = default_less<ArrayItemType<Arr>>) {
     sort(ArrayView<T>{arr}, is_less);
 }
 
+// Merges the sorted ranges view[0, mid) and view[mid, n). buffer must have room for mid items.
+template <typename T, typename IsLess>
+void merge_sorted_runs(ArrayView<T> view, u32 mid, T* buffer, const IsLess& is_less) {
+    if (!is_less(view[mid], view[mid - 1]))
+        return; // Already in order.
+    for (u32 i = 0; i < mid; i++) {
+        new (&buffer[i]) T{std::move(view[i])};
+    }
+    u32 a = 0;
+    u32 b = mid;
+    u32 out = 0;
+    while (a < mid && b < view.num_items()) {
+        // Take from the right run only when strictly less, so that equal items keep their order.
+        if (is_less(view[b], buffer[a])) {
+            view[out++] = std::move(view[b++]);
+        } else {
+            view[out++] = std::move(buffer[a++]);
+        }
+    }
+    while (a < mid) {
+        view[out++] = std::move(buffer[a++]);
+    }
+    for (u32 i = 0; i < mid; i++) {
+        buffer[i].~T();
+    }
+}
+
+template <typename T, typename IsLess>
+void merge_sort(ArrayView<T> view, T* buffer, const IsLess& is_less) {
+    if (view.num_items() <= detail::SortInsertionThreshold) {
+        insertion_sort(view, is_less);
+        return;
+    }
+    u32 mid = view.num_items() / 2;
+    merge_sort(view.subview(0, mid), buffer, is_less);
+    merge_sort(view.subview(mid), buffer, is_less);
+    merge_sorted_runs(view, mid, buffer, is_less);
+}
+
+// Keeps equal items in their original order. Needs scratch space for n / 2 items, which comes from
+// the stack when it's small enough and from the heap otherwise.
+template <typename T, typename IsLess = decltype(default_less<T>)>
+void stable_sort(ArrayView<T> view, const IsLess& is_less = default_less<T>) {
+    if (view.num_items() <= detail::SortInsertionThreshold) {
+        insertion_sort(view, is_less);
+        return;
+    }
+    uptr num_bytes = sizeof(T) * uptr(view.num_items() / 2);
+    alignas(T) char local_buffer[1024];
+    T* buffer = (num_bytes <= sizeof(local_buffer)) ? (T*) local_buffer : (T*) Heap::alloc(num_bytes);
+    merge_sort(view, buffer, is_less);
+    if ((char*) buffer != local_buffer) {
+        Heap::free(buffer);
+    }
+}
+template <typename Arr, typename IsLess = decltype(default_less<ArrayItemType<Arr>>)>
+void stable_sort(Arr& arr, const IsLess& is_less = default_less<ArrayItemType<Arr>>) {
+    using T = ArrayItemType<Arr>;
+    stable_sort(ArrayView<T>{arr}, is_less);
+}
+
+// to_radix_key maps each supported key type to an unsigned integer of the same size whose natural
+// order matches the key's order. Signed integers flip the sign bit. Floats flip every bit when
+// negative and only the sign bit otherwise, so -0.0 sorts just before +0.0.
+inline u8 to_radix_key(u8 key) {
+    return key;
+}
+inline u16 to_radix_key(u16 key) {
+    return key;
+}
+inline u32 to_radix_key(u32 key) {
+    return key;
+}
+inline u64 to_radix_key(u64 key) {
+    return key;
+}
+inline u8 to_radix_key(s8 key) {
+    return u8(key) ^ 0x80u;
+}
+inline u16 to_radix_key(s16 key) {
+    return u16(key) ^ 0x8000u;
+}
+inline u32 to_radix_key(s32 key) {
+    return u32(key) ^ 0x80000000u;
+}
+inline u64 to_radix_key(s64 key) {
+    return u64(key) ^ 0x8000000000000000ull;
+}
+inline u32 to_radix_key(float key) {
+    u32 bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+inline u64 to_radix_key(double key) {
+    u64 bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
+}
+
+// LSD radix sort on 8-bit digits. Stable. get_key returns an integer or floating-point key for each
+// item, and items must be trivially copyable. Needs a heap-allocated scratch buffer of n items.
+// Digits that are the same for every key are skipped.
+template <typename T, typename GetKey>
+void radix_sort(ArrayView<T> view, const GetKey& get_key) {
+    PLY_STATIC_ASSERT(std::is_trivially_copyable<T>::value);
+    using RadixKey = decltype(to_radix_key(get_key(std::declval<const T&>())));
+    static constexpr u32 NumDigits = sizeof(RadixKey);
+    u32 n = view.num_items();
+    if (n <= detail::SortInsertionThreshold) {
+        insertion_sort(view, [&](const T& a, const T& b) { //
+            return to_radix_key(get_key(a)) < to_radix_key(get_key(b));
+        });
+        return;
+    }
+
+    // Build the histograms for every digit in a single pass.
+    u32 counts[NumDigits][256] = {};
+    for (const T& item : view) {
+        RadixKey key = to_radix_key(get_key(item));
+        for (u32 d = 0; d < NumDigits; d++) {
+            counts[d][u8(key >> (d * 8))]++;
+        }
+    }
+
+    RadixKey first_key = to_radix_key(get_key(view[0]));
+    T* src = view.items();
+    T* dst = (T*) Heap::alloc(sizeof(T) * n);
+    T* buffer = dst;
+    for (u32 d = 0; d < NumDigits; d++) {
+        u32* count = counts[d];
+        if (count[u8(first_key >> (d * 8))] == n)
+            continue;
+        u32 offset = 0;
+        for (u32 i = 0; i < 256; i++) {
+            u32 c = count[i];
+            count[i] = offset;
+            offset += c;
+        }
+        for (u32 i = 0; i < n; i++) {
+            u8 digit = u8(to_radix_key(get_key(src[i])) >> (d * 8));
+            memcpy((void*) &dst[count[digit]++], &src[i], sizeof(T));
+        }
+        std::swap(src, dst);
+    }
+    if (src != view.items()) {
+        memcpy((void*) view.items(), src, sizeof(T) * n);
+    }
+    Heap::free(buffer);
+}
+template <typename T>
+void radix_sort(ArrayView<T> view) {
+    radix_sort(view, [](const T& item) { return item; });
+}
+template <typename Arr, typename GetKey, PLY_ENABLE_IF_ARRAY_TYPE(Arr)>
+void radix_sort(Arr& arr, const GetKey& get_key) {
+    radix_sort(ArrayView<ArrayItemType<Arr>>{arr}, get_key);
+}
+template <typename Arr, PLY_ENABLE_IF_ARRAY_TYPE(Arr)>
+void radix_sort(Arr& arr) {
+    radix_sort(ArrayView<ArrayItemType<Arr>>{arr});
+}
+
 enum FindType {
     FindGreaterThan,
     FindGreaterThanOrEqual,
@@ -3670,6 +5729,448 @@ u32 binary_search(Arr& arr, const Key& desired_key, FindType find_type) {
     return binary_search(ArrayView<Item>{arr}, desired_key, find_type);
 }
 
+//  ▄▄▄▄▄▄ ▄▄                              ▄▄  ▄▄▄▄▄                ▄▄
+//    ██   ██▄▄▄  ▄▄▄▄▄   ▄▄▄▄   ▄▄▄▄   ▄▄▄██  ██  ██  ▄▄▄▄   ▄▄▄▄  ██
+//    ██   ██  ██ ██  ▀▀ ██▄▄██  ▄▄▄██ ██  ██  ██▀▀▀  ██  ██ ██  ██ ██
+//    ██   ██  ██ ██     ▀█▄▄▄  ▀█▄▄██ ▀█▄▄██  ██     ▀█▄▄█▀ ▀█▄▄█▀ ██
+//
+
+// Returns the number of logical CPU cores available to the process.
+u32 get_num_cpu_cores();
+
+// Counts the jobs passed to ThreadPool::spawn that haven't finished yet. Pass it to ThreadPool::wait to
+// join them.
+struct JobCounter {
+    Atomic<u32> num_pending = 0;
+};
+
+// A fixed set of worker threads that run jobs. Each worker has its own deque of jobs. A worker pushes
+// and pops jobs at one end of its own deque, and steals from the other end of someone else's deque
+// when its own runs dry. Jobs submitted from outside the pool go to a shared queue. Idle workers sleep
+// on a semaphore until there's more work.
+class ThreadPool {
+public:
+    // Counters for tuning. They're updated without locking, so they're only approximate while jobs
+    // are running.
+    struct Stats {
+        u64 num_jobs_run = 0;
+        u64 num_steals = 0;        // Jobs taken from another worker's deque.
+        u64 num_failed_steals = 0; // Steals that lost a race with another thread.
+        u64 num_sleeps = 0;        // Times a worker went to sleep because it couldn't find work.
+        u32 num_queued_jobs = 0;   // Jobs waiting to run right now.
+        u32 max_queue_depth = 0;   // Most jobs ever waiting in a single worker's deque.
+    };
+
+private:
+    struct Job;
+    struct Worker;
+
+    static ThreadLocal<Worker*> current_worker;
+
+    Array<Owned<Worker>> workers;
+    Mutex external_mutex{"ThreadPool"};
+    Array<Job*> external_jobs; // Jobs pushed from threads outside the pool. Protected by external_mutex.
+    u32 external_head = 0;     // Index of the next job to run in external_jobs.
+    Atomic<u32> num_external_jobs = 0;
+    Semaphore wake_sema;
+    Atomic<u32> num_sleeping = 0; // Workers that will wait on wake_sema without being signaled.
+    Atomic<u32> exiting = 0;
+    Atomic<u64> num_external_jobs_run = 0;
+    Mutex waiter_mutex{"ThreadPool waiters"};
+    ConditionVariable waiter_cond; // Wakes threads blocked in wait(). Protected by waiter_mutex.
+    Atomic<u32> num_waiters = 0;   // Threads that are blocked, or about to block, in wait().
+
+    friend class FutureStateBase;
+
+    Worker* get_current_worker() const;
+    void push_job(Job* job);
+    Job* find_job(Worker* worker);
+    bool has_work() const;
+    void run_job(Worker* worker, Job* job);
+    void wake_one_worker();
+    void wake_waiters();
+    void worker_loop(Worker* worker);
+
+public:
+    ThreadPool(u32 num_workers);
+    // Waits for every submitted job to finish, then stops the workers.
+    ~ThreadPool();
+
+    // The pool used by the parallel algorithms below. It has one worker per CPU core, minus one for
+    // the calling thread.
+    static ThreadPool& get_default();
+
+    // Number of threads that can run jobs at once, including a thread that's waiting in wait().
+    u32 num_threads() const {
+        return this->workers.num_items() + 1;
+    }
+    // Runs job on some thread in the pool. Doesn't wait for it to finish.
+    void submit(Functor<void()>&& job);
+    // Like submit, but counts the job in counter until it finishes.
+    void spawn(JobCounter& counter, Functor<void()>&& job);
+    // Runs queued jobs on the calling thread until every job counted in counter has finished. When
+    // there's nothing left to run, blocks until the counter reaches zero or more work arrives.
+    void wait(JobCounter& counter);
+    // Calls func(i) for every i in [0, num_tasks) and returns when they've all finished.
+    void run_batch(u32 num_tasks, const Functor<void(u32 task_index)>& func);
+    Stats get_stats() const;
+};
+
+// Calls func(i) for every i in [begin, end). Indices are handed out in chunks of grain_size.
+template <typename Func>
+void parallel_for(u32 begin, u32 end, u32 grain_size, const Func& func,
+                  ThreadPool& pool = ThreadPool::get_default()) {
+    if (begin >= end)
+        return;
+    grain_size = max(grain_size, 1u);
+    u32 num_chunks = (end - begin - 1) / grain_size + 1;
+    pool.run_batch(num_chunks, [&](u32 chunk) {
+        u32 chunk_begin = begin + chunk * grain_size;
+        u32 chunk_end = chunk_begin + min(grain_size, end - chunk_begin);
+        for (u32 i = chunk_begin; i < chunk_end; i++) {
+            func(i);
+        }
+    });
+}
+// Calls func(item) for every item in the array.
+template <typename Arr, typename Func, PLY_ENABLE_IF_ARRAY_TYPE(Arr)>
+void parallel_for(Arr& arr, u32 grain_size, const Func& func, ThreadPool& pool = ThreadPool::get_default()) {
+    ArrayView<ArrayItemType<Arr>> view{arr};
+    parallel_for(0, view.num_items(), grain_size, [&](u32 i) { func(view[i]); }, pool);
+}
+
+// Returns combine(...combine(combine(identity, func(begin)), func(begin + 1))..., func(end - 1)).
+// Each chunk of grain_size indices is reduced on its own, then the chunk results are combined in
+// order, so combine needs to be associative but not commutative.
+template <typename T, typename Func, typename Combine>
+T parallel_reduce(u32 begin, u32 end, u32 grain_size, const T& identity, const Func& func,
+                  const Combine& combine, ThreadPool& pool = ThreadPool::get_default()) {
+    if (begin >= end)
+        return identity;
+    grain_size = max(grain_size, 1u);
+    u32 num_chunks = (end - begin - 1) / grain_size + 1;
+    Array<T> chunk_results;
+    chunk_results.resize(num_chunks);
+    pool.run_batch(num_chunks, [&](u32 chunk) {
+        u32 chunk_begin = begin + chunk * grain_size;
+        u32 chunk_end = chunk_begin + min(grain_size, end - chunk_begin);
+        T result = identity;
+        for (u32 i = chunk_begin; i < chunk_end; i++) {
+            result = combine(result, func(i));
+        }
+        chunk_results[chunk] = std::move(result);
+    });
+    T result = identity;
+    for (T& chunk_result : chunk_results) {
+        result = combine(result, chunk_result);
+    }
+    return result;
+}
+
+// Returns the number of items from a that come before the output position k when the sorted runs a
+// and b are merged stably.
+template <typename T, typename IsLess>
+u32 get_merge_split(ArrayView<T> a, ArrayView<T> b, u32 k, const IsLess& is_less) {
+    u32 lo = (k > b.num_items()) ? k - b.num_items() : 0;
+    u32 hi = min(k, a.num_items());
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        // a[mid] comes before b[k - mid - 1] unless b's item is strictly less.
+        if (!is_less(b[k - mid - 1], a[mid])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Stable merge sort that sorts one run per thread, then merges pairs of runs in rounds. Each merge is
+// split into independent pieces so that every thread stays busy until the last round. Needs a heap-
+// allocated scratch buffer of n items.
+template <typename T, typename IsLess = decltype(default_less<T>)>
+void parallel_sort(ArrayView<T> view, const IsLess& is_less = default_less<T>,
+                   ThreadPool& pool = ThreadPool::get_default()) {
+    static constexpr u32 MinItemsPerRun = 4096;
+    u32 n = view.num_items();
+    u32 num_runs = 1;
+    while (num_runs < pool.num_threads() && n / (num_runs * 2) >= MinItemsPerRun) {
+        num_runs *= 2;
+    }
+    if (num_runs <= 1) {
+        stable_sort(view, is_less);
+        return;
+    }
+    auto run_start = [&](u32 run) { return u32(u64(run) * n / num_runs); };
+    pool.run_batch(num_runs, [&](u32 run) { //
+        stable_sort(view.subview(run_start(run), run_start(run + 1) - run_start(run)), is_less);
+    });
+
+    // Move the sorted runs into the scratch buffer. Each round then merges from one array into the other.
+    T* buffer = (T*) Heap::alloc(sizeof(T) * n);
+    parallel_for(
+        0, num_runs, 1,
+        [&](u32 run) {
+            for (u32 i = run_start(run); i < run_start(run + 1); i++) {
+                new (&buffer[i]) T{std::move(view[i])};
+            }
+        },
+        pool);
+    ArrayView<T> src{buffer, n};
+    ArrayView<T> dst = view;
+    for (u32 width = 1; width < num_runs; width *= 2) {
+        // There's one task per run in every round. Each merge is split into as many pieces as it has runs.
+        u32 pieces_per_merge = width * 2;
+        pool.run_batch(num_runs, [&](u32 task) {
+            u32 merge = task / pieces_per_merge;
+            u32 piece = task % pieces_per_merge;
+            u32 start = run_start(merge * width * 2);
+            u32 mid = run_start(merge * width * 2 + width);
+            u32 end = run_start((merge + 1) * width * 2);
+            ArrayView<T> a = src.subview(start, mid - start);
+            ArrayView<T> b = src.subview(mid, end - mid);
+            u32 out_begin = u32(u64(end - start) * piece / pieces_per_merge);
+            u32 out_end = u32(u64(end - start) * (piece + 1) / pieces_per_merge);
+            u32 ai = get_merge_split(a, b, out_begin, is_less);
+            u32 a_end = get_merge_split(a, b, out_end, is_less);
+            u32 bi = out_begin - ai;
+            u32 b_end = out_end - a_end;
+            T* out = &dst[start + out_begin];
+            while (ai < a_end && bi < b_end) {
+                *out++ = is_less(b[bi], a[ai]) ? std::move(b[bi++]) : std::move(a[ai++]);
+            }
+            while (ai < a_end) {
+                *out++ = std::move(a[ai++]);
+            }
+            while (bi < b_end) {
+                *out++ = std::move(b[bi++]);
+            }
+        });
+        std::swap(src, dst);
+    }
+
+    bool result_in_buffer = (src.items() == buffer);
+    if (result_in_buffer || !std::is_trivially_destructible<T>::value) {
+        parallel_for(
+            0, n, MinItemsPerRun,
+            [&](u32 i) {
+                if (result_in_buffer) {
+                    view[i] = std::move(buffer[i]);
+                }
+                buffer[i].~T();
+            },
+            pool);
+    }
+    Heap::free(buffer);
+}
+template <typename Arr, typename IsLess = decltype(default_less<ArrayItemType<Arr>>)>
+void parallel_sort(Arr& arr, const IsLess& is_less = default_less<ArrayItemType<Arr>>,
+                   ThreadPool& pool = ThreadPool::get_default()) {
+    using T = ArrayItemType<Arr>;
+    parallel_sort(ArrayView<T>{arr}, is_less, pool);
+}
+
+//  ▄▄▄▄▄         ▄▄
+//  ██    ▄▄  ▄▄ ▄██▄▄ ▄▄  ▄▄ ▄▄▄▄▄   ▄▄▄▄
+//  ██▀▀  ██  ██  ██   ██  ██ ██  ▀▀ ██▄▄██
+//  ██    ▀█▄▄██  ▀█▄▄ ▀█▄▄██ ██     ▀█▄▄▄
+//
+
+// Shared state behind a Future and its Promise. Continuations added before the result is set run on the thread that
+// sets it. Continuations added afterwards run immediately.
+class FutureStateBase : public RefCounted<FutureStateBase> {
+private:
+    Mutex mutex;
+    Array<Functor<void()>> continuations; // Protected by mutex. Cleared once the result is set.
+
+public:
+    ThreadPool* pool;
+    JobCounter pending; // Counts one pending job until the result is set, so ThreadPool::wait can wait for it.
+
+    FutureStateBase(ThreadPool* pool) : pool{pool} {
+        this->pending.num_pending.store_relaxed(1);
+    }
+    virtual ~FutureStateBase() = default;
+    void on_ref_count_zero() {
+        Heap::destroy(this);
+    }
+    bool is_ready() const {
+        return this->pending.num_pending.load_acquire() == 0;
+    }
+    // Runs queued jobs from the pool on the calling thread until the result is set.
+    void wait() {
+        this->pool->wait(this->pending);
+    }
+    void mark_ready();
+    void add_continuation(Functor<void()>&& func);
+};
+
+template <typename T>
+class FutureState : public FutureStateBase {
+private:
+    union {
+        T value;
+    };
+
+public:
+    using GetType = const T&;
+
+    FutureState(ThreadPool* pool) : FutureStateBase{pool} {
+    }
+    ~FutureState() override {
+        if (this->is_ready()) {
+            this->value.~T();
+        }
+    }
+    template <typename... Args>
+    void set(Args&&... args) {
+        new (&this->value) T(std::forward<Args>(args)...);
+        this->mark_ready();
+    }
+    template <typename Func>
+    void set_from(const Func& func) {
+        new (&this->value) T(func());
+        this->mark_ready();
+    }
+    const T& get() const {
+        return this->value;
+    }
+    template <typename Func>
+    decltype(auto) invoke(const Func& func) const {
+        return func(this->value);
+    }
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+public:
+    using GetType = void;
+
+    FutureState(ThreadPool* pool) : FutureStateBase{pool} {
+    }
+    void set() {
+        this->mark_ready();
+    }
+    template <typename Func>
+    void set_from(const Func& func) {
+        func();
+        this->mark_ready();
+    }
+    void get() const {
+    }
+    template <typename Func>
+    decltype(auto) invoke(const Func& func) const {
+        return func();
+    }
+};
+
+// The type of the Future returned by Future<T>::then(func).
+template <typename T, typename Func>
+using ContinuationResult = std::decay_t<decltype(declval<const FutureState<T>&>().invoke(declval<const Func&>()))>;
+
+// A Future holds the result of work that might still be running on a ThreadPool. Futures are cheap to copy, and every
+// copy refers to the same result. The default-constructed Future is invalid.
+template <typename T>
+class Future {
+private:
+    Reference<FutureState<T>> state;
+
+public:
+    Future() = default;
+    Future(FutureState<T>* state) : state{state} {
+    }
+    bool is_valid() const {
+        return (bool) this->state;
+    }
+    bool is_ready() const {
+        return this->state->is_ready();
+    }
+    // Waits for the result. If the calling thread belongs to the Future's pool, it runs other jobs while waiting.
+    void wait() const {
+        this->state->wait();
+    }
+    // Waits for the result, then returns it.
+    typename FutureState<T>::GetType get() const {
+        this->state->wait();
+        return this->state->get();
+    }
+    // Returns a Future for func(result), or func() if T is void. func runs on the pool once the result is ready.
+    template <typename Func>
+    Future<ContinuationResult<T, Func>> then(Func&& func) const {
+        using U = ContinuationResult<T, Func>;
+        Reference<FutureState<T>> src = this->state;
+        Reference<FutureState<U>> dst = Heap::create<FutureState<U>>(src->pool);
+        src->add_continuation([src, dst, func = std::forward<Func>(func)] {
+            src->pool->submit([src, dst, func] { dst->set_from([&]() -> U { return src->invoke(func); }); });
+        });
+        return Future<U>{dst};
+    }
+    FutureStateBase* get_state() const {
+        return this->state;
+    }
+};
+
+// The writing end of a Future. Call set_value exactly once.
+template <typename T>
+class Promise {
+private:
+    Reference<FutureState<T>> state;
+
+public:
+    Promise(ThreadPool& pool = ThreadPool::get_default()) : state{Heap::create<FutureState<T>>(&pool)} {
+    }
+    Future<T> get_future() const {
+        return Future<T>{this->state};
+    }
+    template <typename... Args>
+    void set_value(Args&&... args) const {
+        PLY_ASSERT(!this->state->is_ready());
+        this->state->set(std::forward<Args>(args)...);
+    }
+};
+
+// Calls func on the pool and returns a Future for its result.
+template <typename Func>
+Future<std::decay_t<decltype(declval<const Func&>()())>> start_task(Func&& func,
+                                                                    ThreadPool& pool = ThreadPool::get_default()) {
+    using T = std::decay_t<decltype(declval<const Func&>()())>;
+    Reference<FutureState<T>> state = Heap::create<FutureState<T>>(&pool);
+    Future<T> future{state};
+    pool.submit([state, func = std::forward<Func>(func)] { state->set_from(func); });
+    return future;
+}
+
+Future<void> when_all_states(ArrayView<FutureStateBase* const> states, ThreadPool& pool);
+Future<u32> when_any_states(ArrayView<FutureStateBase* const> states, ThreadPool& pool);
+
+// Returns a Future that becomes ready once every Future in futures is ready. Get the results from the original
+// Futures.
+template <typename T>
+Future<void> when_all(ArrayView<const Future<T>> futures, ThreadPool& pool = ThreadPool::get_default()) {
+    Array<FutureStateBase*> states;
+    for (const Future<T>& future : futures) {
+        states.append(future.get_state());
+    }
+    return when_all_states(states, pool);
+}
+template <typename Arr, PLY_ENABLE_IF_ARRAY_TYPE(Arr)>
+auto when_all(const Arr& futures, ThreadPool& pool = ThreadPool::get_default()) {
+    return when_all(ArrayView<const ArrayItemType<Arr>>{futures}, pool);
+}
+// Returns a Future for the index of the first Future in futures to become ready.
+template <typename T>
+Future<u32> when_any(ArrayView<const Future<T>> futures, ThreadPool& pool = ThreadPool::get_default()) {
+    Array<FutureStateBase*> states;
+    for (const Future<T>& future : futures) {
+        states.append(future.get_state());
+    }
+    return when_any_states(states, pool);
+}
+template <typename Arr, PLY_ENABLE_IF_ARRAY_TYPE(Arr)>
+auto when_any(const Arr& futures, ThreadPool& pool = ThreadPool::get_default()) {
+    return when_any(ArrayView<const ArrayItemType<Arr>>{futures}, pool);
+}
+
 //  ▄▄▄▄▄  ▄▄
 //  ██  ██ ▄▄ ▄▄▄▄▄   ▄▄▄▄
 //  ██▀▀▀  ██ ██  ██ ██▄▄██
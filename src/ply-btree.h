@@ -17,11 +17,137 @@ namespace ply {
 //  ██▄▄█▀   ██   ██     ▀█▄▄▄  ▀█▄▄▄
 //
 
-template <typename Item>
+// Counts the keys that don't meet the search condition. In a sorted node, that's the index of the first key that
+// does. Every key is compared without branching, so the cost doesn't depend on how well the branches are predicted.
+template <typename Key>
+PLY_FORCE_INLINE u32 count_keys_before(const Key* keys, u32 num_keys, Key desired_key, FindType find_type) {
+    u32 count = 0;
+    if (find_type == FindGreaterThan) {
+        for (u32 i = 0; i < num_keys; i++) {
+            count += u32(keys[i] <= desired_key);
+        }
+    } else {
+        for (u32 i = 0; i < num_keys; i++) {
+            count += u32(keys[i] < desired_key);
+        }
+    }
+    return count;
+}
+
+#if PLY_CPU_X64
+
+// Returns the sum of the four 32-bit lanes.
+PLY_FORCE_INLINE u32 sum_lanes_epi32(__m128i sum) {
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (u32) _mm_cvtsi128_si32(sum);
+}
+
+// The SSE2 versions compare four 32-bit keys, or two doubles, per instruction. Each comparison sets a lane to -1, so
+// subtracting the comparison results counts the keys. SSE2 only compares signed integers, so unsigned keys have their
+// sign bits flipped first.
+PLY_FORCE_INLINE u32 count_keys_before_epi32(const u32* keys, u32 num_keys, u32 desired_key, u32 sign_flip,
+                                             FindType find_type) {
+    __m128i flip = _mm_set1_epi32((int) sign_flip);
+    __m128i desired = _mm_set1_epi32((int) (desired_key ^ sign_flip));
+    __m128i sum = _mm_setzero_si128();
+    u32 i = 0;
+    if (find_type == FindGreaterThan) {
+        // Count keys > desired_key, then subtract from the total.
+        for (; i + 4 <= num_keys; i += 4) {
+            __m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (keys + i)), flip);
+            sum = _mm_sub_epi32(sum, _mm_cmpgt_epi32(k, desired));
+        }
+        u32 count = sum_lanes_epi32(sum);
+        for (; i < num_keys; i++) {
+            count += u32(s32(keys[i] ^ sign_flip) > s32(desired_key ^ sign_flip));
+        }
+        return num_keys - count;
+    } else {
+        for (; i + 4 <= num_keys; i += 4) {
+            __m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (keys + i)), flip);
+            sum = _mm_sub_epi32(sum, _mm_cmpgt_epi32(desired, k));
+        }
+        u32 count = sum_lanes_epi32(sum);
+        for (; i < num_keys; i++) {
+            count += u32(s32(keys[i] ^ sign_flip) < s32(desired_key ^ sign_flip));
+        }
+        return count;
+    }
+}
+PLY_FORCE_INLINE u32 count_keys_before(const u32* keys, u32 num_keys, u32 desired_key, FindType find_type) {
+    return count_keys_before_epi32(keys, num_keys, desired_key, 0x80000000u, find_type);
+}
+PLY_FORCE_INLINE u32 count_keys_before(const s32* keys, u32 num_keys, s32 desired_key, FindType find_type) {
+    return count_keys_before_epi32((const u32*) keys, num_keys, (u32) desired_key, 0, find_type);
+}
+PLY_FORCE_INLINE u32 count_keys_before(const float* keys, u32 num_keys, float desired_key, FindType find_type) {
+    __m128 desired = _mm_set1_ps(desired_key);
+    __m128i sum = _mm_setzero_si128();
+    u32 i = 0;
+    if (find_type == FindGreaterThan) {
+        for (; i + 4 <= num_keys; i += 4) {
+            sum = _mm_sub_epi32(sum, _mm_castps_si128(_mm_cmple_ps(_mm_loadu_ps(keys + i), desired)));
+        }
+    } else {
+        for (; i + 4 <= num_keys; i += 4) {
+            sum = _mm_sub_epi32(sum, _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(keys + i), desired)));
+        }
+    }
+    return sum_lanes_epi32(sum) + count_keys_before<float>(keys + i, num_keys - i, desired_key, find_type);
+}
+PLY_FORCE_INLINE u32 count_keys_before(const double* keys, u32 num_keys, double desired_key, FindType find_type) {
+    __m128d desired = _mm_set1_pd(desired_key);
+    __m128i sum = _mm_setzero_si128();
+    u32 i = 0;
+    if (find_type == FindGreaterThan) {
+        for (; i + 2 <= num_keys; i += 2) {
+            sum = _mm_sub_epi64(sum, _mm_castpd_si128(_mm_cmple_pd(_mm_loadu_pd(keys + i), desired)));
+        }
+    } else {
+        for (; i + 2 <= num_keys; i += 2) {
+            sum = _mm_sub_epi64(sum, _mm_castpd_si128(_mm_cmplt_pd(_mm_loadu_pd(keys + i), desired)));
+        }
+    }
+    sum = _mm_add_epi64(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    return (u32) _mm_cvtsi128_si32(sum) + count_keys_before<double>(keys + i, num_keys - i, desired_key, find_type);
+}
+
+#endif // PLY_CPU_X64
+
+// Returns the index of the first item in a BTree node that meets the search condition. Nodes of plain integer or
+// floating-point items are searched by comparing every key in a range at once. Large nodes are first narrowed down
+// to that range with a few binary search steps.
+template <typename Item, std::enable_if_t<!std::is_arithmetic<Item>::value, int> = 0>
+u32 search_btree_node(ArrayView<Item> items, const LookupKey<Item>& desired_key, FindType find_type) {
+    return binary_search(items, desired_key, find_type);
+}
+template <typename Item, std::enable_if_t<std::is_arithmetic<Item>::value, int> = 0>
+u32 search_btree_node(ArrayView<Item> items, Item desired_key, FindType find_type) {
+    static constexpr u32 MaxKeysToCount = 32;
+    u32 lo = 0;
+    u32 hi = items.num_items();
+    while (hi - lo > MaxKeysToCount) {
+        u32 mid = (lo + hi) / 2;
+        if (meets_condition(items[mid], desired_key, find_type)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo + count_keys_before(items.begin() + lo, hi - lo, desired_key, find_type);
+}
+
+// NodeAllocator supplies memory for the tree's nodes. Use PoolNodeAllocator to allocate nodes from shared pools
+// instead of the general-purpose heap. MaxItemsPerNode_ is the fan-out: the most items a leaf node can hold, and the
+// most children an inner node can have.
+template <typename Item, typename NodeAllocator = HeapNodeAllocator, u32 MaxItemsPerNode_ = 16>
 struct BTree {
     using Key = LookupKey<Item>;
 
-    constexpr static u32 MaxItemsPerNode = 16;
+    constexpr static u32 MaxItemsPerNode = MaxItemsPerNode_;
+    // Nodes are split in half when they're full, and merged when they drop below half full.
+    PLY_STATIC_ASSERT(MaxItemsPerNode >= 4 && MaxItemsPerNode % 2 == 0 && MaxItemsPerNode <= 0xffff);
 
     struct InnerNode;
 
@@ -31,6 +157,8 @@ struct BTree {
         Node* right_sibling = nullptr;
         Key max_key;
         bool is_leaf = true;
+        // The index of this node in parent->children, so that key updates don't have to search for it.
+        u16 index_in_parent = 0;
     };
 
     struct InnerNode : Node {
@@ -132,18 +260,22 @@ struct BTree {
     };
 
 private:
+    //------------------------------------------------
+    // Stores child at the given index in parent, and updates the child's parent pointer and index to match.
+    static void set_child(InnerNode* parent, u32 index, Node* child) {
+        PLY_ASSERT(index < MaxItemsPerNode);
+        parent->children[index] = child;
+        child->parent = parent;
+        child->index_in_parent = (u16) index;
+    }
+
     //------------------------------------------------
     PLY_NO_INLINE static void on_min_key_changed(Node* node) {
         PLY_ASSERT(node);
         if (node->parent) {
-            // Find the index of this node within its parent.
-            PLY_ASSERT(node->parent->num_children > 0);
-            u32 index_in_parent = 0;
-            for (; index_in_parent < node->parent->num_children; index_in_parent++) {
-                if (node->parent->children[index_in_parent] == node)
-                    break;
-            }
-            PLY_ASSERT(index_in_parent < node->parent->num_children); // Must be found.
+            u32 index_in_parent = node->index_in_parent;
+            PLY_ASSERT(index_in_parent < node->parent->num_children);
+            PLY_ASSERT(node->parent->children[index_in_parent] == node);
 
             // Update the corresponding child key.
             if (node->is_leaf) {
@@ -167,8 +299,8 @@ private:
             node->max_key = static_cast<InnerNode*>(node)->get_internal_max_key();
         }
         if (node->parent) {
-            PLY_ASSERT(node->parent->num_children > 0);
-            if (node->parent->children[node->parent->num_children - 1] == node) {
+            PLY_ASSERT(node->parent->children[node->index_in_parent] == node);
+            if (node->index_in_parent == node->parent->num_children - 1) {
                 on_max_key_changed(node->parent);
             }
         }
@@ -188,20 +320,15 @@ private:
         InnerNode* existing_parent = existing_node->parent;
         u32 insert_index = 0;
         if (existing_parent) {
-            for (; insert_index < existing_parent->num_children; insert_index++) {
-                if (existing_parent->children[insert_index] == existing_node)
-                    break;
-            }
-            // existing_node must have been found.
-            PLY_ASSERT(insert_index < existing_parent->num_children);
-            // Increment because we are inserting to the right.
-            insert_index++;
+            PLY_ASSERT(existing_parent->children[existing_node->index_in_parent] == existing_node);
+            // Add one because we are inserting to the right.
+            insert_index = existing_node->index_in_parent + 1;
         } else {
             // There's no parent for this node, which means it's currently the root.
             // Create new root node and make this node its only child. node_to_insert will
             // be inserted to its right.
             PLY_ASSERT(this->root == existing_node);
-            InnerNode* new_root = (InnerNode*) Heap::alloc(sizeof(InnerNode));
+            InnerNode* new_root = NodeAllocator::template alloc<InnerNode>();
             new (new_root) Node; // Construct base class members only
             new_root->is_leaf = false;
             new_root->num_children = 1;
@@ -210,9 +337,8 @@ private:
             } else {
                 new (&new_root->child_keys[0]) Key{static_cast<InnerNode*>(existing_node)->child_keys[0]};
             }
-            new_root->children[0] = existing_node;
+            set_child(new_root, 0, existing_node);
             new_root->max_key = new_root->child_keys[0];
-            existing_node->parent = new_root;
             this->root = new_root;
             existing_parent = new_root;
             insert_index = 1;
@@ -225,7 +351,7 @@ private:
         InnerNode* split_parent = nullptr;
         if (existing_parent->num_children == MaxItemsPerNode) {
             // Split parent into two nodes. split_parent will be the new sibling to its right.
-            split_parent = (InnerNode*) Heap::alloc(sizeof(InnerNode));
+            split_parent = NodeAllocator::template alloc<InnerNode>();
             new (split_parent) Node; // Construct base class members only.
             split_parent->is_leaf = false;
             // Move half of parent's items to split_parent.
@@ -235,8 +361,7 @@ private:
                 Key& key_to_move = existing_parent->child_keys[existing_parent->num_children + i];
                 new (&split_parent->child_keys[i]) Key{std::move(key_to_move)};
                 key_to_move.~Key();
-                split_parent->children[i] = existing_parent->children[existing_parent->num_children + i];
-                split_parent->children[i]->parent = split_parent;
+                set_child(split_parent, i, existing_parent->children[existing_parent->num_children + i]);
             }
 
             // If out of range...
@@ -262,10 +387,10 @@ private:
         } else {
             u32 i = node_to_insert->parent->num_children;
             new (&node_to_insert->parent->child_keys[i]) Key{std::move(node_to_insert->parent->child_keys[i - 1])};
-            node_to_insert->parent->children[i] = node_to_insert->parent->children[i - 1];
+            set_child(node_to_insert->parent, i, node_to_insert->parent->children[i - 1]);
             for (; i > insert_index; i--) {
                 node_to_insert->parent->child_keys[i] = std::move(node_to_insert->parent->child_keys[i - 1]);
-                node_to_insert->parent->children[i] = node_to_insert->parent->children[i - 1];
+                set_child(node_to_insert->parent, i, node_to_insert->parent->children[i - 1]);
             }
             if (node_to_insert->is_leaf) {
                 node_to_insert->parent->child_keys[insert_index] =
@@ -275,7 +400,7 @@ private:
                     static_cast<InnerNode*>(node_to_insert)->get_min_key();
             }
         }
-        node_to_insert->parent->children[insert_index] = node_to_insert;
+        set_child(node_to_insert->parent, insert_index, node_to_insert);
         node_to_insert->parent->num_children++;
         PLY_ASSERT(node_to_insert->parent->num_children <= MaxItemsPerNode);
         if (insert_index == 0) {
@@ -297,7 +422,7 @@ private:
             // A null iterator means insert at the end of the list.
             if (!this->root) {
                 // It's an empty tree. Create a new Leaf_Node and set it as root.
-                insert_pos->leaf_node = (LeafNode*) Heap::alloc(sizeof(LeafNode));
+                insert_pos->leaf_node = NodeAllocator::template alloc<LeafNode>();
                 insert_pos->item_index = 0;
                 // Construct base class members only (no Items are constructed).
                 new (insert_pos->leaf_node) Node;
@@ -316,7 +441,7 @@ private:
             u32 N = leaf_node->num_items;
 
             // Split this leaf node in two. split_node will be the new sibling to its right.
-            LeafNode* split_node = (LeafNode*) Heap::alloc(sizeof(LeafNode));
+            LeafNode* split_node = NodeAllocator::template alloc<LeafNode>();
             // Construct base class members only (no Items are constructed).
             new (split_node) Node;
             split_node->parent = leaf_node->parent;
@@ -405,6 +530,100 @@ private:
 #endif
     }
 
+    //------------------------------------------------
+    // Returns how many nodes to spread num_entries across so that each node gets about max_per_node entries, and no
+    // node gets fewer than MaxItemsPerNode / 2 unless there's only one.
+    static u32 get_num_nodes_in_row(u32 num_entries, u32 max_per_node) {
+        u32 num_nodes = (num_entries + max_per_node - 1) / max_per_node;
+        if (num_nodes > 1 && num_entries / num_nodes < MaxItemsPerNode / 2) {
+            num_nodes = num_entries / (MaxItemsPerNode / 2);
+        }
+        return num_nodes;
+    }
+
+    //------------------------------------------------
+    PLY_NO_INLINE void build_from_sorted_internal(ArrayView<Item> items, float fill_factor, bool with_move_semantics) {
+        PLY_ASSERT(fill_factor >= 0.5f && fill_factor <= 1.f);
+        this->clear();
+        if (items.is_empty())
+            return;
+        u32 max_per_node = clamp((u32) (MaxItemsPerNode * fill_factor), MaxItemsPerNode / 2, MaxItemsPerNode);
+
+        // Build the row of leaf nodes from left to right.
+        Array<Node*> row;
+        u32 num_nodes = get_num_nodes_in_row(items.num_items(), max_per_node);
+        row.resize(num_nodes);
+        u32 src_index = 0;
+        for (u32 n = 0; n < num_nodes; n++) {
+            LeafNode* leaf_node = NodeAllocator::template alloc<LeafNode>();
+            // Construct base class members only (no Items are constructed).
+            new (leaf_node) Node;
+            // Spread the items evenly, giving one extra item to each of the first few nodes.
+            leaf_node->num_items = items.num_items() / num_nodes + (n < items.num_items() % num_nodes ? 1 : 0);
+            for (u32 i = 0; i < leaf_node->num_items; i++) {
+                Item& src_item = items[src_index + i];
+                // The input must be sorted. Compare against the previous item already in the tree, since
+                // its source may have been moved from.
+#if defined(PLY_WITH_ASSERTS)
+                if (i > 0) {
+                    PLY_ASSERT(get_any_lookup_key(leaf_node->items[i - 1]) <= get_any_lookup_key(src_item));
+                } else if (n > 0) {
+                    LeafNode* prev_leaf = static_cast<LeafNode*>(row[n - 1]);
+                    PLY_ASSERT(get_any_lookup_key(prev_leaf->items[prev_leaf->num_items - 1]) <=
+                               get_any_lookup_key(src_item));
+                }
+#endif
+                if (with_move_semantics) {
+                    new (&leaf_node->items[i]) Item{std::move(src_item)};
+                } else {
+                    new (&leaf_node->items[i]) Item{static_cast<const Item&>(src_item)};
+                }
+            }
+            src_index += leaf_node->num_items;
+            leaf_node->max_key = leaf_node->get_internal_max_key();
+            if (n > 0) {
+                leaf_node->left_sibling = row[n - 1];
+                row[n - 1]->right_sibling = leaf_node;
+            }
+            row[n] = leaf_node;
+        }
+        PLY_ASSERT(src_index == items.num_items());
+
+        // Build each row of inner nodes on top of the row below it until there's a single root.
+        while (row.num_items() > 1) {
+            Array<Node*> parent_row;
+            num_nodes = get_num_nodes_in_row(row.num_items(), max_per_node);
+            parent_row.resize(num_nodes);
+            u32 child_index = 0;
+            for (u32 n = 0; n < num_nodes; n++) {
+                InnerNode* inner_node = NodeAllocator::template alloc<InnerNode>();
+                new (inner_node) Node; // Construct base class members only.
+                inner_node->is_leaf = false;
+                inner_node->num_children = row.num_items() / num_nodes + (n < row.num_items() % num_nodes ? 1 : 0);
+                for (u32 i = 0; i < inner_node->num_children; i++) {
+                    Node* child = row[child_index + i];
+                    if (child->is_leaf) {
+                        new (&inner_node->child_keys[i]) Key{static_cast<LeafNode*>(child)->get_min_key()};
+                    } else {
+                        new (&inner_node->child_keys[i]) Key{static_cast<InnerNode*>(child)->get_min_key()};
+                    }
+                    set_child(inner_node, i, child);
+                }
+                child_index += inner_node->num_children;
+                inner_node->max_key = inner_node->get_internal_max_key();
+                if (n > 0) {
+                    inner_node->left_sibling = parent_row[n - 1];
+                    parent_row[n - 1]->right_sibling = inner_node;
+                }
+                parent_row[n] = inner_node;
+            }
+            row = std::move(parent_row);
+        }
+
+        this->root = row[0];
+        this->num_items = items.num_items();
+    }
+
     //------------------------------------------------
     PLY_NO_INLINE void merge_with_right_sibling(Node* node) {
         PLY_ASSERT(node);
@@ -427,8 +646,7 @@ private:
                 Key& key_to_move = right_sibling->child_keys[i];
                 inner_node->child_keys[N + i] = std::move(key_to_move);
                 key_to_move.~Key();
-                inner_node->children[N + i] = right_sibling->children[i];
-                inner_node->children[N + i]->parent = inner_node;
+                set_child(inner_node, N + i, right_sibling->children[i]);
             }
             inner_node->num_children += right_sibling->num_children;
         }
@@ -461,27 +679,22 @@ private:
 
         // Locate the right sibling within its parent.
         Node* right_sibling = node->right_sibling;
-        u32 erase_index = 0;
-        for (; erase_index < parent->num_children; erase_index++) {
-            if (parent->children[erase_index] == right_sibling)
-                break;
-        }
-        // The right sibling must have been found.
-        PLY_ASSERT(erase_index < parent->num_children);
+        PLY_ASSERT(right_sibling->parent == parent);
+        u32 erase_index = right_sibling->index_in_parent;
+        PLY_ASSERT(erase_index < parent->num_children && parent->children[erase_index] == right_sibling);
 
         // Erase the right sibling from its parent.
         if (steal_from_left) {
             // Move the child nodes left of the erase position to the right.
             for (u32 i = erase_index; i > 0; i--) {
                 parent->child_keys[i] = std::move(parent->child_keys[i - 1]);
-                parent->children[i] = parent->children[i - 1];
+                set_child(parent, i, parent->children[i - 1]);
             }
             // Move the child node from the left sibling to the first position.
             Key& key_to_move = parent_left_sibling->child_keys[parent_left_sibling->num_children - 1];
             parent->child_keys[0] = std::move(key_to_move);
             key_to_move.~Key();
-            parent->children[0] = parent_left_sibling->children[parent_left_sibling->num_children - 1];
-            parent->children[0]->parent = parent;
+            set_child(parent, 0, parent_left_sibling->children[parent_left_sibling->num_children - 1]);
             // Decrement the number of items in the left sibling.
             parent_left_sibling->num_children--;
             on_max_key_changed(parent_left_sibling);
@@ -493,19 +706,18 @@ private:
             // Move the child nodes on the right of the erase position to the left.
             for (u32 i = erase_index; i < (u32) parent->num_children - 1; i++) {
                 parent->child_keys[i] = std::move(parent->child_keys[i + 1]);
-                parent->children[i] = parent->children[i + 1];
+                set_child(parent, i, parent->children[i + 1]);
             }
             if (steal_from_right) {
                 // Move the child node from the right sibling to the last position.
                 Key& key_to_move = parent_right_sibling->child_keys[0];
                 parent->child_keys[parent->num_children - 1] = std::move(key_to_move);
                 key_to_move.~Key();
-                parent->children[parent->num_children - 1] = parent_right_sibling->children[0];
-                parent->children[parent->num_children - 1]->parent = parent;
+                set_child(parent, parent->num_children - 1, parent_right_sibling->children[0]);
                 // Move all child nodes in the right sibling to the left.
                 for (u32 i = 0; i < (u32) parent_right_sibling->num_children - 1; i++) {
                     parent_right_sibling->child_keys[i] = std::move(parent_right_sibling->child_keys[i + 1]);
-                    parent_right_sibling->children[i] = parent_right_sibling->children[i + 1];
+                    set_child(parent_right_sibling, i, parent_right_sibling->children[i + 1]);
                 }
                 // Decrement the number of items in the right sibling.
                 parent_right_sibling->num_children--;
@@ -529,8 +741,9 @@ private:
                 PLY_ASSERT(this->root == parent);
                 PLY_ASSERT(!parent->parent);
                 parent->children[0]->parent = nullptr;
+                parent->children[0]->index_in_parent = 0;
                 this->root = parent->children[0];
-                Heap::free(parent);
+                NodeAllocator::free(parent);
             }
         }
 
@@ -541,7 +754,11 @@ private:
         }
 
         // Delete right sibling.
-        Heap::free(right_sibling);
+        if (right_sibling->is_leaf) {
+            NodeAllocator::free(static_cast<LeafNode*>(right_sibling));
+        } else {
+            NodeAllocator::free(static_cast<InnerNode*>(right_sibling));
+        }
     }
 
 public:
@@ -598,9 +815,9 @@ public:
             InnerNode* inner_node = static_cast<InnerNode*>(node);
             PLY_ASSERT((inner_node->num_children > 0) && (inner_node->num_children <= MaxItemsPerNode));
 
-            // Binary search this inner node.
-            u32 found_item =
-                binary_search(ArrayView<Key>{inner_node->child_keys, inner_node->num_children}, desired_key, find_type);
+            // Search this inner node.
+            u32 found_item = search_btree_node(ArrayView<Key>{inner_node->child_keys, inner_node->num_children},
+                                               desired_key, find_type);
 
             // found_item identifies the first child node whose descendent items *all* meet the specified search
             // condition, which may not necessarily be the node we'll descend into. If the node preceding that one has a
@@ -617,11 +834,12 @@ public:
             }
         }
 
-        // Binary search the items in this leaf node.
+        // Search the items in this leaf node.
         // Items are stored with their keys in increasing order (with possible duplicate keys).
         LeafNode* leaf_node = static_cast<LeafNode*>(node);
         PLY_ASSERT((leaf_node->num_items > 0) && (leaf_node->num_items <= MaxItemsPerNode));
-        u32 found_item = binary_search(ArrayView<Item>{leaf_node->items, leaf_node->num_items}, desired_key, find_type);
+        u32 found_item =
+            search_btree_node(ArrayView<Item>{leaf_node->items, leaf_node->num_items}, desired_key, find_type);
         // Item must have been found, because this->root->max_key promised it would be.
         PLY_ASSERT(found_item < leaf_node->num_items);
         PLY_ASSERT(meets_condition(get_any_lookup_key(leaf_node->items[found_item]), desired_key, find_type));
@@ -733,7 +951,7 @@ public:
                     PLY_ASSERT(this->root == leaf_node);
                     PLY_ASSERT(leaf_node->parent == nullptr);
                     this->root = nullptr;
-                    Heap::free(leaf_node);
+                    NodeAllocator::free(leaf_node);
                 } else {
                     if (erase_pos.item_index == 0) {
                         on_min_key_changed(leaf_node);
@@ -759,6 +977,8 @@ public:
 
     //------------------------------------------------
     PLY_NO_INLINE void clear() {
+        if (!this->root)
+            return;
         Node* first_node_in_row = this->root;
         while (!first_node_in_row->is_leaf) {
             InnerNode* inner_node = static_cast<InnerNode*>(first_node_in_row);
@@ -771,7 +991,7 @@ public:
                     inner_node->child_keys[i].~Key();
                 }
                 InnerNode* next = static_cast<InnerNode*>(inner_node->right_sibling);
-                Heap::free(inner_node);
+                NodeAllocator::free(inner_node);
                 inner_node = next;
             }
         }
@@ -784,7 +1004,7 @@ public:
                 leaf_node->items[i].~Item();
             }
             LeafNode* next = static_cast<LeafNode*>(leaf_node->right_sibling);
-            Heap::free(leaf_node);
+            NodeAllocator::free(leaf_node);
             leaf_node = next;
         }
 
@@ -792,6 +1012,19 @@ public:
         this->num_items = 0;
     }
 
+    //------------------------------------------------
+    // Replaces the contents of the tree with items that are already sorted by key. The tree is built bottom-up in a
+    // single pass, which is much faster than inserting the items one at a time. fill_factor sets how full each node
+    // is, from 0.5 to 1. Nodes that are less full leave room for later inserts before any node has to split.
+    void build_from_sorted(ArrayView<const Item> items, float fill_factor = 1.f) {
+        this->build_from_sorted_internal({const_cast<Item*>(items.begin()), items.num_items()}, fill_factor, false);
+    }
+
+    // Same as above, but moves the items out of the given array instead of copying them.
+    void build_from_sorted(Array<Item>&& items, float fill_factor = 1.f) {
+        this->build_from_sorted_internal(items, fill_factor, true);
+    }
+
     ~BTree() {
         this->clear();
     }
@@ -821,8 +1054,9 @@ public:
 
                 // Iterate over this node's children.
                 for (u32 i = 0; i < inner_node->num_children; i++) {
-                    // Validate the parent pointer.
+                    // Validate the parent pointer and index.
                     PLY_ASSERT(inner_node->children[i]->parent == inner_node);
+                    PLY_ASSERT(inner_node->children[i]->index_in_parent == i);
                     // Validate that the child keys are non-decreasing.
                     if (i > 0) {
                         PLY_ASSERT(inner_node->child_keys[i] >= inner_node->child_keys[i - 1]);
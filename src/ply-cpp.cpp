@@ -21,7 +21,8 @@ struct Preprocessor {
     struct File {
         String abs_path;
         StringView contents;
-        String contents_storage;
+        // Kept on the heap so that contents stays valid when the files array grows.
+        Owned<String> contents_storage;
         TokenLocationMap token_loc_map;
     };
     Array<File> files;
@@ -265,8 +266,8 @@ void include_file(ParserImpl* parser, StringView filename, u32 input_offset) {
             u32 file_index = parser->pp.files.num_items();
             Preprocessor::File& file = parser->pp.files.append();
             file.abs_path = full_path;
-            file.contents_storage = Filesystem::load_text_autodetect(full_path);
-            file.contents = file.contents_storage;
+            file.contents_storage = Heap::create<String>(Filesystem::load_text_autodetect(full_path));
+            file.contents = *file.contents_storage;
             file.token_loc_map = TokenLocationMap::create_from_string(file.contents);
 
             // Add to the include stack.
@@ -109,7 +109,16 @@ Parser::Token Parser::read_plain_token(Token::Type type) {
     return result;
 }
 
-bool Parser::read_escaped_hex(Stream& out, u32 escape_file_ofs) {
+void Parser::StringBuilder::grow() {
+    u32 new_capacity = max<u32>(this->capacity * 2, 64);
+    char* new_bytes = (char*) this->arena.alloc(new_capacity, 1);
+    PLY_ASSERT(new_bytes);
+    memcpy(new_bytes, this->bytes, this->num_bytes);
+    this->bytes = new_bytes;
+    this->capacity = new_capacity;
+}
+
+bool Parser::read_escaped_hex(StringBuilder& out, u32 escape_file_ofs) {
     PLY_ASSERT(0); // FIXME
     return false;
 }
@@ -117,7 +126,7 @@ bool Parser::read_escaped_hex(Stream& out, u32 escape_file_ofs) {
 Parser::Token Parser::read_quoted_string() {
     PLY_ASSERT(this->next_unit == '"' || this->next_unit == '\'');
     Token token = {Token::Text, this->read_ofs, {}};
-    MemStream out;
+    StringBuilder out{this->arena};
     s32 end_byte = this->next_unit;
     u32 quote_run = 1;
     bool multiline = false;
@@ -241,7 +250,7 @@ Parser::Token Parser::read_quoted_string() {
         }
     }
 
-    token.text = out.move_to_string();
+    token.text = out.view();
     return token;
 }
 
@@ -254,7 +263,7 @@ Parser::Token Parser::read_literal() {
         this->advance_char();
     }
 
-    token.text = StringView{(char*) this->src_view.bytes() + start_ofs, this->read_ofs - start_ofs};
+    token.text = this->src_view.substr(start_ofs, this->read_ofs - start_ofs);
     return token;
 }
 
@@ -483,7 +492,7 @@ Node Parser::read_expression(Token&& first_token, const Token* after_token) {
             if (first_token.text == "false") {
                 return Node{Node::Bool{false}, first_token.file_ofs};
             }
-            return Node{Node::Text{std::move(first_token.text)}, first_token.file_ofs};
+            return Node{Node::Text{first_token.text}, first_token.file_ofs};
         }
 
         case Token::Invalid:
@@ -499,6 +508,8 @@ Node Parser::read_expression(Token&& first_token, const Token* after_token) {
 }
 
 Parser::Result Parser::parse(StringView path, StringView src_view_) {
+    // Token text may point into the arena, so the arena lives until the parse is done.
+    PLY_ON_SCOPE_EXIT({ this->arena.reset(); });
     this->src_view = src_view_;
     this->next_unit = this->src_view.num_bytes() > 0 ? this->src_view[0] : -1;
 
@@ -596,5 +607,34 @@ String to_string(const Node& node) {
     return out.move_to_string();
 }
 
+static Node number_node(u64 value) {
+    return Node::Text{String::format("{}", value)};
+}
+
+Node to_node(const Heap::Stats& stats) {
+    Node node{Node::Object{}};
+    node.set("num_bytes_allocated", number_node(stats.num_bytes_allocated));
+    node.set("virtual_memory_size", number_node(stats.virtual_memory_size));
+#if PLY_HEAP_STATS
+    node.set("peak_bytes_allocated", number_node(stats.peak_bytes_allocated));
+    node.set("num_allocs", number_node(stats.num_allocs));
+    node.set("num_frees", number_node(stats.num_frees));
+    Node size_classes{Node::Array{}};
+    for (u32 i = 0; i < Heap::NumStatsSizeClasses; i++) {
+        size_classes.array().append(number_node(stats.num_allocs_per_size_class[i]));
+    }
+    node.set("num_allocs_per_size_class", std::move(size_classes));
+    Node tags{Node::Object{}};
+    for (u32 i = 0; i < stats.num_tags; i++) {
+        Node tag{Node::Object{}};
+        tag.set("num_bytes_allocated", number_node(stats.tags[i].num_bytes_allocated));
+        tag.set("num_allocs", number_node(stats.tags[i].num_allocs));
+        tags.set(stats.tags[i].name, std::move(tag));
+    }
+    node.set("tags", std::move(tags));
+#endif
+    return node;
+}
+
 } // namespace json
 } // namespace ply
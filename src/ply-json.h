@@ -207,7 +207,7 @@ private:
         };
         Type type = Invalid;
         u32 file_ofs = 0;
-        String text;
+        StringView text; // Points into the source or into the parser's arena
 
         bool is_valid() const {
             return type != Type::Invalid;
@@ -223,6 +223,7 @@ private:
     u32 tab_size = 4;
     Token push_back_token;
     Array<ParseError::Scope> context;
+    Arena arena; // Decoded string literals. Reset at the end of each parse.
 
     void push_back(Token&& token) {
         push_back_token = std::move(token);
@@ -250,7 +251,29 @@ private:
     void error(u32 file_ofs, String&& message);
     void advance_char();
     Token read_plain_token(Token::Type type);
-    bool read_escaped_hex(Stream& out, u32 escape_file_ofs);
+    // Accumulates a decoded string literal in the arena. When the buffer fills up, a larger one is allocated from the
+    // arena; the abandoned buffer is released with everything else at the end of the parse.
+    struct StringBuilder {
+        Arena& arena;
+        char* bytes = nullptr;
+        u32 num_bytes = 0;
+        u32 capacity = 0;
+
+        StringBuilder(Arena& arena) : arena{arena} {
+        }
+        void write(char c) {
+            if (this->num_bytes >= this->capacity) {
+                this->grow();
+            }
+            this->bytes[this->num_bytes++] = c;
+        }
+        void grow();
+        StringView view() const {
+            return {this->bytes, this->num_bytes};
+        }
+    };
+
+    bool read_escaped_hex(StringBuilder& out, u32 escape_file_ofs);
     Token read_quoted_string();
     Token read_literal();
     Token read_token(bool tokenize_new_line = false);
@@ -290,5 +313,8 @@ public:
 void write(Stream& out, const Node& a_node);
 String to_string(const Node& a_node);
 
+// Converts a snapshot returned by Heap::get_stats(). Numbers are stored as text.
+Node to_node(const Heap::Stats& stats);
+
 } // namespace json
 } // namespace ply
@@ -80,6 +80,9 @@ struct ParserDetails : Parser {
     // *could* store the number of such Lists on the stack, and eliminate the is_loose_if_continued flag completely, but
     // it would complicate match_existing_indentation a little bit. Sticking with this approach for now.)
     bool check_list_continuations = false;
+
+    // Scratch memory for the line being parsed. Rewound at the end of each line.
+    Arena line_arena;
 };
 
 // This is called at the start of each line. It figures out which of the existing elements we are still inside by
@@ -774,18 +777,23 @@ Owned<Parser> create_parser() {
     return Heap::create<ParserDetails>();
 }
 
-String untabify(StringView str, u32 tab_size) {
-    MemStream mem;
+// Returns a copy of str with tabs expanded to spaces. The copy is allocated from the arena.
+StringView untabify(Arena& arena, StringView str, u32 tab_size) {
+    // Each byte expands to at most tab_size bytes. Any unused space is given back to the arena at the end.
+    char* start = (char*) arena.alloc((uptr) str.num_bytes() * tab_size, 1);
+    if (!start)
+        return str; // The arena is exhausted. Leave the tabs in place rather than dropping the line.
+    char* dst = start;
     u32 column = 0;
     for (char c : str) {
         if (c == '\t') {
             u32 spaces = tab_size - (column % tab_size);
             for (u32 i = 0; i < spaces; i++) {
-                mem.write(' ');
+                *dst++ = ' ';
             }
             column += spaces;
         } else {
-            mem.write(c);
+            *dst++ = c;
             if (c == '\n') {
                 column = 0;
             } else if (c >= 32) {
@@ -793,18 +801,18 @@ String untabify(StringView str, u32 tab_size) {
             }
         }
     }
-    return mem.move_to_string();
+    arena.rewind({dst});
+    return {start, u32(dst - start)};
 }
 
 Owned<Element> parse_line(Parser* parser, StringView line) {
     ParserDetails* details = static_cast<ParserDetails*>(parser);
 
     // Untabify the input line (if needed) to simplify internal processing.
-    String untabified;
-    if (line.find(' ') >= 0) {
+    Arena::Scope line_scope{details->line_arena};
+    if (line.find('\t') >= 0) {
         constexpr u32 tab_size = 4;
-        untabified = untabify(line, tab_size);
-        line = untabified;
+        line = untabify(details->line_arena, line, tab_size);
     }
 
     LineParser lp{line};
@@ -5,13 +5,27 @@
       └──┴┴┴┘   
 ========================================================*/
 
+#if defined(__APPLE__)
+// The ucontext functions used by EventLoop are only declared when _XOPEN_SOURCE is defined.
+#define _XOPEN_SOURCE 600
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "ply-network.h"
 
-#if PLY_MACOS
+#if defined(PLY_POSIX)
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <ucontext.h>
 #define PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS 0
 #endif
 
+#if defined(PLY_LINUX)
+#include <sys/epoll.h>
+#endif
+
 namespace ply {
 
 //  ▄▄▄▄ ▄▄▄▄▄   ▄▄▄▄      ▄▄     ▄▄
@@ -64,20 +78,44 @@ PipeWinsock::~PipeWinsock() {
     }
 }
 
+void make_socket_nonblocking(SOCKET socket) {
+    u_long mode = 1;
+    int rc = ioctlsocket(socket, FIONBIO, &mode);
+    PLY_ASSERT(rc == 0 || PLY_IPWINSOCK_ALLOW_UNKNOWN_ERRORS);
+    PLY_UNUSED(rc);
+}
+
 u32 PipeWinsock::read(MutStringView buf) {
-    int rc = recv(this->socket, (char*) buf.bytes, int(buf.num_bytes), 0);
-    if (rc == 0 || rc == SOCKET_ERROR)
-        return 0;
-    PLY_ASSERT(rc > 0);
-    return rc;
+    if (!this->is_nonblocking && EventLoop::get_current()) {
+        make_socket_nonblocking(this->socket);
+        this->is_nonblocking = true;
+    }
+    for (;;) {
+        int rc = recv(this->socket, (char*) buf.bytes, int(buf.num_bytes), 0);
+        if (rc != SOCKET_ERROR) {
+            PLY_ASSERT(rc >= 0);
+            return rc;
+        }
+        if (WSAGetLastError() != WSAEWOULDBLOCK)
+            return 0;
+        EventLoop::wait_for_socket(this->socket, false);
+    }
 }
 
 bool PipeWinsock::write(StringView buf) {
+    if (!this->is_nonblocking && EventLoop::get_current()) {
+        make_socket_nonblocking(this->socket);
+        this->is_nonblocking = true;
+    }
     while (buf.num_bytes() > 0) {
         int rc = send(this->socket, (const char*) buf.bytes(), (DWORD) buf.num_bytes(), 0);
-        if (rc == SOCKET_ERROR) // FIXME: Test to make sure that disconnected sockets return
-                                // SOCKET_ERROR and not 0
-            return false;
+        if (rc == SOCKET_ERROR) { // FIXME: Test to make sure that disconnected sockets return
+                                  // SOCKET_ERROR and not 0
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+                return false;
+            EventLoop::wait_for_socket(this->socket, true);
+            continue;
+        }
         PLY_ASSERT(rc >= 0 && u32(rc) <= buf.num_bytes());
         buf = buf.substr(rc);
     }
@@ -123,7 +161,14 @@ Owned<TCPConnection> TCPListener::accept() {
         remote_addr_len = sizeof(sockaddr_in6);
     }
     socklen_t passed_addr_len = remote_addr_len;
-    SOCKET host_socket = ::accept(this->listen_socket, (struct sockaddr*) &remote_addr, &remote_addr_len);
+    SOCKET host_socket;
+    for (;;) {
+        host_socket = ::accept(this->listen_socket, (struct sockaddr*) &remote_addr, &remote_addr_len);
+        if (host_socket != INVALID_SOCKET || WSAGetLastError() != WSAEWOULDBLOCK)
+            break;
+        // Wait for the next connection without blocking other fibers.
+        EventLoop::wait_for_socket(this->listen_socket, false);
+    }
 
     if (host_socket == INVALID_SOCKET) {
         // FIXME: Check WSAGetLastError
@@ -172,7 +217,12 @@ SOCKET create_socket(int type) {
     return s;
 }
 
-TCPListener Network::bind_tcp(u16 port) {
+TCPListener Network::bind_tcp(u16 port, bool reuse_port) {
+    if (reuse_port) {
+        // Winsock has no equivalent of SO_REUSEPORT.
+        Network::last_result_.store(IPResult::NO_SOCKET);
+        return {};
+    }
     SOCKET listen_socket = create_socket(SOCK_STREAM);
     if (listen_socket == INVALID_SOCKET) { // last_result_ is already set
         return {};
@@ -209,8 +259,11 @@ TCPListener Network::bind_tcp(u16 port) {
 
     rc = bind(listen_socket, (struct sockaddr*) &server_addr, server_addr_len);
     if (rc == 0) {
-        rc = listen(listen_socket, 1);
+        rc = listen(listen_socket, SOMAXCONN);
         if (rc == 0) {
+            // Listeners are always non-blocking, so that accept() can wait in an EventLoop. Outside a fiber,
+            // accept() blocks in EventLoop::wait_for_socket() instead.
+            make_socket_nonblocking(listen_socket);
             Network::last_result_.store(IPResult::OK);
             return TCPListener{listen_socket};
         } else {
@@ -387,7 +440,58 @@ void Network::shutdown() {
 
 TCPConnection::~TCPConnection() {
     // Prevent double-deletion of file descriptor
-    this->out_pipe->fd = -1;
+    if (this->out_pipe) {
+        this->out_pipe->fd = -1;
+    }
+}
+
+void make_socket_nonblocking(int socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    int rc = fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+    PLY_ASSERT(rc == 0 || PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS);
+    PLY_UNUSED(rc);
+}
+
+u32 PipeSocket::read(MutStringView buf) {
+    PLY_ASSERT(this->fd >= 0);
+    if (!this->is_nonblocking && EventLoop::get_current()) {
+        make_socket_nonblocking(this->fd);
+        this->is_nonblocking = true;
+    }
+    for (;;) {
+        s32 rc = (s32)::read(this->fd, buf.bytes, buf.num_bytes);
+        if (rc >= 0)
+            return rc;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            EventLoop::wait_for_socket(this->fd, false);
+        } else if (errno != EINTR) {
+            return 0; // The connection was reset.
+        }
+    }
+}
+
+bool PipeSocket::write(StringView buf) {
+    PLY_ASSERT(this->fd >= 0);
+    if (!this->is_nonblocking && EventLoop::get_current()) {
+        make_socket_nonblocking(this->fd);
+        this->is_nonblocking = true;
+    }
+    while (buf.num_bytes() > 0) {
+        s32 sent = (s32)::write(this->fd, buf.bytes(), buf.num_bytes());
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                EventLoop::wait_for_socket(this->fd, true);
+            } else if (errno != EINTR) {
+                return false;
+            }
+            continue;
+        }
+        if (sent == 0)
+            return false;
+        PLY_ASSERT((u32) sent <= buf.num_bytes());
+        buf = buf.substr(sent);
+    }
+    return true;
 }
 
 Owned<TCPConnection> TCPListener::accept() {
@@ -402,7 +506,14 @@ Owned<TCPConnection> TCPListener::accept() {
         remote_addr_len = sizeof(sockaddr_in6);
     }
     socklen_t passed_addr_len = remote_addr_len;
-    int host_socket = ::accept(this->listen_socket, (struct sockaddr*) &remote_addr, &remote_addr_len);
+    int host_socket;
+    for (;;) {
+        host_socket = ::accept(this->listen_socket, (struct sockaddr*) &remote_addr, &remote_addr_len);
+        if (host_socket >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            break;
+        // Wait for the next connection without blocking other fibers.
+        EventLoop::wait_for_socket(this->listen_socket, false);
+    }
 
     if (host_socket <= 0) {
         // FIXME: Check errno
@@ -426,8 +537,8 @@ Owned<TCPConnection> TCPListener::accept() {
         tcp_conn->remote_addr_ = IPAddress::from_ipv4(remoteAddrV4->sin_addr.s_addr);
     }
     tcp_conn->remote_port_ = convert_big_endian(remote_addr.sin6_port);
-    tcp_conn->in_pipe->fd = host_socket;
-    tcp_conn->out_pipe->fd = host_socket;
+    tcp_conn->in_pipe = Heap::create<PipeSocket>(host_socket, Pipe::HAS_READ_PERMISSION);
+    tcp_conn->out_pipe = Heap::create<PipeSocket>(host_socket, Pipe::HAS_WRITE_PERMISSION);
     Network::last_result_.store(IPResult::OK);
     return tcp_conn;
 }
@@ -461,7 +572,14 @@ int create_socket(int type) {
     return s;
 }
 
-TCPListener Network::bind_tcp(u16 port) {
+TCPListener Network::bind_tcp(u16 port, bool reuse_port) {
+#if !defined(PLY_LINUX)
+    if (reuse_port) {
+        // Other kernels accept SO_REUSEPORT, but don't spread connections between the sockets that share a port.
+        Network::last_result_.store(IPResult::NO_SOCKET);
+        return {};
+    }
+#endif
     int listen_socket = create_socket(SOCK_STREAM);
     if (listen_socket < 0) { // last_result_ is already set
         return {};
@@ -470,6 +588,13 @@ TCPListener Network::bind_tcp(u16 port) {
     int reuse_addr = 1;
     int rc = setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr));
     PLY_ASSERT(rc == 0 || PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS);
+#if defined(PLY_LINUX)
+    if (reuse_port) {
+        int value = 1;
+        rc = setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
+        PLY_ASSERT(rc == 0 || PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS);
+    }
+#endif
 
     struct PLY_IF_IPV6(sockaddr_in6, sockaddr_in) server_addr;
     socklen_t server_addr_len = sizeof(sockaddr_in);
@@ -498,8 +623,11 @@ TCPListener Network::bind_tcp(u16 port) {
 
     rc = bind(listen_socket, (struct sockaddr*) &server_addr, server_addr_len);
     if (rc == 0) {
-        rc = listen(listen_socket, 1);
+        rc = listen(listen_socket, SOMAXCONN);
         if (rc == 0) {
+            // Listeners are always non-blocking, so that accept() can wait in an EventLoop. Outside a fiber,
+            // accept() blocks in EventLoop::wait_for_socket() instead.
+            make_socket_nonblocking(listen_socket);
             Network::last_result_.store(IPResult::OK);
             return TCPListener{listen_socket};
         } else {
@@ -575,8 +703,8 @@ Owned<TCPConnection> Network::connect_tcp(const IPAddress& address, u16 port) {
         TCPConnection* tcp_conn = Heap::create<TCPConnection>();
         tcp_conn->remote_addr_ = address;
         tcp_conn->remote_port_ = port;
-        tcp_conn->in_pipe->fd = connect_socket;
-        tcp_conn->out_pipe->fd = connect_socket;
+        tcp_conn->in_pipe = Heap::create<PipeSocket>(connect_socket, Pipe::HAS_READ_PERMISSION);
+        tcp_conn->out_pipe = Heap::create<PipeSocket>(connect_socket, Pipe::HAS_WRITE_PERMISSION);
         Network::last_result_.store(IPResult::OK);
         return tcp_conn;
     }
@@ -654,4 +782,268 @@ IPAddress Network::resolve_host_name(StringView host_name, IPVersion ip_version)
 
 #endif // PLY_POSIX
 
+//  ▄▄▄▄▄                       ▄▄   ▄▄
+//  ██    ▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ██     ▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄
+//  ██▀▀  ██  ██ ██▄▄██ ██  ██  ██   ██    ██  ██ ██  ██ ██  ██
+//  ██▄▄▄  ▀██▀  ▀█▄▄▄  ██  ██  ▀█▄▄ ██▄▄▄ ▀█▄▄█▀ ▀█▄▄█▀ ██▄▄█▀
+//                                                       ██
+
+ThreadLocal<EventLoop*> EventLoop::current_loop;
+
+struct EventLoop::Fiber {
+    Functor<void()> func;
+    bool is_finished = false;
+#if defined(PLY_WINDOWS)
+    LPVOID handle = nullptr;
+#elif defined(PLY_POSIX)
+    // The stack's region begins with an uncommitted guard page, so a stack overflow faults instead of overwriting
+    // other memory.
+    void* stack_region = nullptr;
+    uptr stack_region_size = 0;
+    ucontext_t context;
+#endif
+};
+
+// A fiber waiting on a socket, when there's no epoll.
+struct EventLoop::Waiter {
+    Handle socket;
+    bool for_write;
+    Fiber* fiber;
+};
+
+// Blocks the calling thread until one of the sockets in fds is ready.
+static void poll_sockets(pollfd* fds, u32 num_fds) {
+#if defined(PLY_WINDOWS)
+    int rc = WSAPoll(fds, num_fds, -1);
+    PLY_ASSERT(rc != SOCKET_ERROR || PLY_IPWINSOCK_ALLOW_UNKNOWN_ERRORS);
+#elif defined(PLY_POSIX)
+    // rc is -1 with errno == EINTR if the wait was interrupted by a signal. Callers check the socket again anyway.
+    int rc = ::poll(fds, num_fds, -1);
+    PLY_ASSERT(rc >= 0 || errno == EINTR || PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS);
+#endif
+    PLY_UNUSED(rc);
+}
+
+EventLoop::EventLoop() {
+    this->loop_fiber = Heap::create<Fiber>();
+#if defined(PLY_LINUX)
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    PLY_ASSERT(this->epoll_fd >= 0);
+#endif
+}
+
+EventLoop::~EventLoop() {
+    PLY_ASSERT(!this->current_fiber);
+    // Only fibers that never started can be left over, since run() returns once every fiber has finished.
+    for (Fiber* fiber : this->ready_fibers) {
+        destroy_fiber(fiber);
+    }
+    Heap::destroy(this->loop_fiber);
+#if defined(PLY_LINUX)
+    ::close(this->epoll_fd);
+#endif
+}
+
+void EventLoop::fiber_main() {
+    EventLoop* loop = current_loop.load();
+    Fiber* fiber = loop->current_fiber;
+    fiber->func();
+    fiber->is_finished = true;
+    loop->suspend();
+    PLY_ASSERT(0); // Finished fibers are never resumed.
+}
+
+void EventLoop::destroy_fiber(Fiber* fiber) {
+#if defined(PLY_WINDOWS)
+    if (fiber->handle) {
+        DeleteFiber(fiber->handle);
+    }
+#elif defined(PLY_POSIX)
+    if (fiber->stack_region) {
+        uptr guard_size = VirtualMemory::get_properties().page_size;
+        VirtualMemory::unreserve_region(fiber->stack_region, fiber->stack_region_size,
+                                        fiber->stack_region_size - guard_size);
+    }
+#endif
+    Heap::destroy(fiber);
+}
+
+void EventLoop::spawn(Functor<void()>&& func, u32 stack_size) {
+    Fiber* fiber = Heap::create<Fiber>();
+    fiber->func = std::move(func);
+#if defined(PLY_WINDOWS)
+    // Fiber stacks on Windows already end with a guard page, the same as thread stacks.
+    fiber->handle = CreateFiber(stack_size, [](LPVOID) { fiber_main(); }, nullptr);
+    PLY_ASSERT(fiber->handle);
+#elif defined(PLY_POSIX)
+    // Stacks grow down, so the guard page goes at the bottom of the region.
+    VirtualMemory::Properties props = VirtualMemory::get_properties();
+    uptr guard_size = props.page_size;
+    fiber->stack_region_size =
+        (uptr) align_to_power_of_2(u64(stack_size) + guard_size, (u64) props.region_alignment);
+    fiber->stack_region = VirtualMemory::reserve_region(fiber->stack_region_size);
+    PLY_ASSERT(fiber->stack_region);
+    char* stack = (char*) fiber->stack_region + guard_size;
+    bool committed = VirtualMemory::commit_pages(stack, fiber->stack_region_size - guard_size);
+    PLY_ASSERT(committed);
+    PLY_UNUSED(committed);
+    int rc = getcontext(&fiber->context);
+    PLY_ASSERT(rc == 0);
+    PLY_UNUSED(rc);
+    fiber->context.uc_stack.ss_sp = stack;
+    fiber->context.uc_stack.ss_size = fiber->stack_region_size - guard_size;
+    fiber->context.uc_link = nullptr;
+    makecontext(&fiber->context, fiber_main, 0);
+#endif
+    this->num_fibers++;
+    this->ready_fibers.append(fiber);
+}
+
+void EventLoop::switch_to(Fiber* fiber) {
+    this->current_fiber = fiber;
+#if defined(PLY_WINDOWS)
+    SwitchToFiber(fiber->handle);
+#elif defined(PLY_POSIX)
+    int rc = swapcontext(&this->loop_fiber->context, &fiber->context);
+    PLY_ASSERT(rc == 0);
+    PLY_UNUSED(rc);
+#endif
+    this->current_fiber = nullptr;
+    if (fiber->is_finished) {
+        destroy_fiber(fiber);
+        this->num_fibers--;
+    }
+}
+
+void EventLoop::suspend() {
+    Fiber* fiber = this->current_fiber;
+    PLY_ASSERT(fiber);
+#if defined(PLY_WINDOWS)
+    PLY_UNUSED(fiber);
+    SwitchToFiber(this->loop_fiber->handle);
+#elif defined(PLY_POSIX)
+    int rc = swapcontext(&fiber->context, &this->loop_fiber->context);
+    PLY_ASSERT(rc == 0);
+    PLY_UNUSED(rc);
+#endif
+}
+
+#if defined(PLY_LINUX)
+void EventLoop::arm_socket(int socket, const SocketWaiters& waiters) {
+    epoll_event event = {};
+    event.events = (waiters.reader ? EPOLLIN : 0) | (waiters.writer ? EPOLLOUT : 0) | EPOLLONESHOT;
+    event.data.fd = socket;
+    // A socket stays registered after its first wait. EPOLLONESHOT disarms it after each event, so it only needs to
+    // be modified after that. The kernel unregisters it when it's closed.
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, socket, &event) != 0) {
+        int rc = epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, socket, &event);
+        PLY_ASSERT(rc == 0 || PLY_IPPOSIX_ALLOW_UNKNOWN_ERRORS);
+        PLY_UNUSED(rc);
+    }
+}
+#endif
+
+void EventLoop::wait_for_sockets() {
+#if defined(PLY_LINUX)
+    PLY_ASSERT(this->num_waiting > 0); // Otherwise, no fiber could ever become ready.
+    epoll_event events[64];
+    int num_events = epoll_wait(this->epoll_fd, events, PLY_STATIC_ARRAY_SIZE(events), -1);
+    // num_events is -1 if the wait was interrupted by a signal. run() will just call this again.
+    for (int i = 0; i < num_events; i++) {
+        int socket = events[i].data.fd;
+        SocketWaiters* waiters = this->socket_waiters.find(socket);
+        PLY_ASSERT(waiters);
+        // Errors and hangups wake both waiters, so that their next read or write reports the failure.
+        u32 failed = events[i].events & (EPOLLERR | EPOLLHUP);
+        if (waiters->reader && (events[i].events & EPOLLIN || failed)) {
+            this->ready_fibers.append(waiters->reader);
+            waiters->reader = nullptr;
+            this->num_waiting--;
+        }
+        if (waiters->writer && (events[i].events & EPOLLOUT || failed)) {
+            this->ready_fibers.append(waiters->writer);
+            waiters->writer = nullptr;
+            this->num_waiting--;
+        }
+        if (waiters->reader || waiters->writer) {
+            // EPOLLONESHOT disarmed the socket, but a fiber is still waiting on the other direction.
+            arm_socket(socket, *waiters);
+        } else {
+            this->socket_waiters.erase(socket);
+        }
+    }
+#else
+    PLY_ASSERT(!this->waiters.is_empty()); // Otherwise, no fiber could ever become ready.
+    Array<pollfd> fds;
+    for (const Waiter& waiter : this->waiters) {
+        fds.append({waiter.socket, (short) (waiter.for_write ? POLLOUT : POLLIN), 0});
+    }
+    poll_sockets(fds.items(), fds.num_items());
+    for (u32 i = fds.num_items(); i-- > 0;) {
+        if (fds[i].revents != 0) {
+            this->ready_fibers.append(this->waiters[i].fiber);
+            this->waiters.erase_quick(i);
+        }
+    }
+#endif
+}
+
+void EventLoop::run() {
+    PLY_ASSERT(!current_loop.load()); // Event loops can't be nested.
+    current_loop.store(this);
+#if defined(PLY_WINDOWS)
+    bool was_fiber = IsThreadAFiber();
+    this->loop_fiber->handle = was_fiber ? GetCurrentFiber() : ConvertThreadToFiber(nullptr);
+#endif
+    while (this->num_fibers > 0) {
+        if (this->ready_fibers.is_empty()) {
+            this->wait_for_sockets();
+            continue;
+        }
+        // Fibers that become ready while these run will run on the next pass.
+        Array<Fiber*> fibers_to_run = std::move(this->ready_fibers);
+        for (Fiber* fiber : fibers_to_run) {
+            this->switch_to(fiber);
+        }
+    }
+#if defined(PLY_WINDOWS)
+    if (!was_fiber) {
+        ConvertFiberToThread();
+    }
+    this->loop_fiber->handle = nullptr;
+#endif
+    current_loop.store((EventLoop*) nullptr);
+}
+
+void EventLoop::yield() {
+    PLY_ASSERT(this->current_fiber);
+    this->ready_fibers.append(this->current_fiber);
+    this->suspend();
+}
+
+EventLoop* EventLoop::get_current() {
+    EventLoop* loop = current_loop.load();
+    return (loop && loop->current_fiber) ? loop : nullptr;
+}
+
+void EventLoop::wait_for_socket(Handle socket, bool for_write) {
+    EventLoop* loop = get_current();
+    if (!loop) {
+        pollfd fd = {socket, (short) (for_write ? POLLOUT : POLLIN), 0};
+        poll_sockets(&fd, 1);
+        return;
+    }
+#if defined(PLY_LINUX)
+    SocketWaiters* waiters = loop->socket_waiters.insert(socket).value;
+    Fiber*& waiter = for_write ? waiters->writer : waiters->reader;
+    PLY_ASSERT(!waiter); // Only one fiber at a time can wait for each direction on a socket.
+    waiter = loop->current_fiber;
+    loop->arm_socket(socket, *waiters);
+    loop->num_waiting++;
+#else
+    loop->waiters.append({socket, for_write, loop->current_fiber});
+#endif
+    loop->suspend();
+}
+
 } // namespace ply
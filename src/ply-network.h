@@ -74,6 +74,23 @@ struct PipeWinsock : Pipe {
     virtual u32 read(MutStringView buf) override;
     virtual bool write(StringView buf) override;
     virtual void flush(bool) override;
+
+private:
+    bool is_nonblocking = false;
+};
+
+#elif defined(PLY_POSIX)
+
+// A Pipe_FD for a socket. When it's used from an EventLoop fiber, read() and write() suspend the fiber until the
+// socket is ready instead of blocking the thread.
+struct PipeSocket : Pipe_FD {
+    PipeSocket(int fd, u32 flags) : Pipe_FD{fd, flags} {
+    }
+    virtual u32 read(MutStringView buf) override;
+    virtual bool write(StringView buf) override;
+
+private:
+    bool is_nonblocking = false;
 };
 
 #endif
@@ -104,7 +121,9 @@ public:
 
     static void initialize(IPVersion ip_version);
     static void shutdown();
-    static TCPListener bind_tcp(u16 port);
+    // When reuse_port is true, several listeners can be bound to the same port, and the kernel spreads incoming
+    // connections between them. Only supported on Linux; elsewhere, it fails with IPResult::NO_SOCKET.
+    static TCPListener bind_tcp(u16 port, bool reuse_port = false);
     static Owned<TCPConnection> connect_tcp(const IPAddress& address, u16 port);
     static IPAddress resolve_host_name(StringView host_name, IPVersion ip_version);
     static IPResult last_result() {
@@ -266,4 +285,79 @@ public:
 
 #endif
 
+//  ▄▄▄▄▄                       ▄▄   ▄▄
+//  ██    ▄▄  ▄▄  ▄▄▄▄  ▄▄▄▄▄  ▄██▄▄ ██     ▄▄▄▄   ▄▄▄▄  ▄▄▄▄▄
+//  ██▀▀  ██  ██ ██▄▄██ ██  ██  ██   ██    ██  ██ ██  ██ ██  ██
+//  ██▄▄▄  ▀██▀  ▀█▄▄▄  ██  ██  ▀█▄▄ ██▄▄▄ ▀█▄▄█▀ ▀█▄▄█▀ ██▄▄█▀
+//                                                       ██
+
+// An EventLoop runs many fibers on a single thread. A fiber that would block on a socket, either in
+// TCPListener::accept() or in a read or write on a TCPConnection's streams, suspends itself instead, and the loop
+// resumes it once the socket is ready. That lets code that handles a connection be written as straight-line blocking
+// code, while the thread stays free to serve other connections in the meantime.
+//
+// Fibers are cooperative. A fiber keeps the thread until it finishes, waits on a socket or calls yield(). Listeners
+// are non-blocking from the start. Connection sockets are switched to non-blocking mode the first time they're used
+// from a fiber.
+class EventLoop {
+public:
+#if defined(PLY_WINDOWS)
+    using Handle = SOCKET;
+#elif defined(PLY_POSIX)
+    using Handle = int;
+#endif
+    static constexpr u32 DefaultStackSize = 256 * 1024;
+
+private:
+    struct Fiber;
+    struct Waiter;
+#if defined(PLY_LINUX)
+    // The fibers waiting for a socket to become readable and writable.
+    struct SocketWaiters {
+        Fiber* reader = nullptr;
+        Fiber* writer = nullptr;
+    };
+#endif
+
+    static ThreadLocal<EventLoop*> current_loop;
+
+    Fiber* loop_fiber = nullptr;    // The context that run() was called from.
+    Fiber* current_fiber = nullptr; // The fiber that's running right now, if any.
+    Array<Fiber*> ready_fibers;
+    u32 num_fibers = 0;
+#if defined(PLY_LINUX)
+    int epoll_fd = -1;
+    u32 num_waiting = 0;
+    Map<int, SocketWaiters> socket_waiters;
+#else
+    Array<Waiter> waiters;
+#endif
+
+    static void fiber_main();
+    static void destroy_fiber(Fiber* fiber);
+    void switch_to(Fiber* fiber);
+    void suspend();
+    void wait_for_sockets();
+#if defined(PLY_LINUX)
+    void arm_socket(int socket, const SocketWaiters& waiters);
+#endif
+
+public:
+    EventLoop();
+    ~EventLoop();
+    // Creates a fiber that will call func. It starts running once run() is called, or once the running fiber
+    // suspends.
+    void spawn(Functor<void()>&& func, u32 stack_size = DefaultStackSize);
+    // Runs fibers on the calling thread until every fiber has finished.
+    void run();
+    // Lets other ready fibers run before the calling fiber continues.
+    void yield();
+    // Returns the loop that's running the calling fiber, or nullptr if the caller isn't a fiber.
+    static EventLoop* get_current();
+    // Waits until socket is readable, or writable if for_write is true. Suspends the calling fiber if it's called
+    // from a fiber. Otherwise, blocks the calling thread. One fiber can wait to read from a socket while another waits
+    // to write to it, but two fibers can't wait for the same direction on the same socket at once.
+    static void wait_for_socket(Handle socket, bool for_write);
+};
+
 } // namespace ply